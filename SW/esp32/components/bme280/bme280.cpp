@@ -1,13 +1,17 @@
-#include <memory>
+#include <string.h>
 
 #include "bme280.h"
 #include "esp_log.h"
+#include "nvs.h"
 
 BME280::BME280(){
   esp_log_level_set(BME280_TAG, ESP_LOG_ERROR);
   ESP_LOGI(BME280_TAG, "set BME280_TAG log level: %d", ESP_LOG_ERROR);
 }
 
+BME280::~BME280(){
+}
+
 esp_err_t BME280::init_i2c(void){
  esp_err_t r = ESP_OK;
 
@@ -19,8 +23,7 @@ esp_err_t BME280::init_i2c(void){
     .scl_wait_us = 0,
    };
    i2c_device_config.flags.disable_ack_check = true;
-   r = i2c_master_bus_add_device(pmi2c->get_i2c_master_bus_handle(),
-       &i2c_device_config, &mi2c_device_handle); 
+   r = pmi2c->add_device(&i2c_device_config, &mi2c_device_handle, "bme280");
    if(r != ESP_OK){
      ESP_LOGE(BME280_TAG, "fail to add bme280 to i2c port");
    }
@@ -56,7 +59,7 @@ esp_err_t BME280::init(
   msensor_mode_value = sensor_mode;
   ESP_LOGI(BME280_TAG, "set sensor mode:%x", sensor_mode); 
 
-  uint8_t config_data = t_standby_500 | filter_off | spi3w_disable; 
+  uint8_t config_data = mstandby_time_value | mfilter_value | spi3w_disable; 
   uint8_t ctrl_meas_data = mpressure_oversampling_value | mtemperature_oversampling_value | msensor_mode_value;
   ESP_LOGI(BME280_TAG, "set CONFIG register to %x", config_data); 
   ESP_LOGI(BME280_TAG, "ser CTRL_MEAS register to %x", ctrl_meas_data);
@@ -67,9 +70,6 @@ esp_err_t BME280::init(
       ESP_LOGE(BME280_TAG, "fail to check device id.");
     }
   }
-  if(r == ESP_OK){
-    r = set_config_filter(1);
-  }
   if(r == ESP_OK){
     r |= write_byte(CONFIG, config_data); 
     r |= get_calibration_data();
@@ -83,30 +83,6 @@ esp_err_t BME280::init(
   return r;
 }
 
-QueueHandle_t BME280::get_results_buffer(){
-  return results_buffer;
-}
-
-esp_err_t BME280::create_task(const char* pname, uint16_t stack_size, UBaseType_t task_priority){
-  esp_err_t r = ESP_OK;
-  BaseType_t r2 = pdTRUE;
-  if(r == ESP_OK){
-    results_buffer = xQueueCreate(results_buffer_size, sizeof(results_data));
-    if(results_buffer == NULL){
-      ESP_LOGE(BME280_TAG, "fail to create bme280 results_buffer");
-      r = ESP_ERR_NO_MEM;
-    }
-  } 
-  if(r == ESP_OK){
-    r2 = xTaskCreate(get_measure_task_entry_point, pname, stack_size, this, task_priority, &task_handle);
-    if(r2 != pdTRUE){
-      ESP_LOGE(BME280_TAG, "fail to create measure_task.");
-      r = ESP_FAIL;
-    }
-  }
-  return r;
-}
-
 uint8_t BME280::get_status(){
   esp_err_t r = ESP_OK; 
   uint8_t read_data {0};
@@ -120,143 +96,142 @@ uint8_t BME280::get_status(){
 
 esp_err_t BME280::get_calibration_data(){
   esp_err_t r = ESP_OK;
-  int8_t digH4Msb = 0;
-  int8_t digH4H5Shared = 0;
-  int8_t digH5Msb = 0;
-  //============================== Temperature Calibration Data ===========================
-  if(r == ESP_OK){
-    r = read_uint16_t(0x88, &dig_t1);
-    if(r == ESP_OK){ 
-      ESP_LOGI(BME280_TAG, "dig_t1: %d", dig_t1);
-    }
-  }
-  if(r == ESP_OK){
-    r = read_int16_t(0x8A, &dig_t2);
-    if(r == ESP_OK){
-      ESP_LOGI(BME280_TAG, "dig_t2: %d", dig_t2);
-    }
-  }
-  if(r == ESP_OK){
-    r = read_int16_t(0x8C, &dig_t3);
-    if(r == ESP_OK){ 
-      ESP_LOGI(BME280_TAG, "dig_t3: %d", dig_t3);
-    }
-  }
-  //=======================================================================================
-  //============================== Pressure Calibration Data ==============================
-  if(r == ESP_OK){ 
-    r = read_uint16_t(0x8E, &dig_p1);
-    if(r == ESP_OK){ 
-      ESP_LOGI(BME280_TAG, "dig_p1: %d", dig_p1);
-    }
-  }
-  if(r == ESP_OK){
-    r = read_int16_t(0x90, &dig_p2); 
-    if(r == ESP_OK){
-      ESP_LOGI(BME280_TAG, "dig_p2: %d", dig_p2);
-    }
-  }
-  if(r == ESP_OK){
-    r = read_int16_t(0x92, &dig_p3);
-    if(r == ESP_OK){
-      ESP_LOGI(BME280_TAG, "dig_p3: %d", dig_p3);
-    }
-  }
-  if(r == ESP_OK){
-    r = read_int16_t(0x94, &dig_p4);
-    if(r == ESP_OK){
-      ESP_LOGI(BME280_TAG, "dig_p4: %d", dig_p4);
-    }
-  }
-  if(r == ESP_OK){
-    r = read_int16_t(0x96, &dig_p5);
-    if(r == ESP_OK){
-      ESP_LOGI(BME280_TAG, "dig_p5: %d", dig_p5);
-    }
-  }
-  if(r == ESP_OK){
-    r = read_int16_t(0x98, &dig_p6);
-    if(r == ESP_OK){
-      ESP_LOGI(BME280_TAG, "dig_p6: %d", dig_p6);
-    }
-  }
-  if(r == ESP_OK){
-    r = read_int16_t(0x9A, &dig_p7);
-    if(r == ESP_OK){
-      ESP_LOGI(BME280_TAG, "dig_p7: %d", dig_p7);
-    }
-  }
-  if(r == ESP_OK){
-    r = read_int16_t(0x9C, &dig_p8);
-    if(r == ESP_OK){
-      ESP_LOGI(BME280_TAG, "dig_p8: %d", dig_p8);
-    }
+  calibration_cache_t calibration_cache{};
+
+  // a recorded trace must contain the calibration reads to be replayed.
+  if((!pmi2c->is_recording()) && (load_calibration_cache(&calibration_cache) == ESP_OK) &&
+      (check_calibration_cache(&calibration_cache) == ESP_OK)){
+    ESP_LOGI(BME280_TAG, "use calibration data cached in nvs.");
   }
-  if(r == ESP_OK){
-    r = read_int16_t(0x9E, &dig_p9);
+  else{
+    r = read_calibration_data(&calibration_cache);
     if(r == ESP_OK){
-      ESP_LOGI(BME280_TAG, "dig_p9: %d", dig_p9);
+      // a failure to cache only costs the burst reads on the next boot.
+      if(store_calibration_cache(&calibration_cache) != ESP_OK){
+        ESP_LOGW(BME280_TAG, "fail to store calibration data to nvs.");
+      }
     }
   }
-  //=======================================================================================
-  //============================== Humidity Calibration Data ==============================
   if(r == ESP_OK){
-    r = read_byte(0xA1, &dig_h1);  
-    if(r == ESP_OK){
-      ESP_LOGI(BME280_TAG, "dig_h1: %d", dig_h1);
-    }
+    parse_calibration_data(&calibration_cache);
+#if CONFIG_BME280_COMPENSATION_BENCHMARK
+    bme280::log_compensation_benchmark(&mcalibration);
+#endif
   }
+  return r;
+}
+
+esp_err_t BME280::read_calibration_data(calibration_cache_t* pcalibration_cache){
+  esp_err_t r = ESP_OK;
+
+  pcalibration_cache->version = CALIBRATION_CACHE_VERSION;
+  pcalibration_cache->chip_id = mchip_id;
   if(r == ESP_OK){
-    r = read_int16_t(0xE1, &dig_h2);
-    if(r == ESP_OK){
-      ESP_LOGI(BME280_TAG, "dig_h2: %d", dig_h2);
+    r = read_data(CALIB_00, reinterpret_cast<uint8_t*>(&pcalibration_cache->block_00),
+        sizeof(pcalibration_cache->block_00));
+    if(r != ESP_OK){
+      ESP_LOGE(BME280_TAG, "fail to read calibration data 0x88 - 0xA1.");
     }
   }
   if(r == ESP_OK){
-    r = read_byte(0xE3, &dig_h3);
-    if(r == ESP_OK){
-      ESP_LOGI(BME280_TAG, "dig_h3: %d", dig_h3);
+    r = read_data(CALIB_26, reinterpret_cast<uint8_t*>(&pcalibration_cache->block_26),
+        sizeof(pcalibration_cache->block_26));
+    if(r != ESP_OK){
+      ESP_LOGE(BME280_TAG, "fail to read calibration data 0xE1 - 0xE7.");
     }
   }
+  return r;
+}
+
+esp_err_t BME280::load_calibration_cache(calibration_cache_t* pcalibration_cache){
+  esp_err_t r = ESP_OK;
+  nvs_handle_t nvs_handle;
+  char key[NVS_KEY_NAME_MAX_SIZE];
+  size_t cache_size = sizeof(calibration_cache_t);
+  snprintf(key, sizeof(key), "calib_%02x", DEVICE_ADDRS);
+
+  r = nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs_handle);
   if(r == ESP_OK){
-    r = read_byte(0xE4, (uint8_t*)&digH4Msb);
-    if(r == ESP_OK){
-      ESP_LOGI(BME280_TAG, "digH4Msb: %d", digH4Msb);
-    }
+    r = nvs_get_blob(nvs_handle, key, pcalibration_cache, &cache_size);
+    nvs_close(nvs_handle);
   }
   if(r == ESP_OK){
-    r = read_byte(0xE5, (uint8_t*)(&digH4H5Shared)); // this register hold parts of the values of dig_H4 and dig_h5
-    if(r == ESP_OK){
-      ESP_LOGI(BME280_TAG, "dig_H4H5Shared: %d", digH4H5Shared);
+    if((cache_size != sizeof(calibration_cache_t)) ||
+        (pcalibration_cache->version != CALIBRATION_CACHE_VERSION) ||
+        (pcalibration_cache->chip_id != mchip_id)){
+      ESP_LOGW(BME280_TAG, "calibration cache in nvs does not match the sensor.");
+      r = ESP_ERR_INVALID_VERSION;
     }
   }
+  return r;
+}
+
+esp_err_t BME280::store_calibration_cache(const calibration_cache_t* pcalibration_cache){
+  esp_err_t r = ESP_OK;
+  nvs_handle_t nvs_handle;
+  char key[NVS_KEY_NAME_MAX_SIZE];
+  snprintf(key, sizeof(key), "calib_%02x", DEVICE_ADDRS);
+
+  r = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs_handle);
   if(r == ESP_OK){
-    r = read_byte(0xE6, (uint8_t*)(&digH5Msb));
+    r = nvs_set_blob(nvs_handle, key, pcalibration_cache, sizeof(calibration_cache_t));
     if(r == ESP_OK){
-      ESP_LOGI(BME280_TAG, "digH5Msb: %d", digH5Msb);
+      r = nvs_commit(nvs_handle);
     }
+    nvs_close(nvs_handle);
   }
-  if(r == ESP_OK){
-    r = read_byte(0xE7, (uint8_t*)(&dig_h6));
-    if(r == ESP_OK){
-      ESP_LOGI(BME280_TAG, "dig_h6: %d", dig_h6);
-    }
+  return r;
+}
+
+esp_err_t BME280::check_calibration_cache(const calibration_cache_t* pcalibration_cache){
+  esp_err_t r = ESP_OK;
+  uint8_t check_data[CALIBRATION_CHECK_SIZE] {};
+
+  r = read_data(CALIB_00, check_data, sizeof(check_data));
+  if(r != ESP_OK){
+    ESP_LOGE(BME280_TAG, "fail to read calibration data 0x88 - 0x8D.");
   }
-  if(r == ESP_OK){
-    dig_h4 = static_cast<int16_t>(digH4Msb << 4 | (digH4H5Shared & 0x0F));        // split and shift the bits appropriately.
-    ESP_LOGI(BME280_TAG, "dig_h4: %d", dig_h4);
-    dig_h5 = static_cast<int16_t>(digH5Msb << 4 | ((digH4H5Shared & 0xF0) >> 4)); // split and shift the bits appropriately.
-    ESP_LOGI(BME280_TAG, "dig_h5: %d", dig_h5);
+  if((r == ESP_OK) && (memcmp(check_data, &pcalibration_cache->block_00, sizeof(check_data)) != 0)){
+    ESP_LOGW(BME280_TAG, "calibration cache in nvs belongs to another sensor.");
+    r = ESP_ERR_INVALID_STATE;
   }
-  //=======================================================================================
   return r;
 }
 
+void BME280::parse_calibration_data(const calibration_cache_t* pcalibration_cache){
+  const calibration_block_00_t* pblock_00 = &pcalibration_cache->block_00;
+  const calibration_block_26_t* pblock_26 = &pcalibration_cache->block_26;
+
+  mcalibration.dig_t1 = pblock_00->dig_t1;
+  mcalibration.dig_t2 = pblock_00->dig_t2;
+  mcalibration.dig_t3 = pblock_00->dig_t3;
+  mcalibration.dig_p1 = pblock_00->dig_p1;
+  mcalibration.dig_p2 = pblock_00->dig_p2;
+  mcalibration.dig_p3 = pblock_00->dig_p3;
+  mcalibration.dig_p4 = pblock_00->dig_p4;
+  mcalibration.dig_p5 = pblock_00->dig_p5;
+  mcalibration.dig_p6 = pblock_00->dig_p6;
+  mcalibration.dig_p7 = pblock_00->dig_p7;
+  mcalibration.dig_p8 = pblock_00->dig_p8;
+  mcalibration.dig_p9 = pblock_00->dig_p9;
+  mcalibration.dig_h1 = pblock_00->dig_h1;
+  mcalibration.dig_h2 = pblock_26->dig_h2;
+  mcalibration.dig_h3 = pblock_26->dig_h3;
+  mcalibration.dig_h4 = static_cast<int16_t>(pblock_26->dig_h4_msb * 16 | (pblock_26->dig_h4_h5_shared & 0x0F));        // split and shift the bits appropriately.
+  mcalibration.dig_h5 = static_cast<int16_t>(pblock_26->dig_h5_msb * 16 | ((pblock_26->dig_h4_h5_shared & 0xF0) >> 4)); // split and shift the bits appropriately.
+  mcalibration.dig_h6 = pblock_26->dig_h6;
+  ESP_LOGD(BME280_TAG, "dig_t1: %d, dig_t2: %d, dig_t3: %d",
+      mcalibration.dig_t1, mcalibration.dig_t2, mcalibration.dig_t3);
+  ESP_LOGD(BME280_TAG, "dig_p1: %d, dig_p2: %d, dig_p3: %d, dig_p4: %d, dig_p5: %d, dig_p6: %d, dig_p7: %d, dig_p8: %d, dig_p9: %d",
+      mcalibration.dig_p1, mcalibration.dig_p2, mcalibration.dig_p3, mcalibration.dig_p4, mcalibration.dig_p5,
+      mcalibration.dig_p6, mcalibration.dig_p7, mcalibration.dig_p8, mcalibration.dig_p9);
+  ESP_LOGD(BME280_TAG, "dig_h1: %d, dig_h2: %d, dig_h3: %d, dig_h4: %d, dig_h5: %d, dig_h6: %d",
+      mcalibration.dig_h1, mcalibration.dig_h2, mcalibration.dig_h3, mcalibration.dig_h4, mcalibration.dig_h5, mcalibration.dig_h6);
+}
+
 esp_err_t BME280::get_sensor_data(sensor_raw_data_t* psensor_result_raw_data){
   esp_err_t r = ESP_OK;
 
-  std::unique_ptr<uint8_t[]> buff = std::make_unique<uint8_t[]>(8);
-
   if(msensor_mode_value == sensorForcedMode){
     r = set_mode(sensorForcedMode);
     while(check_status_measuring_busy() || check_imUpdate_busy()){
@@ -265,7 +240,18 @@ esp_err_t BME280::get_sensor_data(sensor_raw_data_t* psensor_result_raw_data){
   }
   
   if(r == ESP_OK){
-    r = read_data(PRESS_MSB, buff.get(), 8);
+    r = read_raw_data(psensor_result_raw_data);
+  }
+  return r;
+}
+
+esp_err_t BME280::read_raw_data(sensor_raw_data_t* psensor_result_raw_data){
+  esp_err_t r = ESP_OK;
+
+  uint8_t buff[RAW_DATA_SIZE] {};
+
+  if(r == ESP_OK){
+    r = read_data(PRESS_MSB, buff, sizeof(buff));
     if(r != ESP_OK){
       ESP_LOGE(BME280_TAG, "fail to read block data");
     }
@@ -295,86 +281,29 @@ esp_err_t BME280::get_sensor_data(sensor_raw_data_t* psensor_result_raw_data){
   return r;
 }
 
-float BME280::compensate_temperature(const signed long adc_T){
-  int32_t var1;
-  int32_t var2;
-  int32_t temperature;
-  int32_t temperature_min = -4000;
-  int32_t temperature_max = 8500;
+int32_t BME280::compensate_temperature_fixed(const int32_t adc_T){
+  return bme280::compensate_temperature_fixed(&mcalibration, adc_T, &t_fine);
+}
 
-  var1 = (int32_t)(adc_T / 8) - ((uint32_t)dig_t1 * 2);
-  var1 = (var1 * ((int32_t)dig_t2)) / 2048;
-  var2 = (int32_t)((adc_T / 16) - ((int32_t)dig_t1));
-  var2 = (((var2 * var2) / 4096) * ((int32_t)dig_t3)) / 16384;
-  t_fine = var1 + var2;
-  temperature = (t_fine * 5 + 128) / 256;
+uint32_t BME280::compensate_pressure_fixed(const int32_t adc_P){
+  return bme280::compensate_pressure_fixed(&mcalibration, adc_P, t_fine);
+}
 
-  if (temperature < temperature_min){
-    temperature = temperature_min;
-  }
-  else if (temperature > temperature_max){
-    temperature = temperature_max;
-  }
+uint32_t BME280::compensate_humidity_fixed(const int32_t adc_H){
+  return bme280::compensate_humidity_fixed(&mcalibration, adc_H, t_fine);
+}
 
-  return static_cast<float>(temperature) / 100;
+float BME280::compensate_temperature(const signed long adc_T){
+  return static_cast<float>(compensate_temperature_fixed(static_cast<int32_t>(adc_T))) / 100.0f;
 }
 
 float BME280::compensate_pressure(const unsigned long adc_P){
-  int64_t var1;
-  int64_t var2;
-  int64_t var3;
-  int64_t var4;
-  uint32_t pressure;
-  uint32_t pressure_min = 3000000;
-  uint32_t pressure_max = 11000000;
-
-  var1 = ((int64_t)t_fine) - 128000;
-  var2 = var1 * var1 * (int64_t)dig_p6;
-  var2 = var2 + ((var1 * (int64_t)dig_p5) * 131072);
-  var2 = var2 + (((int64_t)dig_p4) * 34359738368);
-  var1 = ((var1 * var1 * (int64_t)dig_p3) / 256) + ((var1 * ((int64_t)dig_p2) * 4096));
-  var3 = ((int64_t)1) * 140737488355328;
-  var1 = (var3 + var1) * ((int64_t)dig_p1) / 8589934592;
-
-  /* To avoid divide by zero exception */
-  if (var1 != 0){
-    var4 = 1048576 - adc_P;
-    var4 = (((var4 * INT64_C(2147483648)) - var2) * 3125) / var1;
-    var1 = (((int64_t)dig_p9) * (var4 / 8192) * (var4 / 8192)) / 33554432;
-    var2 = (((int64_t)dig_p8) * var4) / 524288;
-    var4 = ((var4 + var1 + var2) / 256) + (((int64_t)dig_p7) * 16);
-    pressure = (uint32_t)(((var4 / 2) * 100) / 128);
-
-    if (pressure < pressure_min){
-      pressure = pressure_min;
-    }
-    else if (pressure > pressure_max){
-      pressure = pressure_max;
-    }
-  }
-  else{
-    pressure = pressure_min;
-  }
-
-  return static_cast<float>(pressure) / 10000.0;
+  // Pa * 256 to hPa
+  return static_cast<float>(compensate_pressure_fixed(static_cast<int32_t>(adc_P))) / 25600.0f;
 }
 
-double BME280::compensate_humidity(const unsigned long adc_H){
-  double humidity;
-
-  humidity = static_cast<double>(t_fine) - 76800.0;
-  humidity = ((double)adc_H - (((double)dig_h4) * 64.0 + ((double)dig_h5) / 16384.0 * humidity)) * (((double)dig_h2) / 65536.0 * (1.0 + ((double)dig_h6) / 67108864.0 * humidity * (1.0 + ((double)dig_h3) / 67108864.0 * humidity)));
-  humidity = humidity * (1.0 - ((double)dig_h1) * humidity / 524288.0);
-  
-  ESP_LOGI(BME280_TAG, "calculate compensate humidity: %f", humidity);
-  if (humidity > 100.0){
-    humidity = 100.0;
-  }
-  else if(humidity < 0.0){
-    humidity = 0.0;
-  }
-
-  return humidity;
+float BME280::compensate_humidity(const unsigned long adc_H){
+  return static_cast<float>(compensate_humidity_fixed(static_cast<int32_t>(adc_H))) / 1024.0f;
 }
 
 esp_err_t BME280::get_deviceID(uint8_t* pdeviceID){
@@ -401,7 +330,8 @@ esp_err_t BME280::check_deviceID(void){
     }
   }
   if(r == ESP_OK){
-    if(device_id != 0x60){
+    mchip_id = device_id;
+    if(device_id != CHIP_ID){
       r = ESP_FAIL;
       ESP_LOGE(BME280_TAG, "device id is not correct.");
     }
@@ -423,7 +353,8 @@ esp_err_t BME280::set_config_standby_time(const uint8_t standby){
   }
   if(r == ESP_OK){ 
     temp_data &= 0x1F;
-    r = write_byte(CONFIG, temp_data | standby);
+    mstandby_time_value = standby & 0xE0;
+    r = write_byte(CONFIG, temp_data | mstandby_time_value);
     if(r != ESP_OK){
       ESP_LOGE(BME280_TAG, "fail to set standby time.");
     }
@@ -440,7 +371,8 @@ esp_err_t BME280::set_config_filter(const uint8_t filter){
   }
   if(r == ESP_OK){
     temp_data = temp_data & 0xE3;
-    temp_data = temp_data | filter << 2;
+    mfilter_value = filter & 0x1C;
+    temp_data = temp_data | mfilter_value;
     r = write_byte(CONFIG, temp_data);
     if(r != ESP_OK){
       ESP_LOGE(BME280_TAG, "fail to set filter configration.");
@@ -520,6 +452,27 @@ esp_err_t BME280::set_mode(const uint8_t mode){
   return r;
 }
 
+esp_err_t BME280::start_normal_mode(const uint8_t standby, const uint8_t filter){
+  esp_err_t r = ESP_OK;
+  // writes to CONFIG may be ignored in normal mode, so configure it in sleep mode.
+  if(r == ESP_OK){
+    r = set_mode(sensorSleepMode);
+  }
+  if(r == ESP_OK){
+    r = set_config_standby_time(standby);
+  }
+  if(r == ESP_OK){
+    r = set_config_filter(filter);
+  }
+  if(r == ESP_OK){
+    r = set_mode(sensorNormalMode);
+  }
+  if(r != ESP_OK){
+    ESP_LOGE(BME280_TAG, "fail to start normal mode.");
+  }
+  return r;
+}
+
 esp_err_t BME280::set_ctrl_hummidity(const int humidity_oversampling){ 
   esp_err_t r = ESP_OK; 
   // ctrl_hum bits 2, 1, 0    page 28
@@ -540,14 +493,59 @@ esp_err_t BME280::update_sensor_data(){
     }
   }
   if(r == ESP_OK){
-    results_data.temperature = compensate_temperature(result_raw.mtemperature);
-    results_data.humidity = compensate_humidity(result_raw.mhumidity);
-    results_data.pressure = compensate_pressure(result_raw.mpressure);
+    compensated_data.temperature = compensate_temperature_fixed(result_raw.mtemperature);
+    compensated_data.humidity = compensate_humidity_fixed(result_raw.mhumidity);
+    compensated_data.pressure = compensate_pressure_fixed(result_raw.mpressure);
+    results_data.temperature = static_cast<float>(compensated_data.temperature) / 100.0f;
+    results_data.humidity = static_cast<float>(compensated_data.humidity) / 1024.0f;
+    results_data.pressure = static_cast<float>(compensated_data.pressure) / 25600.0f;
   }
 
   return r;
 }
 
+esp_err_t BME280::measure_step(compensated_data_t* presults, uint32_t* pwait_ms){
+  esp_err_t r = ESP_OK;
+  uint8_t status = 0;
+  sensor_raw_data_t result_raw{};
+  *pwait_ms = 0;
+
+  if(mmeasure_step == measure_step_e::START){
+    if(msensor_mode_value == sensorForcedMode){
+      r = set_mode(sensorForcedMode);
+      if(r == ESP_OK){
+        mmeasure_step = measure_step_e::WAIT_CONVERSION;
+        *pwait_ms = FORCED_MEASUREMENT_TIME;
+        r = ESP_ERR_NOT_FINISHED;
+      }
+    }
+  }
+  else{
+    r = read_byte(STATUS, &status);
+    if((r == ESP_OK) && ((status & (status_measuring | status_update_busy)) != 0)){
+      *pwait_ms = STATUS_POLL_INTERVAL;
+      r = ESP_ERR_NOT_FINISHED;
+    }
+  }
+  // normal mode, or the forced conversion is done.
+  if(r == ESP_OK){
+    r = read_raw_data(&result_raw);
+  }
+  if(r == ESP_OK){
+    compensated_data.temperature = compensate_temperature_fixed(result_raw.mtemperature);
+    compensated_data.humidity = compensate_humidity_fixed(result_raw.mhumidity);
+    compensated_data.pressure = compensate_pressure_fixed(result_raw.mpressure);
+    *presults = compensated_data;
+  }
+  if(r != ESP_ERR_NOT_FINISHED){
+    mmeasure_step = measure_step_e::START;
+  }
+  if((r != ESP_OK) && (r != ESP_ERR_NOT_FINISHED)){
+    ESP_LOGE(BME280_TAG, "fail to measure. error:%s", esp_err_to_name(r));
+  }
+  return r;
+}
+
 esp_err_t BME280::get_all_results(results_data_t* results){
   esp_err_t r = ESP_OK;
   sensor_raw_data_t result_raw{};
@@ -566,7 +564,25 @@ esp_err_t BME280::get_all_results(results_data_t* results){
   return r;
 }
 
-esp_err_t BME280::get_all_results(float* ptemperature, double* phumidity, float *ppressure){
+esp_err_t BME280::get_compensated_results(compensated_data_t* presults){
+  esp_err_t r = ESP_OK;
+  sensor_raw_data_t result_raw{};
+  if(r == ESP_OK){
+    r = get_sensor_data(&result_raw);
+    if(r != ESP_OK){
+      ESP_LOGE(BME280_TAG, "fail to get sensor data.");
+    }
+  }
+  if(r == ESP_OK){
+    presults->temperature = compensate_temperature_fixed(result_raw.mtemperature);
+    presults->humidity = compensate_humidity_fixed(result_raw.mhumidity);
+    presults->pressure = compensate_pressure_fixed(result_raw.mpressure);
+  }
+
+  return r;
+}
+
+esp_err_t BME280::get_all_results(float* ptemperature, float* phumidity, float *ppressure){
   esp_err_t r = ESP_OK;
   sensor_raw_data_t result_raw{};
   if(r == ESP_OK){
@@ -629,7 +645,7 @@ esp_err_t BME280::get_pressure(float* ppressure){
   return r;
 }
 
-esp_err_t BME280::get_humidity(double* phumidity){
+esp_err_t BME280::get_humidity(float* phumidity){
   esp_err_t r = ESP_OK;
   //ToDo: add mutex
   *phumidity = results_data.humidity;
@@ -743,33 +759,3 @@ int BME280::read_data(const uint8_t command,
   }
   return r;
 }
-
-void BME280::measure_task(){
-  esp_err_t r = ESP_OK;
-  BaseType_t r2 = pdTRUE; 
-  while(true){
-    ESP_LOGI(BME280_TAG, "start bme280 measure task.");
-    vTaskDelay(pdMS_TO_TICKS(1000));
-    if(r == ESP_OK){
-      r = update_sensor_data(); 
-    }
-    if(r == ESP_OK){
-      r2 = xQueueSendToBack(results_buffer, &results_data, pdMS_TO_TICKS(100000));
-      if(r2 != pdTRUE){
-        ESP_LOGE(BME280_TAG, "fail to send to bme280 results_buffer");
-        r = ESP_FAIL;
-      } 
-    }
-    vTaskDelay(pdMS_TO_TICKS(5000));
-  }
-  vTaskDelete(NULL);
-}
-
-void BME280::get_measure_task_entry_point(void* arg){
-  BME280* pinstance = static_cast<BME280*>(arg);
-  pinstance->measure_task();
-}
-
-void BME280::notify_measurement_start(){
-  xTaskNotifyGive(task_handle);
-}
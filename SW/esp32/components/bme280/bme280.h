@@ -11,6 +11,7 @@
 #include "freertos/task.h"
 
 #include "i2c_base.h"
+#include "bme280_compensation.h"
 
 /**
  * @brief Class to interface with the BME280 sensor.
@@ -64,6 +65,12 @@ class BME280{
     constexpr static uint8_t CTRL_HUM   {0xF2};
     constexpr static uint8_t RESET      {0xE0};
     constexpr static uint8_t ID         {0xD0};
+    constexpr static uint8_t CALIB_26   {0xE1};
+    constexpr static uint8_t CALIB_00   {0x88};
+    /**
+     * @brief Expected value of the ID register.
+     */
+    constexpr static uint8_t CHIP_ID    {0x60};
     // ==========================
     // Sensor Configuration Settings
     // ==========================
@@ -132,6 +139,30 @@ class BME280{
      */   
 
     uint8_t msensor_mode_value = sensorForcedMode;              // Default to forced mode
+    uint8_t mstandby_time_value = configStandby500ms;           // Default to 500ms standby
+    uint8_t mfilter_value = configFilterOff;                    // Default to IIR filter off
+    /**
+     * @brief Maximum forced mode conversion time with x1 oversampling in milliseconds.
+     *
+     * 1.25 + 2.3 + 2.875 + 2.875 = 9.3ms (data sheet 9.1).
+     */
+    constexpr static uint32_t FORCED_MEASUREMENT_TIME {10};
+    /**
+     * @brief Status poll interval while a forced conversion is still running in milliseconds.
+     */
+    constexpr static uint32_t STATUS_POLL_INTERVAL {2};
+    /**
+     * @brief Size of the pressure, temperature and humidity burst read.
+     */
+    constexpr static size_t RAW_DATA_SIZE {8};
+    /**
+     * @brief States of the non-blocking measurement.
+     */
+    enum class measure_step_e{
+      START,            // trigger a forced conversion, or read right away in normal mode
+      WAIT_CONVERSION,  // forced conversion running
+    };
+    measure_step_e mmeasure_step {measure_step_e::START};
     /**
      * @brief Structure to hold raw sensor data.
      */  
@@ -147,38 +178,71 @@ class BME280{
   // ==========================
   // Calibration Data
   // ==========================                                                               
-    uint16_t  dig_t1 = 0;
-    int16_t   dig_t2 = 0;
-    int16_t   dig_t3 = 0;
-    int32_t   t_fine = 0;
-    uint16_t  dig_p1 = 0;
-    int16_t   dig_p2 = 0;
-    int16_t   dig_p3 = 0;
-    int16_t   dig_p4 = 0;
-    int16_t   dig_p5 = 0;
-    int16_t   dig_p6 = 0;
-    int16_t   dig_p7 = 0;
-    int16_t   dig_p8 = 0;
-    int16_t   dig_p9 = 0;
-    uint8_t   dig_h1 = 0;
-    int16_t   dig_h2 = 0;
-    uint8_t   dig_h3 = 0;
-    int16_t   dig_h4 = 0;
-    int16_t   dig_h5 = 0;
-    int8_t    dig_h6 = 0;
-
-    /**
-     * @brief Task handle for measurement task.
-     */
-    TaskHandle_t task_handle {NULL};
-    /**
-     * @brief Queue handle for results buffer.
-     */
-    QueueHandle_t results_buffer {NULL};
-    /**
-     * @brief Size of results buffer.
-     */ 
-    UBaseType_t results_buffer_size {1};
+    /**
+     * @brief Trimming registers 0x88 - 0xA1 as read in one burst.
+     */
+    typedef struct __attribute__((packed)){
+      uint16_t  dig_t1;
+      int16_t   dig_t2;
+      int16_t   dig_t3;
+      uint16_t  dig_p1;
+      int16_t   dig_p2;
+      int16_t   dig_p3;
+      int16_t   dig_p4;
+      int16_t   dig_p5;
+      int16_t   dig_p6;
+      int16_t   dig_p7;
+      int16_t   dig_p8;
+      int16_t   dig_p9;
+      uint8_t   reserved;
+      uint8_t   dig_h1;
+    }calibration_block_00_t;
+    static_assert(sizeof(calibration_block_00_t) == 26, "calibration_block_00_t must match 0x88 - 0xA1");
+
+    /**
+     * @brief Trimming registers 0xE1 - 0xE7 as read in one burst.
+     */
+    typedef struct __attribute__((packed)){
+      int16_t   dig_h2;
+      uint8_t   dig_h3;
+      int8_t    dig_h4_msb;
+      uint8_t   dig_h4_h5_shared;  // bits 3..0: dig_h4 lsb, bits 7..4: dig_h5 lsb
+      int8_t    dig_h5_msb;
+      int8_t    dig_h6;
+    }calibration_block_26_t;
+    static_assert(sizeof(calibration_block_26_t) == 7, "calibration_block_26_t must match 0xE1 - 0xE7");
+
+    /**
+     * @brief Calibration data as cached in NVS.
+     */
+    typedef struct __attribute__((packed)){
+      uint8_t version;
+      uint8_t chip_id;
+      calibration_block_00_t block_00;
+      calibration_block_26_t block_26;
+    }calibration_cache_t;
+
+    /**
+     * @brief NVS namespace and layout version of the calibration cache.
+     */
+    constexpr static const char* NVS_NAMESPACE = "bme280";
+    constexpr static uint8_t CALIBRATION_CACHE_VERSION {1};
+    /**
+     * @brief dig_t1 - dig_t3 at the start of block 0x88, compared with the cache.
+     *
+     * The trimming differs from part to part, so another sensor at the same
+     * address does not match even though it reports the same chip id.
+     */
+    constexpr static size_t CALIBRATION_CHECK_SIZE {6};
+
+    /**
+     * @brief Chip ID read by check_deviceID().
+     */
+    uint8_t mchip_id {0};
+
+    bme280::calibration_t mcalibration {};
+    int32_t t_fine = 0;
+
     /**
      * @brief Initializes I2C communication.
      *
@@ -200,6 +264,50 @@ class BME280{
      */
     esp_err_t get_calibration_data();
 
+    /**
+     * @brief Reads the trimming registers in two burst transfers.
+     *
+     * @param pcalibration_cache Pointer to store calibration data.
+     * @return ESP_OK if successful, error code otherwise.
+     */
+    esp_err_t read_calibration_data(calibration_cache_t* pcalibration_cache);
+
+    /**
+     * @brief Loads the calibration data of this sensor from NVS.
+     *
+     * The cache is keyed by the I2C address and only accepted when its layout
+     * version and chip ID match the connected sensor.
+     *
+     * @param pcalibration_cache Pointer to store calibration data.
+     * @return ESP_OK if a valid cache was found, error code otherwise.
+     */
+    esp_err_t load_calibration_cache(calibration_cache_t* pcalibration_cache);
+
+    /**
+     * @brief Stores the calibration data of this sensor to NVS.
+     *
+     * @param pcalibration_cache Pointer to calibration data.
+     * @return ESP_OK if successful, error code otherwise.
+     */
+    esp_err_t store_calibration_cache(const calibration_cache_t* pcalibration_cache);
+
+    /**
+     * @brief Checks that the cache belongs to the fitted sensor.
+     *
+     * Reads CALIBRATION_CHECK_SIZE bytes of block 0x88 instead of both blocks.
+     *
+     * @param pcalibration_cache Pointer to calibration data loaded from NVS.
+     * @return ESP_OK if the cache matches, ESP_ERR_INVALID_STATE for another sensor.
+     */
+    esp_err_t check_calibration_cache(const calibration_cache_t* pcalibration_cache);
+
+    /**
+     * @brief Sets the dig_* coefficients from raw calibration data.
+     *
+     * @param pcalibration_cache Pointer to calibration data.
+     */
+    void parse_calibration_data(const calibration_cache_t* pcalibration_cache);
+
     /**
      * @brief Retrieves raw sensor data.
      *
@@ -208,6 +316,41 @@ class BME280{
      */
     esp_err_t get_sensor_data(sensor_raw_data_t* sensor_result_row_data);
 
+    /**
+     * @brief Reads the last conversion in one burst without triggering a new one.
+     *
+     * @param psensor_result_raw_data Pointer to store raw sensor data.
+     * @return ESP_OK if successful, error code otherwise.
+     */
+    esp_err_t read_raw_data(sensor_raw_data_t* psensor_result_raw_data);
+
+    /**
+     * @brief Compensates temperature data with the Bosch 32-bit integer formula.
+     *
+     * Also updates t_fine, so it must be called before the pressure and
+     * humidity compensation.
+     *
+     * @param adc_T Raw temperature data.
+     * @return Compensated temperature in 0.01 degree Celsius.
+     */
+    int32_t compensate_temperature_fixed(const int32_t adc_T);
+
+    /**
+     * @brief Compensates pressure data with the Bosch 64-bit integer formula.
+     *
+     * @param adc_P Raw pressure data.
+     * @return Compensated pressure in Pa as unsigned Q24.8 (Pa * 256).
+     */
+    uint32_t compensate_pressure_fixed(const int32_t adc_P);
+
+    /**
+     * @brief Compensates humidity data with the Bosch 32-bit integer formula.
+     *
+     * @param adc_H Raw humidity data.
+     * @return Compensated humidity in %RH as unsigned Q22.10 (%RH * 1024).
+     */
+    uint32_t compensate_humidity_fixed(const int32_t adc_H);
+
     /**
      * @brief Compensates temperature data.
      *
@@ -230,7 +373,7 @@ class BME280{
      * @param adc_H Raw humidity data.
      * @return Compensated humidity data.
      */
-    double compensate_humidity(const unsigned long adc_H);
+    float compensate_humidity(const unsigned long adc_H);
     /**
      * @brief Writes a byte to the specified register.
      *
@@ -289,16 +432,6 @@ class BME280{
      * @return ESP_OK if successful, error code otherwise.
      */ 
     esp_err_t write_data(const uint8_t command, uint8_t* pwrite_data_buffer, size_t buffer_size);
-    /**
-     * @brief Measurement task for reading sensor data periodically.
-     */   
-    void measure_task();
-    /**
-     * @brief Entry point for measurement task.
-     *
-     * @param arg Task argument.
-     */
-    static void get_measure_task_entry_point(void* arg);
 
   public:
     /**
@@ -306,16 +439,29 @@ class BME280{
      */ 
     typedef struct{
       float temperature = 0.0;
-      double humidity = 0;
+      float humidity = 0.0;
       float pressure = 0.0;
     }results_data_t;
 
+    /**
+     * @brief Structure to hold fixed-point sensor data.
+     */ 
+    typedef struct{
+      int32_t temperature = 0;  //[0.01 degree Celsius]
+      uint32_t pressure = 0;    //[Pa * 256]
+      uint32_t humidity = 0;    //[%RH * 1024]
+    }compensated_data_t;
+
     /**
      * @brief Constructor.
      *
      * Initializes internal parameters.
      */
     results_data_t results_data;
+    /**
+     * @brief Latest fixed-point sensor data.
+     */
+    compensated_data_t compensated_data;
     /**
      * @brief Constructor.
      *
@@ -348,25 +494,18 @@ class BME280{
         const uint8_t sensor_mode = sensorForcedMode);
     //esp_err_t Close(void);
     /**
-     * @brief Retrieves the results buffer.
+     * @brief Runs one step of a measurement without blocking.
      *
-     * @return Results buffer.
-     */ 
-    QueueHandle_t get_results_buffer(); 
-    /**
-     * @brief Creates a task to read sensor data periodically.
+     * Meant to be called from a cooperative scheduler. In normal mode the last
+     * conversion is read in one step, in forced mode a conversion is triggered
+     * first and the status is polled until it is done.
      *
-     * @param pname Task name.
-     * @param stack_size Task stack size.
-     * @param task_priority Task priority.
-     * @return ESP_OK if successful, error code otherwise.
-     */ 
-    esp_err_t create_task(const char* pname, uint16_t stack_size, UBaseType_t task_priority);
-
-    /**
-     * @brief Starts the measurement task.
+     * @param presults Pointer to store fixed-point sensor data.
+     * @param pwait_ms Time until the next step in milliseconds.
+     * @return ESP_OK when presults is updated, ESP_ERR_NOT_FINISHED while
+     *         the conversion is running, error code otherwise.
      */
-    void notify_measurement_start();
+    esp_err_t measure_step(compensated_data_t* presults, uint32_t* pwait_ms);
 
     /**
      * @breif Get the device ID
@@ -398,7 +537,7 @@ class BME280{
     /**
      * @brief Set the filter value.
      *
-     * @param filter Filter value.
+     * @param filter Filter value (configFilterOff ... configFilter16).
      * @return ESP_OK if successful, error code otherwise.
      */ 
     esp_err_t set_config_filter(const uint8_t filter);      // config bits 4, 3, 2
@@ -437,6 +576,18 @@ class BME280{
     *   @return ESP_OK if successful, error code otherwise.
     */
     esp_err_t set_mode(const uint8_t mode);                                    // ctrl_meas bits 1, 0
+   /**
+    * @brief Start normal mode with the on-chip IIR filter.
+    *
+    * The sensor measures continuously, so get_sensor_data() only burst-reads
+    * the data registers without triggering or polling the status register.
+    *
+    * @param standby Standby time between two measurements.
+    * @param filter IIR filter coefficient.
+    * @return ESP_OK if successful, error code otherwise.
+    */
+    esp_err_t start_normal_mode(const uint8_t standby = configStandby1000ms, 
+        const uint8_t filter = configFilter16);
    /**
     * @brief Set control humidity. 
     *
@@ -457,13 +608,20 @@ class BME280{
     *   @return ESP_OK if successful, error code otherwise.
     */
     esp_err_t get_all_results(results_data_t *results);
-    esp_err_t get_all_results(float *temperature, double *humidity, float *pressure);
+   /** 
+    * @brief Get sensor data without floating point conversion.
+    *   
+    *   @param presults Pointer to store fixed-point sensor data.
+    *   @return ESP_OK if successful, error code otherwise.
+    */
+    esp_err_t get_compensated_results(compensated_data_t* presults);
+    esp_err_t get_all_results(float *temperature, float *humidity, float *pressure);
     float get_temperature(void);    
     float get_pressure(void);       
     int get_humidity(void);       
     esp_err_t get_temperature(float* ptemperature);    
     esp_err_t get_pressure(float* ppressure);       
-    esp_err_t get_humidity(double* humidity);       
+    esp_err_t get_humidity(float* humidity);       
 
     bool check_status_measuring_busy(void); // check status (0xF3) bit 3
     bool check_imUpdate_busy(void);        // check status (0xF3) bit 0
@@ -0,0 +1,227 @@
+#include "bme280_compensation.h"
+
+#if CONFIG_BME280_COMPENSATION_BENCHMARK
+#include "esp_cpu.h"
+#include "esp_log.h"
+#endif
+
+namespace bme280{
+  int32_t compensate_temperature_fixed(const calibration_t* pcalibration, int32_t adc_T, int32_t* pt_fine){
+    int32_t var1;
+    int32_t var2;
+    int32_t temperature;
+    int32_t temperature_min = -4000;
+    int32_t temperature_max = 8500;
+
+    var1 = (int32_t)(adc_T / 8) - ((int32_t)pcalibration->dig_t1 * 2);
+    var1 = (var1 * ((int32_t)pcalibration->dig_t2)) / 2048;
+    var2 = (int32_t)((adc_T / 16) - ((int32_t)pcalibration->dig_t1));
+    var2 = (((var2 * var2) / 4096) * ((int32_t)pcalibration->dig_t3)) / 16384;
+    *pt_fine = var1 + var2;
+    temperature = (*pt_fine * 5 + 128) / 256;
+
+    if (temperature < temperature_min){
+      temperature = temperature_min;
+    }
+    else if (temperature > temperature_max){
+      temperature = temperature_max;
+    }
+
+    return temperature;
+  }
+
+  uint32_t compensate_pressure_fixed(const calibration_t* pcalibration, int32_t adc_P, int32_t t_fine){
+    int64_t var1;
+    int64_t var2;
+    int64_t var3;
+    int64_t var4;
+    uint32_t pressure;
+    uint32_t pressure_min = 30000 * 256;
+    uint32_t pressure_max = 110000 * 256;
+
+    var1 = ((int64_t)t_fine) - 128000;
+    var2 = var1 * var1 * (int64_t)pcalibration->dig_p6;
+    var2 = var2 + ((var1 * (int64_t)pcalibration->dig_p5) * 131072);
+    var2 = var2 + (((int64_t)pcalibration->dig_p4) * 34359738368);
+    var1 = ((var1 * var1 * (int64_t)pcalibration->dig_p3) / 256) + ((var1 * ((int64_t)pcalibration->dig_p2) * 4096));
+    var3 = ((int64_t)1) * 140737488355328;
+    var1 = (var3 + var1) * ((int64_t)pcalibration->dig_p1) / 8589934592;
+
+    /* To avoid divide by zero exception */
+    if (var1 != 0){
+      var4 = 1048576 - adc_P;
+      var4 = (((var4 * INT64_C(2147483648)) - var2) * 3125) / var1;
+      var1 = (((int64_t)pcalibration->dig_p9) * (var4 / 8192) * (var4 / 8192)) / 33554432;
+      var2 = (((int64_t)pcalibration->dig_p8) * var4) / 524288;
+      var4 = ((var4 + var1 + var2) / 256) + (((int64_t)pcalibration->dig_p7) * 16);
+
+      if (var4 < pressure_min){
+        pressure = pressure_min;
+      }
+      else if (var4 > pressure_max){
+        pressure = pressure_max;
+      }
+      else{
+        pressure = (uint32_t)var4;
+      }
+    }
+    else{
+      pressure = pressure_min;
+    }
+
+    return pressure;
+  }
+
+  uint32_t compensate_humidity_fixed(const calibration_t* pcalibration, int32_t adc_H, int32_t t_fine){
+    int32_t var1;
+    int32_t var2;
+    int32_t var3;
+    int32_t var4;
+    int32_t var5;
+    uint32_t humidity_max = 100 * 1024;
+
+    var1 = t_fine - ((int32_t)76800);
+    var2 = (int32_t)(adc_H * 16384);
+    var3 = (int32_t)(((int32_t)pcalibration->dig_h4) * 1048576);
+    var4 = ((int32_t)pcalibration->dig_h5) * var1;
+    var5 = (((var2 - var3) - var4) + (int32_t)16384) / 32768;
+    var2 = (var1 * ((int32_t)pcalibration->dig_h6)) / 1024;
+    var3 = (var1 * ((int32_t)pcalibration->dig_h3)) / 2048;
+    var4 = ((var2 * (var3 + (int32_t)32768)) / 1024) + (int32_t)2097152;
+    var2 = ((var4 * ((int32_t)pcalibration->dig_h2)) + 8192) / 16384;
+    var3 = var5 * var2;
+    var4 = ((var3 / 32768) * (var3 / 32768)) / 128;
+    var5 = var3 - ((var4 * ((int32_t)pcalibration->dig_h1)) / 16);
+    var5 = (var5 < 0 ? 0 : var5);
+    var5 = (var5 > 419430400 ? 419430400 : var5);
+
+    uint32_t humidity = (uint32_t)(var5 / 4096);
+    if (humidity > humidity_max){
+      humidity = humidity_max;
+    }
+
+    return humidity;
+  }
+
+  float compensate_temperature_reference(const calibration_t* pcalibration, int32_t adc_T, int32_t* pt_fine){
+    int32_t var1;
+    int32_t var2;
+    int32_t temperature;
+    int32_t temperature_min = -4000;
+    int32_t temperature_max = 8500;
+
+    var1 = (int32_t)(adc_T / 8) - ((uint32_t)pcalibration->dig_t1 * 2);
+    var1 = (var1 * ((int32_t)pcalibration->dig_t2)) / 2048;
+    var2 = (int32_t)((adc_T / 16) - ((int32_t)pcalibration->dig_t1));
+    var2 = (((var2 * var2) / 4096) * ((int32_t)pcalibration->dig_t3)) / 16384;
+    *pt_fine = var1 + var2;
+    temperature = (*pt_fine * 5 + 128) / 256;
+
+    if (temperature < temperature_min){
+      temperature = temperature_min;
+    }
+    else if (temperature > temperature_max){
+      temperature = temperature_max;
+    }
+
+    return static_cast<float>(temperature) / 100;
+  }
+
+  float compensate_pressure_reference(const calibration_t* pcalibration, int32_t adc_P, int32_t t_fine){
+    int64_t var1;
+    int64_t var2;
+    int64_t var3;
+    int64_t var4;
+    uint32_t pressure;
+    uint32_t pressure_min = 3000000;
+    uint32_t pressure_max = 11000000;
+
+    var1 = ((int64_t)t_fine) - 128000;
+    var2 = var1 * var1 * (int64_t)pcalibration->dig_p6;
+    var2 = var2 + ((var1 * (int64_t)pcalibration->dig_p5) * 131072);
+    var2 = var2 + (((int64_t)pcalibration->dig_p4) * 34359738368);
+    var1 = ((var1 * var1 * (int64_t)pcalibration->dig_p3) / 256) + ((var1 * ((int64_t)pcalibration->dig_p2) * 4096));
+    var3 = ((int64_t)1) * 140737488355328;
+    var1 = (var3 + var1) * ((int64_t)pcalibration->dig_p1) / 8589934592;
+
+    /* To avoid divide by zero exception */
+    if (var1 != 0){
+      var4 = 1048576 - adc_P;
+      var4 = (((var4 * INT64_C(2147483648)) - var2) * 3125) / var1;
+      var1 = (((int64_t)pcalibration->dig_p9) * (var4 / 8192) * (var4 / 8192)) / 33554432;
+      var2 = (((int64_t)pcalibration->dig_p8) * var4) / 524288;
+      var4 = ((var4 + var1 + var2) / 256) + (((int64_t)pcalibration->dig_p7) * 16);
+      pressure = (uint32_t)(((var4 / 2) * 100) / 128);
+
+      if (pressure < pressure_min){
+        pressure = pressure_min;
+      }
+      else if (pressure > pressure_max){
+        pressure = pressure_max;
+      }
+    }
+    else{
+      pressure = pressure_min;
+    }
+
+    return static_cast<float>(pressure) / 10000.0;
+  }
+
+  double compensate_humidity_reference(const calibration_t* pcalibration, int32_t adc_H, int32_t t_fine){
+    double humidity;
+
+    humidity = static_cast<double>(t_fine) - 76800.0;
+    humidity = ((double)adc_H - (((double)pcalibration->dig_h4) * 64.0 + ((double)pcalibration->dig_h5) / 16384.0 * humidity)) *
+        (((double)pcalibration->dig_h2) / 65536.0 * (1.0 + ((double)pcalibration->dig_h6) / 67108864.0 * humidity *
+        (1.0 + ((double)pcalibration->dig_h3) / 67108864.0 * humidity)));
+    humidity = humidity * (1.0 - ((double)pcalibration->dig_h1) * humidity / 524288.0);
+
+    if (humidity > 100.0){
+      humidity = 100.0;
+    }
+    else if(humidity < 0.0){
+      humidity = 0.0;
+    }
+
+    return humidity;
+  }
+
+#if CONFIG_BME280_COMPENSATION_BENCHMARK
+  namespace{
+    constexpr const char* BME280_COMPENSATION_TAG = "bme280_compensation";
+    // raw values in small steps around 20 degree Celsius, 1000 hPa and 50 %RH
+    constexpr uint32_t BENCHMARK_COUNT {256};
+    constexpr int32_t ADC_T_BASE {520000};
+    constexpr int32_t ADC_P_BASE {330000};
+    constexpr int32_t ADC_H_BASE {28000};
+    constexpr int32_t ADC_STEP   {64};
+  }
+
+  void log_compensation_benchmark(const calibration_t* pcalibration){
+    volatile uint32_t fixed_sink = 0;
+    volatile float reference_sink = 0.0f;
+    int32_t t_fine = 0;
+
+    const uint32_t fixed_start = esp_cpu_get_cycle_count();
+    for(uint32_t index = 0; index < BENCHMARK_COUNT; index++){
+      const int32_t step = static_cast<int32_t>(index) * ADC_STEP;
+      fixed_sink = fixed_sink + compensate_temperature_fixed(pcalibration, ADC_T_BASE + step, &t_fine);
+      fixed_sink = fixed_sink + compensate_pressure_fixed(pcalibration, ADC_P_BASE + step, t_fine);
+      fixed_sink = fixed_sink + compensate_humidity_fixed(pcalibration, ADC_H_BASE + step, t_fine);
+    }
+    const uint32_t fixed_cycles = esp_cpu_get_cycle_count() - fixed_start;
+
+    const uint32_t reference_start = esp_cpu_get_cycle_count();
+    for(uint32_t index = 0; index < BENCHMARK_COUNT; index++){
+      const int32_t step = static_cast<int32_t>(index) * ADC_STEP;
+      reference_sink = reference_sink + compensate_temperature_reference(pcalibration, ADC_T_BASE + step, &t_fine);
+      reference_sink = reference_sink + compensate_pressure_reference(pcalibration, ADC_P_BASE + step, t_fine);
+      reference_sink = reference_sink + static_cast<float>(compensate_humidity_reference(pcalibration, ADC_H_BASE + step, t_fine));
+    }
+    const uint32_t reference_cycles = esp_cpu_get_cycle_count() - reference_start;
+
+    ESP_LOGI(BME280_COMPENSATION_TAG, "cycles per sample of temperature, pressure and humidity: integer:%lu reference:%lu",
+        fixed_cycles / BENCHMARK_COUNT, reference_cycles / BENCHMARK_COUNT);
+  }
+#endif
+}
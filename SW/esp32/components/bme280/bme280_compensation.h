@@ -0,0 +1,51 @@
+// compensation formulas of the bme280 datasheet (bst-bme280-ds002, 4.2.3 and 8.2).
+// free functions over the calibration, so the host tests (tools/host_tests) run them
+// without a sensor and compare them with the floating point formulas used before.
+#pragma once
+
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+namespace bme280{
+  // dig_* coefficients of the calibration registers 0x88 - 0xA1 and 0xE1 - 0xE7
+  typedef struct{
+    uint16_t  dig_t1;
+    int16_t   dig_t2;
+    int16_t   dig_t3;
+    uint16_t  dig_p1;
+    int16_t   dig_p2;
+    int16_t   dig_p3;
+    int16_t   dig_p4;
+    int16_t   dig_p5;
+    int16_t   dig_p6;
+    int16_t   dig_p7;
+    int16_t   dig_p8;
+    int16_t   dig_p9;
+    uint8_t   dig_h1;
+    int16_t   dig_h2;
+    uint8_t   dig_h3;
+    int16_t   dig_h4;
+    int16_t   dig_h5;
+    int8_t    dig_h6;
+  }calibration_t;
+
+  // 32-bit integer formula, limited to -40..85 degree Celsius.
+  // *pt_fine is the temperature input of the pressure and humidity compensation.
+  int32_t compensate_temperature_fixed(const calibration_t* pcalibration, int32_t adc_T, int32_t* pt_fine);  //[0.01 degree Celsius]
+  // 64-bit integer formula, limited to 300..1100 hPa.
+  uint32_t compensate_pressure_fixed(const calibration_t* pcalibration, int32_t adc_P, int32_t t_fine);      //[Pa * 256]
+  // 32-bit integer formula, limited to 0..100 %RH.
+  uint32_t compensate_humidity_fixed(const calibration_t* pcalibration, int32_t adc_H, int32_t t_fine);     //[%RH * 1024]
+
+  // the float and double formulas of the driver before the integer path. only the reference
+  // of the host tests and of the benchmark, the driver does not use them.
+  float compensate_temperature_reference(const calibration_t* pcalibration, int32_t adc_T, int32_t* pt_fine); //[degree Celsius]
+  float compensate_pressure_reference(const calibration_t* pcalibration, int32_t adc_P, int32_t t_fine);      //[hPa]
+  double compensate_humidity_reference(const calibration_t* pcalibration, int32_t adc_H, int32_t t_fine);     //[%RH]
+
+#if CONFIG_BME280_COMPENSATION_BENCHMARK
+  // logs the cpu cycles of one compensation of all three values, integer and reference.
+  void log_compensation_benchmark(const calibration_t* pcalibration);
+#endif
+}
@@ -19,8 +19,7 @@ esp_err_t AQM0802A::init_i2c(void){
     .scl_wait_us = 0,
    };
    i2c_device_config.flags.disable_ack_check = true;
-   r = i2c_master_bus_add_device(pmi2c->get_i2c_master_bus_handle(),
-       &i2c_device_config, &mi2c_device_handle); 
+   r = pmi2c->add_device(&i2c_device_config, &mi2c_device_handle, "aqm0802a");
   }
   if(r != ESP_OK){
     ESP_LOGE(AQM0802A_TAG, "fail to add AQM0802A to i2c port");
@@ -28,6 +28,7 @@ class EPAPER4IN26{
     constexpr static gpio_num_t EPAPER_BUSY_PIN  {GPIO_NUM_48}; // input
 
     constexpr static int SPI_CLOCK_SPEED  {500 * 1000};
+    constexpr static int SPI_QUEUE_SIZE   {8};
 
     // display settings
     constexpr static uint16_t DISPLAY_RESOLUTION_HEIGHT  {480};
@@ -60,8 +61,14 @@ class EPAPER4IN26{
     constexpr static uint8_t DATA_ENTRY_MODE_SETTING                {0x01};
     // valiables
     constexpr static uint16_t MAX_SPI_TARANSFER_SIZE   {16*1000}; 
+    constexpr static size_t   MAX_FRAME_CHUNKS         {(DISPLAY_DISP_BYTES + MAX_SPI_TARANSFER_SIZE - 1) / MAX_SPI_TARANSFER_SIZE};
+    static_assert(MAX_FRAME_CHUNKS <= SPI_QUEUE_SIZE, "all frame chunks must fit in the spi transaction queue");
     spi_device_handle_t spi_handle;
     static state_e mstate; 
+    // chunk timestamps captured in the spi isr callbacks [us]
+    static int64_t mchunk_start_time[MAX_FRAME_CHUNKS];
+    static int64_t mchunk_end_time[MAX_FRAME_CHUNKS];
+    int64_t mlast_frame_max_chunk_gap {0}; //[us]
     //class
     GpioInterface::GpioOutput dc_pin;
     GpioInterface::GpioOutput rst_pin;  
@@ -72,6 +79,8 @@ class EPAPER4IN26{
     esp_err_t init_gpio();
     esp_err_t send_command(const uint8_t addr, const uint8_t* pdata_buffer, size_t buffer_size);
     esp_err_t send_frame(const uint8_t* pdata_buffer, size_t buffer_size);
+    static void IRAM_ATTR spi_pre_transfer_callback(spi_transaction_t* ptransaction);
+    static void IRAM_ATTR spi_post_transfer_callback(spi_transaction_t* ptransaction);
     uint8_t  is_busy(); // Returns: 0: Host side can send data to driver. 1: Driver is busy.
     esp_err_t wait_until_ready();
     esp_err_t set_windows(uint16_t x_start, uint16_t y_start, uint16_t x_end, uint16_t y_end);
@@ -84,6 +93,8 @@ class EPAPER4IN26{
     uint16_t get_display_row_length(){return DISPLAY_ROW_LENGTH;}
     int      get_display_bytes(){return DISPLAY_DISP_BYTES;}        
     state_e  get_state(){return mstate;};
+    // Returns: longest idle gap between two chunks of the last frame [us]
+    int64_t  get_last_frame_max_chunk_gap(){return mlast_frame_max_chunk_gap;}
     esp_err_t init();
     esp_err_t init_epaper(); 
     esp_err_t execute_hw_reset(); 
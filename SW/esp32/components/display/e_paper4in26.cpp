@@ -1,10 +1,13 @@
 #include <cstring>
 #include "driver/gpio.h"
+#include "esp_timer.h"
 
 #include "e_paper.h"
 
 uint8_t EPAPER4IN26::transffer_buffer[DISPLAY_DISP_BYTES];
 EPAPER4IN26::state_e EPAPER4IN26::mstate;
+int64_t EPAPER4IN26::mchunk_start_time[MAX_FRAME_CHUNKS];
+int64_t EPAPER4IN26::mchunk_end_time[MAX_FRAME_CHUNKS];
 
 EPAPER4IN26::EPAPER4IN26(){
   esp_log_level_set(EPAPER_TAG, ESP_LOG_INFO);
@@ -31,7 +34,9 @@ esp_err_t EPAPER4IN26::init_spi_bus(){
     .mode = 0,
     .clock_speed_hz = SPI_CLOCK_SPEED,
     .spics_io_num = SPI_CS_PIN,
-    .queue_size = 8,
+    .queue_size = SPI_QUEUE_SIZE,
+    .pre_cb = spi_pre_transfer_callback,
+    .post_cb = spi_post_transfer_callback,
   };
   
   if(r == ESP_OK){
@@ -171,34 +176,75 @@ esp_err_t EPAPER4IN26::send_command(const uint8_t addr, const uint8_t* pdata_buf
 esp_err_t EPAPER4IN26::send_frame(const uint8_t* pdata_buffer, size_t buffer_size){
   esp_err_t r = ESP_OK;
   size_t offset = 0;
-  static spi_transaction_t spi_transaction = {
-    .flags = 0,
-    .user = (void*) 0,
-  };
+  size_t queued_chunks = 0;
+  static spi_transaction_t spi_transactions[MAX_FRAME_CHUNKS];
+
+  if(buffer_size > MAX_FRAME_CHUNKS * MAX_SPI_TARANSFER_SIZE){
+    ESP_LOGE(EPAPER_TAG, "frame size %d exceeds %d chunks.", (int) buffer_size, (int) MAX_FRAME_CHUNKS);
+    r = ESP_ERR_INVALID_SIZE;
+  }
   if(r == ESP_OK){
     r = spi_device_acquire_bus(spi_handle, portMAX_DELAY);
   }
   if(r == ESP_OK){
+    // queue every chunk up-front so that the driver starts the next DMA transfer
+    // from the isr as soon as the previous one finishes.
     while(buffer_size > 0){
       size_t transfer_size = (buffer_size > MAX_SPI_TARANSFER_SIZE)? MAX_SPI_TARANSFER_SIZE : buffer_size;
-      spi_transaction.tx_buffer = pdata_buffer + offset;
-      spi_transaction.length = transfer_size * 8;
-      spi_transaction.flags = (buffer_size > transfer_size) ? SPI_TRANS_CS_KEEP_ACTIVE : 0;
-      r = spi_device_transmit(spi_handle, &spi_transaction);
-      ESP_LOGI(EPAPER_TAG, "send to frame"); 
+      spi_transaction_t* pspi_transaction = &spi_transactions[queued_chunks];
+      memset(pspi_transaction, 0, sizeof(spi_transaction_t));
+      pspi_transaction->tx_buffer = pdata_buffer + offset;
+      pspi_transaction->length = transfer_size * 8;
+      pspi_transaction->flags = (buffer_size > transfer_size) ? SPI_TRANS_CS_KEEP_ACTIVE : 0;
+      pspi_transaction->user = (void*) queued_chunks;
+      r = spi_device_queue_trans(spi_handle, pspi_transaction, portMAX_DELAY);
       if(r != ESP_OK){
-        ESP_LOGE(EPAPER_TAG, "fail to send transmit frame. Error code:%s", esp_err_to_name(r));
+        ESP_LOGE(EPAPER_TAG, "fail to queue frame chunk %d. Error code:%s", (int) queued_chunks, esp_err_to_name(r));
         break; 
       }
+      queued_chunks++;
       offset += transfer_size;
       buffer_size -= transfer_size;
     }
+    // collect every queued chunk, even if a later one could not be queued.
+    for(size_t i = 0; i < queued_chunks; i++){
+      spi_transaction_t* presult = NULL;
+      esp_err_t r2 = spi_device_get_trans_result(spi_handle, &presult, portMAX_DELAY);
+      if(r2 != ESP_OK){
+        ESP_LOGE(EPAPER_TAG, "fail to send transmit frame. Error code:%s", esp_err_to_name(r2));
+        r = r2;
+      }
+    }
     spi_device_release_bus(spi_handle);
   }
+  if(r == ESP_OK){
+    mlast_frame_max_chunk_gap = 0;
+    for(size_t i = 1; i < queued_chunks; i++){
+      int64_t gap = mchunk_start_time[i] - mchunk_end_time[i - 1];
+      if(gap > mlast_frame_max_chunk_gap){
+        mlast_frame_max_chunk_gap = gap;
+      }
+    }
+    ESP_LOGI(EPAPER_TAG, "sent frame in %d chunks. max chunk gap: %lld[us]", (int) queued_chunks, mlast_frame_max_chunk_gap);
+  }
 
   return r;
 }
 
+void IRAM_ATTR EPAPER4IN26::spi_pre_transfer_callback(spi_transaction_t* ptransaction){
+  size_t chunk = (size_t) ptransaction->user;
+  if(chunk < MAX_FRAME_CHUNKS){
+    mchunk_start_time[chunk] = esp_timer_get_time();
+  }
+}
+
+void IRAM_ATTR EPAPER4IN26::spi_post_transfer_callback(spi_transaction_t* ptransaction){
+  size_t chunk = (size_t) ptransaction->user;
+  if(chunk < MAX_FRAME_CHUNKS){
+    mchunk_end_time[chunk] = esp_timer_get_time();
+  }
+}
+
 uint8_t EPAPER4IN26::is_busy(){
   return busy_pin.read();
 }
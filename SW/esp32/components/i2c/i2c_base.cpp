@@ -6,11 +6,13 @@
  * and ESP-IDF on an ESP32 platform.
  */
 
+#include <cstdio>
 #include <cstring>
 
 #include "freertos/FreeRTOS.h"
 #include "i2c_base.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
 namespace i2c_base{
 
@@ -110,6 +112,7 @@ namespace i2c_base{
           if(r != ESP_OK){
             ESP_LOGE(I2C_BASE_TAG, "fail to set i2c port to master mode. error code:%s", esp_err_to_name(r));
           }
+          mbus_utilization_window_start = esp_timer_get_time();
         }
         else{
           ESP_LOGE(I2C_BASE_TAG, "fail to set i2c port to slave mode");
@@ -144,13 +147,9 @@ namespace i2c_base{
     esp_err_t r = ESP_OK;
 
     if(r == ESP_OK){
-      if(take_i2c_port_semaphore() == ESP_OK){ 
-        r = i2c_master_transmit_receive(dev_handle, pcommand, command_size, 
-            pread_data_buffer, 1, pdMS_TO_TICKS(1000));
-        if(r != ESP_OK){
-          ESP_LOGE(I2C_BASE_TAG, "fail to read data.");
-        }
-        r |= release_i2c_port_semaphore(); 
+      r = execute_transaction(dev_handle, pcommand, command_size, pread_data_buffer, 1);
+      if(r != ESP_OK){
+        ESP_LOGE(I2C_BASE_TAG, "fail to read data.");
       }
     }
     return r; 
@@ -163,31 +162,12 @@ namespace i2c_base{
    * @param pcommand Pointer to the command buffer.
    * @param command_size Size of the command buffer.
    * @param write_data The data byte to write.
-   * @return ESP_OK on success, ESP_FAIL on failure.
+   * @return ESP_OK on success, ESP_ERR_INVALID_SIZE if the command is too long, ESP_FAIL on failure.
    */
   esp_err_t I2C::write_byte(i2c_master_dev_handle_t dev_handle, 
       const uint8_t* pcommand, size_t command_size, 
       const uint8_t write_data){
-    esp_err_t r = ESP_OK;
-
-    uint8_t* send_buffer = (uint8_t*)malloc(command_size + 1);
-    if(send_buffer == NULL){
-      r = ESP_FAIL;
-      ESP_LOGE(I2C_BASE_TAG, "fail to alloc buffer.");
-    }
-
-    if(r == ESP_OK){
-      memcpy(send_buffer, pcommand, command_size); 
-      memcpy(send_buffer + command_size, &write_data, 1); 
-      if(take_i2c_port_semaphore() == ESP_OK){ 
-        r = i2c_master_transmit(dev_handle, send_buffer, 2, pdMS_TO_TICKS(I2C_TIMEOUT));
-        if(r != ESP_OK){
-          ESP_LOGE(I2C_BASE_TAG, "fail to send data.");
-        }
-        r |= release_i2c_port_semaphore();
-      }
-    }
-    return r;
+    return I2C::write_data(dev_handle, pcommand, command_size, &write_data, 1);
   }
   /**
    * @brief Reads multiple bytes of data from the I2C device.
@@ -211,12 +191,36 @@ namespace i2c_base{
     esp_err_t r = ESP_OK;
 
     if(r == ESP_OK){
-      if(take_i2c_port_semaphore() == ESP_OK){ 
-        r = i2c_master_transmit_receive(dev_handle, pcommand, command_size, pread_data_buffer, read_buffer_size, pdMS_TO_TICKS(I2C_TIMEOUT));
-        if(r != ESP_OK){
-          ESP_LOGE(I2C_BASE_TAG, "fail to read data. I2C Error:%s", esp_err_to_name(r));
-        }
-        r |= release_i2c_port_semaphore();
+      r = execute_transaction(dev_handle, pcommand, command_size, pread_data_buffer, read_buffer_size);
+      if(r != ESP_OK){
+        ESP_LOGE(I2C_BASE_TAG, "fail to read data. I2C Error:%s", esp_err_to_name(r));
+      }
+    }
+    return r;
+  }
+
+  /**
+   * @brief Reads multiple bytes of data from the I2C device without sending a command.
+   *
+   * Some devices (e.g. the SCD40 forced recalibration) return their result only after a delay,
+   * so the command is written with write_data() and the result is read here.
+   *
+   * @param[in] dev_handle The I2C device handle.
+   * @param[out] pread_data_buffer Pointer to the buffer where the read data will be stored.
+   * @param[in] read_buffer_size Number of bytes to read from the I2C device.
+   * 
+   * @return 
+   *   - ESP_OK if data was successfully read.
+   *   - ESP_FAIL if there was an error in the read operation.
+   */ 
+  esp_err_t I2C::receive_data(i2c_master_dev_handle_t dev_handle, 
+      uint8_t* pread_data_buffer, size_t read_buffer_size){
+    esp_err_t r = ESP_OK;
+
+    if(r == ESP_OK){
+      r = execute_transaction(dev_handle, NULL, 0, pread_data_buffer, read_buffer_size);
+      if(r != ESP_OK){
+        ESP_LOGE(I2C_BASE_TAG, "fail to receive data. I2C Error:%s", esp_err_to_name(r));
       }
     }
     return r;
@@ -236,34 +240,457 @@ namespace i2c_base{
    * 
    * @return 
    *   - ESP_OK if data was successfully written.
+   *   - ESP_ERR_INVALID_SIZE if command and data exceed MAX_WRITE_SIZE.
    *   - ESP_FAIL if there was an error in the write operation.
    */
   esp_err_t I2C::write_data(i2c_master_dev_handle_t dev_handle, 
       const uint8_t* pcommand, size_t command_size, 
       const uint8_t* pwrite_data_buffer, size_t buffer_size){
     esp_err_t r = ESP_OK;
+    SMALL_BUFFER<MAX_WRITE_SIZE> send_buffer;
 
-    size_t send_buffer_size = command_size + buffer_size;
-    uint8_t* send_buffer = (uint8_t*) malloc(send_buffer_size);
-    if(send_buffer == NULL){
-      r = ESP_FAIL;
-      ESP_LOGE(I2C_BASE_TAG, "fail to alloc buffer");
+    if(r == ESP_OK){
+      r = send_buffer.append(pcommand, command_size);
+    }
+    if(r == ESP_OK){
+      r = send_buffer.append(pwrite_data_buffer, buffer_size);
+    }
+    if(r != ESP_OK){
+      ESP_LOGE(I2C_BASE_TAG, "%d bytes do not fit into the send buffer.", (int)(command_size + buffer_size));
     }
+    if(r == ESP_OK){
+      r = execute_transaction(dev_handle, send_buffer.data(), send_buffer.size(), NULL, 0);
+      if(r != ESP_OK){
+        ESP_LOGE(I2C_BASE_TAG, "fail to send data.");
+      }
+    }
+    return r;
+  }
+
+  /**
+   * @brief Runs one transaction on the bus.
+   *
+   * Every blocking call ends up here, so the bus utilization covers all
+   * traffic. The semaphore keeps the tasks that share the bus from
+   * interleaving.
+   *
+   * @param[in] dev_handle The I2C device handle.
+   * @param[in] pwrite_buffer Bytes to write. Unused if write_size is 0.
+   * @param[in] write_size Number of bytes to write.
+   * @param[out] pread_buffer Buffer for the read data. Unused if read_size is 0.
+   * @param[in] read_size Number of bytes to read.
+   *
+   * @return
+   *   - ESP_OK if the transaction succeeded.
+   *   - ESP_ERR_TIMEOUT if the bus semaphore could not be taken.
+   *   - The driver error otherwise.
+   */
+  esp_err_t I2C::execute_transaction(i2c_master_dev_handle_t dev_handle,
+      const uint8_t* pwrite_buffer, size_t write_size,
+      uint8_t* pread_buffer, size_t read_size){
+    esp_err_t r = ESP_OK;
+    int64_t start_time = esp_timer_get_time();
+    int64_t busy_time = 0;
+    int64_t semaphore_wait = 0;
+    device_metrics_t* pmetrics = NULL;
+    uint16_t device_address = 0;
 
+    if(take_i2c_port_semaphore() != ESP_OK){
+      r = ESP_ERR_TIMEOUT;
+    }
+    semaphore_wait = esp_timer_get_time() - start_time;
+    if(r != ESP_OK){
+      portENTER_CRITICAL(&mmetrics_lock);
+      pmetrics = find_device_metrics(dev_handle);
+      if(pmetrics != NULL){
+        pmetrics->semaphore_timeout_count++;
+        add_latency(&pmetrics->semaphore_wait, semaphore_wait);
+      }
+      portEXIT_CRITICAL(&mmetrics_lock);
+    }
     if(r == ESP_OK){
-      memcpy(send_buffer, pcommand, command_size); 
-      if(buffer_size != 0){
-        memcpy(send_buffer + command_size, pwrite_data_buffer, buffer_size);
-      } 
-      if(take_i2c_port_semaphore() == ESP_OK){ 
-        r = i2c_master_transmit(dev_handle, send_buffer, send_buffer_size, pdMS_TO_TICKS(I2C_TIMEOUT));
-        if(r != ESP_OK){
-          ESP_LOGE(I2C_BASE_TAG, "fail to send data.");
+      start_time += semaphore_wait;
+      if(read_size == 0){
+        r = i2c_master_transmit(dev_handle, pwrite_buffer, write_size, I2C_TIMEOUT);
+      }
+      else if(write_size == 0){
+        r = i2c_master_receive(dev_handle, pread_buffer, read_size, I2C_TIMEOUT);
+      }
+      else{
+        r = i2c_master_transmit_receive(dev_handle, pwrite_buffer, write_size, 
+            pread_buffer, read_size, I2C_TIMEOUT);
+      }
+      busy_time = esp_timer_get_time() - start_time;
+      const esp_err_t transaction_result = r;
+      r |= release_i2c_port_semaphore();
+
+      portENTER_CRITICAL(&mmetrics_lock);
+      pmetrics = find_device_metrics(dev_handle);
+      if(pmetrics != NULL){
+        if(read_size == 0){
+          pmetrics->transmit_count++;
+          add_latency(&pmetrics->transmit_latency, busy_time);
+        }
+        else{
+          pmetrics->receive_count++;
+          add_latency(&pmetrics->receive_latency, busy_time);
+        }
+        add_latency(&pmetrics->semaphore_wait, semaphore_wait);
+        if(r == ESP_OK){
+          pmetrics->transferred_bytes += write_size + read_size;
+        }
+        else{
+          pmetrics->error_count++;
         }
-        r |= release_i2c_port_semaphore();
-      } 
+        if(transaction_result == ESP_ERR_TIMEOUT){
+          pmetrics->timeout_count++;
+        }
+        pmetrics->busy_time += busy_time;
+        device_address = pmetrics->device_address;
+      }
+      portEXIT_CRITICAL(&mmetrics_lock);
+
+      if((trace_buffer != NULL) && (pmetrics != NULL)){
+        record_transaction(device_address, start_time, busy_time,
+            pwrite_buffer, write_size, pread_buffer, read_size, transaction_result);
+      }
+
+      portENTER_CRITICAL(&mbus_utilization_lock);
+      mbus_utilization.transaction_count++;
+      if(r != ESP_OK){
+        mbus_utilization.error_count++;
+      }
+      mbus_utilization.busy_time += busy_time;
+      portEXIT_CRITICAL(&mbus_utilization_lock);
     }
-    free(send_buffer);
     return r;
   }
+
+  /**
+   * @brief Reads the bus utilization and starts a new window.
+   *
+   * busy_time / window_time is the fraction of time the bus was in use.
+   *
+   * @param[out] pbus_utilization Pointer to store the utilization of the last window.
+   */
+  void I2C::get_bus_utilization(bus_utilization_t* pbus_utilization){
+    const int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&mbus_utilization_lock);
+    *pbus_utilization = mbus_utilization;
+    pbus_utilization->window_time = now - mbus_utilization_window_start;
+    mbus_utilization = {};
+    mbus_utilization_window_start = now;
+    portEXIT_CRITICAL(&mbus_utilization_lock);
+  }
+
+  /**
+   * @brief Adds a device to the bus and registers its metrics.
+   *
+   * The device is added even when the metrics table is full. Its transactions
+   * are then not recorded.
+   *
+   * @param[in] pdevice_config Device configuration.
+   * @param[out] pdev_handle Pointer to store the device handle.
+   * @param[in] pname Device name used in the metrics. Must stay valid.
+   *
+   * @return
+   *   - ESP_OK if the device was added.
+   *   - The driver error otherwise.
+   */
+  esp_err_t I2C::add_device(const i2c_device_config_t* pdevice_config,
+      i2c_master_dev_handle_t* pdev_handle, const char* pname){
+    esp_err_t r = ESP_OK;
+
+    r = i2c_master_bus_add_device(mi2c_bus_handle, pdevice_config, pdev_handle);
+    if(r != ESP_OK){
+      ESP_LOGE(I2C_BASE_TAG, "fail to add %s to i2c bus. I2C Error:%s", pname, esp_err_to_name(r));
+    }
+    if(r == ESP_OK){
+      portENTER_CRITICAL(&mmetrics_lock);
+      if(mdevice_count < MAX_DEVICES){
+        mdevices[mdevice_count] = {};
+        mdevices[mdevice_count].dev_handle = *pdev_handle;
+        mdevices[mdevice_count].metrics.pname = pname;
+        mdevices[mdevice_count].metrics.device_address = pdevice_config->device_address;
+        mdevices[mdevice_count].metrics.scl_speed_hz = pdevice_config->scl_speed_hz;
+        mdevice_count++;
+        pname = NULL;
+      }
+      portEXIT_CRITICAL(&mmetrics_lock);
+      if(pname != NULL){
+        ESP_LOGW(I2C_BASE_TAG, "no metrics for %s. too many devices.", pname);
+      }
+    }
+    return r;
+  }
+
+  /**
+   * @brief Counts a retry of the device driver.
+   *
+   * @param dev_handle The I2C device handle.
+   */
+  void I2C::record_retry(i2c_master_dev_handle_t dev_handle){
+    portENTER_CRITICAL(&mmetrics_lock);
+    device_metrics_t* pmetrics = find_device_metrics(dev_handle);
+    if(pmetrics != NULL){
+      pmetrics->retry_count++;
+    }
+    portEXIT_CRITICAL(&mmetrics_lock);
+  }
+
+  /**
+   * @brief Number of devices with metrics.
+   *
+   * @return Number of devices added with add_device().
+   */
+  size_t I2C::get_device_count(){
+    return mdevice_count;
+  }
+
+  /**
+   * @brief Copies the metrics of one device.
+   *
+   * @param[in] device_index Index from 0 to get_device_count() - 1.
+   * @param[out] pmetrics Pointer to store the metrics.
+   *
+   * @return
+   *   - ESP_OK if the metrics were copied.
+   *   - ESP_ERR_INVALID_ARG if the index is out of range.
+   */
+  esp_err_t I2C::get_device_metrics(size_t device_index, device_metrics_t* pmetrics){
+    esp_err_t r = ESP_OK;
+    portENTER_CRITICAL(&mmetrics_lock);
+    if(device_index < mdevice_count){
+      *pmetrics = mdevices[device_index].metrics;
+    }
+    else{
+      r = ESP_ERR_INVALID_ARG;
+    }
+    portEXIT_CRITICAL(&mmetrics_lock);
+    return r;
+  }
+
+  /**
+   * @brief Logs the counters and latency histograms of every device.
+   */
+  void I2C::log_metrics(){
+    device_metrics_t metrics {};
+    for(size_t device_index = 0; device_index < get_device_count(); device_index++){
+      if(get_device_metrics(device_index, &metrics) != ESP_OK){
+        continue;
+      }
+      ESP_LOGI(I2C_BASE_TAG, "%s(0x%02x) tx:%lu rx:%lu errors:%lu timeouts:%lu semaphore timeouts:%lu retries:%lu",
+          metrics.pname, metrics.device_address, metrics.transmit_count, metrics.receive_count,
+          metrics.error_count, metrics.timeout_count, metrics.semaphore_timeout_count, metrics.retry_count);
+      if((metrics.busy_time > 0) && (metrics.scl_speed_hz > 0)){
+        // payload bits per second of bus time, against the SCL clock.
+        const uint64_t throughput = (metrics.transferred_bytes * 8 * 1000000) / metrics.busy_time;
+        ESP_LOGI(I2C_BASE_TAG, "%s throughput:%llu bit/s at %lu Hz (%llu%%) busy:%lld us",
+            metrics.pname, throughput, metrics.scl_speed_hz,
+            (throughput * 100) / metrics.scl_speed_hz, metrics.busy_time);
+      }
+      log_histogram(metrics.pname, "tx", &metrics.transmit_latency);
+      log_histogram(metrics.pname, "rx", &metrics.receive_latency);
+      log_histogram(metrics.pname, "semaphore", &metrics.semaphore_wait);
+    }
+  }
+
+  /**
+   * @brief Finds the metrics of a device.
+   *
+   * Must be called with mmetrics_lock held.
+   *
+   * @param dev_handle The I2C device handle.
+   * @return Pointer to the metrics, or NULL for devices not added with add_device().
+   */
+  I2C::device_metrics_t* I2C::find_device_metrics(i2c_master_dev_handle_t dev_handle){
+    for(size_t device_index = 0; device_index < mdevice_count; device_index++){
+      if(mdevices[device_index].dev_handle == dev_handle){
+        return &mdevices[device_index].metrics;
+      }
+    }
+    return NULL;
+  }
+
+  /**
+   * @brief Adds one latency to a histogram.
+   *
+   * @param[in,out] phistogram Histogram to update.
+   * @param[in] latency Latency in microseconds.
+   */
+  void I2C::add_latency(latency_histogram_t* phistogram, int64_t latency){
+    size_t bin = 0;
+    if(latency > 0){
+      // number of significant bits: 1us -> bin 1, 2..3us -> bin 2, ...
+      bin = 64 - __builtin_clzll(static_cast<uint64_t>(latency));
+      if(bin >= LATENCY_HISTOGRAM_BINS){
+        bin = LATENCY_HISTOGRAM_BINS - 1;
+      }
+    }
+    phistogram->bins[bin]++;
+    if(latency > phistogram->max_latency){
+      phistogram->max_latency = latency;
+    }
+  }
+
+  /**
+   * @brief Logs the non-empty bins of a histogram in one line.
+   *
+   * Every bin is printed as <upper bound in us>:<count>.
+   *
+   * @param pname Device name.
+   * @param pkind Name of the histogram.
+   * @param phistogram Histogram to log.
+   */
+  void I2C::log_histogram(const char* pname, const char* pkind, const latency_histogram_t* phistogram){
+    char line[256] = "";
+    size_t length = 0;
+    for(size_t bin = 0; (bin < LATENCY_HISTOGRAM_BINS) && (length < sizeof(line)); bin++){
+      if(phistogram->bins[bin] == 0){
+        continue;
+      }
+      if(bin == (LATENCY_HISTOGRAM_BINS - 1)){
+        length += snprintf(line + length, sizeof(line) - length, " >=%lu:%lu", 
+            1UL << (bin - 1), (unsigned long)phistogram->bins[bin]);
+      }
+      else{
+        length += snprintf(line + length, sizeof(line) - length, " <%lu:%lu", 
+            1UL << bin, (unsigned long)phistogram->bins[bin]);
+      }
+    }
+    ESP_LOGI(I2C_BASE_TAG, "%s %s latency[us]%s max:%lld", pname, pkind, line, phistogram->max_latency);
+  }
+
+  /**
+   * @brief Starts recording every transaction of the devices added with add_device().
+   *
+   * @param[in] buffer_size Size of the trace buffer in bytes.
+   *
+   * @return
+   *   - ESP_OK if recording started.
+   *   - ESP_ERR_INVALID_STATE if already recording.
+   *   - ESP_ERR_NO_MEM if the trace buffer could not be allocated.
+   */
+  esp_err_t I2C::start_recording(size_t buffer_size){
+    esp_err_t r = ESP_OK;
+    if(trace_buffer != NULL){
+      r = ESP_ERR_INVALID_STATE;
+    }
+    if(r == ESP_OK){
+      trace_buffer = xRingbufferCreate(buffer_size, RINGBUF_TYPE_NOSPLIT);
+      if(trace_buffer == NULL){
+        ESP_LOGE(I2C_BASE_TAG, "fail to create trace_buffer.");
+        r = ESP_ERR_NO_MEM;
+      }
+    }
+    if(r == ESP_OK){
+      ESP_LOGI(I2C_BASE_TAG, "start recording i2c transactions.");
+    }
+    return r;
+  }
+
+  /**
+   * @brief Checks whether the transactions are recorded.
+   *
+   * @return true if start_recording() succeeded.
+   */
+  bool I2C::is_recording(){
+    return trace_buffer != NULL;
+  }
+
+  /**
+   * @brief Takes the oldest record from the trace.
+   *
+   * @param[out] pbuffer Buffer for the record.
+   * @param[in] buffer_size Size of the buffer. TRACE_MAX_RECORD_SIZE bytes always fit.
+   * @param[out] precord_size Pointer to store the size of the record.
+   *
+   * @return
+   *   - ESP_OK if a record was copied.
+   *   - ESP_ERR_NOT_FOUND if the trace is empty or not recording.
+   *   - ESP_ERR_INVALID_SIZE if the buffer is too small. The record is lost.
+   */
+  esp_err_t I2C::read_trace_record(uint8_t* pbuffer, size_t buffer_size, size_t* precord_size){
+    esp_err_t r = ESP_OK;
+    void* pitem = NULL;
+    size_t item_size = 0;
+
+    if(trace_buffer == NULL){
+      r = ESP_ERR_NOT_FOUND;
+    }
+    if(r == ESP_OK){
+      pitem = xRingbufferReceive(trace_buffer, &item_size, 0);
+      if(pitem == NULL){
+        r = ESP_ERR_NOT_FOUND;
+      }
+    }
+    if(r == ESP_OK){
+      if(item_size <= buffer_size){
+        memcpy(pbuffer, pitem, item_size);
+        *precord_size = item_size;
+      }
+      else{
+        r = ESP_ERR_INVALID_SIZE;
+      }
+      vRingbufferReturnItem(trace_buffer, pitem);
+    }
+    return r;
+  }
+
+  /**
+   * @brief Number of transactions that were not recorded.
+   *
+   * @return Dropped transactions since start_recording().
+   */
+  uint32_t I2C::get_trace_dropped_count(){
+    portENTER_CRITICAL(&mmetrics_lock);
+    const uint32_t dropped_count = mtrace_dropped_count;
+    portEXIT_CRITICAL(&mmetrics_lock);
+    return dropped_count;
+  }
+
+  /**
+   * @brief Appends one transaction to the trace.
+   *
+   * The record is built in place in the ring buffer, so recording does not
+   * allocate. Read bytes of failed transactions are not stored.
+   */
+  void I2C::record_transaction(uint16_t device_address, int64_t start_time, int64_t duration,
+      const uint8_t* pwrite_buffer, size_t write_size,
+      const uint8_t* pread_buffer, size_t read_size, esp_err_t result){
+    trace_record_header_t header {};
+    void* pitem = NULL;
+
+    header.start_time = static_cast<uint32_t>(start_time);
+    header.duration = static_cast<uint32_t>(duration);
+    header.result = result;
+    header.device_address = device_address;
+    header.write_size = static_cast<uint8_t>(write_size);
+    header.read_size = static_cast<uint8_t>(read_size);
+    const size_t payload_size = get_trace_payload_size(&header);
+
+    if((write_size + read_size) <= TRACE_MAX_PAYLOAD_SIZE){
+      if(xRingbufferSendAcquire(trace_buffer, &pitem, sizeof(header) + payload_size, 0) != pdTRUE){
+        pitem = NULL;
+      }
+    }
+    if(pitem != NULL){
+      uint8_t* pdestination = static_cast<uint8_t*>(pitem);
+      memcpy(pdestination, &header, sizeof(header));
+      pdestination += sizeof(header);
+      if(write_size > 0){
+        memcpy(pdestination, pwrite_buffer, write_size);
+        pdestination += write_size;
+      }
+      if(payload_size > write_size){
+        memcpy(pdestination, pread_buffer, read_size);
+      }
+      xRingbufferSendComplete(trace_buffer, pitem);
+    }
+    else{
+      portENTER_CRITICAL(&mmetrics_lock);
+      mtrace_dropped_count++;
+      portEXIT_CRITICAL(&mmetrics_lock);
+    }
+  }
 }
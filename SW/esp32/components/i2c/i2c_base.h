@@ -10,9 +10,13 @@
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/semphr.h"
+#include "freertos/ringbuf.h"
 #include "driver/i2c_master.h"
 #include "esp_intr_alloc.h"
 
+#include "small_buffer.h"
+#include "i2c_trace.h"
+
 namespace i2c_base {
 
   /**
@@ -21,6 +25,53 @@ namespace i2c_base {
    * This class handles the initialization and basic read/write operations on the I2C bus.
    */
   class I2C {
+    public:
+      /**
+       * @brief Bus utilization over a measurement window.
+       */
+      typedef struct{
+        uint32_t transaction_count;
+        uint32_t error_count;
+        int64_t busy_time;     // [us] time spent in the i2c driver
+        int64_t window_time;   // [us]
+      }bus_utilization_t;
+
+      /**
+       * @brief Number of bins of a latency histogram.
+       */
+      constexpr static size_t LATENCY_HISTOGRAM_BINS {20};
+
+      /**
+       * @brief Log-scale latency histogram.
+       *
+       * Bin 0 counts 0us, bin k counts [2^(k-1), 2^k) us. The last bin also
+       * counts everything above, including expired timeouts.
+       */
+      typedef struct{
+        uint32_t bins[LATENCY_HISTOGRAM_BINS];
+        int64_t max_latency;   // [us]
+      }latency_histogram_t;
+
+      /**
+       * @brief Counters and latencies of one device.
+       */
+      typedef struct{
+        const char* pname;
+        uint16_t device_address;
+        uint32_t scl_speed_hz;
+        uint32_t transmit_count;            // write only transactions
+        uint32_t receive_count;             // transactions that read
+        uint32_t error_count;
+        uint32_t timeout_count;             // the driver timeout (I2C_TIMEOUT) expired
+        uint32_t semaphore_timeout_count;   // the bus semaphore could not be taken
+        uint32_t retry_count;               // retries reported by the device driver
+        latency_histogram_t transmit_latency;
+        latency_histogram_t receive_latency;
+        latency_histogram_t semaphore_wait;
+        uint64_t transferred_bytes;         // written and read bytes of successful transactions
+        int64_t busy_time;                  // [us] time spent in the i2c driver
+      }device_metrics_t;
+
     private:
       /**
        * @brief Tag for logging purposes.
@@ -42,6 +93,111 @@ namespace i2c_base {
        */
       constexpr static int I2C_TIMEOUT {1000};
 
+      /**
+       * @brief Largest command + data written by one blocking write.
+       *
+       * The send buffer lives on the caller's stack, so a write never allocates.
+       */
+      constexpr static size_t MAX_WRITE_SIZE {32};
+
+      /**
+       * @brief Bus utilization of the current window.
+       */
+      bus_utilization_t mbus_utilization {};
+
+      /**
+       * @brief Start of the current utilization window in microseconds.
+       */
+      int64_t mbus_utilization_window_start {0};
+
+      /**
+       * @brief Guards the bus utilization, which is read from other tasks.
+       */
+      portMUX_TYPE mbus_utilization_lock = portMUX_INITIALIZER_UNLOCKED;
+
+      /**
+       * @brief Maximum number of devices with metrics.
+       */
+      constexpr static size_t MAX_DEVICES {4};
+
+      /**
+       * @brief Metrics of a device added with add_device().
+       */
+      typedef struct{
+        i2c_master_dev_handle_t dev_handle;
+        device_metrics_t metrics;
+      }device_entry_t;
+
+      /**
+       * @brief Devices added with add_device().
+       */
+      device_entry_t mdevices[MAX_DEVICES] {};
+
+      /**
+       * @brief Number of entries in use in mdevices.
+       */
+      size_t mdevice_count {0};
+
+      /**
+       * @brief Guards the device metrics, which are read from other tasks.
+       */
+      portMUX_TYPE mmetrics_lock = portMUX_INITIALIZER_UNLOCKED;
+
+      /**
+       * @brief Recorded transactions. NULL while not recording.
+       */
+      RingbufHandle_t trace_buffer {NULL};
+
+      /**
+       * @brief Transactions that did not fit into the trace. Guarded by mmetrics_lock.
+       */
+      uint32_t mtrace_dropped_count {0};
+
+      /**
+       * @brief Appends one transaction to the trace.
+       *
+       * Never blocks. The transaction is dropped if the trace buffer is full.
+       *
+       * @param device_address Address of the device.
+       * @param start_time Start of the driver call in microseconds.
+       * @param duration Time spent in the driver in microseconds.
+       * @param pwrite_buffer Written bytes.
+       * @param write_size Number of written bytes.
+       * @param pread_buffer Read bytes.
+       * @param read_size Number of read bytes.
+       * @param result Result of the driver call.
+       */
+      void record_transaction(uint16_t device_address, int64_t start_time, int64_t duration,
+          const uint8_t* pwrite_buffer, size_t write_size,
+          const uint8_t* pread_buffer, size_t read_size, esp_err_t result);
+
+      /**
+       * @brief Finds the metrics of a device.
+       *
+       * Must be called with mmetrics_lock held.
+       *
+       * @param dev_handle Device handle.
+       * @return Pointer to the metrics, or NULL if the device was not added with add_device().
+       */
+      device_metrics_t* find_device_metrics(i2c_master_dev_handle_t dev_handle);
+
+      /**
+       * @brief Adds one latency to a histogram.
+       *
+       * @param phistogram Histogram to update.
+       * @param latency Latency in microseconds.
+       */
+      static void add_latency(latency_histogram_t* phistogram, int64_t latency);
+
+      /**
+       * @brief Logs the non-empty bins of a histogram in one line.
+       *
+       * @param pname Device name.
+       * @param pkind Name of the histogram.
+       * @param phistogram Histogram to log.
+       */
+      void log_histogram(const char* pname, const char* pkind, const latency_histogram_t* phistogram);
+
       /**
        * @brief Semaphore for exclusive access to the I2C port.
        */
@@ -86,6 +242,25 @@ namespace i2c_base {
        */
       esp_err_t release_i2c_port_semaphore();
 
+      /**
+       * @brief Runs one transaction on the bus.
+       *
+       * The common path of the blocking calls. Writes only,
+       * reads only or writes and reads with a repeated start, depending on
+       * which sizes are zero. The time spent in the driver is added to the
+       * bus utilization.
+       *
+       * @param dev_handle Device handle.
+       * @param pwrite_buffer Bytes to write.
+       * @param write_size Number of bytes to write.
+       * @param pread_buffer Buffer to store the read data.
+       * @param read_size Number of bytes to read.
+       * @return esp_err_t Error code.
+       */
+      esp_err_t execute_transaction(i2c_master_dev_handle_t dev_handle,
+          const uint8_t* pwrite_buffer, size_t write_size,
+          uint8_t* pread_buffer, size_t read_size);
+
     public:
       /**
        * @brief Constructor.
@@ -121,6 +296,83 @@ namespace i2c_base {
        */
       i2c_master_bus_handle_t get_i2c_master_bus_handle();
 
+      /**
+       * @brief Adds a device to the bus and registers its metrics.
+       *
+       * Drivers use this instead of i2c_master_bus_add_device(), so that
+       * their transactions show up in the metrics.
+       *
+       * @param pdevice_config Device configuration.
+       * @param pdev_handle Pointer to store the device handle.
+       * @param pname Device name used in the metrics. Must stay valid.
+       * @return esp_err_t Error code.
+       */
+      esp_err_t add_device(const i2c_device_config_t* pdevice_config,
+          i2c_master_dev_handle_t* pdev_handle, const char* pname);
+
+      /**
+       * @brief Counts a retry of the device driver.
+       *
+       * @param dev_handle Device handle.
+       */
+      void record_retry(i2c_master_dev_handle_t dev_handle);
+
+      /**
+       * @brief Number of devices with metrics.
+       *
+       * @return size_t Number of devices.
+       */
+      size_t get_device_count();
+
+      /**
+       * @brief Copies the metrics of one device.
+       *
+       * @param device_index Index from 0 to get_device_count() - 1.
+       * @param pmetrics Pointer to store the metrics.
+       * @return ESP_OK, or ESP_ERR_INVALID_ARG if the index is out of range.
+       */
+      esp_err_t get_device_metrics(size_t device_index, device_metrics_t* pmetrics);
+
+      /**
+       * @brief Logs the counters and latency histograms of every device.
+       */
+      void log_metrics();
+
+      /**
+       * @brief Starts recording every transaction of the devices added with add_device().
+       *
+       * Call it before the devices are initialized, so that the trace can be
+       * replayed from the start. Recording cannot be stopped.
+       *
+       * @param buffer_size Size of the trace buffer in bytes.
+       * @return esp_err_t Error code.
+       */
+      esp_err_t start_recording(size_t buffer_size);
+
+      /**
+       * @brief Checks whether the transactions are recorded.
+       *
+       * @return true if start_recording() succeeded.
+       */
+      bool is_recording();
+
+      /**
+       * @brief Takes the oldest record from the trace.
+       *
+       * @param pbuffer Buffer for the record. TRACE_MAX_RECORD_SIZE bytes always fit.
+       * @param buffer_size Size of the buffer.
+       * @param precord_size Pointer to store the size of the record.
+       * @return esp_err_t ESP_OK, or ESP_ERR_NOT_FOUND if the trace is empty.
+       */
+      esp_err_t read_trace_record(uint8_t* pbuffer, size_t buffer_size, size_t* precord_size);
+
+      /**
+       * @brief Number of transactions that were not recorded.
+       *
+       * @return uint32_t Dropped transactions since start_recording().
+       */
+      uint32_t get_trace_dropped_count();
+
       /**
        * @brief Reads a single byte.
        *
@@ -165,6 +417,19 @@ namespace i2c_base {
           const uint8_t* pcommand, size_t command_size,
           uint8_t* pread_data_buffer, size_t read_buffer_size);
 
+      /**
+       * @brief Reads multiple bytes without sending a command.
+       *
+       * Used by devices that return a result some time after the command was written.
+       *
+       * @param dev_handle Device handle.
+       * @param pread_data_buffer Buffer to store the read data.
+       * @param read_buffer_size Size of the read buffer.
+       * @return esp_err_t Error code.
+       */
+      esp_err_t receive_data(i2c_master_dev_handle_t dev_handle,
+          uint8_t* pread_data_buffer, size_t read_buffer_size);
+
       /**
        * @brief Writes multiple bytes.
        *
@@ -180,5 +445,12 @@ namespace i2c_base {
       esp_err_t write_data(i2c_master_dev_handle_t dev_handle,
           const uint8_t* pcommand, size_t command_size,
           const uint8_t* pwrite_data_buffer, size_t write_buffer_size);
+
+      /**
+       * @brief Reads the bus utilization and starts a new window.
+       *
+       * @param pbus_utilization Pointer to store the utilization of the last window.
+       */
+      void get_bus_utilization(bus_utilization_t* pbus_utilization);
   };
 }
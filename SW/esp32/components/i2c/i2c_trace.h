@@ -0,0 +1,74 @@
+/**
+ * @file i2c_trace.h
+ * @brief Binary format of the I2C bus traces.
+ *
+ * A trace file is a trace_file_header_t followed by records. A record is a
+ * trace_record_header_t, the write bytes and, if the transaction succeeded,
+ * the read bytes. All fields are little endian.
+ *
+ * The format is shared by the recorder in i2c_base::I2C and the host replay
+ * tool, so it only depends on the standard headers.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace i2c_base {
+
+  /**
+   * @brief "I2CT" in the first four bytes of a trace file.
+   */
+  constexpr static uint32_t TRACE_MAGIC {0x54433249};
+
+  /**
+   * @brief Version of the record layout.
+   */
+  constexpr static uint16_t TRACE_VERSION {1};
+
+  /**
+   * @brief Maximum number of write and read bytes stored by one record.
+   *
+   * Longer transactions are not recorded and counted as dropped.
+   */
+  constexpr static size_t TRACE_MAX_PAYLOAD_SIZE {96};
+
+  /**
+   * @brief Header at the start of a trace file.
+   */
+  typedef struct __attribute__((packed)){
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_header_size;
+  }trace_file_header_t;
+
+  /**
+   * @brief Header of one recorded transaction.
+   */
+  typedef struct __attribute__((packed)){
+    uint32_t start_time;      // [us] low 32 bits of esp_timer_get_time(). readers unwrap it.
+    uint32_t duration;        // [us] time spent in the i2c driver
+    int32_t result;           // esp_err_t of the driver call
+    uint16_t device_address;
+    uint8_t write_size;
+    uint8_t read_size;        // the read bytes are only stored if result is ESP_OK (0)
+  }trace_record_header_t;
+
+  static_assert(sizeof(trace_record_header_t) == 16, "trace record header layout changed");
+
+  /**
+   * @brief Maximum size of one record.
+   */
+  constexpr static size_t TRACE_MAX_RECORD_SIZE {sizeof(trace_record_header_t) + TRACE_MAX_PAYLOAD_SIZE};
+
+  /**
+   * @brief Size of the payload stored after a record header.
+   *
+   * @param pheader Record header.
+   * @return size_t Number of bytes following the header.
+   */
+  inline size_t get_trace_payload_size(const trace_record_header_t* pheader){
+    return pheader->write_size + ((pheader->result == 0) ? pheader->read_size : 0);
+  }
+}
@@ -0,0 +1,88 @@
+/**
+ * @file small_buffer.h
+ * @brief Fixed-capacity byte buffer for I2C transactions.
+ *
+ * Used instead of heap buffers, so that a transaction never allocates.
+ */
+
+#pragma once
+
+#include <cstring>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+namespace i2c_base {
+
+  /**
+   * @brief Byte buffer with a compile-time capacity.
+   *
+   * Lives on the stack or inside its owner. Appending more than CAPACITY
+   * bytes fails instead of growing.
+   *
+   * @tparam CAPACITY Maximum number of bytes.
+   */
+  template<size_t CAPACITY>
+  class SMALL_BUFFER {
+    private:
+      /**
+       * @brief Buffer storage.
+       */
+      uint8_t mdata[CAPACITY];
+
+      /**
+       * @brief Number of bytes in use.
+       */
+      size_t msize {0};
+
+    public:
+      /**
+       * @brief Appends bytes to the end of the buffer.
+       *
+       * @param pdata Bytes to append. May be NULL if size is 0.
+       * @param size Number of bytes to append.
+       * @return
+       *   - ESP_OK if the bytes were appended.
+       *   - ESP_ERR_INVALID_SIZE if they do not fit. The buffer is unchanged.
+       */
+      esp_err_t append(const uint8_t* pdata, size_t size){
+        if(size > (CAPACITY - msize)){
+          return ESP_ERR_INVALID_SIZE;
+        }
+        if(size != 0){
+          memcpy(mdata + msize, pdata, size);
+          msize += size;
+        }
+        return ESP_OK;
+      }
+
+      /**
+       * @brief Removes all bytes.
+       */
+      void clear(){
+        msize = 0;
+      }
+
+      /**
+       * @brief Pointer to the first byte.
+       */
+      const uint8_t* data() const {
+        return mdata;
+      }
+
+      /**
+       * @brief Number of bytes in use.
+       */
+      size_t size() const {
+        return msize;
+      }
+
+      /**
+       * @brief Maximum number of bytes.
+       */
+      constexpr static size_t capacity(){
+        return CAPACITY;
+      }
+  };
+}
@@ -1,9 +1,11 @@
 #include <math.h>
 #include "esp_log.h"
 #include "esp_check.h"
+#include "esp_timer.h"
 
 #include "i2c_base.h"
 #include "scd40.h"
+#include "scd40_crc.h"
 
 SCD40::SCD40(){
   esp_log_level_set(SCD40_TAG, ESP_LOG_ERROR);
@@ -21,8 +23,7 @@ esp_err_t SCD40::init_i2c(void){
     .scl_wait_us = 0,
    };
    i2c_device_config.flags.disable_ack_check = true;
-   r = i2c_master_bus_add_device(pmi2c->get_i2c_master_bus_handle(),
-       &i2c_device_config, &mi2c_device_handle); 
+   r = pmi2c->add_device(&i2c_device_config, &mi2c_device_handle, "scd40");
   }
   if(r != ESP_OK){
     ESP_LOGE(SCD40_TAG, "fail to add SCD40 to i2c port");
@@ -31,26 +32,20 @@ esp_err_t SCD40::init_i2c(void){
   return r;
 }
 
-uint8_t SCD40::calculate_crc(const uint8_t* data, uint16_t byte_size){
-  //check sum calculation method is written usermanual p.23 
-  uint16_t current_byte = 0;
-  uint8_t crc = 0xFF;
-  const uint8_t CRC8_POLYNOMIAL = 0x31;
-  uint8_t crc_bit = 0;
-  /* calculates 8-Bit checksum with given polynomial */
-  for(current_byte = 0; current_byte < byte_size; ++current_byte){
-    crc ^= (data[current_byte]);
-    for(crc_bit = 8; crc_bit > 0; --crc_bit){
-      if(crc & 0x80){
-        crc = (crc << 1) ^ CRC8_POLYNOMIAL;
-      }
-      else{
-        crc = (crc << 1);
+esp_err_t SCD40::verify_crc(const uint8_t* pdata, size_t data_size, size_t* pfailed_word){
+  esp_err_t r = ESP_OK;
+  if((data_size % WORD_SIZE) != 0){
+    r = ESP_ERR_INVALID_SIZE;
+  }
+  for(size_t offset = 0; (r == ESP_OK) && (offset < data_size); offset += WORD_SIZE){
+    if(scd40::calculate_crc(&pdata[offset], WORD_SIZE - 1) != pdata[offset + 2]){
+      r = ESP_ERR_INVALID_CRC;
+      if(pfailed_word != NULL){
+        *pfailed_word = offset / WORD_SIZE;
       }
     }
   }
-  ESP_LOGI(SCD40_TAG, "Calculate CRC = %x", crc);
-  return crc;
+  return r;
 }
 
 esp_err_t SCD40::init(i2c_base::I2C* pi2c){
@@ -58,6 +53,7 @@ esp_err_t SCD40::init(i2c_base::I2C* pi2c){
   
   if(r == ESP_OK){
     pmi2c = pi2c;
+    mambient_pressure = 0;
     r = init_i2c();
     if(r != ESP_OK){
       ESP_LOGE(SCD40_TAG, "fail to initialize SCD40.");
@@ -72,6 +68,7 @@ esp_err_t SCD40::init(i2c_base::I2C* pi2c){
       ESP_LOGI(SCD40_TAG, "send stop_periodic_measurement command.");
       vTaskDelay(pdMS_TO_TICKS(50));
       if(r == ESP_OK){
+        pmi2c->record_retry(mi2c_device_handle);
         r = check_serial_number();
       }
     }
@@ -107,32 +104,6 @@ esp_err_t SCD40::get_serial_number(uint64_t* pserial_number){
     ESP_LOGD(SCD40_TAG, "scd40 get serial number:%llu", *pserial_number);
   }
   
-  if(r == ESP_OK){
-    uint8_t word_crc = calculate_crc(serial_number.data.word_0, sizeof(serial_number.data.word_0));
-    ESP_LOGD(SCD40_TAG, "word_0 crc: %x, calculate word_0 crc: %x", serial_number.data.crc_0, word_crc);
-    if(word_crc != serial_number.data.crc_0){
-      r = ESP_FAIL;
-      ESP_LOGE(SCD40_TAG, "scd40 data_0 crc does not match.");
-    }
-  }
-  
-  if(r == ESP_OK){
-    uint8_t word_crc = calculate_crc(serial_number.data.word_1, sizeof(serial_number.data.word_1));
-    ESP_LOGD(SCD40_TAG, "word_1 crc: %x, calculate word_1 crc: %x", serial_number.data.crc_1, word_crc);
-    if(word_crc != serial_number.data.crc_1){
-      r = ESP_FAIL;
-      ESP_LOGE(SCD40_TAG, "scd40 data_1 crc does not match.");
-    }
-  }
-  
-  if(r == ESP_OK){
-    uint8_t word_crc = calculate_crc(serial_number.data.word_2, sizeof(serial_number.data.word_2));
-    ESP_LOGD(SCD40_TAG, "word_2 crc: %x, calculate word_2 crc: %x", serial_number.data.crc_2, word_crc);
-    if(word_crc != serial_number.data.crc_2){
-      r = ESP_FAIL;
-      ESP_LOGE(SCD40_TAG, "scd40 data_2 crc does not match.");
-    }
-  }
   ESP_LOGI(SCD40_TAG, "scd40 serial number:%llu", *pserial_number);
 
   return r;
@@ -155,9 +126,105 @@ esp_err_t SCD40::start_periodic_measurement(){
   if(r != ESP_OK){
     ESP_LOGE(SCD40_TAG, "fail to send periodic measurement command.");
   }
+  else{
+    mis_measuring = true;
+  }
+  return r;
+}
+
+esp_err_t SCD40::start_low_power_periodic_measurement(){
+  esp_err_t r = ESP_OK;
+  r = send_command(START_LOW_POWER_PERIODIC_MEASUREMENT_COMMAND);
+  if(r != ESP_OK){
+    ESP_LOGE(SCD40_TAG, "fail to send low power periodic measurement command.");
+  }
+  else{
+    mis_measuring = true;
+  }
+  return r;
+}
+
+esp_err_t SCD40::get_data_ready_status(bool* pis_data_ready){
+  esp_err_t r = ESP_OK;
+  scd40_data_t data_ready_status = {
+    .arr = {0x00, 0x00, 0x00},
+  };
+  *pis_data_ready = false;
+
+  if(r == ESP_OK){
+    r = read_data(GET_DATA_READY_STATUS_COMMAND, data_ready_status.arr, sizeof(data_ready_status.arr));
+    if(r != ESP_OK){
+      ESP_LOGE(SCD40_TAG, "fail to read data ready status.");
+    }
+  }
+  if(r == ESP_OK){
+    // the least significant 11 bits are 0 while no new data is available.
+    *pis_data_ready = (((data_ready_status.data.value[0] << 8) | data_ready_status.data.value[1]) & 0x07FF) != 0;
+  }
+  return r;
+}
+
+void SCD40::set_measurement_mode(measurement_mode_e measurement_mode){
+  mmeasurement_mode = measurement_mode;
+}
+
+esp_err_t SCD40::power_down(){
+  esp_err_t r = ESP_OK;
+  r = send_command(POWER_DOWN_COMMAND);
+  if(r != ESP_OK){
+    ESP_LOGE(SCD40_TAG, "fail to send power down command.");
+  }
+  // also when the command failed, the next wake up sends the pressure again.
+  mambient_pressure = 0;
+  return r;
+}
+
+bool SCD40::is_ambient_pressure_pending(){
+  return (mambient_pressure_request != 0) && (mambient_pressure_request != mambient_pressure);
+}
+
+esp_err_t SCD40::send_ambient_pressure(){
+  esp_err_t r = ESP_OK;
+  if(is_ambient_pressure_pending()){
+    // the command takes the pressure in Pa / 100.
+    r = write_word(SET_AMBIENT_PRESSURE_COMMAND, mambient_pressure_request);
+    if(r != ESP_OK){
+      ESP_LOGE(SCD40_TAG, "fail to transmit set ambient pressure command.");
+    }
+    else{
+      mambient_pressure = mambient_pressure_request;
+      ESP_LOGD(SCD40_TAG, "set ambient pressure:%d[hPa]", mambient_pressure);
+    }
+  }
+  return r;
+}
+
+esp_err_t SCD40::check_single_shot_support(){
+  esp_err_t r = ESP_OK;
+  scd40_data_t sensor_variant = {
+    .arr = {0x00, 0x00, 0x00},
+  };
+
+  if(r == ESP_OK){
+    r = read_data(GET_SENSOR_VARIANT_COMMAND, sensor_variant.arr, sizeof(sensor_variant.arr));
+    if(r != ESP_OK){
+      ESP_LOGE(SCD40_TAG, "fail to read sensor variant.");
+    }
+  }
+  if(r == ESP_OK){
+    // bits 15..12 are 0 for SCD40 and 1 for SCD41. only SCD41 supports single shot.
+    if((sensor_variant.data.value[0] >> 4) != SCD41_VARIANT){
+      ESP_LOGE(SCD40_TAG, "single shot measurement is not supported by this sensor.");
+      r = ESP_ERR_NOT_SUPPORTED;
+    }
+  }
   return r;
 }
 
+SCD40::measurement_timing_t SCD40::get_last_measurement_timing(){
+  return mlast_measurement_timing;
+}
+
 esp_err_t SCD40::get_sensor_data(uint16_t* pco2, double* ptemperature, double* prelative_humidity) {
   esp_err_t r = ESP_OK;  
   union{
@@ -176,12 +243,6 @@ esp_err_t SCD40::get_sensor_data(uint16_t* pco2, double* ptemperature, double* p
         measurement_data.arr, sizeof(measurement_data.arr));
     if(r != ESP_OK) {
       ESP_LOGE(SCD40_TAG, "fail to get sensor data");
-      r = stop_periodic_measurement();
-
-      if(r == ESP_OK){
-        r = read_data(READ_MEASUREMENT_COMMAND, 
-          measurement_data.arr, sizeof(measurement_data.arr));
-      }
     }
   }
   if(r == ESP_OK){
@@ -208,12 +269,6 @@ esp_err_t SCD40::get_co2_data(uint16_t* pco2){
         measurement_data.arr, sizeof(measurement_data.arr));
     if(r != ESP_OK) {
       ESP_LOGE(SCD40_TAG, "fail to get sensor data");
-      esp_err_t r2 = ESP_OK; 
-      r2 = stop_periodic_measurement();
-      if(r2 == ESP_OK){
-        r = read_data(READ_MEASUREMENT_COMMAND, 
-          measurement_data.arr, sizeof(measurement_data.arr));
-      }
     }
   }
   if(r == ESP_OK){
@@ -222,93 +277,205 @@ esp_err_t SCD40::get_co2_data(uint16_t* pco2){
   return r;
  }
 
-esp_err_t SCD40::get_co2(uint16_t* pco2){
+esp_err_t SCD40::stop_periodic_measurement(){
   esp_err_t r = ESP_OK;
-  //ToDo: add mutex  
-  *pco2 = co2;
-  
+  r = send_command(STOP_PERIODIC_MEASUREMENT_COMMAND);
+  if(r != ESP_OK){
+    ESP_LOGE(SCD40_TAG, "failed to transmit stop periodic measurement command ");
+  }
+  else{
+    mis_measuring = false;
+  }
   return r;
 }
 
-esp_err_t SCD40::stop_periodic_measurement(){
+esp_err_t SCD40::set_temperature_offset(float temperature_offset){
   esp_err_t r = ESP_OK;
-  r = send_command(STOP_PERIODIC_MEASUREMENT_COMMAND);
+
+  uint16_t offset = (temperature_offset * 65536.0) / 175.0;
+  ESP_LOGI(SCD40_TAG, "temperature offset is 0x%x", offset);
+  r = write_word(SET_TEMPERATURE_OFFSET_COMMAND, offset);
   if(r != ESP_OK){
-    ESP_LOGE(SCD40_TAG, "failed to transmit stop periodic measurement command ");
+    ESP_LOGE(SCD40_TAG, "fail to transmit set temperature offset command.");
+  }
+  return r;
+}
+
+esp_err_t SCD40::get_temperature_offset(float* ptemperature_offset){
+  esp_err_t r = ESP_OK;
+  uint16_t offset = 0;
+
+  r = read_word(GET_TEMPERATURE_OFFSET_COMMAND, &offset);
+  if(r != ESP_OK){
+    ESP_LOGE(SCD40_TAG, "fail to read temperature offset.");
+  }
+  if(r == ESP_OK){
+    *ptemperature_offset = round((175 * (offset / 65536.0)) * 10.0) / 10.0;
   }
   return r;
 }
 
-esp_err_t SCD40::create_task(const char* pname, uint16_t stack_size, UBaseType_t task_priority){
+esp_err_t SCD40::configure_temperature_offset(float temperature_offset){
   esp_err_t r = ESP_OK;
-  BaseType_t r2 = pdTRUE;
-  if(r == ESP_OK){ 
-    r2 = xTaskCreate(get_measure_co2_task_entry_point, pname, stack_size, this, task_priority, &task_handle);
-    if(r2 != pdTRUE){
-      ESP_LOGE(SCD40_TAG, "fail to create measure_co2_task.");
-      r = ESP_FAIL;
-    }
+  float current_offset = 0.0;
+
+  if(r == ESP_OK){
+    r = get_temperature_offset(&current_offset);
   }
   if(r == ESP_OK){
-    co2_buffer = xQueueCreate(co2_buffer_size, sizeof(co2));
-    if(co2_buffer == NULL){
-      ESP_LOGE(SCD40_TAG, "fail to create co2_buffer");
-      r = ESP_ERR_NO_MEM; 
+    if(fabs(current_offset - temperature_offset) < TEMPERATURE_OFFSET_RESOLUTION){
+      ESP_LOGI(SCD40_TAG, "temperature offset %.1f is already stored.", current_offset);
+    }
+    else{
+      ESP_LOGI(SCD40_TAG, "update temperature offset %.1f -> %.1f", current_offset, temperature_offset);
+      r = set_temperature_offset(temperature_offset);
+      if(r == ESP_OK){
+        r = persist_settings();
+      }
     }
   }
   return r;
 }
 
-esp_err_t SCD40::set_temperature_offset(float temperature_offset){
+esp_err_t SCD40::set_sensor_altitude(uint16_t altitude){
   esp_err_t r = ESP_OK;
-
-  uint16_t offset = (temperature_offset * 65536.0) / 175.0;
-  ESP_LOGI(SCD40_TAG, "temperature offset is 0x%x", offset);
-  scd40_data_t send_data = {
-    .arr = {0x00, 0x00, 0x00},
-  };
-  
-  send_data.data.value[0] = offset >> 8; //msb
-  send_data.data.value[1] = offset && 0xFF; //lsb
-  send_data.data.crc = calculate_crc(send_data.data.value, sizeof(send_data.data.value));
-  ESP_LOGI(SCD40_TAG, "temperature offset crc is 0x%x", send_data.data.crc);
-  
-  r = write_data(SET_TEMPERATURE_OFFSET_COMMAND, send_data.arr, sizeof(send_data.arr));
+  r = write_word(SET_SENSOR_ALTITUDE_COMMAND, altitude);
   if(r != ESP_OK){
-    ESP_LOGE(SCD40_TAG, "fail to transmit set temperature offset command.");
+    ESP_LOGE(SCD40_TAG, "fail to transmit set sensor altitude command.");
   }
   return r;
 }
 
-esp_err_t SCD40::get_temperature_offset(float* ptemperature_offset){
+esp_err_t SCD40::get_sensor_altitude(uint16_t* paltitude){
   esp_err_t r = ESP_OK;
-  
-  scd40_data_t read_temperature_offset = {
-   .arr = {0x00, 0x00, 0x00},
-  }; 
+  r = read_word(GET_SENSOR_ALTITUDE_COMMAND, paltitude);
+  if(r != ESP_OK){
+    ESP_LOGE(SCD40_TAG, "fail to read sensor altitude.");
+  }
+  return r;
+}
 
-  r = read_data(GET_TEMPERATURE_OFFSET_COMMAND, read_temperature_offset.arr, 
-      sizeof(read_temperature_offset.arr));
+esp_err_t SCD40::set_automatic_self_calibration(bool is_enabled){
+  esp_err_t r = ESP_OK;
+  r = write_word(SET_AUTOMATIC_SELF_CALIBRATION_ENABLED_COMMAND, is_enabled ? 1 : 0);
+  if(r != ESP_OK){
+    ESP_LOGE(SCD40_TAG, "fail to transmit set automatic self calibration command.");
+  }
+  return r;
+}
 
+esp_err_t SCD40::get_automatic_self_calibration(bool* pis_enabled){
+  esp_err_t r = ESP_OK;
+  uint16_t is_enabled = 0;
+  r = read_word(GET_AUTOMATIC_SELF_CALIBRATION_ENABLED_COMMAND, &is_enabled);
   if(r != ESP_OK){
-    ESP_LOGE(SCD40_TAG, "fail to read temperature offset.");
+    ESP_LOGE(SCD40_TAG, "fail to read automatic self calibration status.");
+  }
+  else{
+    *pis_enabled = (is_enabled != 0);
+  }
+  return r;
+}
+
+esp_err_t SCD40::perform_forced_recalibration(uint16_t target_co2, int16_t* pcorrection){
+  esp_err_t r = ESP_OK;
+  scd40_data_t frc_result = {
+    .arr = {0x00, 0x00, 0x00},
+  };
+  uint16_t correction = FORCED_RECALIBRATION_FAILED;
+
+  if(r == ESP_OK){
+    r = write_word(PERFORM_FORCED_RECALIBRATION_COMMAND, target_co2);
+    if(r != ESP_OK){
+      ESP_LOGE(SCD40_TAG, "fail to transmit forced recalibration command.");
+    }
   }
   if(r == ESP_OK){
-    uint8_t expected_crc = calculate_crc(read_temperature_offset.data.value, 
-        sizeof(read_temperature_offset.data.value));
-    if(expected_crc != read_temperature_offset.data.crc){
-      r = ESP_ERR_INVALID_CRC;
-      ESP_LOGE(SCD40_TAG, "don't much read crc and expected crc.");
-      ESP_LOGE(SCD40_TAG, "read crc: 0x%x, expected crc: 0x%x", read_temperature_offset.data.crc, expected_crc);
+    // the result is read without sending a command again.
+    vTaskDelay(pdMS_TO_TICKS(FORCED_RECALIBRATION_TIME));
+    r = pmi2c->receive_data(mi2c_device_handle, frc_result.arr, sizeof(frc_result.arr));
+    if(r == ESP_OK){
+      r = verify_crc(frc_result.arr, sizeof(frc_result.arr), NULL);
+    }
+    if(r != ESP_OK){
+      ESP_LOGE(SCD40_TAG, "fail to read forced recalibration result.");
     }
   }
   if(r == ESP_OK){
-    *ptemperature_offset = round((175 * (((read_temperature_offset.data.value[0] << 8) + 
-              read_temperature_offset.data.value[1]) / 65536.0)) * 10.0) / 10.0;
+    correction = (frc_result.data.value[0] << 8) | frc_result.data.value[1];
+    if(correction == FORCED_RECALIBRATION_FAILED){
+      ESP_LOGE(SCD40_TAG, "forced recalibration failed.");
+      r = ESP_FAIL;
+    }
+  }
+  if(r == ESP_OK){
+    *pcorrection = (int16_t)(correction - FORCED_RECALIBRATION_OFFSET);
+    ESP_LOGI(SCD40_TAG, "forced recalibration to %d[ppm], correction:%d[ppm]", target_co2, *pcorrection);
+  }
+  return r;
+}
+
+esp_err_t SCD40::persist_settings(){
+  esp_err_t r = ESP_OK;
+  r = send_command(PERSIST_SETTINGS_COMMAND);
+  if(r != ESP_OK){
+    ESP_LOGE(SCD40_TAG, "fail to transmit persist settings command.");
+  }
+  else{
+    vTaskDelay(pdMS_TO_TICKS(PERSIST_SETTINGS_TIME));
+  }
+  return r;
+}
+
+esp_err_t SCD40::set_ambient_pressure(float pressure){
+  esp_err_t r = ESP_OK;
+  uint16_t ambient_pressure = (uint16_t)lroundf(pressure);
+
+  if((ambient_pressure < MIN_AMBIENT_PRESSURE) || (ambient_pressure > MAX_AMBIENT_PRESSURE)){
+    ESP_LOGW(SCD40_TAG, "ambient pressure %d[hPa] is out of range.", ambient_pressure);
+    r = ESP_ERR_INVALID_ARG;
+  }
+  if(r == ESP_OK){
+    mambient_pressure_request = ambient_pressure;
+  }
+  // a single shot sensor is powered down or busy measuring, measure_step() sends the pressure
+  // after the next wake up. a periodic measurement takes it at any time.
+  // the sensor keeps the value, so send_ambient_pressure() skips the bus transfer when nothing changed.
+  if((r == ESP_OK) && (mmeasurement_mode != measurement_mode_e::SINGLE_SHOT)){
+    r = send_ambient_pressure();
+    mis_pressure_compensated = (mambient_pressure != 0);
+  }
+  return r;
+}
+
+bool SCD40::is_pressure_compensated(){
+  return mis_pressure_compensated;
+}
+
+esp_err_t SCD40::read_word(const uint8_t* pcommand, uint16_t* pvalue){
+  esp_err_t r = ESP_OK;
+  scd40_data_t read_word_data = {
+    .arr = {0x00, 0x00, 0x00},
+  };
+
+  r = read_data(pcommand, read_word_data.arr, sizeof(read_word_data.arr));
+  if(r == ESP_OK){
+    *pvalue = (read_word_data.data.value[0] << 8) | read_word_data.data.value[1];
   }
   return r;
 }
 
+esp_err_t SCD40::write_word(const uint8_t* pcommand, uint16_t value){
+  scd40_data_t send_data = {
+    .arr = {0x00, 0x00, 0x00},
+  };
+
+  send_data.data.value[0] = value >> 8;   //msb
+  send_data.data.value[1] = value & 0xFF; //lsb
+  send_data.data.crc = scd40::calculate_crc(send_data.data.value, sizeof(send_data.data.value));
+  return write_data(pcommand, send_data.arr, sizeof(send_data.arr));
+}
+
 esp_err_t SCD40::read_data(const uint8_t* pcommand, 
     uint8_t* pread_data_buffer, size_t buffer_size){
   esp_err_t r = ESP_OK;
@@ -319,6 +486,13 @@ esp_err_t SCD40::read_data(const uint8_t* pcommand,
       ESP_LOGE(SCD40_TAG, "fail to read data from %x", (pcommand[0] << 8) | pcommand[1]);
     }
   }
+  if(r == ESP_OK){
+    size_t failed_word = 0;
+    r = verify_crc(pread_data_buffer, buffer_size, &failed_word);
+    if(r != ESP_OK){
+      ESP_LOGE(SCD40_TAG, "crc of word %d from %x does not match.", (int) failed_word, (pcommand[0] << 8) | pcommand[1]);
+    }
+  }
   return r;
 }
 
@@ -340,44 +514,209 @@ esp_err_t SCD40::send_command(const uint8_t* pcommand){
   return r;
 }
 
-void SCD40::measure_co2_task(){
-  esp_err_t r = ESP_OK; 
-  BaseType_t r2 = pdTRUE;
-
-  while(true){
-    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(TIMEOUT_SETTING)); 
-    ESP_LOGI(SCD40_TAG, "start co2 measurement.");
-    if(r == ESP_OK){
-      r = start_periodic_measurement();
-      vTaskDelay(pdMS_TO_TICKS(MEASUREMENT_INTERVAL)); 
+esp_err_t SCD40::check_measurement_mode(){
+  esp_err_t r = ESP_OK;
+  if((mmeasurement_mode == measurement_mode_e::SINGLE_SHOT) && !mis_single_shot_checked){
+    mis_single_shot_checked = true;
+    if(check_single_shot_support() == ESP_OK){
+      r = power_down();
     }
-    if(r == ESP_OK){
-      r = get_co2_data(&co2);
-      ESP_LOGI(SCD40_TAG, "get co2:%d[ppm]", co2);
-      r2 = xQueueSendToBack(co2_buffer, &co2, pdMS_TO_TICKS(TIMEOUT_SETTING));
-      if(r2 != pdTRUE){
-        ESP_LOGE(SCD40_TAG, "fail to send to co2_buffer");
-        r = ESP_FAIL; 
-      }
-      vTaskDelay(pdMS_TO_TICKS(COMMAND_INTERVAL));
+    else{
+      ESP_LOGW(SCD40_TAG, "fall back to periodic measurement.");
+      mmeasurement_mode = measurement_mode_e::PERIODIC;
     }
-    if(r == ESP_OK){
-      r = stop_periodic_measurement();
-      vTaskDelay(pdMS_TO_TICKS(COMMAND_INTERVAL));
+  }
+  return r;
+}
+
+esp_err_t SCD40::measure_step(uint16_t* pco2, uint32_t* pwait_ms){
+  esp_err_t r = ESP_OK;
+  results_data_t results {};
+  *pwait_ms = 0;
+
+  if(r == ESP_OK){
+    r = check_measurement_mode();
+  }
+  if(r == ESP_OK){
+    if(mmeasurement_mode == measurement_mode_e::SINGLE_SHOT){
+      r = measure_single_shot_step(false, &results, pwait_ms);
+      *pco2 = results.co2;
+    }
+    else{
+      r = measure_periodic_step(pco2, pwait_ms);
     }
   }
-  vTaskDelete(NULL);
+  return r;
 }
 
-QueueHandle_t SCD40::get_co2_buffer_handle(){
-  return co2_buffer;
+esp_err_t SCD40::measure_rht_only_step(double* ptemperature, double* prelative_humidity, uint32_t* pwait_ms){
+  esp_err_t r = ESP_OK;
+  results_data_t results {};
+  *pwait_ms = 0;
+
+  if(r == ESP_OK){
+    r = check_measurement_mode();
+  }
+  if((r == ESP_OK) && (mmeasurement_mode != measurement_mode_e::SINGLE_SHOT)){
+    // the sensor only takes the command while it is idle.
+    ESP_LOGE(SCD40_TAG, "rht only measurement needs single shot mode.");
+    r = ESP_ERR_INVALID_STATE;
+  }
+  if(r == ESP_OK){
+    r = measure_single_shot_step(true, &results, pwait_ms);
+    *ptemperature = results.temperature;
+    *prelative_humidity = results.relative_humidity;
+  }
+  return r;
 }
 
-void SCD40::get_measure_co2_task_entry_point(void* arg){
-  SCD40* pinstance = static_cast<SCD40*>(arg);
-  pinstance->measure_co2_task();
+esp_err_t SCD40::measure_periodic_step(uint16_t* pco2, uint32_t* pwait_ms){
+  esp_err_t r = ESP_OK;
+  bool is_data_ready = false;
+  const uint16_t measurement_interval = (mmeasurement_mode == measurement_mode_e::LOW_POWER_PERIODIC) ?
+    LOW_POWER_PERIODIC_MEASUREMENT_INTERVAL : PERIODIC_MEASUREMENT_INTERVAL;
+
+  if(mmeasure_step == measure_step_e::START){
+    // keep the sensor measuring, so that its algorithm and ASC are never restarted.
+    if(!mis_measuring){
+      ESP_LOGI(SCD40_TAG, "start co2 measurement.");
+      if(mmeasurement_mode == measurement_mode_e::LOW_POWER_PERIODIC){
+        r = start_low_power_periodic_measurement();
+      }
+      else{
+        r = start_periodic_measurement();
+      }
+      if(r == ESP_OK){
+        *pwait_ms = measurement_interval;
+        r = ESP_ERR_NOT_FINISHED;
+      }
+    }
+    mmeasure_step = measure_step_e::WAIT_DATA_READY;
+  }
+  if(r == ESP_OK){
+    r = get_data_ready_status(&is_data_ready);
+    if((r == ESP_OK) && !is_data_ready){
+      *pwait_ms = DATA_READY_POLL_INTERVAL;
+      r = ESP_ERR_NOT_FINISHED;
+    }
+  }
+  if(r == ESP_OK){
+    r = get_co2_data(pco2);
+    if(r == ESP_OK){
+      ESP_LOGI(SCD40_TAG, "get co2:%d[ppm]", *pco2);
+    }
+  }
+  if(r != ESP_ERR_NOT_FINISHED){
+    mmeasure_step = measure_step_e::START;
+  }
+  if((r != ESP_OK) && (r != ESP_ERR_NOT_FINISHED)){
+    // restart the measurement on the next cycle. 
+    // the next release comes later than the 500ms the stop command needs.
+    stop_periodic_measurement();
+    mis_measuring = false;
+  }
+  return r;
 }
 
-void SCD40::notify_measurement_start(){
-  xTaskNotifyGive(task_handle);
+esp_err_t SCD40::measure_single_shot_step(bool is_rht_only, results_data_t* presults, uint32_t* pwait_ms){
+  esp_err_t r = ESP_OK;
+  uint16_t discarded_co2 = 0;
+  int64_t read_start_time = 0;
+  int64_t read_end_time = 0;
+
+  if((mmeasure_step != measure_step_e::START) && (is_rht_only != mis_rht_only_measurement)){
+    // the other kind of measurement is running. it keeps its state.
+    return ESP_ERR_INVALID_STATE;
+  }
+  switch(mmeasure_step){
+    case measure_step_e::START:
+      mis_rht_only_measurement = is_rht_only;
+      mwake_up_start_time = esp_timer_get_time();
+      // the sensor does not acknowledge wake_up, so the transmit result is ignored.
+      send_command(WAKE_UP_COMMAND);
+      mmeasure_step = measure_step_e::WAIT_WAKE_UP;
+      *pwait_ms = WAKE_UP_TIME;
+      r = ESP_ERR_NOT_FINISHED;
+      break;
+    case measure_step_e::WAIT_WAKE_UP:
+      // the sensor lost the pressure while it was powered down.
+      // without it the measurement runs uncompensated. temperature and humidity do not use it.
+      if(!mis_rht_only_measurement && is_ambient_pressure_pending() && (send_ambient_pressure() == ESP_OK)){
+        mmeasure_step = measure_step_e::WAIT_AMBIENT_PRESSURE;
+        *pwait_ms = SET_AMBIENT_PRESSURE_TIME;
+        r = ESP_ERR_NOT_FINISHED;
+        break;
+      }
+      [[fallthrough]];
+    case measure_step_e::WAIT_AMBIENT_PRESSURE:
+      if(mis_rht_only_measurement){
+        // nothing to discard, only the co2 reading is inaccurate after a wake up.
+        mmeasurement_start_time = esp_timer_get_time();
+        r = send_command(MEASURE_SINGLE_SHOT_RHT_ONLY_COMMAND);
+        if(r == ESP_OK){
+          mmeasure_step = measure_step_e::WAIT_SINGLE_SHOT;
+          *pwait_ms = SINGLE_SHOT_RHT_ONLY_MEASUREMENT_TIME;
+          r = ESP_ERR_NOT_FINISHED;
+        }
+        else{
+          ESP_LOGE(SCD40_TAG, "fail to send measure single shot rht only command.");
+        }
+        break;
+      }
+      mis_pressure_compensated = (mambient_pressure != 0);
+      r = send_command(MEASURE_SINGLE_SHOT_COMMAND);
+      if(r == ESP_OK){
+        mmeasure_step = measure_step_e::WAIT_DISCARDED_SINGLE_SHOT;
+        *pwait_ms = SINGLE_SHOT_MEASUREMENT_TIME;
+        r = ESP_ERR_NOT_FINISHED;
+      }
+      else{
+        ESP_LOGE(SCD40_TAG, "fail to send measure single shot command.");
+      }
+      break;
+    case measure_step_e::WAIT_DISCARDED_SINGLE_SHOT:
+      // the first reading after a wake up is not accurate and is discarded, as the datasheet requires.
+      // it is still read, so that the data ready flag is cleared for the next measurement.
+      r = get_co2_data(&discarded_co2);
+      if(r == ESP_OK){
+        mmeasurement_start_time = esp_timer_get_time();
+        r = send_command(MEASURE_SINGLE_SHOT_COMMAND);
+        if(r == ESP_OK){
+          mmeasure_step = measure_step_e::WAIT_SINGLE_SHOT;
+          *pwait_ms = SINGLE_SHOT_MEASUREMENT_TIME;
+          r = ESP_ERR_NOT_FINISHED;
+        }
+        else{
+          ESP_LOGE(SCD40_TAG, "fail to send measure single shot command.");
+        }
+      }
+      break;
+    case measure_step_e::WAIT_SINGLE_SHOT:
+      read_start_time = esp_timer_get_time();
+      r = get_sensor_data(&presults->co2, &presults->temperature, &presults->relative_humidity);
+      read_end_time = esp_timer_get_time();
+      break;
+    default:
+      r = ESP_ERR_INVALID_STATE;
+      break;
+  }
+  if(r != ESP_ERR_NOT_FINISHED){
+    // keep the first error. or-ing two esp_err_t codes gives a code that means neither.
+    esp_err_t r2 = power_down();
+    if(r == ESP_OK){
+      r = r2;
+    }
+    mmeasure_step = measure_step_e::START;
+  }
+  if(r == ESP_OK){
+    mlast_measurement_timing.wake_up_time = mmeasurement_start_time - mwake_up_start_time;
+    mlast_measurement_timing.measurement_time = read_end_time - mmeasurement_start_time;
+    mlast_measurement_timing.read_time = read_end_time - read_start_time;
+    mlast_measurement_timing.active_time = esp_timer_get_time() - mwake_up_start_time;
+    ESP_LOGI(SCD40_TAG, "single shot%s co2:%d[ppm], temperature:%.2lf, humidity:%.2lf, active:%lld[us], wake up:%lld[us], read:%lld[us]", 
+        mis_rht_only_measurement ? " rht only" : "", presults->co2, presults->temperature, presults->relative_humidity,
+        mlast_measurement_timing.active_time, mlast_measurement_timing.wake_up_time, 
+        mlast_measurement_timing.read_time);
+  }
+  return r;
 }
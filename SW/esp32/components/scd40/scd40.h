@@ -6,6 +6,22 @@
 #include "i2c_base.h"
 
 class SCD40{
+  public:
+    enum class measurement_mode_e{
+      PERIODIC,           // new data every 5 seconds
+      LOW_POWER_PERIODIC, // new data every 30 seconds
+      SINGLE_SHOT         // one measurement per notification, powered down in between (SCD41 only).
+                          // measures twice after each wake up and discards the first reading, about 10 seconds.
+    };
+
+    // timings of the last single shot measurement [us]
+    typedef struct{
+      int64_t wake_up_time;     // wake_up command until the kept measurement starts. includes the discarded one
+      int64_t measurement_time; // measure command until the result is read
+      int64_t read_time;        // read_measurement transaction
+      int64_t active_time;      // sensor not powered down
+    }measurement_timing_t;
+
   private:
     constexpr static const char* SCD40_TAG = "scd40"; 
     i2c_base::I2C* pmi2c;
@@ -15,15 +31,44 @@ class SCD40{
     constexpr static uint8_t DEVICE_ADDRS {0x62};
     constexpr static uint32_t CLK_SPEED_HZ {100000};
     constexpr static uint16_t TIMEOUT_SETTING {10 * 1000};
-    constexpr static uint16_t MEASUREMENT_INTERVAL {6 * 1000};
+    constexpr static uint16_t PERIODIC_MEASUREMENT_INTERVAL {5 * 1000};
+    constexpr static uint16_t LOW_POWER_PERIODIC_MEASUREMENT_INTERVAL {30 * 1000};
+    constexpr static uint16_t DATA_READY_POLL_INTERVAL {1000};
     constexpr static uint16_t COMMAND_INTERVAL {500};
+    constexpr static size_t   WORD_SIZE {3}; // 2 data bytes + crc
+    constexpr static uint16_t SINGLE_SHOT_MEASUREMENT_TIME {5000};
+    constexpr static uint16_t SINGLE_SHOT_RHT_ONLY_MEASUREMENT_TIME {50};
+    constexpr static uint16_t WAKE_UP_TIME {30};
+    constexpr static uint8_t  SCD41_VARIANT {0x01};
+    constexpr static uint16_t FORCED_RECALIBRATION_TIME {400};
+    constexpr static uint16_t PERSIST_SETTINGS_TIME {800};
+    constexpr static uint16_t FORCED_RECALIBRATION_FAILED {0xFFFF};
+    constexpr static uint16_t FORCED_RECALIBRATION_OFFSET {0x8000};
+    constexpr static float    TEMPERATURE_OFFSET_RESOLUTION {0.1}; // [degree Celsius]
+    constexpr static uint16_t MIN_AMBIENT_PRESSURE {700};  // [hPa]
+    constexpr static uint16_t MAX_AMBIENT_PRESSURE {1200}; // [hPa]
+    constexpr static uint16_t SET_AMBIENT_PRESSURE_TIME {1};
     // commands
     constexpr static uint8_t GET_SERIAL_NUMBER_COMMAND[2]           {0x36, 0x82};
     constexpr static uint8_t START_PERIODIC_MEASUREMENT_COMMAND[2]  {0x21, 0xb1};
     constexpr static uint8_t READ_MEASUREMENT_COMMAND[2]            {0xec, 0x05};
     constexpr static uint8_t STOP_PERIODIC_MEASUREMENT_COMMAND[2]   {0x3f, 0x86};
+    constexpr static uint8_t START_LOW_POWER_PERIODIC_MEASUREMENT_COMMAND[2] {0x21, 0xac};
+    constexpr static uint8_t GET_DATA_READY_STATUS_COMMAND[2]       {0xe4, 0xb8};
+    constexpr static uint8_t MEASURE_SINGLE_SHOT_COMMAND[2]         {0x21, 0x9d};
+    constexpr static uint8_t MEASURE_SINGLE_SHOT_RHT_ONLY_COMMAND[2] {0x21, 0x96};
+    constexpr static uint8_t POWER_DOWN_COMMAND[2]                  {0x36, 0xe0};
+    constexpr static uint8_t WAKE_UP_COMMAND[2]                     {0x36, 0xf6};
+    constexpr static uint8_t GET_SENSOR_VARIANT_COMMAND[2]          {0x20, 0x2f};
     constexpr static uint8_t SET_TEMPERATURE_OFFSET_COMMAND[2]      {0x24, 0x1d}; 
     constexpr static uint8_t GET_TEMPERATURE_OFFSET_COMMAND[2]      {0x23, 0x18};
+    constexpr static uint8_t SET_SENSOR_ALTITUDE_COMMAND[2]         {0x24, 0x27};
+    constexpr static uint8_t GET_SENSOR_ALTITUDE_COMMAND[2]         {0x23, 0x22};
+    constexpr static uint8_t SET_AMBIENT_PRESSURE_COMMAND[2]        {0xe0, 0x00};
+    constexpr static uint8_t SET_AUTOMATIC_SELF_CALIBRATION_ENABLED_COMMAND[2] {0x24, 0x16};
+    constexpr static uint8_t GET_AUTOMATIC_SELF_CALIBRATION_ENABLED_COMMAND[2] {0x23, 0x13};
+    constexpr static uint8_t PERFORM_FORCED_RECALIBRATION_COMMAND[2] {0x36, 0x2f};
+    constexpr static uint8_t PERSIST_SETTINGS_COMMAND[2]            {0x36, 0x15};
     // Settings
     typedef struct{
       uint16_t co2;
@@ -39,23 +84,53 @@ class SCD40{
       }data;
      }scd40_data_t;
     
-    TaskHandle_t task_handle = NULL;    
-    QueueHandle_t co2_buffer = NULL;
-    UBaseType_t co2_buffer_size = 1; 
-    uint16_t co2;
+    // states of the non-blocking measurement
+    enum class measure_step_e{
+      START,
+      WAIT_DATA_READY,  // periodic measurement running
+      WAIT_WAKE_UP,     // single shot: sensor waking up
+      WAIT_AMBIENT_PRESSURE, // single shot: ambient pressure sent after the wake up
+      WAIT_DISCARDED_SINGLE_SHOT, // single shot: first measurement after the wake up running
+      WAIT_SINGLE_SHOT, // single shot: measurement running
+    };
 
-    esp_err_t init_i2c(void);
-    uint8_t calculate_crc(const uint8_t* data, uint16_t byte_size);
+    measurement_mode_e mmeasurement_mode {measurement_mode_e::PERIODIC};
+    measure_step_e mmeasure_step {measure_step_e::START};
+    bool mis_single_shot_checked {false};
+    bool mis_rht_only_measurement {false};
+    int64_t mwake_up_start_time {0};
+    int64_t mmeasurement_start_time {0};
+    bool mis_measuring {false};
+    measurement_timing_t mlast_measurement_timing {};
+    // last pressure passed to set_ambient_pressure() [hPa]. 0 until the first valid one.
+    uint16_t mambient_pressure_request {0};
+    // pressure the sensor holds [hPa]. 0 until the first successful write and after power_down(),
+    // the sensor forgets the setting while it is powered down.
+    uint16_t mambient_pressure {0};
+    bool mis_pressure_compensated {false};
 
-    esp_err_t set_temperature_offset(float temperature_offset);
-    esp_err_t get_temperature_offset(float* ptemperature_offset);
+    esp_err_t init_i2c(void);
+    // verify every 2 byte word + crc of a response in one pass.
+    // pfailed_word is set to the index of the first word with a wrong crc.
+    esp_err_t verify_crc(const uint8_t* pdata, size_t data_size, size_t* pfailed_word);
+    // also clears mambient_pressure.
+    esp_err_t power_down();
+    // true when the requested pressure differs from the one the sensor holds.
+    bool is_ambient_pressure_pending();
+    esp_err_t send_ambient_pressure();
+    esp_err_t check_single_shot_support();
+    // on the first measurement in single shot mode: falls back to periodic without an SCD41,
+    // otherwise powers the sensor down.
+    esp_err_t check_measurement_mode();
     
+    esp_err_t read_word(const uint8_t* pcommand, uint16_t* pvalue);
+    esp_err_t write_word(const uint8_t* pcommand, uint16_t value);
     esp_err_t read_data(const uint8_t* pcommand, uint8_t* pread_data_buffer, size_t buffer_size);
     esp_err_t write_data(const uint8_t* pcommand, uint8_t* pwrite_data_buffer, size_t buffer_size);
     esp_err_t send_command(const uint8_t* command);
-
-    void measure_co2_task();
-    static void get_measure_co2_task_entry_point(void* arg);
+    esp_err_t measure_periodic_step(uint16_t* pco2, uint32_t* pwait_ms);
+    // the co2 measurement discards the first reading after the wake up, rht only does not.
+    esp_err_t measure_single_shot_step(bool is_rht_only, results_data_t* presults, uint32_t* pwait_ms);
 
   public:
     SCD40();
@@ -66,12 +141,45 @@ class SCD40{
     esp_err_t check_serial_number();
     // Wait for 5 seconds before sending the next command
     esp_err_t start_periodic_measurement();
+    esp_err_t start_low_power_periodic_measurement();
     esp_err_t stop_periodic_measurement();
+    // true when a new measurement can be read with get_sensor_data() or get_co2_data()
+    esp_err_t get_data_ready_status(bool* pis_data_ready);
+    // select the mode used by measure_step(). call before the first step.
+    void set_measurement_mode(measurement_mode_e measurement_mode);
+    // one step of a measurement for a cooperative scheduler. never blocks.
+    // returns ESP_OK with a new co2 value, ESP_ERR_NOT_FINISHED to be called again after *pwait_ms.
+    // periodic modes start the measurement on the first call and keep it running.
+    esp_err_t measure_step(uint16_t* pco2, uint32_t* pwait_ms);
+    // temperature and humidity only, like measure_step(). single shot mode only, about 80 milliseconds
+    // with the wake up. ESP_ERR_INVALID_STATE while a co2 measurement of measure_step() is running.
+    esp_err_t measure_rht_only_step(double* ptemperature, double* prelative_humidity, uint32_t* pwait_ms);
+    measurement_timing_t get_last_measurement_timing();
+    // read the last measurement. a failed read is returned as is, the measurement keeps running.
+    // measure_step() restarts a periodic measurement after an error.
     esp_err_t get_sensor_data(uint16_t* pco2, double* ptemperature, double* prelative_humidity);
     esp_err_t get_co2_data(uint16_t* pco2);
-    esp_err_t get_co2(uint16_t* pco2);
 
-    QueueHandle_t get_co2_buffer_handle();
-    esp_err_t create_task(const char* pname, uint16_t stack_size, UBaseType_t task_priority);
-    void notify_measurement_start();
+    // the following settings can only be changed while periodic measurement is stopped.
+    // they are volatile until persist_settings() is called.
+    esp_err_t set_temperature_offset(float temperature_offset);
+    esp_err_t get_temperature_offset(float* ptemperature_offset);
+    // writes the offset and persists it only when it differs from the stored one.
+    esp_err_t configure_temperature_offset(float temperature_offset);
+    esp_err_t set_sensor_altitude(uint16_t altitude);
+    esp_err_t get_sensor_altitude(uint16_t* paltitude);
+    esp_err_t set_automatic_self_calibration(bool is_enabled);
+    esp_err_t get_automatic_self_calibration(bool* pis_enabled);
+    // the sensor must have measured in periodic mode at the target concentration for 3 minutes.
+    // pcorrection is the applied correction [ppm].
+    esp_err_t perform_forced_recalibration(uint16_t target_co2, int16_t* pcorrection);
+    // writes the settings to EEPROM. limited write endurance, so only call on changes.
+    esp_err_t persist_settings();
+    // can be sent during periodic measurement and overrides the altitude setting.
+    // nothing is sent when the rounded pressure did not change. [hPa]
+    // in single shot mode the pressure is sent after the next wake up, the sensor loses it
+    // while it is powered down.
+    esp_err_t set_ambient_pressure(float pressure);
+    // true when the last co2 value was measured with the pressure of set_ambient_pressure().
+    bool is_pressure_compensated();
 };
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <array>
+#include <stddef.h>
+#include <stdint.h>
+
+// crc-8 of the scd40 words. only standard headers, so the host tests (tools/host_tests)
+// compare the table with the bitwise calculation the driver used before.
+// check sum calculation method is written usermanual p.23
+namespace scd40{
+  constexpr uint8_t CRC8_POLYNOMIAL {0x31};
+  constexpr uint8_t CRC8_INIT {0xFF};
+
+  constexpr std::array<uint8_t, 256> generate_crc8_table(){
+    std::array<uint8_t, 256> table {};
+    for(uint16_t value = 0; value < 256; value++){
+      uint8_t crc = static_cast<uint8_t>(value);
+      for(uint8_t crc_bit = 8; crc_bit > 0; --crc_bit){
+        if(crc & 0x80){
+          crc = (crc << 1) ^ CRC8_POLYNOMIAL;
+        }
+        else{
+          crc = (crc << 1);
+        }
+      }
+      table[value] = crc;
+    }
+    return table;
+  }
+
+  constexpr std::array<uint8_t, 256> CRC8_TABLE = generate_crc8_table();
+
+  constexpr uint8_t calculate_crc(const uint8_t* pdata, size_t data_size){
+    uint8_t crc = CRC8_INIT;
+    for(size_t data_index = 0; data_index < data_size; data_index++){
+      crc = CRC8_TABLE[crc ^ pdata[data_index]];
+    }
+    return crc;
+  }
+
+  // bit by bit without the table. the reference of the host test.
+  constexpr uint8_t calculate_crc_bitwise(const uint8_t* pdata, size_t data_size){
+    uint8_t crc = CRC8_INIT;
+    for(size_t data_index = 0; data_index < data_size; data_index++){
+      crc ^= pdata[data_index];
+      for(uint8_t crc_bit = 8; crc_bit > 0; --crc_bit){
+        if(crc & 0x80){
+          crc = (crc << 1) ^ CRC8_POLYNOMIAL;
+        }
+        else{
+          crc = (crc << 1);
+        }
+      }
+    }
+    return crc;
+  }
+
+  // example from the data sheet: crc of 0xBEEF is 0x92
+  constexpr uint8_t CRC8_CHECK_DATA[] = {0xBE, 0xEF};
+  static_assert(calculate_crc(CRC8_CHECK_DATA, sizeof(CRC8_CHECK_DATA)) == 0x92, "crc8 table does not match the data sheet");
+  static_assert(calculate_crc_bitwise(CRC8_CHECK_DATA, sizeof(CRC8_CHECK_DATA)) == 0x92, "crc8 does not match the data sheet");
+}
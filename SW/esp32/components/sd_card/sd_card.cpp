@@ -1,13 +1,39 @@
 #include <cstring>
+#include <dirent.h>
 #include <errno.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "esp_log.h"
 #include "esp_vfs_fat.h"
+#include "driver/sdmmc_host.h"
+#include "driver/sdspi_host.h"
 #include "sdmmc_cmd.h"
 
 #include "sd_card.h"
 
+namespace{
+  // SD_CARD::lock() for the duration of one call
+  class SCOPED_CARD_LOCK{
+    private:
+      SD_CARD* psd_card;
+      esp_err_t mresult;
+
+    public:
+      explicit SCOPED_CARD_LOCK(SD_CARD* psd_card) : psd_card(psd_card), mresult(psd_card->lock()){}
+      ~SCOPED_CARD_LOCK(){
+        if(mresult == ESP_OK){
+          psd_card->unlock();
+        }
+      }
+      SCOPED_CARD_LOCK(const SCOPED_CARD_LOCK&) = delete;
+      SCOPED_CARD_LOCK& operator=(const SCOPED_CARD_LOCK&) = delete;
+      esp_err_t get_result(){
+        return mresult;
+      }
+  };
+}
+
 SD_CARD::SD_CARD(){
   esp_log_level_set(SD_CARD_TAG, ESP_LOG_ERROR);
   ESP_LOGI(SD_CARD_TAG, "set SD_CARD_TAG log level: %d", ESP_LOG_ERROR);
@@ -15,14 +41,13 @@ SD_CARD::SD_CARD(){
 
 esp_err_t SD_CARD::init(){
   esp_err_t r = ESP_OK;
-  esp_vfs_fat_sdmmc_mount_config_t mount_config = {
-    .format_if_mount_failed = true,
-    .max_files = 10,
-    .allocation_unit_size = 16 * 1024
-  };
 
-  sdmmc_card_t* pcard;
   ESP_LOGI(SD_CARD_TAG, "Initializing SD card");
+#if CONFIG_SD_CARD_INTERFACE_SDMMC
+  ESP_LOGI(SD_CARD_TAG, "Using SDMMC peripheral, %d bit", CONFIG_SD_CARD_SDMMC_BUS_WIDTH);
+  // the sdmmc host is initialized by every mount and freed by unmount.
+  is_initialized = true;
+#else
   ESP_LOGI(SD_CARD_TAG, "Using SPI peripheral");
 
   //initialize spi bus 
@@ -42,97 +67,483 @@ esp_err_t SD_CARD::init(){
     ESP_LOGE(SD_CARD_TAG, "failed to initialize SPI bus.");
     r = ESP_FAIL;
   }
+  else{
+    is_initialized = true;
+  }
+#endif
 
   //setup sdcard
   if(r == ESP_OK){
+    r = mount_file_system(true);
+  }
+  
+  return r;
+}
+
+esp_err_t SD_CARD::mount(){
+  return mount_file_system(false);
+}
+
+esp_err_t SD_CARD::mount_file_system(bool is_format_allowed){
+  esp_err_t r = ESP_OK;
+  esp_vfs_fat_sdmmc_mount_config_t mount_config = {
+    .format_if_mount_failed = is_format_allowed,
+    .max_files = 10,
+    .allocation_unit_size = 16 * 1024
+  };
+  // published after the mount, lock() must not see a card that is still being mounted.
+  sdmmc_card_t* pmounted_card = NULL;
+
+  if(!is_initialized){
+    r = ESP_ERR_INVALID_STATE;
+  }
+  if((r == ESP_OK) && is_mounted()){
+    // already mounted
+    return ESP_OK;
+  }
+  if(r == ESP_OK){
+    ESP_LOGI(SD_CARD_TAG, "Mounting file system");
+#if CONFIG_SD_CARD_INTERFACE_SDMMC
+    sdmmc_host_t host = SDMMC_HOST_DEFAULT();
+    host.max_freq_khz = CONFIG_SD_CARD_MAX_FREQUENCY;
+    // the same wires as in spi mode. the pins go through the gpio matrix.
+    sdmmc_slot_config_t slot_config = SDMMC_SLOT_CONFIG_DEFAULT();
+    slot_config.width = CONFIG_SD_CARD_SDMMC_BUS_WIDTH;
+    slot_config.clk = static_cast<gpio_num_t>(SPI_CLK_PIN);
+    slot_config.cmd = static_cast<gpio_num_t>(SPI_MOSI_PIN);
+    slot_config.d0 = static_cast<gpio_num_t>(SPI_MISO_PIN);
+#if CONFIG_SD_CARD_SDMMC_BUS_WIDTH_4
+    slot_config.d1 = static_cast<gpio_num_t>(CONFIG_SD_CARD_SDMMC_D1_PIN);
+    slot_config.d2 = static_cast<gpio_num_t>(CONFIG_SD_CARD_SDMMC_D2_PIN);
+    slot_config.d3 = SPI_CS_PIN;
+#else
+    // d3 is the chip select in spi mode. low at the first command would select spi mode.
+    gpio_set_pull_mode(SPI_CS_PIN, GPIO_PULLUP_ONLY);
+#endif
+    slot_config.flags |= SDMMC_SLOT_FLAG_INTERNAL_PULLUP;
+
+    r = esp_vfs_fat_sdmmc_mount(MOUNT_POINT, &host, &slot_config, &mount_config, &pmounted_card);
+#else
+    sdmmc_host_t host = SDSPI_HOST_DEFAULT();
+    host.max_freq_khz = CONFIG_SD_CARD_MAX_FREQUENCY;
     sdspi_device_config_t slot_config = SDSPI_DEVICE_CONFIG_DEFAULT();
     slot_config.gpio_cs = SPI_CS_PIN;
     slot_config.host_id = (spi_host_device_t)host.slot;
 
-    ESP_LOGI(SD_CARD_TAG, "Mounting file system");
-    
-    r = esp_vfs_fat_sdspi_mount(MOUNT_POINT, &host, &slot_config, &mount_config, &pcard);
+    r = esp_vfs_fat_sdspi_mount(MOUNT_POINT, &host, &slot_config, &mount_config, &pmounted_card);
+#endif
     if(r == ESP_OK){
       ESP_LOGI(SD_CARD_TAG, "mount filesystem.");
-      sdmmc_card_print_info(stdout, pcard);
+      sdmmc_card_print_info(stdout, pmounted_card);
+      portENTER_CRITICAL(&mlock);
+      pcard = pmounted_card;
+      portEXIT_CRITICAL(&mlock);
     }
     else{
       ESP_LOGE(SD_CARD_TAG, "fail to moutn file system.");
     }
   }
-  
+
   return r;
 }
 
-esp_err_t SD_CARD::write_data(const char* pfile_path, size_t file_path_size, char* data, char mode){
+esp_err_t SD_CARD::unmount(){
   esp_err_t r = ESP_OK;
-  char write_file_path[100] = {};
-  FILE* pfile = NULL;
-  
-  if((sizeof(MOUNT_POINT) + file_path_size) < sizeof(write_file_path)){
-    strncat(write_file_path, MOUNT_POINT, sizeof(write_file_path)-strlen(write_file_path)-1);
-    strncat(write_file_path, pfile_path, sizeof(write_file_path)-strlen(write_file_path)-1);
-    ESP_LOGI(SD_CARD_TAG, "opening sd_card file:%s", write_file_path);
+  sdmmc_card_t* punmounted_card = NULL;
+  uint32_t user_count = 0;
+
+  portENTER_CRITICAL(&mlock);
+  punmounted_card = pcard;
+  is_unmount_pending = (pcard != NULL);
+  portEXIT_CRITICAL(&mlock);
+  if(punmounted_card == NULL){
+    return ESP_OK;
+  }
+  // e.g. the retention task finishing a segment. its files must be closed before the unmount.
+  while(true){
+    portENTER_CRITICAL(&mlock);
+    user_count = muser_count;
+    portEXIT_CRITICAL(&mlock);
+    if(user_count == 0){
+      break;
+    }
+    vTaskDelay(pdMS_TO_TICKS(UNMOUNT_POLL_INTERVAL));
+  }
+  // also frees the spi device or the sdmmc host. the spi bus stays for the next mount.
+  r = esp_vfs_fat_sdcard_unmount(MOUNT_POINT, punmounted_card);
+  if(r != ESP_OK){
+    ESP_LOGE(SD_CARD_TAG, "fail to unmount file system. error:%s", esp_err_to_name(r));
+  }
+  portENTER_CRITICAL(&mlock);
+  pcard = NULL;
+  is_unmount_pending = false;
+  portEXIT_CRITICAL(&mlock);
+  return r;
+}
+
+bool SD_CARD::is_mounted(){
+  portENTER_CRITICAL(&mlock);
+  const bool is_card_mounted = (pcard != NULL) && !is_unmount_pending;
+  portEXIT_CRITICAL(&mlock);
+  return is_card_mounted;
+}
+
+esp_err_t SD_CARD::lock(){
+  esp_err_t r = ESP_OK;
+  portENTER_CRITICAL(&mlock);
+  if((pcard == NULL) || is_unmount_pending){
+    r = ESP_ERR_INVALID_STATE;
+  }
+  else{
+    muser_count++;
+  }
+  portEXIT_CRITICAL(&mlock);
+  return r;
+}
+
+void SD_CARD::unlock(){
+  portENTER_CRITICAL(&mlock);
+  if(muser_count > 0){
+    muser_count--;
+  }
+  portEXIT_CRITICAL(&mlock);
+}
+
+uint32_t SD_CARD::get_frequency(){
+  uint32_t frequency = 0;
+  if(lock() == ESP_OK){
+    frequency = pcard->real_freq_khz;
+    unlock();
+  }
+  return frequency;
+}
+
+uint8_t SD_CARD::get_bus_width(){
+  uint8_t bus_width = 0;
+  if(lock() == ESP_OK){
+    bus_width = 1 << pcard->log_bus_width;
+    unlock();
+  }
+  return bus_width;
+}
+
+
+esp_err_t SD_CARD::make_full_path(const char* ppath, size_t path_size, char* pfull_path, size_t full_path_size){
+  esp_err_t r = ESP_OK;
+  pfull_path[0] = '\0';
+  if((sizeof(MOUNT_POINT) + path_size) < full_path_size){
+    strncat(pfull_path, MOUNT_POINT, full_path_size-strlen(pfull_path)-1);
+    strncat(pfull_path, ppath, full_path_size-strlen(pfull_path)-1);
   }
   else{
     r  = ESP_FAIL;
     ESP_LOGW(SD_CARD_TAG, "file path is too large.");
   }
+  return r;
+}
 
-  for(uint8_t retry_count = 0; retry_count < 5; retry_count++){  
+esp_err_t SD_CARD::open_file(const char* pfile_path, size_t file_path_size, char mode, SD_FILE* pfile){
+  SCOPED_CARD_LOCK card_lock(this);
+  esp_err_t r = card_lock.get_result();
+  char write_file_path[FULL_PATH_SIZE] = {};
+  FILE* pstream = NULL;
+
+  // before the open, e.g. to open a file created with 'w' again with '+'.
+  pfile->close();
+
+  if(r == ESP_OK){
+    r = make_full_path(pfile_path, file_path_size, write_file_path, sizeof(write_file_path));
+  }
+  if(r == ESP_OK){
+    ESP_LOGI(SD_CARD_TAG, "opening sd_card file:%s", write_file_path);
+  }
+
+  for(uint8_t retry_count = 0; (r == ESP_OK) && (retry_count < 5); retry_count++){  
     switch(mode){
       case 'a': 
-        pfile = fopen(write_file_path, "a");
+        pstream = fopen(write_file_path, "a");
         break;
       case 'w':
-        pfile = fopen(write_file_path, "w");
+        pstream = fopen(write_file_path, "w");
+        break;
+      case 'r':
+        pstream = fopen(write_file_path, "r");
+        break;
+      case '+':
+        pstream = fopen(write_file_path, "r+");
         break;
       default:
         ESP_LOGW(SD_CARD_TAG, "invalid write mode: %c", mode);
         r = ESP_FAIL;
     }
-    if(pfile != NULL){
-      r = ESP_OK;
+    if(pstream != NULL){
       ESP_LOGI(SD_CARD_TAG, "success to open sd_card file.");
       break;
     }
-    else if(pfile == NULL){
-      ESP_LOGE(SD_CARD_TAG, "fail to open file for writing.");
+    else if((r == ESP_OK) && ((mode == 'r') || (mode == '+')) && (errno == ENOENT)){
+      // nothing to retry. e.g. a log segment of a day without samples.
+      r = ESP_ERR_NOT_FOUND;
+    }
+    else if(r == ESP_OK){
+      ESP_LOGE(SD_CARD_TAG, "fail to open file.");
       ESP_LOGE(SD_CARD_TAG, "errno=%d: %s", errno, strerror(errno));
-      r = ESP_FAIL;
+    }
+    if(r != ESP_OK){
+      break;
     }
     vTaskDelay(pdMS_TO_TICKS(50));
   }
+  if((pstream == NULL) && (r == ESP_OK)){
+    r = ESP_FAIL;
+  }
+  pfile->attach(pstream);
+  return r;
+}
 
+esp_err_t SD_CARD::write_data(const char* pfile_path, size_t file_path_size, const char* data, char mode){
+  esp_err_t r = write_binary_data(pfile_path, file_path_size, data, strlen(data), mode);
   if(r == ESP_OK){
-    fprintf(pfile, data);
-    fclose(pfile);
-    ESP_LOGI(SD_CARD_TAG, "write data to sd card:%s", data );
+    ESP_LOGI(SD_CARD_TAG, "write data to sd card:%s", data);
   }
-  
   return r;
 }
 
-esp_err_t SD_CARD::read_data(const char* pfile_path){
-  esp_err_t r = ESP_OK;
-  ESP_LOGI(SD_CARD_TAG, "read file path: %s", pfile_path);
+esp_err_t SD_CARD::write_binary_data(const char* pfile_path, size_t file_path_size, 
+    const void* pdata, size_t data_size, char mode){
+  // the file is open beyond open_file()
+  SCOPED_CARD_LOCK card_lock(this);
+  esp_err_t r = card_lock.get_result();
+  SD_FILE file;
 
-  FILE* pfile = fopen(pfile_path, "r");
-  if(pfile == NULL){
-    ESP_LOGE(SD_CARD_TAG, "fail to open file for reading.");
+  if(r == ESP_OK){
+    r = open_file(pfile_path, file_path_size, mode, &file);
+  }
+  if(r == ESP_OK){
+    r = file.write(pdata, data_size);
+  }
+  if(file.is_open() && (file.close() != ESP_OK)){
     r = ESP_FAIL;
   }
   
+  return r;
+}
+
+esp_err_t SD_CARD::read_binary_data(const char* pfile_path, size_t file_path_size, 
+    long offset, void* pdata, size_t data_size, size_t* pread_size){
+  SCOPED_CARD_LOCK card_lock(this);
+  esp_err_t r = card_lock.get_result();
+  SD_FILE file;
+
+  *pread_size = 0;
   if(r == ESP_OK){
-    char line[MAX_SDCARD_LINE_CHAR_SIZE];
-    fgets(line, sizeof(line), pfile);
-    fclose(pfile);
+    r = open_file(pfile_path, file_path_size, 'r', &file);
+  }
+  if(r == ESP_OK){
+    r = file.read_at(offset, pdata, data_size, pread_size);
+  }
+
+  return r;
+}
+
+esp_err_t SD_CARD::read_file(const char* pfile_path, size_t file_path_size, void* pbuffer, size_t buffer_size,
+    chunk_function_t chunk_function, void* arg){
+  SCOPED_CARD_LOCK card_lock(this);
+  esp_err_t r = card_lock.get_result();
+  SD_FILE file;
+  size_t read_size = 0;
+
+  if(r == ESP_OK){
+    r = open_file(pfile_path, file_path_size, 'r', &file);
+  }
+  if(r == ESP_OK){
+    // the chunks already go to the caller buffer, a stdio buffer would only copy them again.
+    r = file.set_buffer(NULL, 0);
+  }
+  while(r == ESP_OK){
+    r = file.read(pbuffer, buffer_size, &read_size);
+    if((r != ESP_OK) || (read_size == 0)){
+      break;
+    }
+    r = chunk_function(arg, static_cast<const uint8_t*>(pbuffer), read_size);
+    if(read_size < buffer_size){
+      break;
+    }
+  }
+
+  return r;
+}
+
+esp_err_t SD_CARD::make_directory(const char* pdirectory_path, size_t directory_path_size){
+  SCOPED_CARD_LOCK card_lock(this);
+  esp_err_t r = card_lock.get_result();
+  char full_path[FULL_PATH_SIZE] = {};
 
-    char* ppos = strchr(line, '\n');
-    if(ppos){
-      *ppos = '\0';
+  if(r == ESP_OK){
+    r = make_full_path(pdirectory_path, directory_path_size, full_path, sizeof(full_path));
+  }
+  if((r == ESP_OK) && (mkdir(full_path, 0777) != 0) && (errno != EEXIST)){
+    ESP_LOGE(SD_CARD_TAG, "fail to create %s. errno=%d: %s", full_path, errno, strerror(errno));
+    r = ESP_FAIL;
+  }
+
+  return r;
+}
+
+esp_err_t SD_CARD::list_directory(const char* pdirectory_path, size_t directory_path_size, 
+    entry_function_t entry_function, void* arg){
+  SCOPED_CARD_LOCK card_lock(this);
+  esp_err_t r = card_lock.get_result();
+  char full_path[FULL_PATH_SIZE] = {};
+  DIR* pdirectory = NULL;
+
+  if(r == ESP_OK){
+    r = make_full_path(pdirectory_path, directory_path_size, full_path, sizeof(full_path));
+  }
+  if(r == ESP_OK){
+    pdirectory = opendir(full_path);
+    if(pdirectory == NULL){
+      ESP_LOGE(SD_CARD_TAG, "fail to open %s. errno=%d: %s", full_path, errno, strerror(errno));
+      r = ESP_FAIL;
+    }
+  }
+  if(r == ESP_OK){
+    struct dirent* pentry = NULL;
+    while((pentry = readdir(pdirectory)) != NULL){
+      if(pentry->d_type == DT_REG){
+        entry_function(arg, pentry->d_name);
+      }
+    }
+    closedir(pdirectory);
+  }
+
+  return r;
+}
+
+esp_err_t SD_CARD::list_directory(const char* pdirectory_path, size_t directory_path_size, 
+    entry_info_function_t entry_function, void* arg){
+  SCOPED_CARD_LOCK card_lock(this);
+  esp_err_t r = card_lock.get_result();
+  char full_path[FULL_PATH_SIZE] = {};
+  DIR* pdirectory = NULL;
+  size_t directory_length = 0;
+
+  if(r == ESP_OK){
+    r = make_full_path(pdirectory_path, directory_path_size, full_path, sizeof(full_path));
+  }
+  if(r == ESP_OK){
+    pdirectory = opendir(full_path);
+    if(pdirectory == NULL){
+      ESP_LOGE(SD_CARD_TAG, "fail to open %s. errno=%d: %s", full_path, errno, strerror(errno));
+      r = ESP_FAIL;
+    }
+  }
+  if(r == ESP_OK){
+    // the names are appended to the directory path in place.
+    directory_length = strlen(full_path);
+    if((directory_length > 0) && (full_path[directory_length - 1] != '/') && (directory_length + 1 < sizeof(full_path))){
+      full_path[directory_length++] = '/';
+      full_path[directory_length] = '\0';
+    }
+    struct dirent* pentry = NULL;
+    while((pentry = readdir(pdirectory)) != NULL){
+      if((pentry->d_type != DT_REG) && (pentry->d_type != DT_DIR)){
+        continue;
+      }
+      entry_info_t entry {};
+      struct stat entry_stat {};
+      entry.pname = pentry->d_name;
+      entry.is_directory = (pentry->d_type == DT_DIR);
+      if(directory_length + strlen(pentry->d_name) < sizeof(full_path)){
+        strcpy(full_path + directory_length, pentry->d_name);
+        if(stat(full_path, &entry_stat) == 0){
+          entry.size = entry.is_directory ? 0 : static_cast<uint32_t>(entry_stat.st_size);
+          entry.modified_time = entry_stat.st_mtime;
+        }
+      }
+      else{
+        ESP_LOGW(SD_CARD_TAG, "no stat of %s, the path is too large.", pentry->d_name);
+      }
+      entry_function(arg, &entry);
+    }
+    closedir(pdirectory);
+  }
+
+  return r;
+}
+
+esp_err_t SD_CARD::get_space(uint64_t* ptotal_size, uint64_t* pfree_size){
+  SCOPED_CARD_LOCK card_lock(this);
+  esp_err_t r = card_lock.get_result();
+  *ptotal_size = 0;
+  *pfree_size = 0;
+  if(r == ESP_OK){
+    r = esp_vfs_fat_info(MOUNT_POINT, ptotal_size, pfree_size);
+    if(r != ESP_OK){
+      ESP_LOGE(SD_CARD_TAG, "fail to get the free space. error:%s", esp_err_to_name(r));
+    }
+  }
+  return r;
+}
+
+esp_err_t SD_CARD::remove_file(const char* pfile_path, size_t file_path_size){
+  SCOPED_CARD_LOCK card_lock(this);
+  esp_err_t r = card_lock.get_result();
+  char full_path[FULL_PATH_SIZE] = {};
+
+  if(r == ESP_OK){
+    r = make_full_path(pfile_path, file_path_size, full_path, sizeof(full_path));
+  }
+  if((r == ESP_OK) && (unlink(full_path) != 0)){
+    if(errno == ENOENT){
+      r = ESP_ERR_NOT_FOUND;
+    }
+    else{
+      ESP_LOGE(SD_CARD_TAG, "fail to remove %s. errno=%d: %s", full_path, errno, strerror(errno));
+      r = ESP_FAIL;
+    }
+  }
+
+  return r;
+}
+
+esp_err_t SD_CARD::rename_file(const char* pold_path, size_t old_path_size, const char* pnew_path, size_t new_path_size){
+  SCOPED_CARD_LOCK card_lock(this);
+  esp_err_t r = card_lock.get_result();
+  char old_full_path[FULL_PATH_SIZE] = {};
+  char new_full_path[FULL_PATH_SIZE] = {};
+
+  if(r == ESP_OK){
+    r = make_full_path(pold_path, old_path_size, old_full_path, sizeof(old_full_path));
+  }
+  if(r == ESP_OK){
+    r = make_full_path(pnew_path, new_path_size, new_full_path, sizeof(new_full_path));
+  }
+  if((r == ESP_OK) && (rename(old_full_path, new_full_path) != 0)){
+    if(errno == ENOENT){
+      r = ESP_ERR_NOT_FOUND;
+    }
+    else{
+      ESP_LOGE(SD_CARD_TAG, "fail to rename %s to %s. errno=%d: %s", old_full_path, new_full_path, errno, strerror(errno));
+      r = ESP_FAIL;
+    }
+  }
+
+  return r;
+}
+
+esp_err_t SD_CARD::create_contiguous_file(const char* pfile_path, size_t file_path_size, uint64_t file_size){
+  SCOPED_CARD_LOCK card_lock(this);
+  esp_err_t r = card_lock.get_result();
+  char full_path[FULL_PATH_SIZE] = {};
+
+  if(r == ESP_OK){
+    r = make_full_path(pfile_path, file_path_size, full_path, sizeof(full_path));
+  }
+  if(r == ESP_OK){
+    r = esp_vfs_fat_create_contiguous_file(MOUNT_POINT, full_path, file_size, true);
+    if(r != ESP_OK){
+      ESP_LOGE(SD_CARD_TAG, "fail to preallocate %s. error:%s", full_path, esp_err_to_name(r));
     }
-    ESP_LOGI(SD_CARD_TAG, "read from file: '%s'", line);
   }
 
   return r;
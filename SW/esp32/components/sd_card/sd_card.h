@@ -1,7 +1,28 @@
 #pragma once
+#include <stdio.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "driver/gpio.h"
 #include "esp_err.h"
+#include "sdmmc_cmd.h"
+
+#include "sd_file.h"
 
 class SD_CARD{
+  public:
+    typedef void (*entry_function_t)(void* arg, const char* pname);
+
+    typedef struct{
+      const char* pname;      // without the path
+      bool is_directory;
+      uint32_t size;          //[byte] 0 for directories
+      time_t modified_time;   // local time of the fat timestamp, 2 s resolution
+    }entry_info_t;
+    typedef void (*entry_info_function_t)(void* arg, const entry_info_t* pentry);
+
+    // returns ESP_OK to continue the read. pdata is the buffer passed to read_file().
+    typedef esp_err_t (*chunk_function_t)(void* arg, const uint8_t* pdata, size_t data_size);
+
   private:
     constexpr static const char* SD_CARD_TAG = "sd_card";
     
@@ -11,13 +32,93 @@ class SD_CARD{
     constexpr static int SPI_CLK_PIN          = GPIO_NUM_40;
     constexpr static gpio_num_t SPI_CS_PIN    = GPIO_NUM_42;
    
-    constexpr static int MAX_SDCARD_LINE_CHAR_SIZE = 512;
+    // the mount point and the path below it
+    constexpr static size_t FULL_PATH_SIZE {100};
+    // unmount() polls for the last unlock()
+    constexpr static uint32_t UNMOUNT_POLL_INTERVAL {10}; //[ms]
+
+    // guards pcard, muser_count and is_unmount_pending, which every task reads
+    portMUX_TYPE mlock = portMUX_INITIALIZER_UNLOCKED;
+    sdmmc_card_t* pcard {NULL};
+    // lock() calls without unlock()
+    uint32_t muser_count {0};
+    // unmount() waits for the users. lock() fails meanwhile
+    bool is_unmount_pending {false};
+    // the spi bus is initialized. the sdmmc host needs nothing before the mount.
+    bool is_initialized {false};
+
+    esp_err_t make_full_path(const char* ppath, size_t path_size, char* pfull_path, size_t full_path_size);
+    esp_err_t mount_file_system(bool is_format_allowed);
   public:
     SD_CARD();
 
+    // initializes the spi bus and mounts the card. CONFIG_SD_CARD_INTERFACE selects spi or sdmmc.
+    // the bus stays initialized if the mount fails, so mount() can be retried later.
     esp_err_t init();
 
-    esp_err_t write_data(const char* pfile_path, size_t file_path_size, char* data, char mode);
+    // mount() and unmount() are for one task that owns the card, e.g. after a write failure.
+    // unmount() waits until every lock() is released. files opened before unmount() must not be
+    // used anymore, so other tasks hold a lock as long as they keep a file open.
+    // the owner task itself must not hold a lock while it calls unmount().
+    // unlike init(), mount() never formats. a card that is still being inserted must not be erased.
+    esp_err_t mount();
+    esp_err_t unmount();
+    bool is_mounted();
+    // keeps the card mounted until unlock(). ESP_ERR_INVALID_STATE without a card or while
+    // unmount() waits, the lock is not held then. every call below takes a lock for its own
+    // duration, so they fail the same way without a card. locks of several tasks do not block
+    // each other, the file system serializes the access itself.
+    esp_err_t lock();
+    void unlock();
+    // of the mounted card, 0 otherwise
+    uint32_t get_frequency();   //[kHz]
+    uint8_t get_bus_width();    // 1 in spi mode
+
+    // writes the text of data without the terminating zero. mode is 'a' or 'w'.
+    esp_err_t write_data(const char* pfile_path, size_t file_path_size, const char* data, char mode);
+
+    // writes data_size bytes as they are. mode is 'a' or 'w' like write_data.
+    esp_err_t write_binary_data(const char* pfile_path, size_t file_path_size, 
+        const void* pdata, size_t data_size, char mode);
+
+    // opens a file below the mount point with up to 5 retries. mode is 'a', 'w', 'r' or
+    // '+' (r+, read and overwrite an existing file in place).
+    // a missing file opened with 'r' or '+' is not retried and returns ESP_ERR_NOT_FOUND.
+    // a file already open in pfile is closed first, e.g. to open a file created with 'w' again with '+'.
+    esp_err_t open_file(const char* pfile_path, size_t file_path_size, char mode, SD_FILE* pfile);
+
+    // streams the whole file through pbuffer. calls chunk_function for every buffer_size bytes
+    // and once for the rest. an error of chunk_function stops the read and is returned.
+    esp_err_t read_file(const char* pfile_path, size_t file_path_size, void* pbuffer, size_t buffer_size,
+        chunk_function_t chunk_function, void* arg);
+
+    // reads up to data_size bytes from offset. *pread_size is smaller at the end of the file.
+    esp_err_t read_binary_data(const char* pfile_path, size_t file_path_size, 
+        long offset, void* pdata, size_t data_size, size_t* pread_size);
+
+    // creates a directory below the mount point. an existing directory is not an error.
+    esp_err_t make_directory(const char* pdirectory_path, size_t directory_path_size);
+
+    // calls entry_function with the name of every file in the directory, without the path.
+    esp_err_t list_directory(const char* pdirectory_path, size_t directory_path_size, 
+        entry_function_t entry_function, void* arg);
+
+    // calls entry_function for every file and directory with its size and modification time.
+    // the stat of each entry reads the directory again, so list_directory() is cheaper for names only.
+    esp_err_t list_directory(const char* pdirectory_path, size_t directory_path_size, 
+        entry_info_function_t entry_function, void* arg);
+
+    // of the mounted file system
+    esp_err_t get_space(uint64_t* ptotal_size, uint64_t* pfree_size);   //[byte]
+
+    // a missing file returns ESP_ERR_NOT_FOUND.
+    esp_err_t remove_file(const char* pfile_path, size_t file_path_size);
+
+    // fails if pnew_path exists. fat renames by rewriting one directory entry, so a reset leaves
+    // either name, never both or none.
+    esp_err_t rename_file(const char* pold_path, size_t old_path_size, const char* pnew_path, size_t new_path_size);
 
-    esp_err_t read_data(const char* path);
+    // creates a file of file_size bytes in contiguous clusters (f_expand). the content is undefined.
+    // writes inside the file then never allocate clusters or update the fat.
+    esp_err_t create_contiguous_file(const char* pfile_path, size_t file_path_size, uint64_t file_size);
 };
@@ -0,0 +1,197 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "sd_card_benchmark.h"
+
+void SD_CARD_BENCHMARK::add_time(operation_stats_t* pstats, int64_t time){
+  if((pstats->count == 0) || (time < pstats->min_time)){
+    pstats->min_time = time;
+  }
+  if(time > pstats->max_time){
+    pstats->max_time = time;
+  }
+  pstats->total_time += time;
+  pstats->count++;
+}
+
+// fixed seed, so both backends read the same offsets.
+uint32_t SD_CARD_BENCHMARK::get_random(){
+  mrandom_state = mrandom_state * 1664525 + 1013904223;
+  return mrandom_state;
+}
+
+esp_err_t SD_CARD_BENCHMARK::write_sequential(benchmark_result_t* presult){
+  esp_err_t r = ESP_OK;
+  SD_FILE file;
+
+  for(size_t buffer_index = 0; buffer_index < CHUNK_SIZE; buffer_index++){
+    pbuffer[buffer_index] = static_cast<uint8_t>(buffer_index);
+  }
+  const int64_t start_time = esp_timer_get_time();
+  r = psd_card->open_file(BENCHMARK_FILE_PATH, sizeof(BENCHMARK_FILE_PATH), 'w', &file);
+  if(r == ESP_OK){
+    r = file.set_buffer(NULL, 0);
+  }
+  for(uint32_t offset = 0; (r == ESP_OK) && (offset < presult->file_size); offset += CHUNK_SIZE){
+    r = file.write(pbuffer, CHUNK_SIZE);
+  }
+  if(r == ESP_OK){
+    r = file.sync();
+  }
+  if(file.is_open() && (file.close() != ESP_OK)){
+    r = ESP_FAIL;
+  }
+  presult->write_time = esp_timer_get_time() - start_time;
+  return r;
+}
+
+esp_err_t SD_CARD_BENCHMARK::read_sequential(benchmark_result_t* presult){
+  esp_err_t r = ESP_OK;
+  SD_FILE file;
+  size_t read_size = 0;
+
+  const int64_t start_time = esp_timer_get_time();
+  r = psd_card->open_file(BENCHMARK_FILE_PATH, sizeof(BENCHMARK_FILE_PATH), 'r', &file);
+  if(r == ESP_OK){
+    r = file.set_buffer(NULL, 0);
+  }
+  for(uint32_t offset = 0; (r == ESP_OK) && (offset < presult->file_size); offset += CHUNK_SIZE){
+    r = file.read(pbuffer, CHUNK_SIZE, &read_size);
+    if((r == ESP_OK) && (read_size != CHUNK_SIZE)){
+      r = ESP_FAIL;
+    }
+  }
+  file.close();
+  presult->read_time = esp_timer_get_time() - start_time;
+  return r;
+}
+
+// like the binary search of SENSOR_LOG_READER
+esp_err_t SD_CARD_BENCHMARK::read_random(benchmark_result_t* presult){
+  esp_err_t r = ESP_OK;
+  SD_FILE file;
+  size_t read_size = 0;
+  const uint32_t sector_count = presult->file_size / SECTOR_SIZE;
+
+  r = psd_card->open_file(BENCHMARK_FILE_PATH, sizeof(BENCHMARK_FILE_PATH), 'r', &file);
+  if(r == ESP_OK){
+    r = file.set_buffer(NULL, 0);
+  }
+  for(uint32_t read_index = 0; (r == ESP_OK) && (read_index < RANDOM_READ_COUNT); read_index++){
+    const long offset = static_cast<long>(get_random() % sector_count) * SECTOR_SIZE;
+    const int64_t start_time = esp_timer_get_time();
+    r = file.read_at(offset, pbuffer, SECTOR_SIZE, &read_size);
+    if((r == ESP_OK) && (read_size != SECTOR_SIZE)){
+      r = ESP_FAIL;
+    }
+    add_time(&presult->random_read, esp_timer_get_time() - start_time);
+  }
+  return r;
+}
+
+esp_err_t SD_CARD_BENCHMARK::open_close(benchmark_result_t* presult){
+  esp_err_t r = ESP_OK;
+  SD_FILE file;
+
+  for(uint32_t open_index = 0; (r == ESP_OK) && (open_index < OPEN_CLOSE_COUNT); open_index++){
+    const int64_t start_time = esp_timer_get_time();
+    r = psd_card->open_file(BENCHMARK_FILE_PATH, sizeof(BENCHMARK_FILE_PATH), 'r', &file);
+    if(r == ESP_OK){
+      r = file.close();
+    }
+    add_time(&presult->open_close, esp_timer_get_time() - start_time);
+  }
+  return r;
+}
+
+// the fsync writes the data, the directory entry and the fat, like every flush of the sensor log.
+esp_err_t SD_CARD_BENCHMARK::append_fsync(benchmark_result_t* presult){
+  esp_err_t r = ESP_OK;
+  SD_FILE file;
+
+  r = psd_card->open_file(BENCHMARK_FILE_PATH, sizeof(BENCHMARK_FILE_PATH), 'a', &file);
+  for(uint32_t sync_index = 0; (r == ESP_OK) && (sync_index < FSYNC_COUNT); sync_index++){
+    r = file.write(pbuffer, SECTOR_SIZE);
+    if(r == ESP_OK){
+      r = file.flush();
+    }
+    if(r != ESP_OK){
+      break;
+    }
+    const int64_t start_time = esp_timer_get_time();
+    r = file.sync();
+    add_time(&presult->fsync, esp_timer_get_time() - start_time);
+  }
+  if(file.is_open() && (file.close() != ESP_OK)){
+    r = ESP_FAIL;
+  }
+  return r;
+}
+
+esp_err_t SD_CARD_BENCHMARK::run(SD_CARD* psd_card, uint32_t file_size, benchmark_result_t* presult){
+  esp_err_t r = ESP_OK;
+  this->psd_card = psd_card;
+  mrandom_state = 1;
+  *presult = benchmark_result_t {};
+  presult->file_size = (file_size < CHUNK_SIZE) ? CHUNK_SIZE : file_size - (file_size % CHUNK_SIZE);
+
+  if(!psd_card->is_mounted()){
+    ESP_LOGE(SD_CARD_BENCHMARK_TAG, "the sd card is not mounted.");
+    r = ESP_ERR_INVALID_STATE;
+  }
+  if(r == ESP_OK){
+    pbuffer = static_cast<uint8_t*>(malloc(CHUNK_SIZE));
+    if(pbuffer == NULL){
+      ESP_LOGE(SD_CARD_BENCHMARK_TAG, "fail to allocate the buffer.");
+      r = ESP_ERR_NO_MEM;
+    }
+  }
+  if(r == ESP_OK){
+    r = write_sequential(presult);
+  }
+  if(r == ESP_OK){
+    r = read_sequential(presult);
+  }
+  if(r == ESP_OK){
+    r = read_random(presult);
+  }
+  if(r == ESP_OK){
+    r = open_close(presult);
+  }
+  if(r == ESP_OK){
+    r = append_fsync(presult);
+  }
+  if(r != ESP_OK){
+    ESP_LOGE(SD_CARD_BENCHMARK_TAG, "benchmark failed. error:%s", esp_err_to_name(r));
+  }
+  if(pbuffer != NULL){
+    psd_card->remove_file(BENCHMARK_FILE_PATH, sizeof(BENCHMARK_FILE_PATH));
+    free(pbuffer);
+    pbuffer = NULL;
+  }
+  return r;
+}
+
+void SD_CARD_BENCHMARK::log_result(const benchmark_result_t* presult){
+  const operation_stats_t* pstats[] = {&presult->random_read, &presult->open_close, &presult->fsync};
+  const char* NAMES[] = {"random read", "open close", "fsync"};
+
+#if CONFIG_SD_CARD_INTERFACE_SDMMC
+  const char* pinterface = "sdmmc";
+#else
+  const char* pinterface = "sdspi";
+#endif
+  ESP_LOGI(SD_CARD_BENCHMARK_TAG, "%s, %u bit, %lu kHz", pinterface, psd_card->get_bus_width(), psd_card->get_frequency());
+  ESP_LOGI(SD_CARD_BENCHMARK_TAG, "sequential write: %lu KB in %lld ms, %lld KB/s", presult->file_size / 1024,
+      presult->write_time / 1000, (presult->write_time > 0) ? (int64_t)presult->file_size * 1000000 / 1024 / presult->write_time : 0);
+  ESP_LOGI(SD_CARD_BENCHMARK_TAG, "sequential read: %lu KB in %lld ms, %lld KB/s", presult->file_size / 1024,
+      presult->read_time / 1000, (presult->read_time > 0) ? (int64_t)presult->file_size * 1000000 / 1024 / presult->read_time : 0);
+  for(size_t stats_index = 0; stats_index < sizeof(pstats) / sizeof(pstats[0]); stats_index++){
+    const operation_stats_t* pstat = pstats[stats_index];
+    ESP_LOGI(SD_CARD_BENCHMARK_TAG, "%s: count:%lu min:%lld avg:%lld max:%lld [us]", NAMES[stats_index], pstat->count,
+        pstat->min_time, (pstat->count > 0) ? pstat->total_time / pstat->count : 0, pstat->max_time);
+  }
+}
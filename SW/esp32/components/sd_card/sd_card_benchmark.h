@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "esp_err.h"
+
+#include "sd_card.h"
+
+// measures the mounted card through the same file api the sensor log uses, so the spi and the
+// sdmmc backend (CONFIG_SD_CARD_INTERFACE) can be compared on the same card.
+// writes and removes BENCHMARK_FILE_PATH. nothing else may use the card meanwhile.
+class SD_CARD_BENCHMARK{
+  public:
+    typedef struct{
+      uint32_t count;
+      int64_t min_time;   //[us]
+      int64_t max_time;   //[us]
+      int64_t total_time; //[us]
+    }operation_stats_t;
+
+    typedef struct{
+      uint32_t file_size;             //[byte]
+      int64_t write_time;             // sequential CHUNK_SIZE writes and one fsync [us]
+      int64_t read_time;              // sequential CHUNK_SIZE reads [us]
+      operation_stats_t random_read;  // one sector at a random offset, unbuffered
+      operation_stats_t open_close;   // fopen and fclose of an existing file
+      operation_stats_t fsync;        // after appending one sector, like a flush of the sensor log
+    }benchmark_result_t;
+
+  private:
+    constexpr static const char* SD_CARD_BENCHMARK_TAG = "sd_card_benchmark";
+    constexpr static char BENCHMARK_FILE_PATH[] = "/sd_bench.bin";
+    // one fat cluster, the flush block size of the sensor log
+    constexpr static size_t CHUNK_SIZE {16 * 1024};
+    constexpr static size_t SECTOR_SIZE {512};
+    constexpr static uint32_t RANDOM_READ_COUNT {200};
+    constexpr static uint32_t OPEN_CLOSE_COUNT {50};
+    constexpr static uint32_t FSYNC_COUNT {50};
+
+    SD_CARD* psd_card {NULL};
+    uint8_t* pbuffer {NULL};
+    uint32_t mrandom_state {0};
+
+    static void add_time(operation_stats_t* pstats, int64_t time);
+    uint32_t get_random();
+    esp_err_t write_sequential(benchmark_result_t* presult);
+    esp_err_t read_sequential(benchmark_result_t* presult);
+    esp_err_t read_random(benchmark_result_t* presult);
+    esp_err_t open_close(benchmark_result_t* presult);
+    esp_err_t append_fsync(benchmark_result_t* presult);
+
+  public:
+    // file_size is rounded down to CHUNK_SIZE, at least one chunk.
+    esp_err_t run(SD_CARD* psd_card, uint32_t file_size, benchmark_result_t* presult);
+    void log_result(const benchmark_result_t* presult);
+};
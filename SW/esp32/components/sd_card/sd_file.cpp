@@ -0,0 +1,180 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+
+#include "sd_file.h"
+
+SD_FILE::~SD_FILE(){
+  close();
+}
+
+SD_FILE::SD_FILE(SD_FILE&& other){
+  pfile = other.pfile;
+  other.pfile = NULL;
+}
+
+SD_FILE& SD_FILE::operator=(SD_FILE&& other){
+  if(this != &other){
+    attach(other.pfile);
+    other.pfile = NULL;
+  }
+  return *this;
+}
+
+void SD_FILE::attach(FILE* pfile){
+  close();
+  this->pfile = pfile;
+}
+
+bool SD_FILE::is_open(){
+  return pfile != NULL;
+}
+
+esp_err_t SD_FILE::set_buffer(char* pbuffer, size_t buffer_size){
+  esp_err_t r = ESP_OK;
+  if(pfile == NULL){
+    r = ESP_ERR_INVALID_STATE;
+  }
+  else if(setvbuf(pfile, pbuffer, (buffer_size > 0) ? _IOFBF : _IONBF, buffer_size) != 0){
+    r = ESP_FAIL;
+  }
+  return r;
+}
+
+esp_err_t SD_FILE::read(void* pdata, size_t data_size, size_t* pread_size){
+  esp_err_t r = ESP_OK;
+  *pread_size = 0;
+  if(pfile == NULL){
+    r = ESP_ERR_INVALID_STATE;
+  }
+  if(r == ESP_OK){
+    *pread_size = fread(pdata, 1, data_size, pfile);
+    if(ferror(pfile)){
+      ESP_LOGE(SD_FILE_TAG, "fail to read %d bytes. errno=%d: %s", (int)data_size, errno, strerror(errno));
+      clearerr(pfile);
+      r = ESP_FAIL;
+    }
+  }
+  return r;
+}
+
+esp_err_t SD_FILE::write(const void* pdata, size_t data_size){
+  esp_err_t r = ESP_OK;
+  if(pfile == NULL){
+    r = ESP_ERR_INVALID_STATE;
+  }
+  else if(fwrite(pdata, 1, data_size, pfile) != data_size){
+    ESP_LOGE(SD_FILE_TAG, "fail to write %d bytes. errno=%d: %s", (int)data_size, errno, strerror(errno));
+    clearerr(pfile);
+    r = ESP_FAIL;
+  }
+  return r;
+}
+
+esp_err_t SD_FILE::read_at(long offset, void* pdata, size_t data_size, size_t* pread_size){
+  esp_err_t r = seek(offset);
+  *pread_size = 0;
+  if(r == ESP_OK){
+    r = read(pdata, data_size, pread_size);
+  }
+  return r;
+}
+
+esp_err_t SD_FILE::write_at(long offset, const void* pdata, size_t data_size){
+  esp_err_t r = seek(offset);
+  if(r == ESP_OK){
+    r = write(pdata, data_size);
+  }
+  return r;
+}
+
+esp_err_t SD_FILE::seek(long offset){
+  esp_err_t r = ESP_OK;
+  if(pfile == NULL){
+    r = ESP_ERR_INVALID_STATE;
+  }
+  else if(fseek(pfile, offset, SEEK_SET) != 0){
+    ESP_LOGE(SD_FILE_TAG, "fail to seek to %ld. errno=%d: %s", offset, errno, strerror(errno));
+    r = ESP_FAIL;
+  }
+  return r;
+}
+
+esp_err_t SD_FILE::seek_end(){
+  esp_err_t r = ESP_OK;
+  if(pfile == NULL){
+    r = ESP_ERR_INVALID_STATE;
+  }
+  else if(fseek(pfile, 0, SEEK_END) != 0){
+    ESP_LOGE(SD_FILE_TAG, "fail to seek to the end. errno=%d: %s", errno, strerror(errno));
+    r = ESP_FAIL;
+  }
+  return r;
+}
+
+esp_err_t SD_FILE::get_size(long* pfile_size){
+  esp_err_t r = ESP_OK;
+  long position = -1;
+  *pfile_size = 0;
+  if(pfile == NULL){
+    r = ESP_ERR_INVALID_STATE;
+  }
+  if((r == ESP_OK) && ((position = ftell(pfile)) < 0)){
+    r = ESP_FAIL;
+  }
+  if((r == ESP_OK) && ((fseek(pfile, 0, SEEK_END) != 0) || ((*pfile_size = ftell(pfile)) < 0))){
+    *pfile_size = 0;
+    r = ESP_FAIL;
+  }
+  if((r == ESP_OK) && (fseek(pfile, position, SEEK_SET) != 0)){
+    r = ESP_FAIL;
+  }
+  if(r == ESP_FAIL){
+    ESP_LOGE(SD_FILE_TAG, "fail to get the file size. errno=%d: %s", errno, strerror(errno));
+  }
+  return r;
+}
+
+esp_err_t SD_FILE::truncate(long file_size){
+  esp_err_t r = flush();
+  if((r == ESP_OK) && (ftruncate(fileno(pfile), file_size) != 0)){
+    ESP_LOGE(SD_FILE_TAG, "fail to truncate to %ld. errno=%d: %s", file_size, errno, strerror(errno));
+    r = ESP_FAIL;
+  }
+  return r;
+}
+
+esp_err_t SD_FILE::flush(){
+  esp_err_t r = ESP_OK;
+  if(pfile == NULL){
+    r = ESP_ERR_INVALID_STATE;
+  }
+  else if(fflush(pfile) != 0){
+    ESP_LOGE(SD_FILE_TAG, "fail to flush. errno=%d: %s", errno, strerror(errno));
+    r = ESP_FAIL;
+  }
+  return r;
+}
+
+esp_err_t SD_FILE::sync(){
+  esp_err_t r = flush();
+  if((r == ESP_OK) && (fsync(fileno(pfile)) != 0)){
+    ESP_LOGE(SD_FILE_TAG, "fail to sync. errno=%d: %s", errno, strerror(errno));
+    r = ESP_FAIL;
+  }
+  return r;
+}
+
+esp_err_t SD_FILE::close(){
+  esp_err_t r = ESP_OK;
+  if(pfile != NULL){
+    if(fclose(pfile) != 0){
+      ESP_LOGE(SD_FILE_TAG, "fail to close. errno=%d: %s", errno, strerror(errno));
+      r = ESP_FAIL;
+    }
+    pfile = NULL;
+  }
+  return r;
+}
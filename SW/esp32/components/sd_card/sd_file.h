@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "esp_err.h"
+
+// a file opened by SD_CARD::open_file(). closes the file when it goes out of scope, so early
+// returns and error paths never leak a handle.
+// the full path is built once at the open. reads, writes and seeks only use the handle.
+// movable, not copyable. read() and write() continue at the position of the last call,
+// read_at() and write_at() move the position to the end of their data.
+class SD_FILE{
+  private:
+    constexpr static const char* SD_FILE_TAG = "sd_file";
+
+    FILE* pfile {NULL};
+
+  public:
+    SD_FILE() = default;
+    ~SD_FILE();
+    SD_FILE(const SD_FILE&) = delete;
+    SD_FILE& operator=(const SD_FILE&) = delete;
+    SD_FILE(SD_FILE&& other);
+    SD_FILE& operator=(SD_FILE&& other);
+
+    // takes the ownership of pfile and closes the file held before.
+    void attach(FILE* pfile);
+    bool is_open();
+
+    // setvbuf() before the first read or write. pbuffer NULL with buffer_size 0 is unbuffered,
+    // for io in whole blocks. pbuffer NULL with a size lets stdio allocate the buffer.
+    esp_err_t set_buffer(char* pbuffer, size_t buffer_size);
+
+    // reads up to data_size bytes. *pread_size is smaller at the end of the file, 0 after it.
+    esp_err_t read(void* pdata, size_t data_size, size_t* pread_size);
+    esp_err_t write(const void* pdata, size_t data_size);
+    // like pread() and pwrite() with an offset from the start of the file.
+    esp_err_t read_at(long offset, void* pdata, size_t data_size, size_t* pread_size);
+    esp_err_t write_at(long offset, const void* pdata, size_t data_size);
+    esp_err_t seek(long offset);
+    esp_err_t seek_end();
+    // includes the data of write() still in the buffer. keeps the position.
+    esp_err_t get_size(long* pfile_size);
+    // flush() and ftruncate(). cuts the file to file_size bytes, or extends it with zeros.
+    esp_err_t truncate(long file_size);
+
+    // hands the buffered data to the file system.
+    esp_err_t flush();
+    // flush() and fsync(). the data, the directory entry and the fat are on the card afterwards.
+    esp_err_t sync();
+    // the error of fclose(), e.g. a failed write of the buffered data. closing a closed file is ok.
+    esp_err_t close();
+};
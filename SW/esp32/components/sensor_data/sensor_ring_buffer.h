@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+
+namespace sensor_data{
+
+  // lock-free ring buffer for one producer task and any number of consumers.
+  // the producer never waits for consumers. it overwrites the oldest slot, and a
+  // consumer that falls more than CAPACITY samples behind skips ahead and counts the lost samples.
+  // every slot is guarded by a sequence number: odd while the producer writes it,
+  // 2 * (index + 1) once sample number index is complete.
+  template<typename T, size_t CAPACITY>
+  class RING_BUFFER{
+    static_assert((CAPACITY != 0) && ((CAPACITY & (CAPACITY - 1)) == 0), "CAPACITY must be a power of 2");
+    static_assert(std::is_trivially_copyable<T>::value, "T is copied without locks");
+
+    private:
+      typedef struct{
+        std::atomic<uint32_t> sequence;
+        T value;
+      }slot_t;
+
+      slot_t mslots[CAPACITY] {};
+      // number of samples pushed so far
+      std::atomic<uint32_t> mwrite_index {0};
+
+    public:
+      // each consumer keeps its own cursor, so consumers never touch shared state.
+      class READER{
+        friend class RING_BUFFER;
+        private:
+          const RING_BUFFER* pmring_buffer;
+          uint32_t mread_index;
+          uint32_t mlost_count {0};
+        public:
+          explicit READER(const RING_BUFFER* pring_buffer) :
+            pmring_buffer(pring_buffer), mread_index(pring_buffer->get_write_index()){}
+          // copies the next unread sample. false when the consumer is up to date.
+          bool read(T* pvalue){ return pmring_buffer->read(this, pvalue); }
+          // samples overwritten before this consumer read them
+          uint32_t get_lost_count() const { return mlost_count; }
+      };
+
+      // producer only
+      void push(const T& value){
+        const uint32_t index = mwrite_index.load(std::memory_order_relaxed);
+        slot_t& slot = mslots[index & (CAPACITY - 1)];
+        slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        slot.value = value;
+        slot.sequence.store(2 * (index + 1), std::memory_order_release);
+        mwrite_index.store(index + 1, std::memory_order_release);
+      }
+
+      uint32_t get_write_index() const {
+        return mwrite_index.load(std::memory_order_acquire);
+      }
+
+      // a reader that starts with the next pushed sample
+      READER create_reader() const {
+        return READER(this);
+      }
+
+      // a reader that starts with the oldest sample still in the buffer.
+      // one slot is left out, the producer may already be writing it.
+      READER create_history_reader() const {
+        READER reader(this);
+        const uint32_t write_index = get_write_index();
+        reader.mread_index = (write_index >= CAPACITY) ? (write_index - CAPACITY + 1) : 0;
+        return reader;
+      }
+
+    private:
+      bool read(READER* preader, T* pvalue) const {
+        while(true){
+          const uint32_t write_index = get_write_index();
+          if(preader->mread_index == write_index){
+            return false;
+          }
+          // the producer lapped this consumer. keep a margin of one slot for the sample being written.
+          if((write_index - preader->mread_index) >= CAPACITY){
+            const uint32_t next_index = write_index - CAPACITY + 1;
+            preader->mlost_count += next_index - preader->mread_index;
+            preader->mread_index = next_index;
+          }
+          const slot_t& slot = mslots[preader->mread_index & (CAPACITY - 1)];
+          const uint32_t expected_sequence = 2 * (preader->mread_index + 1);
+          if(slot.sequence.load(std::memory_order_acquire) == expected_sequence){
+            T value = slot.value;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(slot.sequence.load(std::memory_order_relaxed) == expected_sequence){
+              *pvalue = value;
+              preader->mread_index++;
+              return true;
+            }
+          }
+          // the slot was overwritten while reading. try again from the new write index.
+          preader->mlost_count++;
+          preader->mread_index++;
+        }
+      }
+  };
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+namespace sensor_data{
+
+  enum class sensor_id_e : uint8_t{
+    SCD40  = 0, // value[0]: co2 [ppm]
+    BME280 = 1, // value[0]: temperature [0.01 degree Celsius], value[1]: pressure [Pa * 256], value[2]: humidity [%RH * 1024]
+  };
+
+  // quality flags
+  constexpr static uint8_t SAMPLE_TIME_NOT_SYNCED       {0x01}; // timestamp is seconds since boot, not unix time
+  constexpr static uint8_t SAMPLE_PRESSURE_COMPENSATED  {0x02}; // co2 compensated with the measured ambient pressure
+
+  constexpr static uint8_t SAMPLE_VALUE_SIZE {3};
+  // 2020-01-01 00:00:00. anything older was taken before sntp synchronized the clock.
+  constexpr static time_t SYNCED_TIME_MIN {1577836800};
+
+  // fixed layout, so samples can be copied into the log or sent over the network as they are.
+  typedef struct{
+    uint32_t timestamp;       // unix time [s]
+    sensor_id_e sensor_id;
+    uint8_t quality;          // SAMPLE_* flags
+    uint16_t reserved;
+    int32_t value[SAMPLE_VALUE_SIZE];
+  }sensor_sample_t;
+
+  static_assert(sizeof(sensor_sample_t) == 20, "sensor_sample_t layout changed");
+
+  inline sensor_sample_t make_sample(sensor_id_e sensor_id, uint8_t quality = 0){
+    sensor_sample_t sample {};
+    time_t now = time(NULL);
+    if(now < SYNCED_TIME_MIN){
+      quality |= SAMPLE_TIME_NOT_SYNCED;
+    }
+    sample.timestamp = static_cast<uint32_t>(now);
+    sample.sensor_id = sensor_id;
+    sample.quality = quality;
+    return sample;
+  }
+}
@@ -0,0 +1,100 @@
+#include <string.h>
+
+#include "log_aggregator.h"
+
+void LOG_AGGREGATOR::begin(SD_FILE* pfile, uint32_t interval){
+  this->pfile = pfile;
+  minterval = interval;
+  mrecord_count = 0;
+  memset(maccumulators, 0, sizeof(maccumulators));
+}
+
+esp_err_t LOG_AGGREGATOR::write_record(size_t sensor_index){
+  esp_err_t r = ESP_OK;
+  accumulator_t* paccumulator = &maccumulators[sensor_index];
+  sensor_log::log_aggregate_record_t record {};
+
+  record.magic = sensor_log::LOG_AGGREGATE_MAGIC;
+  record.version = sensor_log::LOG_FORMAT_VERSION;
+  record.sensor_id = static_cast<sensor_data::sensor_id_e>(sensor_index);
+  record.quality = paccumulator->quality;
+  record.start_timestamp = paccumulator->start_timestamp;
+  record.interval = minterval;
+  record.sample_count = paccumulator->sample_count;
+  for(size_t value_index = 0; value_index < sensor_data::SAMPLE_VALUE_SIZE; value_index++){
+    record.min[value_index] = paccumulator->min[value_index];
+    record.max[value_index] = paccumulator->max[value_index];
+    record.mean[value_index] = static_cast<int32_t>(paccumulator->sum[value_index] / paccumulator->sample_count);
+  }
+  record.crc = sensor_log::calculate_aggregate_crc(&record);
+  r = pfile->write(&record, sizeof(record));
+  paccumulator->is_active = false;
+  mrecord_count++;
+  return r;
+}
+
+// the sensors are interleaved in the log, so an interval is only complete once a later one started.
+esp_err_t LOG_AGGREGATOR::write_intervals_before(uint32_t start_timestamp){
+  esp_err_t r = ESP_OK;
+  while(r == ESP_OK){
+    size_t oldest_index = SENSOR_COUNT;
+    for(size_t sensor_index = 0; sensor_index < SENSOR_COUNT; sensor_index++){
+      const accumulator_t* paccumulator = &maccumulators[sensor_index];
+      if(paccumulator->is_active && (paccumulator->start_timestamp < start_timestamp) &&
+          ((oldest_index == SENSOR_COUNT) || (paccumulator->start_timestamp < maccumulators[oldest_index].start_timestamp))){
+        oldest_index = sensor_index;
+      }
+    }
+    if(oldest_index == SENSOR_COUNT){
+      break;
+    }
+    r = write_record(oldest_index);
+  }
+  return r;
+}
+
+esp_err_t LOG_AGGREGATOR::add(const sensor_data::sensor_sample_t* psample){
+  esp_err_t r = ESP_OK;
+  const size_t sensor_index = static_cast<size_t>(psample->sensor_id);
+  const uint32_t start_timestamp = psample->timestamp - (psample->timestamp % minterval);
+
+  if(sensor_index >= SENSOR_COUNT){
+    return ESP_OK;
+  }
+  r = write_intervals_before(start_timestamp);
+  accumulator_t* paccumulator = &maccumulators[sensor_index];
+  // the clock stepped back. keep the samples, the records are out of order then.
+  if((r == ESP_OK) && paccumulator->is_active && (paccumulator->start_timestamp != start_timestamp)){
+    r = write_record(sensor_index);
+  }
+  if(r == ESP_OK){
+    if(!paccumulator->is_active){
+      paccumulator->is_active = true;
+      paccumulator->start_timestamp = start_timestamp;
+      paccumulator->quality = 0;
+      paccumulator->sample_count = 0;
+      for(size_t value_index = 0; value_index < sensor_data::SAMPLE_VALUE_SIZE; value_index++){
+        paccumulator->min[value_index] = INT32_MAX;
+        paccumulator->max[value_index] = INT32_MIN;
+        paccumulator->sum[value_index] = 0;
+      }
+    }
+    paccumulator->quality |= psample->quality;
+    paccumulator->sample_count++;
+    for(size_t value_index = 0; value_index < sensor_data::SAMPLE_VALUE_SIZE; value_index++){
+      const int32_t value = psample->value[value_index];
+      paccumulator->min[value_index] = (value < paccumulator->min[value_index]) ? value : paccumulator->min[value_index];
+      paccumulator->max[value_index] = (value > paccumulator->max[value_index]) ? value : paccumulator->max[value_index];
+      paccumulator->sum[value_index] += value;
+    }
+  }
+  return r;
+}
+
+esp_err_t LOG_AGGREGATOR::finish(){
+  return write_intervals_before(UINT32_MAX);
+}
+
+uint32_t LOG_AGGREGATOR::get_record_count(){
+  return mrecord_count;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "esp_err.h"
+
+#include "sd_file.h"
+#include "sensor_sample.h"
+#include "sensor_log_format.h"
+
+// reduces time ordered samples to one log_aggregate_record_t per sensor and interval
+// and writes the records to a file in the order of their start time.
+class LOG_AGGREGATOR{
+  private:
+    constexpr static size_t SENSOR_COUNT {2};
+
+    typedef struct{
+      bool is_active;
+      uint32_t start_timestamp;
+      uint8_t quality;
+      uint32_t sample_count;
+      int32_t min[sensor_data::SAMPLE_VALUE_SIZE];
+      int32_t max[sensor_data::SAMPLE_VALUE_SIZE];
+      int64_t sum[sensor_data::SAMPLE_VALUE_SIZE];
+    }accumulator_t;
+
+    SD_FILE* pfile {NULL};
+    uint32_t minterval {0};
+    accumulator_t maccumulators[SENSOR_COUNT] {};
+    uint32_t mrecord_count {0};
+
+    esp_err_t write_record(size_t sensor_index);
+    esp_err_t write_intervals_before(uint32_t start_timestamp);
+
+  public:
+    // pfile stays owned by the caller.
+    void begin(SD_FILE* pfile, uint32_t interval);
+    // samples of unknown sensors are ignored.
+    esp_err_t add(const sensor_data::sensor_sample_t* psample);
+    // writes the open intervals.
+    esp_err_t finish();
+    uint32_t get_record_count();
+};
@@ -0,0 +1,177 @@
+#include <string.h>
+
+#include "log_block_decoder.h"
+
+LOG_BLOCK_DECODER::block_state_e LOG_BLOCK_DECODER::open(const uint8_t* pblock){
+  block_state_e state = block_state_e::VALID;
+  this->pblock = pblock;
+  mpayload_offset = 0;
+  mrecord_index = 0;
+  memcpy(&mheader, pblock, sizeof(mheader));
+
+  if(mheader.magic != sensor_log::LOG_BLOCK_MAGIC){
+    state = block_state_e::BAD_MAGIC;
+    bool is_empty = true;
+    for(size_t block_index = 0; block_index < sensor_log::LOG_BLOCK_SIZE; block_index++){
+      if((pblock[block_index] != 0x00) && (pblock[block_index] != 0xff)){
+        is_empty = false;
+        break;
+      }
+    }
+    if(is_empty){
+      state = block_state_e::EMPTY;
+    }
+  }
+  if((state == block_state_e::VALID) && (mheader.version != sensor_log::LOG_FORMAT_VERSION) &&
+      (mheader.version != sensor_log::LOG_PACKED_FORMAT_VERSION)){
+    state = block_state_e::BAD_VERSION;
+  }
+  if(state == block_state_e::VALID){
+    sensor_log::log_block_header_t header = mheader;
+    uint8_t block[sensor_log::LOG_BLOCK_SIZE];
+    header.crc = 0;
+    memcpy(block, pblock, sizeof(block));
+    memcpy(block, &header, sizeof(header));
+    if(sensor_log::calculate_crc32(block, sizeof(block)) != mheader.crc){
+      state = block_state_e::BAD_CRC;
+    }
+  }
+  if((state == block_state_e::VALID) && (mheader.version == sensor_log::LOG_PACKED_FORMAT_VERSION)){
+    state = check_packed_records();
+  }
+  else if(state == block_state_e::VALID){
+    state = check_records();
+  }
+  if(state != block_state_e::VALID){
+    mheader.record_count = 0;
+  }
+  mtimestamp = mheader.base_timestamp;
+  return state;
+}
+
+// a block with a good crc can still come from a newer writer with a bug. never read past the payload.
+LOG_BLOCK_DECODER::block_state_e LOG_BLOCK_DECODER::check_records(){
+  block_state_e state = block_state_e::VALID;
+  size_t payload_offset = 0;
+  sensor_log::log_record_header_t record_header {};
+
+  if(mheader.payload_size > sensor_log::LOG_BLOCK_PAYLOAD_SIZE){
+    state = block_state_e::BAD_PAYLOAD;
+  }
+  for(uint8_t record_index = 0; (state == block_state_e::VALID) && (record_index < mheader.record_count); record_index++){
+    if(payload_offset + sizeof(record_header) > mheader.payload_size){
+      state = block_state_e::BAD_PAYLOAD;
+      break;
+    }
+    memcpy(&record_header, pblock + sizeof(mheader) + payload_offset, sizeof(record_header));
+    payload_offset += sensor_log::get_log_record_size(record_header.sensor_id);
+  }
+  if((state == block_state_e::VALID) && (payload_offset != mheader.payload_size)){
+    state = block_state_e::BAD_PAYLOAD;
+  }
+  return state;
+}
+
+// the packed records have no fixed size, so the check decodes them once.
+LOG_BLOCK_DECODER::block_state_e LOG_BLOCK_DECODER::check_packed_records(){
+  block_state_e state = block_state_e::VALID;
+  size_t payload_offset = 0;
+  sensor_data::sensor_sample_t sample {};
+  uint32_t time_delta = 0;
+
+  if(mheader.payload_size > sensor_log::LOG_BLOCK_PAYLOAD_SIZE){
+    state = block_state_e::BAD_PAYLOAD;
+  }
+  memset(mpacked_states, 0, sizeof(mpacked_states));
+  for(uint8_t record_index = 0; (state == block_state_e::VALID) && (record_index < mheader.record_count); record_index++){
+    const size_t record_size = read_packed_record(payload_offset, &sample, &time_delta);
+    if(record_size == 0){
+      state = block_state_e::BAD_PAYLOAD;
+      break;
+    }
+    payload_offset += record_size;
+  }
+  if((state == block_state_e::VALID) && (payload_offset != mheader.payload_size)){
+    state = block_state_e::BAD_PAYLOAD;
+  }
+  memset(mpacked_states, 0, sizeof(mpacked_states));
+  return state;
+}
+
+// returns the size of the record, 0 if it does not fit into the payload.
+size_t LOG_BLOCK_DECODER::read_packed_record(size_t payload_offset, sensor_data::sensor_sample_t* psample, uint32_t* ptime_delta){
+  const uint8_t* precord = pblock + sizeof(mheader) + payload_offset;
+  const size_t available_size = mheader.payload_size - payload_offset;
+  size_t record_size = 0;
+  size_t varint_size = 0;
+  uint32_t varint = 0;
+
+  if(available_size == 0){
+    return 0;
+  }
+  const uint8_t flags = precord[record_size++];
+  if((flags & ~(sensor_log::LOG_PACKED_SENSOR_ID_MASK | sensor_log::LOG_PACKED_QUALITY_FLAG)) != 0){
+    return 0;
+  }
+  sensor_log::log_packed_state_t* pstate = &mpacked_states[flags & sensor_log::LOG_PACKED_SENSOR_ID_MASK];
+  if((flags & sensor_log::LOG_PACKED_QUALITY_FLAG) != 0){
+    if(record_size >= available_size){
+      return 0;
+    }
+    pstate->quality = precord[record_size++];
+  }
+  varint_size = sensor_log::get_log_varint(precord + record_size, available_size - record_size, ptime_delta);
+  if((varint_size == 0) || (*ptime_delta > sensor_log::LOG_MAX_TIME_DELTA)){
+    return 0;
+  }
+  record_size += varint_size;
+
+  *psample = sensor_data::sensor_sample_t {};
+  psample->sensor_id = static_cast<sensor_data::sensor_id_e>(flags & sensor_log::LOG_PACKED_SENSOR_ID_MASK);
+  psample->quality = pstate->quality;
+  for(size_t value_index = 0; value_index < sensor_log::get_log_value_count(psample->sensor_id); value_index++){
+    varint_size = sensor_log::get_log_varint(precord + record_size, available_size - record_size, &varint);
+    if(varint_size == 0){
+      return 0;
+    }
+    record_size += varint_size;
+    pstate->value[value_index] = static_cast<int32_t>(static_cast<uint32_t>(pstate->value[value_index]) +
+        static_cast<uint32_t>(sensor_log::decode_zigzag(varint)));
+    psample->value[value_index] = pstate->value[value_index];
+  }
+  return record_size;
+}
+
+bool LOG_BLOCK_DECODER::next(sensor_data::sensor_sample_t* psample){
+  sensor_log::log_record_header_t record_header {};
+  uint32_t time_delta = 0;
+  if(mrecord_index >= mheader.record_count){
+    return false;
+  }
+  if(mheader.version == sensor_log::LOG_PACKED_FORMAT_VERSION){
+    // open() checked every record, so this never fails.
+    mpayload_offset += read_packed_record(mpayload_offset, psample, &time_delta);
+    mtimestamp += time_delta;
+    psample->timestamp = mtimestamp;
+    mrecord_index++;
+    return true;
+  }
+  const uint8_t* precord = pblock + sizeof(mheader) + mpayload_offset;
+  memcpy(&record_header, precord, sizeof(record_header));
+  const size_t value_count = sensor_log::get_log_value_count(record_header.sensor_id);
+
+  mtimestamp += record_header.time_delta;
+  *psample = sensor_data::sensor_sample_t {};
+  psample->timestamp = mtimestamp;
+  psample->sensor_id = record_header.sensor_id;
+  psample->quality = record_header.quality;
+  memcpy(psample->value, precord + sizeof(record_header), value_count * sizeof(int32_t));
+
+  mpayload_offset += sensor_log::get_log_record_size(record_header.sensor_id);
+  mrecord_index++;
+  return true;
+}
+
+const sensor_log::log_block_header_t* LOG_BLOCK_DECODER::get_header(){
+  return &mheader;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "sensor_sample.h"
+#include "sensor_log_format.h"
+
+// reads the samples back from one LOG_BLOCK_SIZE block of either format version.
+// only standard headers, so the host tools build it as well.
+class LOG_BLOCK_DECODER{
+  public:
+    enum class block_state_e{
+      VALID,
+      EMPTY,          // all bytes erased or zero, e.g. the unwritten end of a file
+      BAD_MAGIC,
+      BAD_VERSION,
+      BAD_CRC,
+      BAD_PAYLOAD,    // the records do not add up to the payload size
+    };
+
+  private:
+    const uint8_t* pblock {NULL};
+    sensor_log::log_block_header_t mheader {};
+    size_t mpayload_offset {0};
+    uint8_t mrecord_index {0};
+    uint32_t mtimestamp {0};
+    // previous record of each sensor in a packed block
+    sensor_log::log_packed_state_t mpacked_states[sensor_log::LOG_PACKED_SENSOR_COUNT] {};
+
+    block_state_e check_records();
+    block_state_e check_packed_records();
+    size_t read_packed_record(size_t payload_offset, sensor_data::sensor_sample_t* psample, uint32_t* ptime_delta);
+
+  public:
+    // checks the header, the crc and the record layout of pblock.
+    // next() returns samples only if this returned VALID.
+    block_state_e open(const uint8_t* pblock);
+    // false after the last record of the block.
+    bool next(sensor_data::sensor_sample_t* psample);
+    const sensor_log::log_block_header_t* get_header();
+};
@@ -0,0 +1,131 @@
+#include <string.h>
+
+#include "log_block_encoder.h"
+
+void LOG_BLOCK_ENCODER::begin(uint8_t* pblock, uint32_t sequence, uint8_t version){
+  this->pblock = pblock;
+  mversion = version;
+  mpayload_size = 0;
+  mrecord_count = 0;
+  msequence = sequence;
+  mfirst_timestamp = 0;
+  mlast_timestamp = 0;
+  memset(mpacked_states, 0, sizeof(mpacked_states));
+}
+
+size_t LOG_BLOCK_ENCODER::make_record(const sensor_data::sensor_sample_t* psample, uint16_t time_delta, uint8_t* precord){
+  const size_t record_size = sensor_log::get_log_record_size(psample->sensor_id);
+  sensor_log::log_record_header_t record_header {};
+  record_header.sensor_id = psample->sensor_id;
+  record_header.quality = psample->quality;
+  record_header.time_delta = time_delta;
+  memcpy(precord, &record_header, sizeof(record_header));
+  memcpy(precord + sizeof(record_header), psample->value, record_size - sizeof(record_header));
+  return record_size;
+}
+
+// returns 0 if the sensor id does not fit. the state is updated by add() once the record fits.
+size_t LOG_BLOCK_ENCODER::make_packed_record(const sensor_data::sensor_sample_t* psample, uint16_t time_delta, uint8_t* precord){
+  const uint8_t sensor_index = static_cast<uint8_t>(psample->sensor_id);
+  size_t record_size = 0;
+  if(sensor_index > sensor_log::LOG_PACKED_SENSOR_ID_MASK){
+    return 0;
+  }
+  const sensor_log::log_packed_state_t* pstate = &mpacked_states[sensor_index];
+  const bool has_quality = (psample->quality != pstate->quality);
+
+  precord[record_size++] = sensor_index | (has_quality ? sensor_log::LOG_PACKED_QUALITY_FLAG : 0);
+  if(has_quality){
+    precord[record_size++] = psample->quality;
+  }
+  record_size += sensor_log::put_log_varint(precord + record_size, time_delta);
+  for(size_t value_index = 0; value_index < sensor_log::get_log_value_count(psample->sensor_id); value_index++){
+    // wraps around for differences beyond int32_t, the decoder wraps back.
+    const int32_t difference = static_cast<int32_t>(static_cast<uint32_t>(psample->value[value_index]) -
+        static_cast<uint32_t>(pstate->value[value_index]));
+    record_size += sensor_log::put_log_varint(precord + record_size, sensor_log::encode_zigzag(difference));
+  }
+  return record_size;
+}
+
+esp_err_t LOG_BLOCK_ENCODER::add(const sensor_data::sensor_sample_t* psample){
+  esp_err_t r = ESP_OK;
+  uint8_t record[sensor_log::LOG_PACKED_RECORD_MAX_SIZE];
+  size_t record_size = 0;
+  static_assert(sizeof(record) >= sizeof(sensor_log::log_record_header_t) + sizeof(psample->value), "record buffer too small");
+
+  if(mrecord_count == 0){
+    mfirst_timestamp = psample->timestamp;
+    mlast_timestamp = psample->timestamp;
+  }
+  // the time deltas are unsigned 16 bit. a clock step back (sntp) or a long gap starts a new block.
+  if((mrecord_count == UINT8_MAX) ||
+      (psample->timestamp < mlast_timestamp) ||
+      (psample->timestamp - mlast_timestamp > sensor_log::LOG_MAX_TIME_DELTA)){
+    r = ESP_ERR_NO_MEM;
+  }
+  if(r == ESP_OK){
+    const uint16_t time_delta = static_cast<uint16_t>(psample->timestamp - mlast_timestamp);
+    if(mversion == sensor_log::LOG_PACKED_FORMAT_VERSION){
+      record_size = make_packed_record(psample, time_delta, record);
+    }
+    else{
+      record_size = make_record(psample, time_delta, record);
+    }
+    if(record_size == 0){
+      r = ESP_ERR_INVALID_ARG;
+    }
+  }
+  if((r == ESP_OK) && (mpayload_size + record_size > sensor_log::LOG_BLOCK_PAYLOAD_SIZE)){
+    r = ESP_ERR_NO_MEM;
+  }
+  if(r == ESP_OK){
+    if(mrecord_count == 0){
+      // the base timestamp lives in the header, which is written by finish().
+      reinterpret_cast<sensor_log::log_block_header_t*>(pblock)->base_timestamp = psample->timestamp;
+    }
+    memcpy(pblock + sizeof(sensor_log::log_block_header_t) + mpayload_size, record, record_size);
+    mpayload_size += record_size;
+    mrecord_count++;
+    mlast_timestamp = psample->timestamp;
+    if(mversion == sensor_log::LOG_PACKED_FORMAT_VERSION){
+      sensor_log::log_packed_state_t* pstate = &mpacked_states[static_cast<uint8_t>(psample->sensor_id)];
+      pstate->quality = psample->quality;
+      memcpy(pstate->value, psample->value, sizeof(pstate->value));
+    }
+  }
+  return r;
+}
+
+void LOG_BLOCK_ENCODER::set_sequence(uint32_t sequence){
+  msequence = sequence;
+}
+
+void LOG_BLOCK_ENCODER::finish(){
+  sensor_log::log_block_header_t header {};
+  memcpy(&header, pblock, sizeof(header));
+  header.magic = sensor_log::LOG_BLOCK_MAGIC;
+  header.version = mversion;
+  header.record_count = mrecord_count;
+  header.payload_size = static_cast<uint16_t>(mpayload_size);
+  header.sequence = msequence;
+  if(mrecord_count == 0){
+    header.base_timestamp = 0;
+  }
+  header.crc = 0;
+  memcpy(pblock, &header, sizeof(header));
+  memset(pblock + sizeof(header) + mpayload_size, 0, sensor_log::LOG_BLOCK_PAYLOAD_SIZE - mpayload_size);
+  header.crc = sensor_log::calculate_crc32(pblock, sensor_log::LOG_BLOCK_SIZE);
+  memcpy(pblock, &header, sizeof(header));
+}
+
+bool LOG_BLOCK_ENCODER::is_empty(){
+  return mrecord_count == 0;
+}
+
+sensor_log::log_index_entry_t LOG_BLOCK_ENCODER::get_index_entry(){
+  sensor_log::log_index_entry_t entry {};
+  entry.first_timestamp = mfirst_timestamp;
+  entry.last_timestamp = mlast_timestamp;
+  return entry;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "esp_err.h"
+
+#include "sensor_sample.h"
+#include "sensor_log_format.h"
+
+// packs sensor samples into one LOG_BLOCK_SIZE block at a time.
+class LOG_BLOCK_ENCODER{
+  private:
+    uint8_t* pblock {NULL};
+    uint8_t mversion {sensor_log::LOG_FORMAT_VERSION};
+    size_t mpayload_size {0};
+    uint8_t mrecord_count {0};
+    uint32_t msequence {0};
+    uint32_t mfirst_timestamp {0};
+    uint32_t mlast_timestamp {0};
+    // previous record of each sensor in a packed block
+    sensor_log::log_packed_state_t mpacked_states[sensor_log::LOG_PACKED_SENSOR_COUNT] {};
+
+    size_t make_record(const sensor_data::sensor_sample_t* psample, uint16_t time_delta, uint8_t* precord);
+    size_t make_packed_record(const sensor_data::sensor_sample_t* psample, uint16_t time_delta, uint8_t* precord);
+
+  public:
+    // starts an empty block in pblock, which holds LOG_BLOCK_SIZE bytes.
+    // version is sensor_log::LOG_FORMAT_VERSION or LOG_PACKED_FORMAT_VERSION.
+    void begin(uint8_t* pblock, uint32_t sequence, uint8_t version = sensor_log::LOG_FORMAT_VERSION);
+    // ESP_ERR_NO_MEM: the sample does not fit into this block, finish it and begin the next one.
+    // ESP_ERR_INVALID_ARG: a packed block can not hold the sensor id.
+    esp_err_t add(const sensor_data::sensor_sample_t* psample);
+    // the sequence is only known at the end of a packed block.
+    void set_sequence(uint32_t sequence);
+    // writes the header and the crc and clears the unused bytes.
+    void finish();
+    bool is_empty();
+    // index entry of the block without the block index. valid if the block is not empty.
+    sensor_log::log_index_entry_t get_index_entry();
+};
@@ -0,0 +1,149 @@
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "log_journal.h"
+
+LOG_JOURNAL::LOG_JOURNAL(){
+  esp_log_level_set(LOG_JOURNAL_TAG, ESP_LOG_INFO);
+  ESP_LOGI(LOG_JOURNAL_TAG, "set LOG_JOURNAL_TAG log level: %d", ESP_LOG_INFO);
+}
+
+LOG_JOURNAL::~LOG_JOURNAL(){
+  close();
+}
+
+void LOG_JOURNAL::close(){
+  mfile.close();
+}
+
+esp_err_t LOG_JOURNAL::preallocate(uint32_t first_position, uint8_t* pwork_block){
+  esp_err_t r = ESP_OK;
+  memset(pwork_block, 0, sensor_log::LOG_BLOCK_SIZE);
+  r = mfile.seek((long)first_position * sensor_log::LOG_BLOCK_SIZE);
+  for(uint32_t position = first_position; (r == ESP_OK) && (position < mblock_count); position++){
+    r = mfile.write(pwork_block, sensor_log::LOG_BLOCK_SIZE);
+  }
+  if(r == ESP_OK){
+    r = mfile.sync();
+  }
+  return r;
+}
+
+esp_err_t LOG_JOURNAL::open(SD_CARD* psd_card, const char* pfile_path, size_t file_path_size, uint32_t block_count, uint8_t* pwork_block){
+  esp_err_t r = ESP_OK;
+  long file_size = 0;
+
+  close();
+  mblock_count = block_count;
+  r = psd_card->open_file(pfile_path, file_path_size, '+', &mfile);
+  if(r == ESP_ERR_NOT_FOUND){
+    // create the file, r+ does not.
+    r = psd_card->open_file(pfile_path, file_path_size, 'w', &mfile);
+    if(r == ESP_OK){
+      r = psd_card->open_file(pfile_path, file_path_size, '+', &mfile);
+    }
+  }
+  if(r == ESP_OK){
+    // the journal is written in whole blocks at a time.
+    r = mfile.set_buffer(NULL, 0);
+  }
+  if(r == ESP_OK){
+    r = mfile.get_size(&file_size);
+  }
+  if((r == ESP_OK) && (file_size < (long)block_count * (long)sensor_log::LOG_BLOCK_SIZE)){
+    ESP_LOGI(LOG_JOURNAL_TAG, "preallocate %lu journal blocks.", block_count);
+    r = preallocate(file_size / sensor_log::LOG_BLOCK_SIZE, pwork_block);
+  }
+  if(r != ESP_OK){
+    ESP_LOGE(LOG_JOURNAL_TAG, "fail to open the journal %s.", pfile_path);
+    mfile.close();
+  }
+  return r;
+}
+
+esp_err_t LOG_JOURNAL::read_block(uint32_t position, uint8_t* pblock){
+  size_t read_size = 0;
+  esp_err_t r = mfile.read_at((long)position * sensor_log::LOG_BLOCK_SIZE, pblock, sensor_log::LOG_BLOCK_SIZE, &read_size);
+  if((r == ESP_OK) && (read_size != sensor_log::LOG_BLOCK_SIZE)){
+    r = ESP_FAIL;
+  }
+  return r;
+}
+
+esp_err_t LOG_JOURNAL::recover(block_function_t block_function, void* arg, uint8_t* pwork_block){
+  esp_err_t r = ESP_OK;
+  uint32_t newest_sequence = 0;
+  uint32_t valid_count = 0;
+
+  if(!mfile.is_open()){
+    return ESP_ERR_INVALID_STATE;
+  }
+  // scan forward for the newest valid block.
+  has_blocks = false;
+  for(uint32_t position = 0; (r == ESP_OK) && (position < mblock_count); position++){
+    r = read_block(position, pwork_block);
+    if((r == ESP_OK) && (mdecoder.open(pwork_block) == LOG_BLOCK_DECODER::block_state_e::VALID)){
+      const uint32_t sequence = mdecoder.get_header()->sequence;
+      if((sequence % mblock_count == position) && (!has_blocks || (sequence > newest_sequence))){
+        newest_sequence = sequence;
+        has_blocks = true;
+      }
+    }
+  }
+  // the block_count blocks up to the newest one, oldest first. torn or stale blocks are skipped.
+  const uint32_t oldest_sequence = (has_blocks && (newest_sequence >= mblock_count)) ? newest_sequence - mblock_count + 1 : 0;
+  for(uint64_t sequence = oldest_sequence; (r == ESP_OK) && has_blocks && (sequence <= newest_sequence); sequence++){
+    r = read_block(sequence % mblock_count, pwork_block);
+    if((r == ESP_OK) && (mdecoder.open(pwork_block) == LOG_BLOCK_DECODER::block_state_e::VALID) &&
+        (mdecoder.get_header()->sequence == sequence)){
+      block_function(arg, pwork_block);
+      valid_count++;
+    }
+  }
+  mnext_sequence = has_blocks ? newest_sequence + 1 : 0;
+  if(r == ESP_OK){
+    ESP_LOGI(LOG_JOURNAL_TAG, "recover %lu journal blocks, next sequence %lu.", valid_count, mnext_sequence);
+  }
+  else{
+    ESP_LOGE(LOG_JOURNAL_TAG, "fail to read the journal.");
+  }
+  return r;
+}
+
+uint32_t LOG_JOURNAL::get_next_sequence(){
+  return mnext_sequence;
+}
+
+esp_err_t LOG_JOURNAL::write(const uint8_t* pblocks, size_t block_count){
+  esp_err_t r = ESP_OK;
+  sensor_log::log_block_header_t header {};
+  size_t block_index = 0;
+
+  if(!mfile.is_open()){
+    r = ESP_ERR_INVALID_STATE;
+  }
+  // consecutive sequences are one write up to the end of the file.
+  while((r == ESP_OK) && (block_index < block_count)){
+    memcpy(&header, pblocks + block_index * sensor_log::LOG_BLOCK_SIZE, sizeof(header));
+    const uint32_t position = header.sequence % mblock_count;
+    size_t run_count = 1;
+    while((block_index + run_count < block_count) && (position + run_count < mblock_count)){
+      memcpy(&header, pblocks + (block_index + run_count) * sensor_log::LOG_BLOCK_SIZE, sizeof(header));
+      if(header.sequence % mblock_count != position + run_count){
+        break;
+      }
+      run_count++;
+    }
+    const size_t write_size = run_count * sensor_log::LOG_BLOCK_SIZE;
+    r = mfile.write_at((long)position * sensor_log::LOG_BLOCK_SIZE, pblocks + block_index * sensor_log::LOG_BLOCK_SIZE, write_size);
+    block_index += run_count;
+  }
+  if((r == ESP_OK) && (block_count > 0)){
+    r = mfile.sync();
+    memcpy(&header, pblocks + (block_count - 1) * sensor_log::LOG_BLOCK_SIZE, sizeof(header));
+    mnext_sequence = header.sequence + 1;
+    has_blocks = true;
+  }
+  return r;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "esp_err.h"
+
+#include "sd_card.h"
+#include "sensor_log_format.h"
+#include "log_block_decoder.h"
+
+// write-ahead journal of the sensor log. a preallocated file of block_count log blocks
+// that is only overwritten in place, block by block, so its size and cluster chain never
+// change and a power loss can only tear the blocks being written.
+// a block is stored at position sequence % block_count. the crc and the sequence number of
+// each block tell the valid blocks and their order after a reset.
+class LOG_JOURNAL{
+  public:
+    typedef void (*block_function_t)(void* arg, const uint8_t* pblock);
+
+  private:
+    constexpr static const char* LOG_JOURNAL_TAG = "log_journal";
+
+    SD_FILE mfile;
+    uint32_t mblock_count {0};
+    bool has_blocks {false};
+    uint32_t mnext_sequence {0};
+    LOG_BLOCK_DECODER mdecoder;
+
+    esp_err_t read_block(uint32_t position, uint8_t* pblock);
+    esp_err_t preallocate(uint32_t first_position, uint8_t* pwork_block);
+
+  public:
+    LOG_JOURNAL();
+    ~LOG_JOURNAL();
+
+    // opens the journal and fills it up to block_count zero blocks if it is new or shorter.
+    // pwork_block holds LOG_BLOCK_SIZE bytes.
+    esp_err_t open(SD_CARD* psd_card, const char* pfile_path, size_t file_path_size, uint32_t block_count, uint8_t* pwork_block);
+    // e.g. before the sd card is mounted again. write() fails until the next open().
+    void close();
+    // scans the journal and calls block_function for every valid block from the oldest to the newest.
+    // pblock of block_function is pwork_block.
+    esp_err_t recover(block_function_t block_function, void* arg, uint8_t* pwork_block);
+    // sequence after the newest block of the journal. 0 for an empty journal.
+    uint32_t get_next_sequence();
+    // writes finished blocks at the position of their sequence and syncs the file.
+    esp_err_t write(const uint8_t* pblocks, size_t block_count);
+};
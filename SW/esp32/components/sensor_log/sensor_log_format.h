@@ -0,0 +1,267 @@
+#pragma once
+
+#include <array>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "sensor_sample.h"
+
+// binary sensor log. shared by the logger and the host tools, so only standard headers here.
+//
+// the file is a sequence of LOG_BLOCK_SIZE blocks. a block is a log_block_header_t followed
+// by records and zero padding. a record is a log_record_header_t followed by the fixed-point
+// values of its sensor (get_log_value_count()). all fields are little endian.
+// a block whose crc does not match, e.g. a torn write, is skipped as a whole.
+//
+// the log is split into one segment file per utc day, <directory>/YYYYMMDD.bin, next to
+// a sparse index <directory>/YYYYMMDD.idx with one log_index_entry_t per block. index
+// entries are written after their block, so a torn index only loses the tail of the index.
+// a new segment may be preallocated. the block after the logical end is kept zero, so the
+// first empty block is the logical end. the unused rest is cut off when the day is over.
+// samples taken before sntp synchronized the clock land in 19700101.bin.
+// <directory>/journal.bin holds the same blocks again, see LOG_JOURNAL.
+//
+// SENSOR_LOG_RETENTION packs closed segments into YYYYMMDD.pak, a sequence of blocks of
+// LOG_PACKED_FORMAT_VERSION in time order without an index. it is written as YYYYMMDD.tmp
+// and renamed when complete. the sequence of a packed block is the one of the segment block
+// holding its last record, so segment blocks up to the sequence of the last packed block
+// are in the packed segment already, e.g. after a reset before the segment was removed.
+//
+// SENSOR_LOG_RETENTION replaces old segments by aggregates, YYYYMMDD.1m and YYYYMMDD.1h.
+// an aggregate file is a sequence of log_aggregate_record_t in the order of start_timestamp.
+namespace sensor_log{
+
+  constexpr static uint32_t LOG_BLOCK_MAGIC {0x474f4c53}; // "SLOG"
+  constexpr static uint8_t LOG_FORMAT_VERSION {1};
+  // a packed record is a byte of LOG_PACKED_SENSOR_ID_MASK and LOG_PACKED_QUALITY_FLAG, the
+  // quality byte if the flag is set, the time delta as varint and every value as zigzag varint
+  // of the difference to the previous record of the same sensor in the block. the quality
+  // and the values of a sensor start from 0 in every block, so a block decodes alone.
+  constexpr static uint8_t LOG_PACKED_FORMAT_VERSION {2};
+  // one sd card sector
+  constexpr static size_t LOG_BLOCK_SIZE {512};
+
+  typedef struct __attribute__((packed)){
+    uint32_t magic;
+    uint8_t version;
+    uint8_t record_count;
+    uint16_t payload_size;    // bytes of records after the header
+    uint32_t sequence;        // block number. continues across resets, see LOG_JOURNAL
+    uint32_t base_timestamp;  // [s] the first record is relative to this
+    uint32_t crc;             // crc32 of the whole block with this field set to 0
+  }log_block_header_t;
+
+  typedef struct __attribute__((packed)){
+    sensor_data::sensor_id_e sensor_id;
+    uint8_t quality;          // sensor_data::SAMPLE_* flags
+    uint16_t time_delta;      // [s] since the previous record of the block
+  }log_record_header_t;
+
+  static_assert(sizeof(log_block_header_t) == 20, "log block header layout changed");
+  static_assert(sizeof(log_record_header_t) == 4, "log record header layout changed");
+
+  typedef struct __attribute__((packed)){
+    uint32_t first_timestamp; // [s] of the first record of the block
+    uint32_t last_timestamp;  // [s] of the last record of the block
+    uint32_t block_index;     // position in the segment file [LOG_BLOCK_SIZE]
+  }log_index_entry_t;
+
+  static_assert(sizeof(log_index_entry_t) == 12, "log index entry layout changed");
+
+  constexpr static uint32_t LOG_AGGREGATE_MAGIC {0x47474153}; // "SAGG"
+
+  // min, max and mean of the samples of one sensor in one interval.
+  typedef struct __attribute__((packed)){
+    uint32_t magic;
+    uint8_t version;
+    sensor_data::sensor_id_e sensor_id;
+    uint8_t quality;          // sensor_data::SAMPLE_* flags of all samples or-ed
+    uint8_t reserved;
+    uint32_t start_timestamp; // [s] start of the interval
+    uint32_t interval;        // [s]
+    uint32_t sample_count;
+    int32_t min[sensor_data::SAMPLE_VALUE_SIZE];
+    int32_t max[sensor_data::SAMPLE_VALUE_SIZE];
+    int32_t mean[sensor_data::SAMPLE_VALUE_SIZE];
+    uint32_t crc;             // crc32 of the record up to this field
+  }log_aggregate_record_t;
+
+  static_assert(sizeof(log_aggregate_record_t) == 60, "log aggregate record layout changed");
+
+  constexpr static uint32_t LOG_SEGMENT_DURATION {24 * 60 * 60}; // [s]
+  constexpr static const char* LOG_SEGMENT_EXTENSION {"bin"};
+  constexpr static const char* LOG_INDEX_EXTENSION {"idx"};
+  constexpr static uint32_t LOG_MINUTE_INTERVAL {60};        // [s]
+  constexpr static uint32_t LOG_HOUR_INTERVAL {60 * 60};     // [s]
+  constexpr static const char* LOG_MINUTE_EXTENSION {"1m"};
+  constexpr static const char* LOG_HOUR_EXTENSION {"1h"};
+  constexpr static const char* LOG_PACKED_EXTENSION {"pak"};
+  constexpr static const char* LOG_PACKING_EXTENSION {"tmp"};  // packed segment being written
+  // "/YYYYMMDD.ext" and the terminator
+  constexpr static size_t LOG_SEGMENT_NAME_SIZE {14};
+
+  inline uint32_t get_log_segment_start(uint32_t timestamp){
+    return timestamp - (timestamp % LOG_SEGMENT_DURATION);
+  }
+
+  // <pdirectory>/YYYYMMDD.<pextension> of the segment starting at segment_start.
+  inline bool make_log_segment_path(char* ppath, size_t path_size, const char* pdirectory,
+      uint32_t segment_start, const char* pextension){
+    const time_t segment_time = segment_start;
+    struct tm utc {};
+    gmtime_r(&segment_time, &utc);
+    const int length = snprintf(ppath, path_size, "%s/%04d%02d%02d.%s", pdirectory,
+        utc.tm_year + 1900, utc.tm_mon + 1, utc.tm_mday, pextension);
+    return (length > 0) && (static_cast<size_t>(length) < path_size);
+  }
+
+  // days since 1970-01-01 of a date in the proleptic gregorian calendar.
+  // newlib has no timegm(), so the segment names are converted here.
+  constexpr int64_t get_days_from_civil(int64_t year, uint32_t month, uint32_t day){
+    year -= (month <= 2) ? 1 : 0;
+    const int64_t era = ((year >= 0) ? year : year - 399) / 400;
+    const uint32_t year_of_era = static_cast<uint32_t>(year - era * 400);
+    const uint32_t day_of_year = (153 * ((month > 2) ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    const uint32_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + static_cast<int64_t>(day_of_era) - 719468;
+  }
+
+  static_assert(get_days_from_civil(1970, 1, 1) == 0, "wrong epoch");
+  static_assert(get_days_from_civil(2000, 3, 1) == 11017, "wrong leap year handling");
+
+  // reverses make_log_segment_path() for a file name without directory, e.g. "20261019.bin".
+  // pextension points into pname.
+  inline bool parse_log_segment_name(const char* pname, uint32_t* psegment_start, const char** ppextension){
+    uint32_t date = 0;
+    for(size_t name_index = 0; name_index < 8; name_index++){
+      if((pname[name_index] < '0') || (pname[name_index] > '9')){
+        return false;
+      }
+      date = date * 10 + (pname[name_index] - '0');
+    }
+    if(pname[8] != '.'){
+      return false;
+    }
+    const uint32_t month = (date / 100) % 100;
+    const uint32_t day = date % 100;
+    if((month < 1) || (month > 12) || (day < 1) || (day > 31)){
+      return false;
+    }
+    const int64_t days = get_days_from_civil(date / 10000, month, day);
+    if((days < 0) || (days > UINT32_MAX / LOG_SEGMENT_DURATION)){
+      return false;
+    }
+    *psegment_start = static_cast<uint32_t>(days) * LOG_SEGMENT_DURATION;
+    *ppextension = pname + 9;
+    return true;
+  }
+
+  constexpr static size_t LOG_BLOCK_PAYLOAD_SIZE {LOG_BLOCK_SIZE - sizeof(log_block_header_t)};
+  constexpr static uint32_t LOG_MAX_TIME_DELTA {UINT16_MAX};
+
+  // values stored per record. only the values the sensor fills are stored.
+  inline size_t get_log_value_count(sensor_data::sensor_id_e sensor_id){
+    switch(sensor_id){
+      case sensor_data::sensor_id_e::SCD40:
+        return 1;
+      case sensor_data::sensor_id_e::BME280:
+        return 3;
+    }
+    return sensor_data::SAMPLE_VALUE_SIZE;
+  }
+
+  inline size_t get_log_record_size(sensor_data::sensor_id_e sensor_id){
+    return sizeof(log_record_header_t) + get_log_value_count(sensor_id) * sizeof(int32_t);
+  }
+
+  constexpr static uint8_t LOG_PACKED_SENSOR_ID_MASK {0x0f};
+  constexpr static uint8_t LOG_PACKED_QUALITY_FLAG {0x80};
+  constexpr static size_t LOG_PACKED_SENSOR_COUNT {LOG_PACKED_SENSOR_ID_MASK + 1};
+  // 7 bits per byte, least significant first. the high bit marks that another byte follows.
+  constexpr static size_t LOG_VARINT_MAX_SIZE {5};
+  constexpr static size_t LOG_PACKED_RECORD_MAX_SIZE {2 + LOG_VARINT_MAX_SIZE * (1 + sensor_data::SAMPLE_VALUE_SIZE)};
+
+  // quality and values of the previous packed record of a sensor
+  typedef struct{
+    uint8_t quality;
+    int32_t value[sensor_data::SAMPLE_VALUE_SIZE];
+  }log_packed_state_t;
+
+  // pbuffer holds LOG_VARINT_MAX_SIZE bytes. returns the bytes written.
+  inline size_t put_log_varint(uint8_t* pbuffer, uint32_t value){
+    size_t size = 0;
+    while(value >= 0x80){
+      pbuffer[size++] = static_cast<uint8_t>(value | 0x80);
+      value >>= 7;
+    }
+    pbuffer[size++] = static_cast<uint8_t>(value);
+    return size;
+  }
+
+  // returns the bytes read, 0 if the varint is truncated or too large.
+  inline size_t get_log_varint(const uint8_t* pbuffer, size_t buffer_size, uint32_t* pvalue){
+    uint64_t value = 0;
+    for(size_t size = 0; (size < buffer_size) && (size < LOG_VARINT_MAX_SIZE); size++){
+      value |= static_cast<uint64_t>(pbuffer[size] & 0x7f) << (7 * size);
+      if((pbuffer[size] & 0x80) == 0){
+        if(value > UINT32_MAX){
+          return 0;
+        }
+        *pvalue = static_cast<uint32_t>(value);
+        return size + 1;
+      }
+    }
+    return 0;
+  }
+
+  // small differences of either sign become small unsigned numbers: 0, -1, 1, -2 -> 0, 1, 2, 3
+  constexpr uint32_t encode_zigzag(int32_t value){
+    return (static_cast<uint32_t>(value) << 1) ^ static_cast<uint32_t>(value >> 31);
+  }
+
+  constexpr int32_t decode_zigzag(uint32_t value){
+    return static_cast<int32_t>((value >> 1) ^ (0 - (value & 1)));
+  }
+
+  static_assert((encode_zigzag(0) == 0) && (encode_zigzag(-1) == 1) && (encode_zigzag(1) == 2), "wrong zigzag encoding");
+  static_assert((decode_zigzag(encode_zigzag(INT32_MIN)) == INT32_MIN) && (decode_zigzag(encode_zigzag(INT32_MAX)) == INT32_MAX),
+      "wrong zigzag decoding");
+
+  // crc-32 (ieee 802.3, reflected 0xedb88320), the same as zlib.
+  constexpr std::array<uint32_t, 256> generate_crc32_table(){
+    std::array<uint32_t, 256> table {};
+    for(uint32_t value = 0; value < 256; value++){
+      uint32_t crc = value;
+      for(uint8_t crc_bit = 0; crc_bit < 8; crc_bit++){
+        crc = (crc & 1) ? ((crc >> 1) ^ 0xedb88320) : (crc >> 1);
+      }
+      table[value] = crc;
+    }
+    return table;
+  }
+
+  constexpr std::array<uint32_t, 256> CRC32_TABLE = generate_crc32_table();
+
+  constexpr uint32_t calculate_crc32(const uint8_t* pdata, size_t data_size){
+    uint32_t crc = 0xffffffff;
+    for(size_t data_index = 0; data_index < data_size; data_index++){
+      crc = CRC32_TABLE[(crc ^ pdata[data_index]) & 0xff] ^ (crc >> 8);
+    }
+    return crc ^ 0xffffffff;
+  }
+
+  // check value of the algorithm
+  constexpr uint8_t CRC32_CHECK_DATA[] = {'1', '2', '3', '4', '5', '6', '7', '8', '9'};
+  static_assert(calculate_crc32(CRC32_CHECK_DATA, sizeof(CRC32_CHECK_DATA)) == 0xcbf43926, "crc32 does not match the check value");
+
+  inline uint32_t calculate_aggregate_crc(const log_aggregate_record_t* precord){
+    return calculate_crc32(reinterpret_cast<const uint8_t*>(precord), offsetof(log_aggregate_record_t, crc));
+  }
+
+  inline bool is_valid_aggregate(const log_aggregate_record_t* precord){
+    return (precord->magic == LOG_AGGREGATE_MAGIC) && (precord->version == LOG_FORMAT_VERSION) &&
+        (precord->crc == calculate_aggregate_crc(precord));
+  }
+}
@@ -0,0 +1,353 @@
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "sensor_log_reader.h"
+
+esp_err_t SENSOR_LOG_READER::init(SD_CARD* psd_card, const char* pdirectory, size_t directory_size){
+  esp_err_t r = ESP_OK;
+  if(strnlen(pdirectory, directory_size) >= sizeof(mdirectory)){
+    ESP_LOGE(SENSOR_LOG_READER_TAG, "log directory path is too large.");
+    r = ESP_ERR_INVALID_ARG;
+  }
+  if(r == ESP_OK){
+    this->psd_card = psd_card;
+    strncpy(mdirectory, pdirectory, sizeof(mdirectory) - 1);
+  }
+  return r;
+}
+
+esp_err_t SENSOR_LOG_READER::open_segment_file(uint32_t segment_start, const char* pextension, SD_FILE* pfile){
+  esp_err_t r = ESP_OK;
+  char path[LOG_PATH_SIZE] = {};
+  if(!sensor_log::make_log_segment_path(path, sizeof(path), mdirectory, segment_start, pextension)){
+    r = ESP_ERR_INVALID_SIZE;
+  }
+  if(r == ESP_OK){
+    r = psd_card->open_file(path, sizeof(path), 'r', pfile);
+  }
+  return r;
+}
+
+esp_err_t SENSOR_LOG_READER::read_block(SD_FILE* pfile, long block_index){
+  size_t read_size = 0;
+  esp_err_t r = pfile->read_at(block_index * sensor_log::LOG_BLOCK_SIZE, mblock, sizeof(mblock), &read_size);
+  if((r == ESP_OK) && (read_size != sizeof(mblock))){
+    r = ESP_FAIL;
+  }
+  return r;
+}
+
+// first block whose last sample is not older than start_time.
+// blocks after the last index entry (lost with a torn index) are found by the scan in read_segment.
+esp_err_t SENSOR_LOG_READER::find_first_block(uint32_t segment_start, uint32_t start_time, uint32_t* pblock_index){
+  esp_err_t r = ESP_OK;
+  SD_FILE index_file;
+  sensor_log::log_index_entry_t entry {};
+  long index_size = 0;
+  size_t read_size = 0;
+
+  *pblock_index = 0;
+  r = open_segment_file(segment_start, sensor_log::LOG_INDEX_EXTENSION, &index_file);
+  if(r == ESP_ERR_NOT_FOUND){
+    // no index. scan the segment from the start.
+    return ESP_OK;
+  }
+  if(r == ESP_OK){
+    r = index_file.get_size(&index_size);
+  }
+  size_t lower = 0;
+  size_t upper = (r == ESP_OK) ? index_size / sizeof(entry) : 0;
+  const size_t entry_count = upper;
+  while((r == ESP_OK) && (lower < upper)){
+    const size_t middle = lower + (upper - lower) / 2;
+    r = index_file.read_at(middle * sizeof(entry), &entry, sizeof(entry), &read_size);
+    if((r == ESP_OK) && (read_size != sizeof(entry))){
+      r = ESP_FAIL;
+    }
+    if(r != ESP_OK){
+      break;
+    }
+    if(entry.last_timestamp < start_time){
+      lower = middle + 1;
+    }
+    else{
+      upper = middle;
+    }
+  }
+  if((r == ESP_OK) && (entry_count > 0)){
+    // past the last entry, continue after the last indexed block.
+    const size_t entry_index = (lower < entry_count) ? lower : entry_count - 1;
+    r = index_file.read_at(entry_index * sizeof(entry), &entry, sizeof(entry), &read_size);
+    if((r == ESP_OK) && (read_size != sizeof(entry))){
+      r = ESP_FAIL;
+    }
+    if(r == ESP_OK){
+      *pblock_index = entry.block_index + ((lower < entry_count) ? 0 : 1);
+    }
+  }
+  return r;
+}
+
+// the packed segment is complete and in time order, so its blocks are searched directly.
+// the block before the first one starting after start_time holds the first samples of the range.
+esp_err_t SENSOR_LOG_READER::find_first_packed_block(SD_FILE* pfile, uint32_t start_time, long* pblock_index,
+    bool* phas_blocks, uint32_t* plast_sequence){
+  esp_err_t r = ESP_OK;
+  long file_size = 0;
+
+  *pblock_index = 0;
+  *phas_blocks = false;
+  r = pfile->get_size(&file_size);
+  const long block_count = (r == ESP_OK) ? file_size / (long)sensor_log::LOG_BLOCK_SIZE : 0;
+  long lower = 0;
+  long upper = block_count;
+  while((r == ESP_OK) && (lower < upper)){
+    const long middle = lower + (upper - lower) / 2;
+    r = read_block(pfile, middle);
+    if(r != ESP_OK){
+      break;
+    }
+    // a bad block does not move the search, the next one decides.
+    if((mdecoder.open(mblock) == LOG_BLOCK_DECODER::block_state_e::VALID) && (mdecoder.get_header()->base_timestamp <= start_time)){
+      lower = middle + 1;
+    }
+    else{
+      upper = middle;
+    }
+  }
+  if((r == ESP_OK) && (block_count > 0)){
+    *pblock_index = (lower > 0) ? lower - 1 : 0;
+    r = read_block(pfile, block_count - 1);
+    if((r == ESP_OK) && (mdecoder.open(mblock) == LOG_BLOCK_DECODER::block_state_e::VALID)){
+      *phas_blocks = true;
+      *plast_sequence = mdecoder.get_header()->sequence;
+    }
+  }
+  return r;
+}
+
+esp_err_t SENSOR_LOG_READER::read_blocks(SD_FILE* pfile, long block_index, uint32_t start_time, uint32_t end_time,
+    sample_function_t sample_function, void* arg, uint32_t* psample_count){
+  esp_err_t r = ESP_OK;
+  sensor_data::sensor_sample_t sample {};
+  size_t read_size = 0;
+
+  r = pfile->seek(block_index * sensor_log::LOG_BLOCK_SIZE);
+  while(r == ESP_OK){
+    r = pfile->read(mblock, sizeof(mblock), &read_size);
+    if((r != ESP_OK) || (read_size != sizeof(mblock))){
+      break;
+    }
+    const LOG_BLOCK_DECODER::block_state_e state = mdecoder.open(mblock);
+    if(state == LOG_BLOCK_DECODER::block_state_e::EMPTY){
+      // the preallocated end of the segment of today
+      break;
+    }
+    if(state != LOG_BLOCK_DECODER::block_state_e::VALID){
+      // a torn block. the next one is complete again.
+      continue;
+    }
+    if(has_packed_segment && (mdecoder.get_header()->sequence <= mpacked_last_sequence)){
+      continue;
+    }
+    if(mdecoder.get_header()->base_timestamp > end_time){
+      break;
+    }
+    while(mdecoder.next(&sample)){
+      if((sample.timestamp >= start_time) && (sample.timestamp <= end_time)){
+        sample_function(arg, &sample);
+        (*psample_count)++;
+      }
+    }
+  }
+  return r;
+}
+
+esp_err_t SENSOR_LOG_READER::read_packed_segment(uint32_t segment_start, uint32_t start_time, uint32_t end_time,
+    sample_function_t sample_function, void* arg, uint32_t* psample_count){
+  esp_err_t r = ESP_OK;
+  SD_FILE file;
+  long block_index = 0;
+  bool has_blocks = false;
+  uint32_t last_sequence = 0;
+
+  r = open_segment_file(segment_start, sensor_log::LOG_PACKED_EXTENSION, &file);
+  if(r == ESP_OK){
+    r = find_first_packed_block(&file, start_time, &block_index, &has_blocks, &last_sequence);
+  }
+  if(r == ESP_OK){
+    r = read_blocks(&file, block_index, start_time, end_time, sample_function, arg, psample_count);
+  }
+  if(r == ESP_OK){
+    has_packed_segment = has_blocks;
+    mpacked_last_sequence = last_sequence;
+  }
+  return r;
+}
+
+esp_err_t SENSOR_LOG_READER::read_raw_segment(uint32_t segment_start, uint32_t start_time, uint32_t end_time,
+    sample_function_t sample_function, void* arg, uint32_t* psample_count){
+  esp_err_t r = ESP_OK;
+  SD_FILE file;
+  uint32_t block_index = 0;
+
+  r = open_segment_file(segment_start, sensor_log::LOG_SEGMENT_EXTENSION, &file);
+  if(r == ESP_OK){
+    r = find_first_block(segment_start, start_time, &block_index);
+  }
+  if(r == ESP_OK){
+    r = read_blocks(&file, block_index, start_time, end_time, sample_function, arg, psample_count);
+  }
+  return r;
+}
+
+// a day is a packed segment, a raw segment or both. the raw segment is read after the packed
+// one and only its blocks that were not packed.
+esp_err_t SENSOR_LOG_READER::read_segment(uint32_t segment_start, uint32_t start_time, uint32_t end_time,
+    sample_function_t sample_function, void* arg, uint32_t* psample_count){
+  esp_err_t r = ESP_OK;
+  bool is_packed_found = false;
+
+  has_packed_segment = false;
+  r = read_packed_segment(segment_start, start_time, end_time, sample_function, arg, psample_count);
+  if(r == ESP_OK){
+    is_packed_found = true;
+  }
+  if(r == ESP_ERR_NOT_FOUND){
+    r = ESP_OK;
+  }
+  if(r == ESP_OK){
+    r = read_raw_segment(segment_start, start_time, end_time, sample_function, arg, psample_count);
+  }
+  if((r == ESP_ERR_NOT_FOUND) && is_packed_found){
+    r = ESP_OK;
+  }
+  has_packed_segment = false;
+  return r;
+}
+
+esp_err_t SENSOR_LOG_READER::read_range(uint32_t start_time, uint32_t end_time,
+    sample_function_t sample_function, void* arg, uint32_t* psample_count){
+  esp_err_t r = ESP_OK;
+  *psample_count = 0;
+  if(psd_card == NULL){
+    r = ESP_ERR_INVALID_STATE;
+  }
+  for(uint64_t segment_start = sensor_log::get_log_segment_start(start_time);
+      (r == ESP_OK) && (segment_start <= end_time); segment_start += sensor_log::LOG_SEGMENT_DURATION){
+    // the files of one day stay open together, the logger must not unmount the card meanwhile.
+    r = psd_card->lock();
+    if(r == ESP_OK){
+      r = read_segment(static_cast<uint32_t>(segment_start), start_time, end_time, sample_function, arg, psample_count);
+      psd_card->unlock();
+    }
+    if(r == ESP_ERR_NOT_FOUND){
+      r = ESP_OK;
+    }
+  }
+  if(r != ESP_OK){
+    ESP_LOGE(SENSOR_LOG_READER_TAG, "fail to read the log. error:%s", esp_err_to_name(r));
+  }
+  return r;
+}
+
+// first record whose interval ends after start_time. the records are ordered by their start.
+esp_err_t SENSOR_LOG_READER::find_first_aggregate(SD_FILE* pfile, uint32_t interval, uint32_t start_time, long* precord_index){
+  esp_err_t r = ESP_OK;
+  sensor_log::log_aggregate_record_t record {};
+  long file_size = 0;
+  size_t read_size = 0;
+
+  r = pfile->get_size(&file_size);
+  long lower = 0;
+  long upper = (r == ESP_OK) ? file_size / (long)sizeof(record) : 0;
+  while((r == ESP_OK) && (lower < upper)){
+    const long middle = lower + (upper - lower) / 2;
+    r = pfile->read_at(middle * sizeof(record), &record, sizeof(record), &read_size);
+    if((r == ESP_OK) && (read_size != sizeof(record))){
+      r = ESP_FAIL;
+    }
+    if(r != ESP_OK){
+      break;
+    }
+    // a torn record does not move the search, the next one decides.
+    if(sensor_log::is_valid_aggregate(&record) && ((uint64_t)record.start_timestamp + interval <= start_time)){
+      lower = middle + 1;
+    }
+    else{
+      upper = middle;
+    }
+  }
+  *precord_index = lower;
+  return r;
+}
+
+esp_err_t SENSOR_LOG_READER::read_aggregate_segment(uint32_t segment_start, const char* pextension, uint32_t interval,
+    uint32_t start_time, uint32_t end_time, aggregate_function_t aggregate_function, void* arg, uint32_t* precord_count){
+  esp_err_t r = ESP_OK;
+  SD_FILE file;
+  sensor_log::log_aggregate_record_t record {};
+  long record_index = 0;
+  size_t read_size = 0;
+
+  r = open_segment_file(segment_start, pextension, &file);
+  if(r == ESP_OK){
+    r = find_first_aggregate(&file, interval, start_time, &record_index);
+  }
+  if(r == ESP_OK){
+    r = file.seek(record_index * sizeof(record));
+  }
+  while(r == ESP_OK){
+    r = file.read(&record, sizeof(record), &read_size);
+    if((r != ESP_OK) || (read_size != sizeof(record))){
+      break;
+    }
+    if(!sensor_log::is_valid_aggregate(&record)){
+      continue;
+    }
+    if(record.start_timestamp > end_time){
+      break;
+    }
+    if((uint64_t)record.start_timestamp + interval > start_time){
+      aggregate_function(arg, &record);
+      (*precord_count)++;
+    }
+  }
+  return r;
+}
+
+esp_err_t SENSOR_LOG_READER::read_aggregates(uint32_t interval, uint32_t start_time, uint32_t end_time,
+    aggregate_function_t aggregate_function, void* arg, uint32_t* precord_count){
+  esp_err_t r = ESP_OK;
+  const char* pextension = NULL;
+  *precord_count = 0;
+  if(psd_card == NULL){
+    r = ESP_ERR_INVALID_STATE;
+  }
+  if((r == ESP_OK) && (interval == sensor_log::LOG_MINUTE_INTERVAL)){
+    pextension = sensor_log::LOG_MINUTE_EXTENSION;
+  }
+  else if((r == ESP_OK) && (interval == sensor_log::LOG_HOUR_INTERVAL)){
+    pextension = sensor_log::LOG_HOUR_EXTENSION;
+  }
+  else if(r == ESP_OK){
+    r = ESP_ERR_INVALID_ARG;
+  }
+  for(uint64_t segment_start = sensor_log::get_log_segment_start(start_time);
+      (r == ESP_OK) && (segment_start <= end_time); segment_start += sensor_log::LOG_SEGMENT_DURATION){
+    r = psd_card->lock();
+    if(r == ESP_OK){
+      r = read_aggregate_segment(static_cast<uint32_t>(segment_start), pextension, interval,
+          start_time, end_time, aggregate_function, arg, precord_count);
+      psd_card->unlock();
+    }
+    if(r == ESP_ERR_NOT_FOUND){
+      r = ESP_OK;
+    }
+  }
+  if(r != ESP_OK){
+    ESP_LOGE(SENSOR_LOG_READER_TAG, "fail to read the log aggregates. error:%s", esp_err_to_name(r));
+  }
+  return r;
+}
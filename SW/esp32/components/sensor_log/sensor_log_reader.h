@@ -0,0 +1,66 @@
+#pragma once
+
+#include "esp_err.h"
+
+#include "sd_card.h"
+#include "sensor_sample.h"
+#include "sensor_log_format.h"
+#include "log_block_decoder.h"
+
+// reads a time range back from the segments written by SENSOR_LOGGER and the aggregates
+// written by SENSOR_LOG_RETENTION.
+// the index of each segment, or the blocks of a packed segment, is searched with a binary
+// search, so only O(log n) index entries and the blocks of the range are read from the sd card.
+// samples still in the ram of the logger are not visible. call SENSOR_LOGGER::request_flush() first if needed.
+// the card is locked (SD_CARD::lock()) while the files of a day are open, also during the callbacks.
+// ESP_ERR_INVALID_STATE without a card.
+class SENSOR_LOG_READER{
+  public:
+    typedef void (*sample_function_t)(void* arg, const sensor_data::sensor_sample_t* psample);
+    typedef void (*aggregate_function_t)(void* arg, const sensor_log::log_aggregate_record_t* precord);
+
+  private:
+    constexpr static const char* SENSOR_LOG_READER_TAG = "sensor_log_reader";
+    constexpr static size_t LOG_DIRECTORY_SIZE {32};
+    constexpr static size_t LOG_PATH_SIZE {LOG_DIRECTORY_SIZE + sensor_log::LOG_SEGMENT_NAME_SIZE};
+
+    SD_CARD* psd_card {NULL};
+    char mdirectory[LOG_DIRECTORY_SIZE] {};
+    uint8_t mblock[sensor_log::LOG_BLOCK_SIZE] {};
+    LOG_BLOCK_DECODER mdecoder;
+    // segment blocks up to this sequence were read from the packed segment of the day
+    bool has_packed_segment {false};
+    uint32_t mpacked_last_sequence {0};
+
+    esp_err_t read_block(SD_FILE* pfile, long block_index);
+    esp_err_t open_segment_file(uint32_t segment_start, const char* pextension, SD_FILE* pfile);
+    esp_err_t find_first_block(uint32_t segment_start, uint32_t start_time, uint32_t* pblock_index);
+    esp_err_t find_first_packed_block(SD_FILE* pfile, uint32_t start_time, long* pblock_index, bool* phas_blocks, uint32_t* plast_sequence);
+    esp_err_t read_blocks(SD_FILE* pfile, long block_index, uint32_t start_time, uint32_t end_time,
+        sample_function_t sample_function, void* arg, uint32_t* psample_count);
+    esp_err_t read_packed_segment(uint32_t segment_start, uint32_t start_time, uint32_t end_time,
+        sample_function_t sample_function, void* arg, uint32_t* psample_count);
+    esp_err_t read_raw_segment(uint32_t segment_start, uint32_t start_time, uint32_t end_time,
+        sample_function_t sample_function, void* arg, uint32_t* psample_count);
+    esp_err_t read_segment(uint32_t segment_start, uint32_t start_time, uint32_t end_time,
+        sample_function_t sample_function, void* arg, uint32_t* psample_count);
+    esp_err_t find_first_aggregate(SD_FILE* pfile, uint32_t interval, uint32_t start_time, long* precord_index);
+    esp_err_t read_aggregate_segment(uint32_t segment_start, const char* pextension, uint32_t interval,
+        uint32_t start_time, uint32_t end_time, aggregate_function_t aggregate_function, void* arg, uint32_t* precord_count);
+
+  public:
+    esp_err_t init(SD_CARD* psd_card, const char* pdirectory, size_t directory_size);
+
+    // calls sample_function for every logged sample with start_time <= timestamp <= end_time
+    // in the order of the log. days without a segment are skipped.
+    // blocks are assumed to be in time order within a segment. after the clock stepped back,
+    // samples of the overlapping time can be missed.
+    esp_err_t read_range(uint32_t start_time, uint32_t end_time,
+        sample_function_t sample_function, void* arg, uint32_t* psample_count);
+
+    // calls aggregate_function for every aggregate of SENSOR_LOG_RETENTION whose interval
+    // overlaps start_time..end_time. interval is sensor_log::LOG_MINUTE_INTERVAL or LOG_HOUR_INTERVAL.
+    // only days whose raw segment was compacted have aggregates.
+    esp_err_t read_aggregates(uint32_t interval, uint32_t start_time, uint32_t end_time,
+        aggregate_function_t aggregate_function, void* arg, uint32_t* precord_count);
+};
@@ -0,0 +1,432 @@
+#include <string.h>
+#include <time.h>
+
+#include "esp_log.h"
+
+#include "sensor_sample.h"
+#include "sensor_log_retention.h"
+
+SENSOR_LOG_RETENTION::SENSOR_LOG_RETENTION(){
+  esp_log_level_set(SENSOR_LOG_RETENTION_TAG, ESP_LOG_INFO);
+  ESP_LOGI(SENSOR_LOG_RETENTION_TAG, "set SENSOR_LOG_RETENTION_TAG log level: %d", ESP_LOG_INFO);
+}
+
+esp_err_t SENSOR_LOG_RETENTION::init(SD_CARD* psd_card, const char* pdirectory, size_t directory_size, const retention_config_t* pconfig){
+  esp_err_t r = ESP_OK;
+  if(pconfig->raw_retention_days == 0){
+    ESP_LOGE(SENSOR_LOG_RETENTION_TAG, "raw samples must be kept at least one day.");
+    r = ESP_ERR_INVALID_ARG;
+  }
+  if((r == ESP_OK) && (strnlen(pdirectory, directory_size) >= sizeof(mdirectory))){
+    ESP_LOGE(SENSOR_LOG_RETENTION_TAG, "log directory path is too large.");
+    r = ESP_ERR_INVALID_ARG;
+  }
+  if(r == ESP_OK){
+    this->psd_card = psd_card;
+    mconfig = *pconfig;
+    strncpy(mdirectory, pdirectory, sizeof(mdirectory) - 1);
+  }
+  return r;
+}
+
+esp_err_t SENSOR_LOG_RETENTION::create_task(const char* pname, uint16_t stack_size, UBaseType_t task_priority){
+  esp_err_t r = ESP_OK;
+  BaseType_t r2 = pdTRUE;
+  if(psd_card == NULL){
+    ESP_LOGE(SENSOR_LOG_RETENTION_TAG, "retention is not initialized.");
+    r = ESP_ERR_INVALID_STATE;
+  }
+  if(r == ESP_OK){
+    r2 = xTaskCreate(get_retention_task_entry_point, pname, stack_size, this, task_priority, &task_handle);
+    if(r2 != pdTRUE){
+      ESP_LOGE(SENSOR_LOG_RETENTION_TAG, "fail to create retention_task.");
+      r = ESP_FAIL;
+    }
+  }
+  return r;
+}
+
+bool SENSOR_LOG_RETENTION::is_expired(uint32_t segment_start, uint32_t retention_days){
+  return (retention_days > 0) && (segment_start <= mscan_today) &&
+      ((mscan_today - segment_start) / sensor_log::LOG_SEGMENT_DURATION >= retention_days);
+}
+
+// the clock of the segments before the sntp synchronization restarts at every boot, so they
+// get new blocks after they were packed. they are only compacted.
+bool SENSOR_LOG_RETENTION::is_pack_due(uint32_t segment_start){
+  SD_FILE packed_file;
+  if((segment_start < sensor_data::SYNCED_TIME_MIN) || !is_expired(segment_start, mconfig.pack_after_days)){
+    return false;
+  }
+  // a raw segment next to its packed segment got blocks after the packing, e.g. after the clock
+  // stepped back, or was not removed before a reset. it stays until the compaction.
+  if(open_file(segment_start, sensor_log::LOG_PACKED_EXTENSION, 'r', &packed_file) == ESP_OK){
+    return false;
+  }
+  return true;
+}
+
+void SENSOR_LOG_RETENTION::scan_entry(const char* pname){
+  uint32_t segment_start = 0;
+  const char* pextension = NULL;
+  action_e action = action_e::NONE;
+
+  if(!sensor_log::parse_log_segment_name(pname, &segment_start, &pextension)){
+    return;
+  }
+  if((strcmp(pextension, sensor_log::LOG_SEGMENT_EXTENSION) == 0) || (strcmp(pextension, sensor_log::LOG_INDEX_EXTENSION) == 0)){
+    if(is_expired(segment_start, mconfig.raw_retention_days)){
+      action = action_e::COMPACT;
+    }
+    else if((strcmp(pextension, sensor_log::LOG_SEGMENT_EXTENSION) == 0) && is_pack_due(segment_start)){
+      action = action_e::PACK;
+    }
+  }
+  else if((strcmp(pextension, sensor_log::LOG_PACKED_EXTENSION) == 0) || (strcmp(pextension, sensor_log::LOG_PACKING_EXTENSION) == 0)){
+    action = is_expired(segment_start, mconfig.raw_retention_days) ? action_e::COMPACT : action_e::NONE;
+  }
+  else if(strcmp(pextension, sensor_log::LOG_MINUTE_EXTENSION) == 0){
+    action = is_expired(segment_start, mconfig.minute_retention_days) ? action_e::REMOVE_MINUTE : action_e::NONE;
+  }
+  else if(strcmp(pextension, sensor_log::LOG_HOUR_EXTENSION) == 0){
+    action = is_expired(segment_start, mconfig.hour_retention_days) ? action_e::REMOVE_HOUR : action_e::NONE;
+  }
+  if((action != action_e::NONE) && ((mnext_action == action_e::NONE) || (segment_start < mnext_segment_start))){
+    mnext_action = action;
+    mnext_segment_start = segment_start;
+  }
+}
+
+void SENSOR_LOG_RETENTION::get_scan_entry_entry_point(void* arg, const char* pname){
+  SENSOR_LOG_RETENTION* pinstance = static_cast<SENSOR_LOG_RETENTION*>(arg);
+  pinstance->scan_entry(pname);
+}
+
+// files are not removed while the directory is read, so every action starts a new scan.
+esp_err_t SENSOR_LOG_RETENTION::find_next_action(uint32_t today){
+  mscan_today = today;
+  mnext_action = action_e::NONE;
+  mnext_segment_start = 0;
+  return psd_card->list_directory(mdirectory, sizeof(mdirectory), get_scan_entry_entry_point, this);
+}
+
+esp_err_t SENSOR_LOG_RETENTION::open_file(uint32_t segment_start, const char* pextension, char mode, SD_FILE* pfile){
+  esp_err_t r = ESP_OK;
+  char path[LOG_PATH_SIZE] = {};
+  if(!sensor_log::make_log_segment_path(path, sizeof(path), mdirectory, segment_start, pextension)){
+    r = ESP_ERR_INVALID_SIZE;
+  }
+  if(r == ESP_OK){
+    r = psd_card->open_file(path, sizeof(path), mode, pfile);
+  }
+  return r;
+}
+
+esp_err_t SENSOR_LOG_RETENTION::remove_file(uint32_t segment_start, const char* pextension){
+  esp_err_t r = ESP_OK;
+  char path[LOG_PATH_SIZE] = {};
+  if(!sensor_log::make_log_segment_path(path, sizeof(path), mdirectory, segment_start, pextension)){
+    r = ESP_ERR_INVALID_SIZE;
+  }
+  if(r == ESP_OK){
+    r = psd_card->remove_file(path, sizeof(path));
+  }
+  return (r == ESP_ERR_NOT_FOUND) ? ESP_OK : r;
+}
+
+esp_err_t SENSOR_LOG_RETENTION::rename_file(uint32_t segment_start, const char* pold_extension, const char* pnew_extension){
+  esp_err_t r = ESP_OK;
+  char old_path[LOG_PATH_SIZE] = {};
+  char new_path[LOG_PATH_SIZE] = {};
+  if(!sensor_log::make_log_segment_path(old_path, sizeof(old_path), mdirectory, segment_start, pold_extension) ||
+      !sensor_log::make_log_segment_path(new_path, sizeof(new_path), mdirectory, segment_start, pnew_extension)){
+    r = ESP_ERR_INVALID_SIZE;
+  }
+  if(r == ESP_OK){
+    r = psd_card->rename_file(old_path, sizeof(old_path), new_path, sizeof(new_path));
+  }
+  return r;
+}
+
+// *plast_sequence is the one of the last valid block, if *phas_blocks.
+esp_err_t SENSOR_LOG_RETENTION::aggregate_blocks(SD_FILE* pfile, bool* phas_blocks, uint32_t* plast_sequence, uint32_t* psample_count){
+  esp_err_t r = ESP_OK;
+  sensor_data::sensor_sample_t sample {};
+  size_t read_size = 0;
+
+  *phas_blocks = false;
+  while((r == ESP_OK) && ((r = pfile->read(mblock, sizeof(mblock), &read_size)) == ESP_OK) && (read_size == sizeof(mblock))){
+    // torn blocks are lost with the raw segment. an untrimmed preallocated segment ends with empty blocks.
+    const LOG_BLOCK_DECODER::block_state_e state = mdecoder.open(mblock);
+    if(state == LOG_BLOCK_DECODER::block_state_e::EMPTY){
+      break;
+    }
+    if(state != LOG_BLOCK_DECODER::block_state_e::VALID){
+      continue;
+    }
+    *phas_blocks = true;
+    *plast_sequence = mdecoder.get_header()->sequence;
+    if(has_packed_blocks && (mdecoder.get_header()->sequence <= mpacked_last_sequence)){
+      continue;
+    }
+    while((r == ESP_OK) && mdecoder.next(&sample)){
+      r = mminute_aggregator.add(&sample);
+      if(r == ESP_OK){
+        r = mhour_aggregator.add(&sample);
+      }
+      (*psample_count)++;
+    }
+  }
+  return r;
+}
+
+// ppacked_file or pfile may be closed. the raw blocks that were packed are skipped.
+esp_err_t SENSOR_LOG_RETENTION::aggregate_segment(SD_FILE* ppacked_file, SD_FILE* pfile, SD_FILE* pminute_file, SD_FILE* phour_file, uint32_t* psample_count){
+  esp_err_t r = ESP_OK;
+  bool has_blocks = false;
+  uint32_t last_sequence = 0;
+
+  mminute_aggregator.begin(pminute_file, sensor_log::LOG_MINUTE_INTERVAL);
+  mhour_aggregator.begin(phour_file, sensor_log::LOG_HOUR_INTERVAL);
+  has_packed_blocks = false;
+  if(ppacked_file->is_open()){
+    r = aggregate_blocks(ppacked_file, &has_blocks, &last_sequence, psample_count);
+    has_packed_blocks = has_blocks;
+    mpacked_last_sequence = last_sequence;
+  }
+  if((r == ESP_OK) && pfile->is_open()){
+    r = aggregate_blocks(pfile, &has_blocks, &last_sequence, psample_count);
+  }
+  has_packed_blocks = false;
+  if(r == ESP_OK){
+    r = mminute_aggregator.finish();
+  }
+  if(r == ESP_OK){
+    r = mhour_aggregator.finish();
+  }
+  return r;
+}
+
+esp_err_t SENSOR_LOG_RETENTION::close_written_file(SD_FILE* pfile){
+  esp_err_t r = ESP_OK;
+  if(!pfile->is_open()){
+    return r;
+  }
+  r = pfile->sync();
+  if(pfile->close() != ESP_OK){
+    r = ESP_FAIL;
+  }
+  return r;
+}
+
+esp_err_t SENSOR_LOG_RETENTION::compact_segment(uint32_t segment_start){
+  esp_err_t r = ESP_OK;
+  SD_FILE packed_file;
+  SD_FILE file;
+  SD_FILE minute_file;
+  SD_FILE hour_file;
+  uint32_t sample_count = 0;
+
+  r = open_file(segment_start, sensor_log::LOG_PACKED_EXTENSION, 'r', &packed_file);
+  if(r == ESP_ERR_NOT_FOUND){
+    r = ESP_OK;
+  }
+  if(r == ESP_OK){
+    r = open_file(segment_start, sensor_log::LOG_SEGMENT_EXTENSION, 'r', &file);
+  }
+  if((r == ESP_ERR_NOT_FOUND) && packed_file.is_open()){
+    r = ESP_OK;
+  }
+  // 'w' makes a repeated compaction after a reset start over.
+  if(r == ESP_OK){
+    r = open_file(segment_start, sensor_log::LOG_MINUTE_EXTENSION, 'w', &minute_file);
+  }
+  if(r == ESP_OK){
+    r = minute_file.set_buffer(NULL, WRITE_BUFFER_SIZE);
+  }
+  if(r == ESP_OK){
+    r = open_file(segment_start, sensor_log::LOG_HOUR_EXTENSION, 'w', &hour_file);
+  }
+  if(r == ESP_OK){
+    r = hour_file.set_buffer(NULL, WRITE_BUFFER_SIZE);
+  }
+  if(r == ESP_OK){
+    r = aggregate_segment(&packed_file, &file, &minute_file, &hour_file, &sample_count);
+  }
+  // all closed before the files are removed.
+  packed_file.close();
+  file.close();
+  const esp_err_t minute_result = close_written_file(&minute_file);
+  const esp_err_t hour_result = close_written_file(&hour_file);
+  if(r == ESP_OK){
+    r = (minute_result != ESP_OK) ? minute_result : hour_result;
+  }
+  if(r == ESP_OK){
+    ESP_LOGI(SENSOR_LOG_RETENTION_TAG, "compact segment %lu: %lu samples to %lu + %lu records.", segment_start / sensor_log::LOG_SEGMENT_DURATION,
+        sample_count, mminute_aggregator.get_record_count(), mhour_aggregator.get_record_count());
+  }
+  // an index or an unfinished packing without its segment is removed alone.
+  // the raw segment goes first. if a reset comes before the packed segment is removed, the blocks
+  // the raw segment got after the packing are lost, not the whole day.
+  if((r == ESP_OK) || (r == ESP_ERR_NOT_FOUND)){
+    r = remove_file(segment_start, sensor_log::LOG_SEGMENT_EXTENSION);
+  }
+  if(r == ESP_OK){
+    r = remove_file(segment_start, sensor_log::LOG_INDEX_EXTENSION);
+  }
+  if(r == ESP_OK){
+    r = remove_file(segment_start, sensor_log::LOG_PACKED_EXTENSION);
+  }
+  if(r == ESP_OK){
+    r = remove_file(segment_start, sensor_log::LOG_PACKING_EXTENSION);
+  }
+  return r;
+}
+
+esp_err_t SENSOR_LOG_RETENTION::write_packed_block(SD_FILE* ppacked_file, uint32_t sequence, uint32_t* ppacked_block_count){
+  esp_err_t r = ESP_OK;
+  mencoder.set_sequence(sequence);
+  mencoder.finish();
+  r = ppacked_file->write(mpacked_block, sizeof(mpacked_block));
+  (*ppacked_block_count)++;
+  return r;
+}
+
+esp_err_t SENSOR_LOG_RETENTION::pack_blocks(SD_FILE* pfile, SD_FILE* ppacked_file, uint32_t* pblock_count, uint32_t* ppacked_block_count){
+  esp_err_t r = ESP_OK;
+  sensor_data::sensor_sample_t sample {};
+  size_t read_size = 0;
+  // of the raw block holding the last record of the packed block
+  uint32_t last_sequence = 0;
+  uint32_t skipped_count = 0;
+
+  mencoder.begin(mpacked_block, 0, sensor_log::LOG_PACKED_FORMAT_VERSION);
+  while((r == ESP_OK) && ((r = pfile->read(mblock, sizeof(mblock), &read_size)) == ESP_OK) && (read_size == sizeof(mblock))){
+    // torn blocks are lost. an untrimmed preallocated segment ends with empty blocks.
+    const LOG_BLOCK_DECODER::block_state_e state = mdecoder.open(mblock);
+    if(state == LOG_BLOCK_DECODER::block_state_e::EMPTY){
+      break;
+    }
+    if(state != LOG_BLOCK_DECODER::block_state_e::VALID){
+      continue;
+    }
+    (*pblock_count)++;
+    while((r == ESP_OK) && mdecoder.next(&sample)){
+      esp_err_t r2 = mencoder.add(&sample);
+      if(r2 == ESP_ERR_NO_MEM){
+        r = write_packed_block(ppacked_file, last_sequence, ppacked_block_count);
+        mencoder.begin(mpacked_block, 0, sensor_log::LOG_PACKED_FORMAT_VERSION);
+        r2 = mencoder.add(&sample);
+      }
+      if(r2 == ESP_OK){
+        last_sequence = mdecoder.get_header()->sequence;
+      }
+      else{
+        skipped_count++;
+      }
+    }
+  }
+  if((r == ESP_OK) && !mencoder.is_empty()){
+    r = write_packed_block(ppacked_file, last_sequence, ppacked_block_count);
+  }
+  if(skipped_count > 0){
+    ESP_LOGW(SENSOR_LOG_RETENTION_TAG, "skip %lu samples of unknown sensors.", skipped_count);
+  }
+  return r;
+}
+
+esp_err_t SENSOR_LOG_RETENTION::pack_segment(uint32_t segment_start){
+  esp_err_t r = ESP_OK;
+  SD_FILE file;
+  SD_FILE packed_file;
+  uint32_t block_count = 0;
+  uint32_t packed_block_count = 0;
+
+  r = open_file(segment_start, sensor_log::LOG_SEGMENT_EXTENSION, 'r', &file);
+  // 'w' makes a repeated packing after a reset start over.
+  if(r == ESP_OK){
+    r = open_file(segment_start, sensor_log::LOG_PACKING_EXTENSION, 'w', &packed_file);
+  }
+  if(r == ESP_OK){
+    r = packed_file.set_buffer(NULL, WRITE_BUFFER_SIZE);
+  }
+  if(r == ESP_OK){
+    r = pack_blocks(&file, &packed_file, &block_count, &packed_block_count);
+  }
+  // closed before the files are renamed and removed.
+  file.close();
+  const esp_err_t close_result = close_written_file(&packed_file);
+  if(r == ESP_OK){
+    r = close_result;
+  }
+  // readers see the packed segment only complete.
+  if(r == ESP_OK){
+    r = rename_file(segment_start, sensor_log::LOG_PACKING_EXTENSION, sensor_log::LOG_PACKED_EXTENSION);
+  }
+  if(r == ESP_OK){
+    ESP_LOGI(SENSOR_LOG_RETENTION_TAG, "pack segment %lu: %lu blocks to %lu blocks.", segment_start / sensor_log::LOG_SEGMENT_DURATION,
+        block_count, packed_block_count);
+    r = remove_file(segment_start, sensor_log::LOG_SEGMENT_EXTENSION);
+  }
+  if(r == ESP_OK){
+    r = remove_file(segment_start, sensor_log::LOG_INDEX_EXTENSION);
+  }
+  return r;
+}
+
+esp_err_t SENSOR_LOG_RETENTION::apply(uint32_t now){
+  esp_err_t r = ESP_OK;
+  if(now < sensor_data::SYNCED_TIME_MIN){
+    // the age of the segments is not known yet.
+    r = ESP_ERR_INVALID_STATE;
+  }
+  const uint32_t today = sensor_log::get_log_segment_start(now);
+  while(r == ESP_OK){
+    // the logger unmounts a failing card. the lock keeps the card mounted until the files
+    // of this action are closed. without a card the retention waits for the next check.
+    r = psd_card->lock();
+    if(r != ESP_OK){
+      break;
+    }
+    r = find_next_action(today);
+    if((r != ESP_OK) || (mnext_action == action_e::NONE)){
+      psd_card->unlock();
+      break;
+    }
+    switch(mnext_action){
+      case action_e::PACK:
+        r = pack_segment(mnext_segment_start);
+        break;
+      case action_e::COMPACT:
+        r = compact_segment(mnext_segment_start);
+        break;
+      case action_e::REMOVE_MINUTE:
+        r = remove_file(mnext_segment_start, sensor_log::LOG_MINUTE_EXTENSION);
+        break;
+      case action_e::REMOVE_HOUR:
+        r = remove_file(mnext_segment_start, sensor_log::LOG_HOUR_EXTENSION);
+        break;
+      case action_e::NONE:
+        break;
+    }
+    psd_card->unlock();
+    if(r != ESP_OK){
+      ESP_LOGE(SENSOR_LOG_RETENTION_TAG, "fail to apply the retention to segment %lu. error:%s",
+          mnext_segment_start / sensor_log::LOG_SEGMENT_DURATION, esp_err_to_name(r));
+    }
+  }
+  return r;
+}
+
+void SENSOR_LOG_RETENTION::retention_task(){
+  while(true){
+    apply(static_cast<uint32_t>(time(NULL)));
+    vTaskDelay(pdMS_TO_TICKS(mconfig.check_interval));
+  }
+  vTaskDelete(NULL);
+}
+
+void SENSOR_LOG_RETENTION::get_retention_task_entry_point(void* arg){
+  SENSOR_LOG_RETENTION* pinstance = static_cast<SENSOR_LOG_RETENTION*>(arg);
+  pinstance->retention_task();
+}
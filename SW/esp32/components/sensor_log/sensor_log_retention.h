@@ -0,0 +1,92 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+
+#include "sd_card.h"
+#include "sensor_log_format.h"
+#include "log_block_decoder.h"
+#include "log_block_encoder.h"
+#include "log_aggregator.h"
+
+// bounds the size of the sensor log on the sd card from a low priority task.
+// raw segments older than pack_after_days are packed (sensor_log_format.h) to about a third
+// of their size. raw segments older than raw_retention_days are compacted into 1 minute and
+// 1 hour aggregates and then removed. the aggregates are removed after their own retention time.
+// packed segments and aggregates are written completely before the raw segment is removed,
+// so a reset in between only repeats the work.
+class SENSOR_LOG_RETENTION{
+  public:
+    typedef struct{
+      uint32_t pack_after_days;       // 0 keeps the raw segments unpacked. the segment of today is never packed
+      uint32_t raw_retention_days;    // at least 1, the segment of today is never compacted
+      uint32_t minute_retention_days; // 0 keeps the 1 minute aggregates
+      uint32_t hour_retention_days;   // 0 keeps the 1 hour aggregates
+      uint32_t check_interval;        // [ms]
+    }retention_config_t;
+
+  private:
+    constexpr static const char* SENSOR_LOG_RETENTION_TAG = "sensor_log_retention";
+    constexpr static size_t LOG_DIRECTORY_SIZE {32};
+    constexpr static size_t LOG_PATH_SIZE {LOG_DIRECTORY_SIZE + sensor_log::LOG_SEGMENT_NAME_SIZE};
+    // stdio buffer of an aggregate or packed file being written
+    constexpr static size_t WRITE_BUFFER_SIZE {4096};
+
+    enum class action_e{
+      NONE,
+      PACK,
+      COMPACT,        // raw or packed segment, or an index left without its segment
+      REMOVE_MINUTE,
+      REMOVE_HOUR,
+    };
+
+    SD_CARD* psd_card {NULL};
+    char mdirectory[LOG_DIRECTORY_SIZE] {};
+    retention_config_t mconfig {};
+    TaskHandle_t task_handle {NULL};
+
+    // owned by the retention task
+    uint8_t mblock[sensor_log::LOG_BLOCK_SIZE] {};
+    LOG_BLOCK_DECODER mdecoder;
+    uint8_t mpacked_block[sensor_log::LOG_BLOCK_SIZE] {};
+    LOG_BLOCK_ENCODER mencoder;
+    // raw blocks up to this sequence were aggregated from the packed segment of the day
+    bool has_packed_blocks {false};
+    uint32_t mpacked_last_sequence {0};
+    LOG_AGGREGATOR mminute_aggregator;
+    LOG_AGGREGATOR mhour_aggregator;
+    // result of the directory scan, the oldest expired file
+    uint32_t mscan_today {0};
+    action_e mnext_action {action_e::NONE};
+    uint32_t mnext_segment_start {0};
+
+    bool is_expired(uint32_t segment_start, uint32_t retention_days);
+    bool is_pack_due(uint32_t segment_start);
+    void scan_entry(const char* pname);
+    static void get_scan_entry_entry_point(void* arg, const char* pname);
+    esp_err_t find_next_action(uint32_t today);
+    esp_err_t open_file(uint32_t segment_start, const char* pextension, char mode, SD_FILE* pfile);
+    esp_err_t remove_file(uint32_t segment_start, const char* pextension);
+    esp_err_t rename_file(uint32_t segment_start, const char* pold_extension, const char* pnew_extension);
+    esp_err_t aggregate_blocks(SD_FILE* pfile, bool* phas_blocks, uint32_t* plast_sequence, uint32_t* psample_count);
+    esp_err_t aggregate_segment(SD_FILE* ppacked_file, SD_FILE* pfile, SD_FILE* pminute_file, SD_FILE* phour_file, uint32_t* psample_count);
+    esp_err_t close_written_file(SD_FILE* pfile);
+    esp_err_t compact_segment(uint32_t segment_start);
+    esp_err_t write_packed_block(SD_FILE* ppacked_file, uint32_t sequence, uint32_t* ppacked_block_count);
+    esp_err_t pack_blocks(SD_FILE* pfile, SD_FILE* ppacked_file, uint32_t* pblock_count, uint32_t* ppacked_block_count);
+    esp_err_t pack_segment(uint32_t segment_start);
+
+    void retention_task();
+    static void get_retention_task_entry_point(void* arg);
+
+  public:
+    SENSOR_LOG_RETENTION();
+
+    esp_err_t init(SD_CARD* psd_card, const char* pdirectory, size_t directory_size, const retention_config_t* pconfig);
+    esp_err_t create_task(const char* pname, uint16_t stack_size, UBaseType_t task_priority);
+
+    // applies the retention to every file of the log directory. now is unix time [s].
+    // ESP_ERR_INVALID_STATE before the clock is synchronized or without a card.
+    esp_err_t apply(uint32_t now);
+};
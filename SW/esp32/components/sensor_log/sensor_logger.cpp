@@ -0,0 +1,877 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "sensor_logger.h"
+
+SENSOR_LOGGER::SENSOR_LOGGER(){
+  esp_log_level_set(SENSOR_LOGGER_TAG, ESP_LOG_INFO);
+  ESP_LOGI(SENSOR_LOGGER_TAG, "set SENSOR_LOGGER_TAG log level: %d", ESP_LOG_INFO);
+}
+
+SENSOR_LOGGER::~SENSOR_LOGGER(){
+  close_segment();
+}
+
+esp_err_t SENSOR_LOGGER::init(SD_CARD* psd_card, const char* pdirectory, size_t directory_size, const logger_config_t* pconfig){
+  esp_err_t r = ESP_OK;
+  if((pconfig->flush_block_size == 0) || ((pconfig->flush_block_size % sensor_log::LOG_BLOCK_SIZE) != 0)){
+    ESP_LOGE(SENSOR_LOGGER_TAG, "the flush block size must be a multiple of %d bytes.", (int)sensor_log::LOG_BLOCK_SIZE);
+    r = ESP_ERR_INVALID_ARG;
+  }
+  if((r == ESP_OK) && (((pconfig->backlog_size % sensor_log::LOG_BLOCK_SIZE) != 0) || (pconfig->backlog_size < pconfig->flush_block_size))){
+    ESP_LOGE(SENSOR_LOGGER_TAG, "the backlog size must be a multiple of %d bytes and hold a flush block.", (int)sensor_log::LOG_BLOCK_SIZE);
+    r = ESP_ERR_INVALID_ARG;
+  }
+  // a flush must not overwrite the journal blocks it writes.
+  if((r == ESP_OK) && (((pconfig->journal_size % sensor_log::LOG_BLOCK_SIZE) != 0) || (pconfig->journal_size < pconfig->flush_block_size))){
+    ESP_LOGE(SENSOR_LOGGER_TAG, "the journal size must be a multiple of %d bytes and hold a flush block.", (int)sensor_log::LOG_BLOCK_SIZE);
+    r = ESP_ERR_INVALID_ARG;
+  }
+  if((r == ESP_OK) && ((pconfig->segment_preallocation_size % sensor_log::LOG_BLOCK_SIZE) != 0)){
+    ESP_LOGE(SENSOR_LOGGER_TAG, "the segment preallocation size must be a multiple of %d bytes.", (int)sensor_log::LOG_BLOCK_SIZE);
+    r = ESP_ERR_INVALID_ARG;
+  }
+  if((r == ESP_OK) && (strnlen(pdirectory, directory_size) >= sizeof(mdirectory))){
+    ESP_LOGE(SENSOR_LOGGER_TAG, "log directory path is too large.");
+    r = ESP_ERR_INVALID_ARG;
+  }
+  if(r == ESP_OK){
+    this->psd_card = psd_card;
+    mconfig = *pconfig;
+    strncpy(mdirectory, pdirectory, sizeof(mdirectory) - 1);
+    mbacklog_block_count = mconfig.backlog_size / sensor_log::LOG_BLOCK_SIZE;
+    ring_buffer = xRingbufferCreate(mconfig.buffer_size, RINGBUF_TYPE_NOSPLIT);
+    pflush_block = static_cast<uint8_t*>(malloc(mconfig.backlog_size));
+    pindex_entries = static_cast<sensor_log::log_index_entry_t*>(malloc(mbacklog_block_count * sizeof(sensor_log::log_index_entry_t)));
+    if((ring_buffer == NULL) || (pflush_block == NULL) || (pindex_entries == NULL)){
+      ESP_LOGE(SENSOR_LOGGER_TAG, "fail to allocate the log buffers.");
+      r = ESP_ERR_NO_MEM;
+    }
+  }
+  if(r == ESP_OK){
+    begin_block();
+  }
+  // without a card the samples stay in the backlog until the writer task can mount one.
+  if((r == ESP_OK) && (!psd_card->is_mounted() || (attach() != ESP_OK))){
+    ESP_LOGW(SENSOR_LOGGER_TAG, "no sd card. keep up to %u blocks in ram.", (unsigned)mbacklog_block_count);
+  }
+  return r;
+}
+
+// mounts the card if needed and opens the journal. the first time also recovers the log.
+esp_err_t SENSOR_LOGGER::attach(){
+  esp_err_t r = ESP_OK;
+  char journal_path[LOG_PATH_SIZE] = {};
+
+  if(!psd_card->is_mounted()){
+    r = psd_card->mount();
+    if(r == ESP_OK){
+      portENTER_CRITICAL(&mlock);
+      mstats.remount_count++;
+      portEXIT_CRITICAL(&mlock);
+    }
+  }
+  if(r == ESP_OK){
+    r = psd_card->make_directory(mdirectory, sizeof(mdirectory));
+    if(r != ESP_OK){
+      ESP_LOGE(SENSOR_LOGGER_TAG, "fail to create %s.", mdirectory);
+    }
+  }
+  if(r == ESP_OK){
+    snprintf(journal_path, sizeof(journal_path), "%s/%s", mdirectory, JOURNAL_FILE_NAME);
+    r = mjournal.open(psd_card, journal_path, sizeof(journal_path), mconfig.journal_size / sensor_log::LOG_BLOCK_SIZE, mjournal_block);
+  }
+  if((r == ESP_OK) && !is_recovered){
+    if(!mencoder.is_empty()){
+      finish_block();
+    }
+    r = recover();
+    if(r == ESP_OK){
+      renumber_staged_blocks();
+      begin_block();
+      is_recovered = true;
+    }
+  }
+  if(r == ESP_OK){
+    is_attached = true;
+    ESP_LOGI(SENSOR_LOGGER_TAG, "sd card ready, %u blocks in the backlog.", (unsigned)mstaged_block_count);
+  }
+  else{
+    detach();
+  }
+  return r;
+}
+
+// forgets every file of the card. the next attach() mounts it again, which also finds a replaced card.
+// unmount() waits until the other tasks with files open, e.g. the retention, release their lock.
+void SENSOR_LOGGER::detach(){
+  close_segment();
+  mjournal.close();
+  is_attached = false;
+  psd_card->unmount();
+}
+
+void SENSOR_LOGGER::find_newest_segment(const char* pname){
+  uint32_t segment_start = 0;
+  const char* pextension = NULL;
+  if(sensor_log::parse_log_segment_name(pname, &segment_start, &pextension) &&
+      (strcmp(pextension, sensor_log::LOG_SEGMENT_EXTENSION) == 0) &&
+      (!has_newest_segment || (segment_start > mnewest_segment_start))){
+    has_newest_segment = true;
+    mnewest_segment_start = segment_start;
+  }
+}
+
+void SENSOR_LOGGER::get_find_newest_segment_entry_point(void* arg, const char* pname){
+  SENSOR_LOGGER* pinstance = static_cast<SENSOR_LOGGER*>(arg);
+  pinstance->find_newest_segment(pname);
+}
+
+// entries in the index of a segment, 0 if it has no index.
+uint32_t SENSOR_LOGGER::get_index_entry_count(uint32_t segment_start){
+  char path[LOG_PATH_SIZE] = {};
+  SD_FILE index_file;
+  long index_size = 0;
+
+  if(sensor_log::make_log_segment_path(path, sizeof(path), mdirectory, segment_start, sensor_log::LOG_INDEX_EXTENSION) &&
+      (psd_card->open_file(path, sizeof(path), 'r', &index_file) == ESP_OK)){
+    // the size is 0 on an error.
+    index_file.get_size(&index_size);
+  }
+  return index_size / sizeof(sensor_log::log_index_entry_t);
+}
+
+// sequence of the last valid block before end_block_index. ESP_ERR_NOT_FOUND if there is none.
+esp_err_t SENSOR_LOGGER::find_last_sequence(SD_FILE* psegment_file, uint32_t end_block_index, uint32_t* psequence){
+  esp_err_t r = ESP_ERR_NOT_FOUND;
+  size_t read_size = 0;
+  // usually the last block is valid, a torn one is skipped.
+  for(long block_index = (long)end_block_index - 1; (r == ESP_ERR_NOT_FOUND) && (block_index >= 0); block_index--){
+    if((psegment_file->read_at(block_index * sensor_log::LOG_BLOCK_SIZE, mread_block, sizeof(mread_block), &read_size) != ESP_OK) ||
+        (read_size != sizeof(mread_block))){
+      r = ESP_FAIL;
+    }
+    else if(mdecoder.open(mread_block) == LOG_BLOCK_DECODER::block_state_e::VALID){
+      *psequence = mdecoder.get_header()->sequence;
+      r = ESP_OK;
+    }
+  }
+  return r;
+}
+
+// sequence of the last valid block of a segment. ESP_ERR_NOT_FOUND if it has none.
+esp_err_t SENSOR_LOGGER::get_segment_last_sequence(uint32_t segment_start, uint32_t* psequence){
+  esp_err_t r = ESP_OK;
+  char path[LOG_PATH_SIZE] = {};
+  SD_FILE segment_file;
+  long file_size = 0;
+  uint32_t end_block_index = 0;
+
+  if(!sensor_log::make_log_segment_path(path, sizeof(path), mdirectory, segment_start, sensor_log::LOG_SEGMENT_EXTENSION)){
+    r = ESP_ERR_INVALID_SIZE;
+  }
+  if(r == ESP_OK){
+    r = psd_card->open_file(path, sizeof(path), 'r', &segment_file);
+  }
+  if(r == ESP_OK){
+    r = segment_file.get_size(&file_size);
+  }
+  if(r == ESP_OK){
+    r = find_segment_end(&segment_file, file_size, get_index_entry_count(segment_start), &end_block_index);
+  }
+  if(r == ESP_OK){
+    r = find_last_sequence(&segment_file, end_block_index, psequence);
+  }
+  return r;
+}
+
+// a journal block is missing in its segment if it is newer than the last block of the segment.
+bool SENSOR_LOGGER::is_missing_in_segment(uint32_t segment_start, uint32_t sequence){
+  recovery_segment_t* psegment = NULL;
+  for(size_t segment_index = 0; segment_index < RECOVERY_SEGMENT_COUNT; segment_index++){
+    if(mrecovery_segments[segment_index].is_used && (mrecovery_segments[segment_index].segment_start == segment_start)){
+      psegment = &mrecovery_segments[segment_index];
+    }
+  }
+  if(psegment == NULL){
+    psegment = &mrecovery_segments[mrecovery_segment_index];
+    mrecovery_segment_index = (mrecovery_segment_index + 1) % RECOVERY_SEGMENT_COUNT;
+    psegment->is_used = true;
+    psegment->segment_start = segment_start;
+    psegment->has_blocks = (get_segment_last_sequence(segment_start, &psegment->last_sequence) == ESP_OK);
+  }
+  const bool is_missing = !psegment->has_blocks || (sequence > psegment->last_sequence);
+  if(is_missing){
+    psegment->has_blocks = true;
+    psegment->last_sequence = sequence;
+  }
+  return is_missing;
+}
+
+void SENSOR_LOGGER::replay_block(const uint8_t* pblock){
+  sensor_data::sensor_sample_t sample {};
+  if(mdecoder.open(pblock) != LOG_BLOCK_DECODER::block_state_e::VALID){
+    return;
+  }
+  const sensor_log::log_block_header_t header = *mdecoder.get_header();
+  const uint32_t segment_start = sensor_log::get_log_segment_start(header.base_timestamp);
+  if(header.sequence >= mblock_sequence){
+    mblock_sequence = header.sequence + 1;
+  }
+  if((header.record_count == 0) || !is_missing_in_segment(segment_start, header.sequence)){
+    return;
+  }
+  if((mreplay_block_count + 1) * sensor_log::LOG_BLOCK_SIZE > mconfig.flush_block_size){
+    write_segment(preplay_blocks, preplay_entries, mreplay_block_count);
+    mreplay_block_count = 0;
+  }
+  sensor_log::log_index_entry_t* pentry = &preplay_entries[mreplay_block_count];
+  pentry->first_timestamp = header.base_timestamp;
+  // the segment lookup above reuses the decoder.
+  mdecoder.open(pblock);
+  while(mdecoder.next(&sample)){
+    pentry->last_timestamp = sample.timestamp;
+  }
+  memcpy(preplay_blocks + mreplay_block_count * sensor_log::LOG_BLOCK_SIZE, pblock, sensor_log::LOG_BLOCK_SIZE);
+  mreplay_block_count++;
+  portENTER_CRITICAL(&mlock);
+  mstats.recovered_block_count++;
+  portEXIT_CRITICAL(&mlock);
+}
+
+void SENSOR_LOGGER::get_replay_block_entry_point(void* arg, const uint8_t* pblock){
+  SENSOR_LOGGER* pinstance = static_cast<SENSOR_LOGGER*>(arg);
+  pinstance->replay_block(pblock);
+}
+
+// copies the journal blocks lost by a reset into their segments and continues the sequence.
+// the replayed blocks are staged apart from the backlog, which may hold blocks already.
+esp_err_t SENSOR_LOGGER::recover(){
+  esp_err_t r = ESP_OK;
+  uint32_t last_sequence = 0;
+
+  preplay_blocks = static_cast<uint8_t*>(malloc(mconfig.flush_block_size));
+  preplay_entries = static_cast<sensor_log::log_index_entry_t*>(malloc(
+      mconfig.flush_block_size / sensor_log::LOG_BLOCK_SIZE * sizeof(sensor_log::log_index_entry_t)));
+  if((preplay_blocks == NULL) || (preplay_entries == NULL)){
+    r = ESP_ERR_NO_MEM;
+  }
+  // the sequence also continues after the newest segment, in case the journal was removed.
+  mblock_sequence = 0;
+  mreplay_block_count = 0;
+  has_newest_segment = false;
+  if(r == ESP_OK){
+    r = psd_card->list_directory(mdirectory, sizeof(mdirectory), get_find_newest_segment_entry_point, this);
+  }
+  if((r == ESP_OK) && has_newest_segment && (get_segment_last_sequence(mnewest_segment_start, &last_sequence) == ESP_OK)){
+    mblock_sequence = last_sequence + 1;
+  }
+  if(r == ESP_OK){
+    r = mjournal.recover(get_replay_block_entry_point, this, mjournal_block);
+  }
+  if((r == ESP_OK) && (mreplay_block_count > 0)){
+    r = write_segment(preplay_blocks, preplay_entries, mreplay_block_count);
+  }
+  if((r == ESP_OK) && (mjournal.get_next_sequence() > mblock_sequence)){
+    mblock_sequence = mjournal.get_next_sequence();
+  }
+  free(preplay_blocks);
+  free(preplay_entries);
+  preplay_blocks = NULL;
+  preplay_entries = NULL;
+  mreplay_block_count = 0;
+  if(r == ESP_OK){
+    ESP_LOGI(SENSOR_LOGGER_TAG, "recover %lu blocks from the journal, next sequence %lu.", mstats.recovered_block_count, mblock_sequence);
+  }
+  else{
+    ESP_LOGE(SENSOR_LOGGER_TAG, "fail to recover the log from the journal.");
+  }
+  return r;
+}
+
+// blocks encoded before the recovery count from 0. they continue the sequence of the card instead.
+void SENSOR_LOGGER::renumber_staged_blocks(){
+  sensor_log::log_block_header_t header {};
+  for(size_t block_index = 0; block_index < mstaged_block_count; block_index++){
+    uint8_t* pblock = pflush_block + block_index * sensor_log::LOG_BLOCK_SIZE;
+    memcpy(&header, pblock, sizeof(header));
+    header.sequence = mblock_sequence++;
+    header.crc = 0;
+    memcpy(pblock, &header, sizeof(header));
+    header.crc = sensor_log::calculate_crc32(pblock, sensor_log::LOG_BLOCK_SIZE);
+    memcpy(pblock, &header, sizeof(header));
+  }
+}
+
+esp_err_t SENSOR_LOGGER::create_task(const char* pname, uint16_t stack_size, UBaseType_t task_priority){
+  esp_err_t r = ESP_OK;
+  BaseType_t r2 = pdTRUE;
+  if(ring_buffer == NULL){
+    ESP_LOGE(SENSOR_LOGGER_TAG, "logger is not initialized.");
+    r = ESP_ERR_INVALID_STATE;
+  }
+  if(r == ESP_OK){
+    r2 = xTaskCreate(get_writer_task_entry_point, pname, stack_size, this, task_priority, &task_handle);
+    if(r2 != pdTRUE){
+      ESP_LOGE(SENSOR_LOGGER_TAG, "fail to create writer_task.");
+      r = ESP_FAIL;
+    }
+  }
+  return r;
+}
+
+esp_err_t SENSOR_LOGGER::append(const sensor_data::sensor_sample_t* psample){
+  esp_err_t r = ESP_OK;
+  if(ring_buffer == NULL){
+    r = ESP_ERR_INVALID_STATE;
+  }
+  if(r == ESP_OK){
+    if(xRingbufferSend(ring_buffer, psample, sizeof(*psample), 0) != pdTRUE){
+      r = ESP_ERR_NO_MEM;
+    }
+  }
+  if(r == ESP_ERR_NO_MEM){
+    portENTER_CRITICAL(&mlock);
+    mstats.dropped_count++;
+    portEXIT_CRITICAL(&mlock);
+  }
+  // the writer only encodes into ram here. the sd card is written by the flush policy.
+  if((r == ESP_OK) && (task_handle != NULL)){
+    xTaskNotifyGive(task_handle);
+  }
+  return r;
+}
+
+void SENSOR_LOGGER::request_flush(){
+  portENTER_CRITICAL(&mlock);
+  mis_flush_requested = true;
+  portEXIT_CRITICAL(&mlock);
+  if(task_handle != NULL){
+    xTaskNotifyGive(task_handle);
+  }
+}
+
+void SENSOR_LOGGER::get_stats(logger_stats_t* pstats){
+  portENTER_CRITICAL(&mlock);
+  *pstats = mstats;
+  portEXIT_CRITICAL(&mlock);
+}
+
+void SENSOR_LOGGER::log_stats(){
+  logger_stats_t stats {};
+  get_stats(&stats);
+  ESP_LOGI(SENSOR_LOGGER_TAG, "samples:%lu written:%llu bytes in %lu flushes, dropped:%lu, write errors:%lu, recovered blocks:%lu, max flush:%lld us",
+      stats.sample_count, stats.written_bytes, stats.flush_count, stats.dropped_count,
+      stats.write_error_count, stats.recovered_block_count, stats.max_flush_time);
+  ESP_LOGI(SENSOR_LOGGER_TAG, "backlog:%lu blocks (max %lu), lost:%lu, remounts:%lu",
+      stats.backlog_block_count, stats.max_backlog_block_count, stats.lost_count, stats.remount_count);
+  ESP_LOGI(SENSOR_LOGGER_TAG, "journal write p50:%lld p90:%lld p99:%lld max:%lld us, segment write p50:%lld p90:%lld p99:%lld max:%lld us",
+      get_percentile(&stats.journal_write_time, 50), get_percentile(&stats.journal_write_time, 90),
+      get_percentile(&stats.journal_write_time, 99), stats.journal_write_time.max_time,
+      get_percentile(&stats.segment_write_time, 50), get_percentile(&stats.segment_write_time, 90),
+      get_percentile(&stats.segment_write_time, 99), stats.segment_write_time.max_time);
+}
+
+void SENSOR_LOGGER::add_write_time(write_time_histogram_t* phistogram, int64_t write_time){
+  size_t bin = 0;
+  if(write_time > 0){
+    // number of significant bits: 1us -> bin 1, 2..3us -> bin 2, ...
+    bin = 64 - __builtin_clzll(static_cast<uint64_t>(write_time));
+    if(bin >= WRITE_TIME_HISTOGRAM_BINS){
+      bin = WRITE_TIME_HISTOGRAM_BINS - 1;
+    }
+  }
+  phistogram->bins[bin]++;
+  if(write_time > phistogram->max_time){
+    phistogram->max_time = write_time;
+  }
+}
+
+int64_t SENSOR_LOGGER::get_percentile(const write_time_histogram_t* phistogram, uint32_t percent){
+  uint64_t count = 0;
+  for(size_t bin = 0; bin < WRITE_TIME_HISTOGRAM_BINS; bin++){
+    count += phistogram->bins[bin];
+  }
+  // rank of the percentile, rounded up
+  const uint64_t rank = (count * percent + 99) / 100;
+  uint64_t cumulative_count = 0;
+  for(size_t bin = 0; (rank > 0) && (bin < WRITE_TIME_HISTOGRAM_BINS); bin++){
+    cumulative_count += phistogram->bins[bin];
+    if(cumulative_count >= rank){
+      // the last bin is open ended
+      const int64_t upper_bound = (bin == WRITE_TIME_HISTOGRAM_BINS - 1) ? phistogram->max_time : (1LL << bin) - 1;
+      return (upper_bound < phistogram->max_time) ? upper_bound : phistogram->max_time;
+    }
+  }
+  return 0;
+}
+
+void SENSOR_LOGGER::begin_block(){
+  mencoder.begin(mopen_block, mblock_sequence);
+}
+
+void SENSOR_LOGGER::finish_block(){
+  if(mstaged_block_count == mbacklog_block_count){
+    drop_oldest_block();
+  }
+  pindex_entries[mstaged_block_count] = mencoder.get_index_entry();
+  mencoder.finish();
+  memcpy(pflush_block + mstaged_block_count * sensor_log::LOG_BLOCK_SIZE, mopen_block, sensor_log::LOG_BLOCK_SIZE);
+  mstaged_block_count++;
+  mblock_sequence++;
+  portENTER_CRITICAL(&mlock);
+  mstats.backlog_block_count = mstaged_block_count;
+  if(mstaged_block_count > mstats.max_backlog_block_count){
+    mstats.max_backlog_block_count = mstaged_block_count;
+  }
+  portEXIT_CRITICAL(&mlock);
+}
+
+// the backlog is full while the card is away. the newest samples are kept.
+void SENSOR_LOGGER::drop_oldest_block(){
+  sensor_log::log_block_header_t header {};
+  memcpy(&header, pflush_block, sizeof(header));
+  mstaged_block_count--;
+  memmove(pflush_block, pflush_block + sensor_log::LOG_BLOCK_SIZE, mstaged_block_count * sensor_log::LOG_BLOCK_SIZE);
+  memmove(pindex_entries, pindex_entries + 1, mstaged_block_count * sizeof(sensor_log::log_index_entry_t));
+  portENTER_CRITICAL(&mlock);
+  mstats.lost_count += header.record_count;
+  portEXIT_CRITICAL(&mlock);
+}
+
+void SENSOR_LOGGER::encode_sample(const sensor_data::sensor_sample_t* psample){
+  // a block only holds the samples of one utc day, so that it belongs to one segment.
+  if(!mencoder.is_empty() && (sensor_log::get_log_segment_start(psample->timestamp) !=
+      sensor_log::get_log_segment_start(mencoder.get_index_entry().first_timestamp))){
+    finish_block();
+    begin_block();
+  }
+  if(mencoder.is_empty() && (mstaged_block_count == 0)){
+    moldest_sample_time = esp_timer_get_time();
+  }
+  if(mencoder.add(psample) != ESP_OK){
+    finish_block();
+    begin_block();
+    mencoder.add(psample);
+  }
+  portENTER_CRITICAL(&mlock);
+  mstats.sample_count++;
+  portEXIT_CRITICAL(&mlock);
+}
+
+void SENSOR_LOGGER::drain_ring_buffer(){
+  size_t item_size = 0;
+  void* pitem = NULL;
+  while((pitem = xRingbufferReceive(ring_buffer, &item_size, 0)) != NULL){
+    if(item_size == sizeof(sensor_data::sensor_sample_t)){
+      encode_sample(static_cast<const sensor_data::sensor_sample_t*>(pitem));
+    }
+    vRingbufferReturnItem(ring_buffer, pitem);
+  }
+}
+
+bool SENSOR_LOGGER::is_flush_due(int64_t now){
+  bool is_due = false;
+  const bool is_pending = !mencoder.is_empty() || (mstaged_block_count > 0);
+  portENTER_CRITICAL(&mlock);
+  if(is_pending){
+    is_due = mis_flush_requested || ((now - moldest_sample_time) >= (int64_t)mconfig.max_latency * 1000);
+  }
+  mis_flush_requested = false;
+  portEXIT_CRITICAL(&mlock);
+  return is_due;
+}
+
+// a full flush block or a due flush is written, but not before the drain or retry interval.
+bool SENSOR_LOGGER::is_write_due(int64_t now){
+  if(mstaged_block_count == 0){
+    mis_write_pending = false;
+  }
+  const bool is_wanted = mis_write_pending ||
+      (mstaged_block_count * sensor_log::LOG_BLOCK_SIZE >= mconfig.flush_block_size);
+  return is_wanted && (now >= mnext_write_time);
+}
+
+TickType_t SENSOR_LOGGER::get_ticks_until(int64_t deadline, int64_t now){
+  const int64_t wait_time = deadline - now;
+  // round up, so that the writer does not wake up one tick early.
+  return (wait_time > 0) ? pdMS_TO_TICKS((wait_time + 999) / 1000) + 1 : 0;
+}
+
+TickType_t SENSOR_LOGGER::get_flush_wait_ticks(int64_t now){
+  TickType_t wait_ticks = portMAX_DELAY;
+  if(!mencoder.is_empty() || (mstaged_block_count > 0)){
+    wait_ticks = get_ticks_until(moldest_sample_time + (int64_t)mconfig.max_latency * 1000, now);
+  }
+  if((mstaged_block_count > 0) && (mis_write_pending ||
+      (mstaged_block_count * sensor_log::LOG_BLOCK_SIZE >= mconfig.flush_block_size))){
+    const TickType_t write_ticks = get_ticks_until(mnext_write_time, now);
+    if(write_ticks < wait_ticks){
+      wait_ticks = write_ticks;
+    }
+  }
+  return wait_ticks;
+}
+
+// writes one flush block of the backlog. a failing card is mounted again after the retry interval.
+void SENSOR_LOGGER::write_backlog(int64_t now){
+  esp_err_t r = ESP_OK;
+  if(!is_write_due(now)){
+    return;
+  }
+  if(!is_attached){
+    r = attach();
+  }
+  if(r == ESP_OK){
+    r = flush_blocks();
+  }
+  if(r == ESP_OK){
+    if(mstaged_block_count == 0){
+      mis_write_pending = false;
+    }
+    // the rest of a backlog follows in steps, so the writer never keeps the cpu and the card for long.
+    const bool has_backlog = mis_write_pending ||
+        (mstaged_block_count * sensor_log::LOG_BLOCK_SIZE >= mconfig.flush_block_size);
+    mnext_write_time = has_backlog ? now + (int64_t)mconfig.drain_interval * 1000 : 0;
+  }
+  else{
+    if(is_attached){
+      ESP_LOGW(SENSOR_LOGGER_TAG, "the sd card fails. keep %u blocks in ram.", (unsigned)mstaged_block_count);
+      detach();
+    }
+    mnext_write_time = now + (int64_t)mconfig.retry_interval * 1000;
+  }
+}
+
+// writes the oldest flush block of the backlog to the journal, then to the segment.
+// the blocks stay in the backlog until both succeeded.
+esp_err_t SENSOR_LOGGER::flush_blocks(){
+  esp_err_t r = ESP_OK;
+  const size_t flush_block_count = mconfig.flush_block_size / sensor_log::LOG_BLOCK_SIZE;
+  const size_t block_count = (mstaged_block_count < flush_block_count) ? mstaged_block_count : flush_block_count;
+  const size_t write_size = block_count * sensor_log::LOG_BLOCK_SIZE;
+  const int64_t start_time = esp_timer_get_time();
+
+  // once the blocks are in the journal, a reset during the segment write loses nothing.
+  r = mjournal.write(pflush_block, block_count);
+  const int64_t journal_time = esp_timer_get_time();
+  if(r != ESP_OK){
+    ESP_LOGE(SENSOR_LOGGER_TAG, "fail to write %u bytes to the journal.", (unsigned)write_size);
+  }
+  if(r == ESP_OK){
+    r = write_segment(pflush_block, pindex_entries, block_count);
+    if(r != ESP_OK){
+      ESP_LOGE(SENSOR_LOGGER_TAG, "fail to write %u bytes to the log.", (unsigned)write_size);
+    }
+  }
+  const int64_t flush_time = esp_timer_get_time() - start_time;
+  if(r == ESP_OK){
+    mstaged_block_count -= block_count;
+    memmove(pflush_block, pflush_block + write_size, mstaged_block_count * sensor_log::LOG_BLOCK_SIZE);
+    memmove(pindex_entries, pindex_entries + block_count, mstaged_block_count * sizeof(sensor_log::log_index_entry_t));
+    moldest_sample_time = esp_timer_get_time();
+  }
+
+  portENTER_CRITICAL(&mlock);
+  if(r == ESP_OK){
+    mstats.written_bytes += write_size + block_count * sizeof(sensor_log::log_index_entry_t);
+    mstats.flush_count++;
+    add_write_time(&mstats.journal_write_time, journal_time - start_time);
+    add_write_time(&mstats.segment_write_time, start_time + flush_time - journal_time);
+  }
+  else{
+    mstats.write_error_count++;
+  }
+  if(flush_time > mstats.max_flush_time){
+    mstats.max_flush_time = flush_time;
+  }
+  mstats.backlog_block_count = mstaged_block_count;
+  portEXIT_CRITICAL(&mlock);
+  return r;
+}
+
+// writes blocks to their segments, in runs of the same segment. blocks that are in the segment
+// already, e.g. because a failed write still reached the card, are skipped.
+esp_err_t SENSOR_LOGGER::write_segment(const uint8_t* pblocks, sensor_log::log_index_entry_t* pentries, size_t block_count){
+  esp_err_t r = ESP_OK;
+  sensor_log::log_block_header_t header {};
+  size_t block_index = 0;
+
+  while((r == ESP_OK) && (block_index < block_count)){
+    memcpy(&header, pblocks + block_index * sensor_log::LOG_BLOCK_SIZE, sizeof(header));
+    const uint32_t segment_start = sensor_log::get_log_segment_start(header.base_timestamp);
+    if(msegment_file.is_open() && (segment_start != msegment_start)){
+      // the day of the open segment is over.
+      trim_segment();
+      close_segment();
+    }
+    if(!msegment_file.is_open()){
+      msegment_start = segment_start;
+      r = open_segment();
+    }
+    size_t skip_count = 0;
+    size_t run_count = 0;
+    while((r == ESP_OK) && (block_index + skip_count + run_count < block_count)){
+      memcpy(&header, pblocks + (block_index + skip_count + run_count) * sensor_log::LOG_BLOCK_SIZE, sizeof(header));
+      if(sensor_log::get_log_segment_start(header.base_timestamp) != segment_start){
+        break;
+      }
+      if((run_count == 0) && has_segment_sequence && (header.sequence <= msegment_last_sequence)){
+        skip_count++;
+      }
+      else{
+        run_count++;
+      }
+    }
+    if((r == ESP_OK) && (run_count > 0)){
+      r = write_segment_run(pblocks + (block_index + skip_count) * sensor_log::LOG_BLOCK_SIZE,
+          pentries + block_index + skip_count, run_count);
+    }
+    block_index += skip_count + run_count;
+  }
+  if(r != ESP_OK){
+    // reopen on the next write. opening finds the logical end again.
+    close_segment();
+  }
+  return r;
+}
+
+// writes blocks of the open segment at its logical end, then appends their index entries.
+esp_err_t SENSOR_LOGGER::write_segment_run(const uint8_t* pblocks, sensor_log::log_index_entry_t* pentries, size_t block_count){
+  esp_err_t r = ESP_OK;
+  sensor_log::log_block_header_t header {};
+  const size_t write_size = block_count * sensor_log::LOG_BLOCK_SIZE;
+  const size_t index_size = block_count * sizeof(sensor_log::log_index_entry_t);
+  const uint32_t end_block_index = msegment_block_count + block_count;
+
+  // the preallocated clusters after the logical end still hold old data. the block after the
+  // new end is zeroed before the blocks are written, so the end is found whether they land or not.
+  if(end_block_index < msegment_file_block_count){
+    memset(mread_block, 0, sizeof(mread_block));
+    r = msegment_file.write_at((long)end_block_index * sensor_log::LOG_BLOCK_SIZE, mread_block, sizeof(mread_block));
+  }
+  // inside the preallocated clusters fatfs neither searches nor links clusters.
+  if(r == ESP_OK){
+    r = msegment_file.write_at((long)msegment_block_count * sensor_log::LOG_BLOCK_SIZE, pblocks, write_size);
+  }
+  // fsync commits the fat and the directory entry once per flush instead of once per sample.
+  if(r == ESP_OK){
+    r = msegment_file.sync();
+  }
+  // the index only points at blocks that are on the card.
+  if(r == ESP_OK){
+    for(size_t block_index = 0; block_index < block_count; block_index++){
+      pentries[block_index].block_index = msegment_block_count + block_index;
+    }
+    msegment_block_count = end_block_index;
+    if(msegment_file_block_count < end_block_index){
+      msegment_file_block_count = end_block_index;
+    }
+    memcpy(&header, pblocks + write_size - sensor_log::LOG_BLOCK_SIZE, sizeof(header));
+    has_segment_sequence = true;
+    msegment_last_sequence = header.sequence;
+    r = mindex_file.write(pentries, index_size);
+    if(r == ESP_OK){
+      r = mindex_file.sync();
+    }
+  }
+  return r;
+}
+
+// opens a segment file for appending and cuts the end back to a multiple of alignment.
+esp_err_t SENSOR_LOGGER::open_aligned_file(const char* pextension, size_t alignment, SD_FILE* pfile, long* pfile_size){
+  esp_err_t r = ESP_OK;
+  char path[LOG_PATH_SIZE] = {};
+  long file_size = 0;
+
+  if(!sensor_log::make_log_segment_path(path, sizeof(path), mdirectory, msegment_start, pextension)){
+    r = ESP_ERR_INVALID_SIZE;
+  }
+  if(r == ESP_OK){
+    r = psd_card->open_file(path, sizeof(path), 'a', pfile);
+  }
+  if(r == ESP_OK){
+    // the blocks are already as large as a cluster. stdio buffering would only split them.
+    r = pfile->set_buffer(NULL, 0);
+  }
+  if(r == ESP_OK){
+    r = pfile->get_size(&file_size);
+  }
+  if((r == ESP_OK) && ((file_size % alignment) != 0)){
+    ESP_LOGW(SENSOR_LOGGER_TAG, "cut %ld bytes of a torn write from %s.", file_size % (long)alignment, path);
+    file_size -= file_size % alignment;
+    r = pfile->truncate(file_size);
+  }
+  if(r != ESP_OK){
+    ESP_LOGE(SENSOR_LOGGER_TAG, "fail to open %s.", path);
+    pfile->close();
+    file_size = 0;
+  }
+  *pfile_size = file_size;
+  return r;
+}
+
+// reserves contiguous clusters for a new segment. fresh clusters still hold the blocks of
+// removed segments, so the first block is zeroed to mark the logical end. write_segment_run()
+// moves the mark along with the end, the rest is never zeroed.
+esp_err_t SENSOR_LOGGER::preallocate_segment(const char* ppath, size_t path_size){
+  esp_err_t r = ESP_OK;
+  SD_FILE new_file;
+  const int64_t start_time = esp_timer_get_time();
+
+  r = psd_card->create_contiguous_file(ppath, path_size, mconfig.segment_preallocation_size);
+  if(r == ESP_OK){
+    r = psd_card->open_file(ppath, path_size, '+', &new_file);
+  }
+  if(r == ESP_OK){
+    r = new_file.set_buffer(NULL, 0);
+  }
+  if(r == ESP_OK){
+    memset(mread_block, 0, sizeof(mread_block));
+    r = new_file.write(mread_block, sizeof(mread_block));
+  }
+  if(r == ESP_OK){
+    r = new_file.sync();
+  }
+  // closed before a failed file is removed.
+  if(new_file.is_open() && (new_file.close() != ESP_OK)){
+    r = ESP_FAIL;
+  }
+  if(r == ESP_OK){
+    ESP_LOGI(SENSOR_LOGGER_TAG, "preallocate %u bytes for %s in %lld us.", (unsigned)mconfig.segment_preallocation_size,
+        ppath, esp_timer_get_time() - start_time);
+  }
+  else{
+    // the segment still works without, it only allocates clusters while writing.
+    ESP_LOGW(SENSOR_LOGGER_TAG, "fail to preallocate %s.", ppath);
+    psd_card->remove_file(ppath, path_size);
+  }
+  return r;
+}
+
+// opens the segment file for writing at any position. a new one is preallocated.
+esp_err_t SENSOR_LOGGER::open_segment_file(SD_FILE* pfile, long* pfile_size){
+  esp_err_t r = ESP_OK;
+  char path[LOG_PATH_SIZE] = {};
+  long file_size = 0;
+
+  if(!sensor_log::make_log_segment_path(path, sizeof(path), mdirectory, msegment_start, sensor_log::LOG_SEGMENT_EXTENSION)){
+    r = ESP_ERR_INVALID_SIZE;
+  }
+  if(r == ESP_OK){
+    r = psd_card->open_file(path, sizeof(path), '+', pfile);
+  }
+  if(r == ESP_ERR_NOT_FOUND){
+    if((mconfig.segment_preallocation_size > 0) && (preallocate_segment(path, sizeof(path)) == ESP_OK)){
+      r = psd_card->open_file(path, sizeof(path), '+', pfile);
+    }
+    else{
+      r = psd_card->open_file(path, sizeof(path), 'w', pfile);
+    }
+  }
+  if(r == ESP_OK){
+    // the blocks are already as large as a cluster. stdio buffering would only split them.
+    r = pfile->set_buffer(NULL, 0);
+  }
+  if(r == ESP_OK){
+    r = pfile->get_size(&file_size);
+  }
+  if(r != ESP_OK){
+    ESP_LOGE(SENSOR_LOGGER_TAG, "fail to open %s.", path);
+    pfile->close();
+    file_size = 0;
+  }
+  *pfile_size = file_size;
+  return r;
+}
+
+// the logical end is the first empty block at or after first_block_index, or the end of the file.
+// the blocks before the last index entry are written, so the index count is a safe start.
+// a torn block is not empty and stays part of the segment.
+esp_err_t SENSOR_LOGGER::find_segment_end(SD_FILE* psegment_file, long file_size, uint32_t first_block_index, uint32_t* pend_block_index){
+  esp_err_t r = ESP_OK;
+  const uint32_t block_count = file_size / sensor_log::LOG_BLOCK_SIZE;
+  uint32_t block_index = (first_block_index < block_count) ? first_block_index : block_count;
+  size_t read_size = 0;
+
+  r = psegment_file->seek((long)block_index * sensor_log::LOG_BLOCK_SIZE);
+  while((r == ESP_OK) && (block_index < block_count)){
+    r = psegment_file->read(mread_block, sizeof(mread_block), &read_size);
+    if((r == ESP_OK) && (read_size != sizeof(mread_block))){
+      r = ESP_FAIL;
+    }
+    if((r != ESP_OK) || (mdecoder.open(mread_block) == LOG_BLOCK_DECODER::block_state_e::EMPTY)){
+      break;
+    }
+    block_index++;
+  }
+  *pend_block_index = block_index;
+  return r;
+}
+
+esp_err_t SENSOR_LOGGER::open_segment(){
+  esp_err_t r = ESP_OK;
+  long file_size = 0;
+  long index_size = 0;
+
+  r = open_aligned_file(sensor_log::LOG_INDEX_EXTENSION, sizeof(sensor_log::log_index_entry_t), &mindex_file, &index_size);
+  if(r == ESP_OK){
+    r = open_segment_file(&msegment_file, &file_size);
+  }
+  if(r == ESP_OK){
+    msegment_file_block_count = file_size / sensor_log::LOG_BLOCK_SIZE;
+    r = find_segment_end(&msegment_file, file_size, index_size / sizeof(sensor_log::log_index_entry_t), &msegment_block_count);
+  }
+  if(r == ESP_OK){
+    r = find_last_sequence(&msegment_file, msegment_block_count, &msegment_last_sequence);
+    has_segment_sequence = (r == ESP_OK);
+    if(r == ESP_ERR_NOT_FOUND){
+      r = ESP_OK;
+    }
+  }
+  if(r != ESP_OK){
+    close_segment();
+  }
+  return r;
+}
+
+// gives the unused preallocated clusters of a finished segment back.
+void SENSOR_LOGGER::trim_segment(){
+  if(msegment_file.is_open() && (msegment_file.truncate((long)msegment_block_count * sensor_log::LOG_BLOCK_SIZE) != ESP_OK)){
+    ESP_LOGW(SENSOR_LOGGER_TAG, "fail to trim the segment after %lu blocks.", msegment_block_count);
+  }
+}
+
+void SENSOR_LOGGER::close_segment(){
+  msegment_file.close();
+  mindex_file.close();
+  has_segment_sequence = false;
+}
+
+void SENSOR_LOGGER::writer_task(){
+  while(true){
+    ulTaskNotifyTake(pdTRUE, get_flush_wait_ticks(esp_timer_get_time()));
+    drain_ring_buffer();
+    const int64_t now = esp_timer_get_time();
+    if(is_flush_due(now)){
+      // close the open block even if it is not full, so the file stays block aligned.
+      if(!mencoder.is_empty()){
+        finish_block();
+        begin_block();
+      }
+      mis_write_pending = true;
+      // while the card is away, the latency only closes one block per interval.
+      moldest_sample_time = now;
+    }
+    write_backlog(now);
+  }
+  vTaskDelete(NULL);
+}
+
+void SENSOR_LOGGER::get_writer_task_entry_point(void* arg){
+  SENSOR_LOGGER* pinstance = static_cast<SENSOR_LOGGER*>(arg);
+  pinstance->writer_task();
+}
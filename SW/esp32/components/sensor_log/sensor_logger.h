@@ -0,0 +1,191 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/ringbuf.h"
+#include "esp_err.h"
+
+#include "sd_card.h"
+#include "sensor_sample.h"
+#include "log_block_encoder.h"
+#include "log_block_decoder.h"
+#include "log_journal.h"
+
+// writes sensor samples in the binary block format of sensor_log_format.h to daily segment
+// files with a sparse index on the sd card from a low priority task.
+// producers only copy the sample into a ram ring buffer. the writer task encodes the
+// samples, keeps the segment open and writes whole clusters, so the sd card latency never
+// reaches the producers.
+// encoded blocks stay in a ram backlog until they are on the card. while the card is missing
+// or fails, the backlog grows up to backlog_size and the writer retries to mount the card.
+// afterwards the backlog is written one flush block per drain_interval.
+class SENSOR_LOGGER{
+  public:
+    typedef struct{
+      size_t buffer_size;       // ram ring buffer of samples waiting for the writer [byte]
+      size_t flush_block_size;  // encoded blocks written at once. one fat cluster [byte]
+      size_t backlog_size;      // encoded blocks kept in ram until written, at least flush_block_size [byte]
+      size_t journal_size;      // preallocated write-ahead journal, at least flush_block_size [byte]
+      size_t segment_preallocation_size; // contiguous clusters reserved for a new segment, 0 = none [byte]
+      uint32_t max_latency;     // write at the latest this long after the oldest unwritten sample [ms]
+      uint32_t drain_interval;  // between the flush blocks of a backlog [ms]
+      uint32_t retry_interval;  // between the mount attempts while the card fails [ms]
+    }logger_config_t;
+
+    constexpr static size_t WRITE_TIME_HISTOGRAM_BINS {24};
+
+    // log-scale histogram. bin 0 counts 0us, bin k counts [2^(k-1), 2^k) us.
+    // the last bin also counts everything above.
+    typedef struct{
+      uint32_t bins[WRITE_TIME_HISTOGRAM_BINS];
+      int64_t max_time;           // [us]
+    }write_time_histogram_t;
+
+    typedef struct{
+      uint64_t written_bytes;
+      uint32_t sample_count;
+      uint32_t dropped_count;     // the ring buffer was full
+      uint32_t lost_count;        // the backlog was full, the oldest samples were dropped
+      uint32_t backlog_block_count;     // encoded blocks not written yet
+      uint32_t max_backlog_block_count;
+      uint32_t remount_count;
+      uint32_t flush_count;
+      uint32_t write_error_count;
+      uint32_t recovered_block_count; // copied from the journal into the segments after a reset
+      int64_t max_flush_time;     // fwrite + fsync [us]
+      write_time_histogram_t journal_write_time;  // per flush
+      write_time_histogram_t segment_write_time;  // per flush, blocks and index
+    }logger_stats_t;
+
+  private:
+    constexpr static const char* SENSOR_LOGGER_TAG = "sensor_logger";
+
+    constexpr static size_t LOG_DIRECTORY_SIZE {32};
+    constexpr static size_t LOG_PATH_SIZE {LOG_DIRECTORY_SIZE + sensor_log::LOG_SEGMENT_NAME_SIZE};
+    constexpr static const char* JOURNAL_FILE_NAME {"journal.bin"};
+    // segments whose last sequence is remembered during the recovery
+    constexpr static size_t RECOVERY_SEGMENT_COUNT {4};
+
+    typedef struct{
+      bool is_used;
+      uint32_t segment_start;
+      bool has_blocks;
+      uint32_t last_sequence;
+    }recovery_segment_t;
+
+    SD_CARD* psd_card {NULL};
+    char mdirectory[LOG_DIRECTORY_SIZE] {};
+    logger_config_t mconfig {};
+    RingbufHandle_t ring_buffer {NULL};
+    TaskHandle_t task_handle {NULL};
+
+    // owned by the writer task
+    // the backlog. encoded blocks waiting for the file, oldest first, allocated once in init.
+    uint8_t* pflush_block {NULL};
+    sensor_log::log_index_entry_t* pindex_entries {NULL};  // one per staged block
+    size_t mstaged_block_count {0};
+    size_t mbacklog_block_count {0};  // capacity of the backlog [blocks]
+    // the block being encoded
+    uint8_t mopen_block[sensor_log::LOG_BLOCK_SIZE] {};
+    // the card is mounted and the journal is open
+    bool is_attached {false};
+    // the sequence continues the one on the card. blocks encoded before are renumbered.
+    bool is_recovered {false};
+    bool mis_write_pending {false};
+    int64_t mnext_write_time {0};     // [us] drain and retry interval
+    // the segment of the open files. the files are opened on the first write.
+    uint32_t msegment_start {0};
+    // blocks up to this sequence are in the segment already, e.g. after a failed write.
+    bool has_segment_sequence {false};
+    uint32_t msegment_last_sequence {0};
+    // logical end of the segment [blocks]. a preallocated file is larger, the block after the end is zero.
+    uint32_t msegment_block_count {0};
+    // size of the segment file [blocks]
+    uint32_t msegment_file_block_count {0};
+    SD_FILE msegment_file;
+    SD_FILE mindex_file;
+    LOG_JOURNAL mjournal;
+    uint8_t mjournal_block[sensor_log::LOG_BLOCK_SIZE] {};
+    // used by the recovery and to zero the block after the logical end
+    uint8_t mread_block[sensor_log::LOG_BLOCK_SIZE] {};
+    LOG_BLOCK_DECODER mdecoder;
+    // replayed journal blocks, allocated during the recovery only
+    uint8_t* preplay_blocks {NULL};
+    sensor_log::log_index_entry_t* preplay_entries {NULL};
+    size_t mreplay_block_count {0};
+    bool has_newest_segment {false};
+    uint32_t mnewest_segment_start {0};
+    recovery_segment_t mrecovery_segments[RECOVERY_SEGMENT_COUNT] {};
+    size_t mrecovery_segment_index {0};
+    LOG_BLOCK_ENCODER mencoder;
+    uint32_t mblock_sequence {0};
+    int64_t moldest_sample_time {0};  // [us] arrival of the oldest sample not written yet
+
+    // guards the fields below, which are written by the producers and the writer task.
+    portMUX_TYPE mlock = portMUX_INITIALIZER_UNLOCKED;
+    bool mis_flush_requested {false};
+    logger_stats_t mstats {};
+
+    void begin_block();
+    void finish_block();
+    void drop_oldest_block();
+    void encode_sample(const sensor_data::sensor_sample_t* psample);
+    void drain_ring_buffer();
+    bool is_flush_due(int64_t now);
+    bool is_write_due(int64_t now);
+    TickType_t get_flush_wait_ticks(int64_t now);
+    static TickType_t get_ticks_until(int64_t deadline, int64_t now);
+    esp_err_t attach();
+    void detach();
+    void renumber_staged_blocks();
+    void write_backlog(int64_t now);
+    esp_err_t flush_blocks();
+    esp_err_t write_segment(const uint8_t* pblocks, sensor_log::log_index_entry_t* pentries, size_t block_count);
+    esp_err_t write_segment_run(const uint8_t* pblocks, sensor_log::log_index_entry_t* pentries, size_t block_count);
+    esp_err_t open_segment();
+    void close_segment();
+    esp_err_t open_aligned_file(const char* pextension, size_t alignment, SD_FILE* pfile, long* pfile_size);
+    esp_err_t preallocate_segment(const char* ppath, size_t path_size);
+    esp_err_t open_segment_file(SD_FILE* pfile, long* pfile_size);
+    esp_err_t find_segment_end(SD_FILE* psegment_file, long file_size, uint32_t first_block_index, uint32_t* pend_block_index);
+    esp_err_t find_last_sequence(SD_FILE* psegment_file, uint32_t end_block_index, uint32_t* psequence);
+    void trim_segment();
+    static void add_write_time(write_time_histogram_t* phistogram, int64_t write_time);
+
+    void find_newest_segment(const char* pname);
+    static void get_find_newest_segment_entry_point(void* arg, const char* pname);
+    uint32_t get_index_entry_count(uint32_t segment_start);
+    esp_err_t get_segment_last_sequence(uint32_t segment_start, uint32_t* psequence);
+    bool is_missing_in_segment(uint32_t segment_start, uint32_t sequence);
+    void replay_block(const uint8_t* pblock);
+    static void get_replay_block_entry_point(void* arg, const uint8_t* pblock);
+    esp_err_t recover();
+
+    void writer_task();
+    static void get_writer_task_entry_point(void* arg);
+
+  public:
+    SENSOR_LOGGER();
+    ~SENSOR_LOGGER();
+
+    // allocates the buffers. if the card is mounted, creates pdirectory on it and copies the blocks
+    // of the journal that did not reach their segment before a reset there. otherwise the writer
+    // task does this once the card is mounted, until then the samples stay in the backlog.
+    // existing segments are appended to.
+    // flush_block_size, backlog_size and journal_size must be multiples of sensor_log::LOG_BLOCK_SIZE.
+    esp_err_t init(SD_CARD* psd_card, const char* pdirectory, size_t directory_size, const logger_config_t* pconfig);
+    esp_err_t create_task(const char* pname, uint16_t stack_size, UBaseType_t task_priority);
+
+    // copies a sample into the ring buffer. never blocks.
+    // ESP_ERR_NO_MEM if the ring buffer is full, the sample is dropped then.
+    esp_err_t append(const sensor_data::sensor_sample_t* psample);
+    // writes everything buffered now, e.g. before a reset.
+    void request_flush();
+
+    void get_stats(logger_stats_t* pstats);
+    void log_stats();
+    // upper bound of the bin holding the percent-th percentile [us]. the last bin reports the max.
+    static int64_t get_percentile(const write_time_histogram_t* phistogram, uint32_t percent);
+};
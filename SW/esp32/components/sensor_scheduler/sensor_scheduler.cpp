@@ -0,0 +1,277 @@
+#include <atomic>
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "sensor_scheduler.h"
+
+namespace{
+  // task whose allocations are counted. only the scheduler task is counted.
+  std::atomic<TaskHandle_t> counted_task_handle {NULL};
+  std::atomic<uint32_t> allocation_count {0};
+}
+
+#if CONFIG_SENSOR_SCHEDULER_ALLOCATION_COUNTER
+// heap hooks of CONFIG_HEAP_USE_HOOKS. they are called for every allocation in the firmware.
+extern "C" IRAM_ATTR void esp_heap_trace_alloc_hook(void* ptr, size_t size, uint32_t caps){
+  if((ptr != NULL) && (xTaskGetCurrentTaskHandle() == counted_task_handle.load(std::memory_order_relaxed))){
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+extern "C" IRAM_ATTR void esp_heap_trace_free_hook(void* ptr){
+}
+#endif
+
+SENSOR_SCHEDULER::SENSOR_SCHEDULER(){
+  esp_log_level_set(SENSOR_SCHEDULER_TAG, ESP_LOG_INFO);
+  ESP_LOGI(SENSOR_SCHEDULER_TAG, "set SENSOR_SCHEDULER_TAG log level: %d", ESP_LOG_INFO);
+}
+
+esp_err_t SENSOR_SCHEDULER::add_job(const job_config_t* pjob_config, size_t* pjob_id){
+  esp_err_t r = ESP_OK;
+  if(task_handle != NULL){
+    ESP_LOGE(SENSOR_SCHEDULER_TAG, "jobs can not be added while the scheduler is running.");
+    r = ESP_ERR_INVALID_STATE;
+  }
+  if(r == ESP_OK){
+    if((pjob_config->step_function == NULL) || (pjob_config->period == 0)){
+      r = ESP_ERR_INVALID_ARG;
+    }
+  }
+  if(r == ESP_OK){
+    if(mjob_count >= MAX_JOBS){
+      ESP_LOGE(SENSOR_SCHEDULER_TAG, "fail to add %s. too many jobs.", pjob_config->pname);
+      r = ESP_ERR_NO_MEM;
+    }
+  }
+  if(r == ESP_OK){
+    mjobs[mjob_count] = {};
+    mjobs[mjob_count].config = *pjob_config;
+    if(pjob_id != NULL){
+      *pjob_id = mjob_count;
+    }
+    mjob_count++;
+  }
+  return r;
+}
+
+esp_err_t SENSOR_SCHEDULER::subscribe(subscriber_function_t subscriber_function, void* arg){
+  esp_err_t r = ESP_OK;
+  if(task_handle != NULL){
+    ESP_LOGE(SENSOR_SCHEDULER_TAG, "subscribers can not be added while the scheduler is running.");
+    r = ESP_ERR_INVALID_STATE;
+  }
+  if(r == ESP_OK){
+    if(msubscriber_count >= MAX_SUBSCRIBERS){
+      ESP_LOGE(SENSOR_SCHEDULER_TAG, "fail to subscribe. too many subscribers.");
+      r = ESP_ERR_NO_MEM;
+    }
+  }
+  if(r == ESP_OK){
+    msubscribers[msubscriber_count].subscriber_function = subscriber_function;
+    msubscribers[msubscriber_count].arg = arg;
+    msubscriber_count++;
+  }
+  return r;
+}
+
+esp_err_t SENSOR_SCHEDULER::create_task(const char* pname, uint16_t stack_size, UBaseType_t task_priority){
+  esp_err_t r = ESP_OK;
+  BaseType_t r2 = pdTRUE;
+  if(r == ESP_OK){
+    r2 = xTaskCreate(get_scheduler_task_entry_point, pname, stack_size, this, task_priority, &task_handle);
+    if(r2 != pdTRUE){
+      ESP_LOGE(SENSOR_SCHEDULER_TAG, "fail to create scheduler_task.");
+      r = ESP_FAIL;
+    }
+  }
+  return r;
+}
+
+esp_err_t SENSOR_SCHEDULER::get_job_stats(size_t job_id, job_stats_t* pstats){
+  esp_err_t r = ESP_OK;
+  if(job_id >= mjob_count){
+    r = ESP_ERR_INVALID_ARG;
+  }
+  if(r == ESP_OK){
+    portENTER_CRITICAL(&mstats_lock);
+    *pstats = mjobs[job_id].stats;
+    portEXIT_CRITICAL(&mstats_lock);
+  }
+  return r;
+}
+
+esp_err_t SENSOR_SCHEDULER::get_steady_state_allocation_count(uint32_t* pallocation_count){
+  esp_err_t r = ESP_OK;
+#if CONFIG_SENSOR_SCHEDULER_ALLOCATION_COUNTER
+  if(!mis_steady_state){
+    r = ESP_ERR_INVALID_STATE;
+  }
+  if(r == ESP_OK){
+    *pallocation_count = allocation_count.load(std::memory_order_relaxed) - msteady_state_allocation_base;
+  }
+#else
+  r = ESP_ERR_NOT_SUPPORTED;
+#endif
+  return r;
+}
+
+void SENSOR_SCHEDULER::check_steady_state(){
+  job_stats_t stats {};
+  bool is_steady_state = true;
+  for(size_t job_id = 0; job_id < mjob_count; job_id++){
+    get_job_stats(job_id, &stats);
+    if((stats.sample_count + stats.error_count) == 0){
+      is_steady_state = false;
+    }
+  }
+  if(is_steady_state){
+    msteady_state_allocation_base = allocation_count.load(std::memory_order_relaxed);
+    mis_steady_state = true;
+    ESP_LOGI(SENSOR_SCHEDULER_TAG, "every job finished its first cycle. %lu allocations so far.", 
+        (unsigned long)msteady_state_allocation_base);
+  }
+}
+
+void SENSOR_SCHEDULER::log_stats(){
+  job_stats_t stats {};
+  for(size_t job_id = 0; job_id < mjob_count; job_id++){
+    get_job_stats(job_id, &stats);
+    uint32_t release_count = stats.sample_count + stats.error_count;
+    int64_t average_release_jitter = (release_count != 0) ? (stats.total_release_jitter / release_count) : 0;
+    ESP_LOGI(SENSOR_SCHEDULER_TAG, "%s samples:%lu errors:%lu deadline misses:%lu skipped:%lu "
+        "jitter avg:%lld[us] max:%lld[us] response max:%lld[us]",
+        mjobs[job_id].config.pname, stats.sample_count, stats.error_count, stats.deadline_miss_count,
+        stats.skipped_release_count, average_release_jitter, stats.max_release_jitter, stats.max_response_time);
+  }
+  uint32_t steady_state_allocation_count = 0;
+  if(get_steady_state_allocation_count(&steady_state_allocation_count) == ESP_OK){
+    if(steady_state_allocation_count != 0){
+      ESP_LOGW(SENSOR_SCHEDULER_TAG, "%lu heap allocations in the steady state sampling loop.", 
+          (unsigned long)steady_state_allocation_count);
+    }
+    else{
+      ESP_LOGI(SENSOR_SCHEDULER_TAG, "no heap allocations in the steady state sampling loop.");
+    }
+  }
+}
+
+void SENSOR_SCHEDULER::release_job(job_t* pjob, int64_t now){
+  const int64_t period = static_cast<int64_t>(pjob->config.period) * 1000;
+  const int64_t release_jitter = now - pjob->next_release_time;
+  uint32_t skipped_release_count = 0;
+
+  pjob->release_time = pjob->next_release_time;
+  pjob->next_release_time += period;
+  // a cycle that overran its period drops the missed releases instead of running them back to back.
+  while(pjob->next_release_time <= now){
+    pjob->next_release_time += period;
+    skipped_release_count++;
+  }
+  pjob->next_step_time = now;
+  pjob->is_running = true;
+
+  portENTER_CRITICAL(&mstats_lock);
+  pjob->stats.skipped_release_count += skipped_release_count;
+  pjob->stats.total_release_jitter += release_jitter;
+  if(release_jitter > pjob->stats.max_release_jitter){
+    pjob->stats.max_release_jitter = release_jitter;
+  }
+  portEXIT_CRITICAL(&mstats_lock);
+}
+
+void SENSOR_SCHEDULER::step_job(job_t* pjob){
+  esp_err_t r = ESP_OK;
+  sensor_data::sensor_sample_t sample {};
+  uint32_t wait_time = 0;
+
+  r = pjob->config.step_function(pjob->config.arg, &sample, &wait_time);
+  const int64_t now = esp_timer_get_time();
+  if(r == ESP_ERR_NOT_FINISHED){
+    pjob->next_step_time = now + static_cast<int64_t>(wait_time) * 1000;
+    return;
+  }
+
+  const int64_t response_time = now - pjob->release_time;
+  pjob->is_running = false;
+  portENTER_CRITICAL(&mstats_lock);
+  if(r == ESP_OK){
+    pjob->stats.sample_count++;
+    if(response_time > pjob->stats.max_response_time){
+      pjob->stats.max_response_time = response_time;
+    }
+    if(response_time > static_cast<int64_t>(pjob->config.deadline) * 1000){
+      pjob->stats.deadline_miss_count++;
+    }
+  }
+  else{
+    pjob->stats.error_count++;
+  }
+  portEXIT_CRITICAL(&mstats_lock);
+
+  if(r == ESP_OK){
+    publish(&sample);
+  }
+  else{
+    ESP_LOGW(SENSOR_SCHEDULER_TAG, "%s failed. error:%s", pjob->config.pname, esp_err_to_name(r));
+  }
+}
+
+void SENSOR_SCHEDULER::publish(const sensor_data::sensor_sample_t* psample){
+  for(size_t subscriber = 0; subscriber < msubscriber_count; subscriber++){
+    msubscribers[subscriber].subscriber_function(msubscribers[subscriber].arg, psample);
+  }
+}
+
+void SENSOR_SCHEDULER::scheduler_task(){
+  const int64_t tick_period = static_cast<int64_t>(portTICK_PERIOD_MS) * 1000;
+  int64_t now = esp_timer_get_time();
+  int64_t next_stats_log_time = now + static_cast<int64_t>(STATS_LOG_INTERVAL) * 1000;
+
+  for(size_t job_id = 0; job_id < mjob_count; job_id++){
+    mjobs[job_id].next_release_time = now;
+  }
+  counted_task_handle.store(xTaskGetCurrentTaskHandle(), std::memory_order_relaxed);
+
+  while(true){
+    int64_t wake_up_time = INT64_MAX;
+    for(size_t job_id = 0; job_id < mjob_count; job_id++){
+      job_t* pjob = &mjobs[job_id];
+      now = esp_timer_get_time();
+      if(!pjob->is_running && (now >= pjob->next_release_time)){
+        release_job(pjob, now);
+      }
+      if(pjob->is_running && (now >= pjob->next_step_time)){
+        step_job(pjob);
+      }
+      const int64_t job_wake_up_time = pjob->is_running ? pjob->next_step_time : pjob->next_release_time;
+      if(job_wake_up_time < wake_up_time){
+        wake_up_time = job_wake_up_time;
+      }
+    }
+
+    if(!mis_steady_state){
+      check_steady_state();
+    }
+    now = esp_timer_get_time();
+    if(now >= next_stats_log_time){
+      log_stats();
+      next_stats_log_time += static_cast<int64_t>(STATS_LOG_INTERVAL) * 1000;
+    }
+    // round up, so that the task does not wake up one tick early and spin.
+    if(wake_up_time > now){
+      const TickType_t wait_ticks = (mjob_count == 0) ? portMAX_DELAY :
+        static_cast<TickType_t>((wake_up_time - now + tick_period - 1) / tick_period);
+      ulTaskNotifyTake(pdTRUE, wait_ticks);
+    }
+  }
+  vTaskDelete(NULL);
+}
+
+void SENSOR_SCHEDULER::get_scheduler_task_entry_point(void* arg){
+  SENSOR_SCHEDULER* pinstance = static_cast<SENSOR_SCHEDULER*>(arg);
+  pinstance->scheduler_task();
+}
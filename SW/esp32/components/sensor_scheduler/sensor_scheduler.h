@@ -0,0 +1,92 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_err.h"
+
+#include "sensor_sample.h"
+
+// runs every sensor driver as a non-blocking state machine in one task.
+// the scheduler task is the only task that talks to the sensors, so it owns the i2c bus.
+class SENSOR_SCHEDULER{
+  public:
+    // one step of a driver state machine.
+    // ESP_OK: psample holds a new sample and the cycle is finished.
+    // ESP_ERR_NOT_FINISHED: call again after *pwait_ms.
+    // anything else: the cycle failed and is retried at the next release.
+    typedef esp_err_t (*step_function_t)(void* arg, sensor_data::sensor_sample_t* psample, uint32_t* pwait_ms);
+    // called from the scheduler task for every new sample. must not block.
+    typedef void (*subscriber_function_t)(void* arg, const sensor_data::sensor_sample_t* psample);
+
+    typedef struct{
+      const char* pname;
+      step_function_t step_function;
+      void* arg;
+      uint32_t period;    // [ms]
+      uint32_t deadline;  // release until the sample is ready [ms]
+    }job_config_t;
+
+    typedef struct{
+      uint32_t sample_count;
+      uint32_t error_count;
+      uint32_t deadline_miss_count;
+      uint32_t skipped_release_count; // releases lost because the previous cycle overran its period
+      int64_t max_release_jitter;     // release until the first step [us]
+      int64_t total_release_jitter;   // [us]
+      int64_t max_response_time;      // release until the sample is ready [us]
+    }job_stats_t;
+
+  private:
+    constexpr static const char* SENSOR_SCHEDULER_TAG = "sensor_scheduler";
+    constexpr static size_t MAX_JOBS {4};
+    constexpr static size_t MAX_SUBSCRIBERS {4};
+    constexpr static uint32_t STATS_LOG_INTERVAL {10 * 60 * 1000}; // [ms]
+
+    typedef struct{
+      job_config_t config;
+      job_stats_t stats;
+      int64_t release_time;       // start of the current cycle [us]
+      int64_t next_release_time;  // [us]
+      int64_t next_step_time;     // [us]
+      bool is_running;
+    }job_t;
+
+    typedef struct{
+      subscriber_function_t subscriber_function;
+      void* arg;
+    }subscriber_t;
+
+    job_t mjobs[MAX_JOBS] {};
+    size_t mjob_count {0};
+    subscriber_t msubscribers[MAX_SUBSCRIBERS] {};
+    size_t msubscriber_count {0};
+    TaskHandle_t task_handle {NULL};
+    // guards job stats, which are read from other tasks
+    portMUX_TYPE mstats_lock = portMUX_INITIALIZER_UNLOCKED;
+    // every job finished its first cycle. lazy initialization is over from here on.
+    bool mis_steady_state {false};
+    uint32_t msteady_state_allocation_base {0};
+
+    void check_steady_state();
+
+    void release_job(job_t* pjob, int64_t now);
+    void step_job(job_t* pjob);
+    void publish(const sensor_data::sensor_sample_t* psample);
+
+    void scheduler_task();
+    static void get_scheduler_task_entry_point(void* arg);
+
+  public:
+    SENSOR_SCHEDULER();
+
+    // jobs and subscribers are fixed once the task is created.
+    esp_err_t add_job(const job_config_t* pjob_config, size_t* pjob_id);
+    esp_err_t subscribe(subscriber_function_t subscriber_function, void* arg);
+    esp_err_t create_task(const char* pname, uint16_t stack_size, UBaseType_t task_priority);
+
+    esp_err_t get_job_stats(size_t job_id, job_stats_t* pstats);
+    // heap allocations of the scheduler task since the steady state was reached.
+    // ESP_ERR_NOT_SUPPORTED without CONFIG_SENSOR_SCHEDULER_ALLOCATION_COUNTER.
+    esp_err_t get_steady_state_allocation_count(uint32_t* pallocation_count);
+    void log_stats();
+};
@@ -0,0 +1,11 @@
+// sensor driver settings of SMART_CLOCK.
+// tools/i2c_replay replays traces with the same settings, so it includes this header on the host.
+#pragma once
+#include "scd40.h"
+
+namespace sensor_settings{
+  // SINGLE_SHOT needs an SCD41 and only measures once per display update.
+  constexpr static SCD40::measurement_mode_e SCD40_MEASUREMENT_MODE {SCD40::measurement_mode_e::PERIODIC};
+  // self heating of the scd40 on the board. stored in the sensor EEPROM.
+  constexpr static float SCD40_TEMPERATURE_OFFSET {4.0}; //[degree Celsius]
+}
@@ -16,59 +16,142 @@ void SMART_CLOCK::update_display_timer_task(){
 }
 
 void SMART_CLOCK::update_display_task(){
-  char timestamp[100] = "time";
-  char sd_card_write_data_buffer[400];
+  sensor_sample_buffer_t::READER sample_reader = sensor_samples.create_history_reader();
+  uint32_t update_count = 0;
 
   while(1){
     esp_err_t r = ESP_OK;
-    esp_err_t r2 = ESP_OK;
     ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
     ESP_LOGI(SMART_CLOCK_TAG, "execute update_display_task");
-    if(r == ESP_OK){
-      r = sntp.get_logtime(timestamp, sizeof(timestamp));
-      if(r != ESP_OK){
-        ESP_LOGE(SMART_CLOCK_TAG, "fail to get timestamp.");
-      }
-    }
-    
-    if(r == ESP_OK){
-      snprintf(sd_card_write_data_buffer, sizeof(sd_card_write_data_buffer), "%s, %d, %.2lf, %.2lf, %.2lf\n", timestamp, co2, temperature, humidity, pressure);
-      r2 = sd_card.write_data(file_path, sizeof(file_path), sd_card_write_data_buffer, 'a');
-      if(r2 != ESP_OK){
-        ESP_LOGE(SMART_CLOCK_TAG, "fail to write sensor log to sd_card.");
-      }
+    read_sensor_samples(&sample_reader);
+#if CONFIG_I2C_TRACE_RECORDER
+    if(drain_i2c_trace() != ESP_OK){
+      ESP_LOGE(SMART_CLOCK_TAG, "fail to write i2c trace to sd_card.");
     }
+#endif
     if(r == ESP_OK){
       r = display_epaper();
       if(r != ESP_OK){
         ESP_LOGE(SMART_CLOCK_TAG, "fail to display epaper.");
       }
     }
+    update_count++;
+    if((update_count % I2C_METRICS_LOG_INTERVAL) == 0){
+      i2c.log_metrics();
+      i2c_base::I2C::bus_utilization_t bus_utilization {};
+      i2c.get_bus_utilization(&bus_utilization);
+      if(bus_utilization.window_time > 0){
+        // share of the time since the last log that a transaction held the bus.
+        ESP_LOGI(SMART_CLOCK_TAG, "i2c bus transactions:%lu errors:%lu busy:%lld us of %lld us (%lld.%02lld%%)",
+            bus_utilization.transaction_count, bus_utilization.error_count,
+            bus_utilization.busy_time, bus_utilization.window_time,
+            (bus_utilization.busy_time * 100) / bus_utilization.window_time,
+            ((bus_utilization.busy_time * 10000) / bus_utilization.window_time) % 100);
+      }
+      sensor_logger.log_stats();
+    }
   }
 }
 
-void SMART_CLOCK::monitor_sensor_task(){
-  BaseType_t r2 = pdTRUE;
+// moves the recorded i2c transactions to the sd card in blocks of whole records.
+esp_err_t SMART_CLOCK::drain_i2c_trace(){
+  esp_err_t r = ESP_OK;
+  size_t write_size = 0;
+  size_t record_size = 0;
 
-  while(true){
-    scd40.notify_measurement_start();
-    bme280.notify_measurement_start();
-    r2 = xQueueReceive(co2_buffer, &co2, pdMS_TO_TICKS(300000));
-    if(r2 != pdTRUE){
-      ESP_LOGW(SMART_CLOCK_TAG, "fail to receive data from co2 buffer");
+  // the sensor logger unmounts a failing card from its own task. without a card the records
+  // stay in the trace buffer, the logger mounts the card again.
+  if(sd_card.lock() == ESP_OK){
+    while(r == ESP_OK){
+      if((sizeof(i2c_trace_write_buffer) - write_size) < i2c_base::TRACE_MAX_RECORD_SIZE){
+        r = sd_card.write_binary_data(i2c_trace_file_path, sizeof(i2c_trace_file_path), 
+            i2c_trace_write_buffer, write_size, 'a');
+        write_size = 0;
+      }
+      if(r == ESP_OK){
+        if(i2c.read_trace_record(i2c_trace_write_buffer + write_size, 
+            sizeof(i2c_trace_write_buffer) - write_size, &record_size) != ESP_OK){
+          break;
+        }
+        write_size += record_size;
+      }
+    }
+    if((r == ESP_OK) && (write_size > 0)){
+      r = sd_card.write_binary_data(i2c_trace_file_path, sizeof(i2c_trace_file_path), 
+          i2c_trace_write_buffer, write_size, 'a');
     }
-    r2 = xQueueReceive(bme280_results_buffer, &results_data, pdMS_TO_TICKS(300000));
-    if(r2 == pdTRUE){
-      temperature = results_data.temperature;
-      pressure = results_data.pressure;
-      humidity = results_data.humidity;
+    sd_card.unlock();
+  }
+  const uint32_t dropped_count = i2c.get_trace_dropped_count();
+  if(dropped_count != i2c_trace_dropped_count){
+    ESP_LOGW(SMART_CLOCK_TAG, "%lu i2c transactions dropped from the trace.", dropped_count - i2c_trace_dropped_count);
+    i2c_trace_dropped_count = dropped_count;
+  }
+  return r;
+}
+
+esp_err_t SMART_CLOCK::bme280_step(sensor_data::sensor_sample_t* psample, uint32_t* pwait_ms){
+  esp_err_t r = ESP_OK;
+  BME280::compensated_data_t bme280_data {};
+
+  r = bme280.measure_step(&bme280_data, pwait_ms);
+  if(r == ESP_OK){
+    *psample = sensor_data::make_sample(sensor_data::sensor_id_e::BME280);
+    psample->value[0] = bme280_data.temperature;
+    psample->value[1] = static_cast<int32_t>(bme280_data.pressure);
+    psample->value[2] = static_cast<int32_t>(bme280_data.humidity);
+  }
+  return r;
+}
+
+esp_err_t SMART_CLOCK::scd40_step(sensor_data::sensor_sample_t* psample, uint32_t* pwait_ms){
+  esp_err_t r = ESP_OK;
+  uint16_t co2_value = 0;
+
+  r = scd40.measure_step(&co2_value, pwait_ms);
+  if(r == ESP_OK){
+    *psample = sensor_data::make_sample(sensor_data::sensor_id_e::SCD40, 
+        scd40.is_pressure_compensated() ? sensor_data::SAMPLE_PRESSURE_COMPENSATED : 0);
+    psample->value[0] = co2_value;
+  }
+  return r;
+}
+
+void SMART_CLOCK::sensor_sample_subscriber(const sensor_data::sensor_sample_t* psample){
+  sensor_samples.push(*psample);
+  // the logger copies the sample and returns, the sd card is written by its own task.
+  if(sensor_logger.append(psample) != ESP_OK){
+    ESP_LOGW(SMART_CLOCK_TAG, "fail to append sensor sample to the log.");
+  }
+  if(psample->sensor_id == sensor_data::sensor_id_e::BME280){
+    // compensate the co2 value with the measured pressure.
+    // the bme280 and scd40 jobs both run in the scheduler task.
+    if(scd40.set_ambient_pressure(psample->value[1] / 25600.0f) != ESP_OK){
+      ESP_LOGW(SMART_CLOCK_TAG, "fail to set scd40 ambient pressure.");
     }
-    else{
-      ESP_LOGW(SMART_CLOCK_TAG, "fail to receive data from bme280 buffer.");
+  }
+}
+
+void SMART_CLOCK::read_sensor_samples(sensor_sample_buffer_t::READER* preader){
+  sensor_data::sensor_sample_t sample {};
+  uint32_t lost_count = preader->get_lost_count();
+
+  while(preader->read(&sample)){
+    switch(sample.sensor_id){
+      case sensor_data::sensor_id_e::SCD40:
+        co2 = static_cast<uint16_t>(sample.value[0]);
+        break;
+      case sensor_data::sensor_id_e::BME280:
+        temperature = sample.value[0] / 100.0f;
+        pressure = sample.value[1] / 25600.0f;
+        humidity = sample.value[2] / 1024.0f;
+        break;
     }
-    vTaskDelay(pdMS_TO_TICKS(10000));
   }
-  vTaskDelete(NULL);
+  if(preader->get_lost_count() != lost_count){
+    ESP_LOGW(SMART_CLOCK_TAG, "%lu sensor samples were overwritten before display.", 
+        (unsigned long)(preader->get_lost_count() - lost_count));
+  }
 }
 
 esp_err_t SMART_CLOCK::display_epaper(){
@@ -130,7 +213,7 @@ esp_err_t SMART_CLOCK::display_epaper(){
     x1 = x; 
     x = black_sprite.getCursorX();
     black_sprite.setCursor(x1, y + black_sprite.fontHeight());
-    black_sprite.printf("%.2lf%%\n", humidity);
+    black_sprite.printf("%.2f%%\n", humidity);
     x += 50; 
     black_sprite.setCursor(x, y);
     black_sprite.printf("Pressure");
@@ -184,9 +267,19 @@ void SMART_CLOCK::get_update_display_task_entry_point(void* arg){
   pinstance->update_display_task();
 }
 
-void SMART_CLOCK::get_monitor_sensor_task_entry_point(void* arg){
+esp_err_t SMART_CLOCK::get_bme280_step_entry_point(void* arg, sensor_data::sensor_sample_t* psample, uint32_t* pwait_ms){
+  SMART_CLOCK* pinstance = static_cast<SMART_CLOCK*>(arg);
+  return pinstance->bme280_step(psample, pwait_ms);
+}
+
+esp_err_t SMART_CLOCK::get_scd40_step_entry_point(void* arg, sensor_data::sensor_sample_t* psample, uint32_t* pwait_ms){
+  SMART_CLOCK* pinstance = static_cast<SMART_CLOCK*>(arg);
+  return pinstance->scd40_step(psample, pwait_ms);
+}
+
+void SMART_CLOCK::get_sensor_sample_subscriber_entry_point(void* arg, const sensor_data::sensor_sample_t* psample){
   SMART_CLOCK* pinstance = static_cast<SMART_CLOCK*>(arg);
-  pinstance->monitor_sensor_task();
+  pinstance->sensor_sample_subscriber(psample);
 }
 
 esp_err_t SMART_CLOCK::init(void){
@@ -236,6 +329,15 @@ esp_err_t SMART_CLOCK::init(void){
       ESP_LOGE(SMART_CLOCK_TAG, "fail to initialize i2c.");
     }
   }
+#if CONFIG_I2C_TRACE_RECORDER
+  // record before the sensors are initialized, so that the trace can be replayed.
+  if(r == ESP_OK){
+    r = i2c.start_recording(CONFIG_I2C_TRACE_BUFFER_SIZE);
+    if(r != ESP_OK){
+      ESP_LOGE(SMART_CLOCK_TAG, "fail to start i2c recording.");
+    }
+  }
+#endif
   // Initialize the BME280 I2C device
   if(r == ESP_OK){ 
     r = bme280.init(&i2c);
@@ -243,45 +345,113 @@ esp_err_t SMART_CLOCK::init(void){
       ESP_LOGE(SMART_CLOCK_TAG, "fail to initialize bme280.");
     }
   }
-  // Initialize the SCD40 I2C device
   if(r == ESP_OK){
-    r = scd40.init(&i2c);
+    r = bme280.start_normal_mode();
     if(r != ESP_OK){
-      ESP_LOGE(SMART_CLOCK_TAG, "fail to initialize scd40.");
+      ESP_LOGE(SMART_CLOCK_TAG, "fail to start bme280 normal mode.");
     }
   }
+  // Initialize the SCD40 I2C device
   if(r == ESP_OK){
-    r = scd40.create_task("measure_co2", 2048, 10);
+    r = scd40.init(&i2c);
     if(r != ESP_OK){
-      ESP_LOGE(SMART_CLOCK_TAG, "fail to create scd40 measure_co2 task");
+      ESP_LOGE(SMART_CLOCK_TAG, "fail to initialize scd40.");
     }
   }
   if(r == ESP_OK){
-    r = bme280.create_task("measure_bme280", 2048, 10);
+    r = scd40.configure_temperature_offset(sensor_settings::SCD40_TEMPERATURE_OFFSET);
     if(r != ESP_OK){
-      ESP_LOGE(SMART_CLOCK_TAG, "fail to create bme280 measure_bme280 task");
+      ESP_LOGE(SMART_CLOCK_TAG, "fail to configure scd40 temperature offset.");
     }
   }
   if(r == ESP_OK){
-    r = create_monitor_sensor_task("monitor_sensor", 2048, 10);
+    scd40.set_measurement_mode(sensor_settings::SCD40_MEASUREMENT_MODE);
+    r = init_sensor_scheduler();
     if(r != ESP_OK){
-      ESP_LOGE(SMART_CLOCK_TAG, "fail to create monitor_sensor task");
+      ESP_LOGE(SMART_CLOCK_TAG, "fail to initialize sensor scheduler.");
     }
   }
   // initialize sd card 
   esp_err_t r2 = ESP_OK;
   if(r == ESP_OK){ 
-    r2 = sd_card.init();
-    if(r2 != ESP_OK){
+    // not fatal. the sensor logger keeps the samples in ram and mounts the card once it is inserted.
+    if(sd_card.init() != ESP_OK){
       ESP_LOGE(SMART_CLOCK_TAG, "fail to initialize sd_card component.");
     }
   }
+#if CONFIG_SD_CARD_BENCHMARK
+  // before the sensor log uses the card
+  if((r == ESP_OK) && sd_card.is_mounted()){
+    SD_CARD_BENCHMARK sd_card_benchmark;
+    SD_CARD_BENCHMARK::benchmark_result_t benchmark_result {};
+    if(sd_card_benchmark.run(&sd_card, CONFIG_SD_CARD_BENCHMARK_FILE_SIZE * 1024, &benchmark_result) == ESP_OK){
+      sd_card_benchmark.log_result(&benchmark_result);
+    }
+  }
+#endif
+  if(r2 == ESP_OK){
+    const SENSOR_LOGGER::logger_config_t logger_config {
+      .buffer_size = SENSOR_LOG_BUFFER_SIZE,
+      .flush_block_size = SENSOR_LOG_FLUSH_BLOCK_SIZE,
+      .backlog_size = SENSOR_LOG_BACKLOG_SIZE,
+      .journal_size = SENSOR_LOG_JOURNAL_SIZE,
+      .segment_preallocation_size = SENSOR_LOG_SEGMENT_PREALLOCATION_SIZE,
+      .max_latency = SENSOR_LOG_MAX_LATENCY,
+      .drain_interval = SENSOR_LOG_DRAIN_INTERVAL,
+      .retry_interval = SENSOR_LOG_RETRY_INTERVAL,
+    };
+    r2 = sensor_logger.init(&sd_card, sensor_log_directory, sizeof(sensor_log_directory), &logger_config);
+    if(r2 != ESP_OK){
+      ESP_LOGE(SMART_CLOCK_TAG, "fail to initialize sensor logger.");
+    }
+  }
+  if(r2 == ESP_OK){
+    // lowest priority of the application. the log is allowed to lag behind.
+    r2 = sensor_logger.create_task("sensor_logger", 3072, 2);
+    if(r2 != ESP_OK){
+      ESP_LOGE(SMART_CLOCK_TAG, "fail to create sensor_logger task");
+    }
+  }
   if(r2 == ESP_OK){
-    char sd_card_write_data_buffer[400];
-    snprintf(sd_card_write_data_buffer, sizeof(sd_card_write_data_buffer), "YYYY/MM/DD, week, HH:MM:SS, CO2[rpm], Temperature[degree], Humidity[%%], Pressure[hPa]\n");
-    r2 = sd_card.write_data(file_path, sizeof(file_path), sd_card_write_data_buffer, 'w');
+    const SENSOR_LOG_RETENTION::retention_config_t retention_config {
+      .pack_after_days = SENSOR_LOG_PACK_AFTER_DAYS,
+      .raw_retention_days = SENSOR_LOG_RAW_RETENTION_DAYS,
+      .minute_retention_days = SENSOR_LOG_MINUTE_RETENTION_DAYS,
+      .hour_retention_days = SENSOR_LOG_HOUR_RETENTION_DAYS,
+      .check_interval = SENSOR_LOG_RETENTION_INTERVAL,
+    };
+    r2 = sensor_log_retention.init(&sd_card, sensor_log_directory, sizeof(sensor_log_directory), &retention_config);
     if(r2 != ESP_OK){
-      ESP_LOGE(SMART_CLOCK_TAG, "fail to write data to sd_card.");
+      ESP_LOGE(SMART_CLOCK_TAG, "fail to initialize sensor log retention.");
+    }
+  }
+  if(r2 == ESP_OK){
+    // below the logger, the compaction reads a whole day from the sd card.
+    r2 = sensor_log_retention.create_task("sensor_log_retention", 4096, 1);
+    if(r2 != ESP_OK){
+      ESP_LOGE(SMART_CLOCK_TAG, "fail to create sensor_log_retention task");
+    }
+  }
+#if CONFIG_I2C_TRACE_RECORDER
+  if((r2 == ESP_OK) && sd_card.is_mounted()){
+    const i2c_base::trace_file_header_t trace_file_header {
+      .magic = i2c_base::TRACE_MAGIC,
+      .version = i2c_base::TRACE_VERSION,
+      .record_header_size = sizeof(i2c_base::trace_record_header_t),
+    };
+    r2 = sd_card.write_binary_data(i2c_trace_file_path, sizeof(i2c_trace_file_path), 
+        &trace_file_header, sizeof(trace_file_header), 'w');
+    if(r2 != ESP_OK){
+      ESP_LOGE(SMART_CLOCK_TAG, "fail to write i2c trace header to sd_card.");
+    }
+  }
+#endif
+  // the first samples are published right after the start. the logger and its task
+  // must be ready by then, otherwise append() drops them.
+  if(r == ESP_OK){
+    r = sensor_scheduler.create_task("sensor_scheduler", 3072, 10);
+    if(r != ESP_OK){
+      ESP_LOGE(SMART_CLOCK_TAG, "fail to create sensor_scheduler task");
     }
   }
   if(r == ESP_OK){
@@ -351,17 +521,32 @@ esp_err_t SMART_CLOCK::run(void){
   return r;
 }
 
-esp_err_t SMART_CLOCK::create_monitor_sensor_task(const char* pname, uint16_t stack_size, UBaseType_t task_priority){
+esp_err_t SMART_CLOCK::init_sensor_scheduler(){
   esp_err_t r = ESP_OK;
-  BaseType_t r2 = pdTRUE;
-  co2_buffer = scd40.get_co2_buffer_handle();
-  bme280_results_buffer = bme280.get_results_buffer(); 
-  if(r == ESP_OK){ 
-    r2 = xTaskCreate(get_monitor_sensor_task_entry_point, pname, stack_size, this, task_priority, &sensor_task_handle);
-    if(r2 != pdTRUE){
-      ESP_LOGE(SMART_CLOCK_TAG, "fail to create monitor_sensor_data_task.");
-      r = ESP_FAIL;
-    }
+  const SENSOR_SCHEDULER::job_config_t bme280_job = {
+    .pname = "bme280",
+    .step_function = get_bme280_step_entry_point,
+    .arg = this,
+    .period = BME280_SAMPLE_PERIOD,
+    .deadline = BME280_SAMPLE_DEADLINE,
+  };
+  const SENSOR_SCHEDULER::job_config_t scd40_job = {
+    .pname = "scd40",
+    .step_function = get_scd40_step_entry_point,
+    .arg = this,
+    .period = SCD40_SAMPLE_PERIOD,
+    .deadline = SCD40_SAMPLE_DEADLINE,
+  };
+
+  // bme280 first, so that the first co2 sample is already pressure compensated.
+  if(r == ESP_OK){
+    r = sensor_scheduler.add_job(&bme280_job, NULL);
+  }
+  if(r == ESP_OK){
+    r = sensor_scheduler.add_job(&scd40_job, NULL);
+  }
+  if(r == ESP_OK){
+    r = sensor_scheduler.subscribe(get_sensor_sample_subscriber_entry_point, this);
   }
   return r;
 }
@@ -11,9 +11,16 @@
 #include "i2c_base.h"
 #include "bme280.h"
 #include "scd40.h"
+#include "sensor_settings.h"
 #include "e_paper.h"
 #include "sd_card.h"
+#include "sd_card_benchmark.h"
 #include "sntp_interface.h"
+#include "sensor_sample.h"
+#include "sensor_ring_buffer.h"
+#include "sensor_scheduler.h"
+#include "sensor_logger.h"
+#include "sensor_log_retention.h"
 
 #include "LovyanGFX.hpp"
 
@@ -22,13 +29,56 @@ class SMART_CLOCK final{
     constexpr static const char* SMART_CLOCK_TAG = "smart_clock"; 
   
     constexpr static uint16_t UPDATE_DISPLAY_INTERVAL {60 * 1000}; //[ms]  
+    // log the i2c device metrics every N display updates
+    constexpr static uint32_t I2C_METRICS_LOG_INTERVAL {10};
+    // sensor scheduler periods and deadlines
+    constexpr static uint32_t BME280_SAMPLE_PERIOD   {10 * 1000}; //[ms]
+    constexpr static uint32_t BME280_SAMPLE_DEADLINE {100};       //[ms]
+    constexpr static uint32_t SCD40_SAMPLE_PERIOD {
+      (sensor_settings::SCD40_MEASUREMENT_MODE == SCD40::measurement_mode_e::SINGLE_SHOT) ? UPDATE_DISPLAY_INTERVAL :
+      (sensor_settings::SCD40_MEASUREMENT_MODE == SCD40::measurement_mode_e::LOW_POWER_PERIODIC) ? 30 * 1000 : 5 * 1000}; //[ms]
+    // single shot measures twice for 5 seconds, periodic data may be up to one poll interval late.
+    constexpr static uint32_t SCD40_SAMPLE_DEADLINE {
+      (sensor_settings::SCD40_MEASUREMENT_MODE == SCD40::measurement_mode_e::SINGLE_SHOT) ? 11 * 1000 : 6 * 1000}; //[ms]
+    constexpr static size_t SENSOR_SAMPLE_BUFFER_SIZE {64};
+    typedef sensor_data::RING_BUFFER<sensor_data::sensor_sample_t, SENSOR_SAMPLE_BUFFER_SIZE> sensor_sample_buffer_t;
     DMA_ATTR static LGFX_Sprite black_sprite;
-    BME280::results_data_t results_data {0.0, 0.0, 0.0};
+    // written by the sensor scheduler task only. every consumer reads it with its own reader.
+    sensor_sample_buffer_t sensor_samples;
+    // latest values, owned by update_display_task
     float temperature {0.0};  //[degree Celsius]
     float pressure    {0.0};  //[hPa]
-    double humidity   {0.0};  //[%]
+    float humidity    {0.0};  //[%]
     uint16_t co2      {0};    //[ppm]
-    const char file_path[50] = "/sensor_log.csv";
+    // daily binary sensor log segments, see sensor_log_format.h. tools/log2csv converts them.
+    const char sensor_log_directory[20] = "/log";
+    // the ring buffer holds samples, the flush blocks match the 16KB fat allocation unit of the sd card.
+    constexpr static size_t SENSOR_LOG_BUFFER_SIZE      {4 * 1024};  //[byte]
+    constexpr static size_t SENSOR_LOG_FLUSH_BLOCK_SIZE {16 * 1024}; //[byte]
+    // encoded blocks kept in ram while the sd card is missing or fails, about 2.5 hours of samples.
+    constexpr static size_t SENSOR_LOG_BACKLOG_SIZE     {32 * 1024}; //[byte]
+    // at least a few days of blocks, even when the latency flushes write partial blocks.
+    constexpr static size_t SENSOR_LOG_JOURNAL_SIZE     {256 * 1024}; //[byte]
+    // a day of samples is about 300KB. the unused rest is given back at midnight.
+    constexpr static size_t SENSOR_LOG_SEGMENT_PREALLOCATION_SIZE {512 * 1024}; //[byte]
+    constexpr static uint32_t SENSOR_LOG_MAX_LATENCY    {10 * 60 * 1000}; //[ms]
+    // a backlog is written one flush block per second, so the display task keeps getting the cpu.
+    constexpr static uint32_t SENSOR_LOG_DRAIN_INTERVAL {1000};      //[ms]
+    // no card detect pin. a missing card is found by mounting it again.
+    constexpr static uint32_t SENSOR_LOG_RETRY_INTERVAL {30 * 1000}; //[ms]
+    // raw samples, then 1 minute aggregates, then 1 hour aggregates forever (about 3KB per day)
+    // yesterday may still get blocks from the ram backlog of the logger, so the days before are packed.
+    // a packed day is about 100KB, 6 weeks take less space than 2 weeks unpacked.
+    constexpr static uint32_t SENSOR_LOG_PACK_AFTER_DAYS       {2};
+    constexpr static uint32_t SENSOR_LOG_RAW_RETENTION_DAYS    {42};
+    constexpr static uint32_t SENSOR_LOG_MINUTE_RETENTION_DAYS {180};
+    constexpr static uint32_t SENSOR_LOG_HOUR_RETENTION_DAYS   {0};
+    constexpr static uint32_t SENSOR_LOG_RETENTION_INTERVAL    {60 * 60 * 1000}; //[ms]
+    // i2c trace, only written with CONFIG_I2C_TRACE_RECORDER
+    const char i2c_trace_file_path[50] = "/i2c_trace.bin";
+    constexpr static size_t I2C_TRACE_WRITE_BUFFER_SIZE {512};
+    uint8_t i2c_trace_write_buffer[I2C_TRACE_WRITE_BUFFER_SIZE];
+    uint32_t i2c_trace_dropped_count {0};
     constexpr static uint8_t WHITE  {255};
     constexpr static uint8_t BLACK  {0};
 
@@ -39,25 +89,30 @@ class SMART_CLOCK final{
     SD_CARD sd_card;
     WIFI wifi;
     SNTP sntp;
-    
-    QueueHandle_t co2_buffer {NULL};
-    QueueHandle_t bme280_results_buffer {NULL};
+    SENSOR_SCHEDULER sensor_scheduler;
+    SENSOR_LOGGER sensor_logger;
+    SENSOR_LOG_RETENTION sensor_log_retention;
 
     TimerHandle_t update_display_timer_handle {NULL}; 
-    TaskHandle_t  sensor_task_handle {NULL};
     TaskHandle_t  update_display_handle {NULL};
 
     esp_err_t create_update_display_timer_task(const char* pname);
     esp_err_t create_update_display_task(const char* pname, uint16_t stack_size, UBaseType_t task_priority);
-    esp_err_t create_monitor_sensor_task(const char* pname, uint16_t stack_size, UBaseType_t task_priority);
+    esp_err_t init_sensor_scheduler();
     
     static void get_update_display_timer_task_entry_point(TimerHandle_t timer_handle);
     static void get_update_display_task_entry_point(void* arg);
-    static void get_monitor_sensor_task_entry_point(void* arg);
+    static esp_err_t get_bme280_step_entry_point(void* arg, sensor_data::sensor_sample_t* psample, uint32_t* pwait_ms);
+    static esp_err_t get_scd40_step_entry_point(void* arg, sensor_data::sensor_sample_t* psample, uint32_t* pwait_ms);
+    static void get_sensor_sample_subscriber_entry_point(void* arg, const sensor_data::sensor_sample_t* psample);
  
     void update_display_timer_task();
     void update_display_task(); 
-    void monitor_sensor_task();
+    esp_err_t bme280_step(sensor_data::sensor_sample_t* psample, uint32_t* pwait_ms);
+    esp_err_t scd40_step(sensor_data::sensor_sample_t* psample, uint32_t* pwait_ms);
+    void sensor_sample_subscriber(const sensor_data::sensor_sample_t* psample);
+    void read_sensor_samples(sensor_sample_buffer_t::READER* preader);
+    esp_err_t drain_i2c_trace();
 
     esp_err_t display_epaper(); 
   
@@ -0,0 +1,151 @@
+// compares the integer compensation of the bme280 driver with the floating point formulas
+// it replaced, over the whole raw adc range and several calibration sets.
+// temperature must match exactly, pressure and humidity within the resolution of the
+// integer formulas. raw pressures beyond 0 Pa are the one known difference: the old
+// formula wrapped them to 1100 hPa, the integer one limits them to 300 hPa.
+// also prints the host time per sample of both.
+#include <chrono>
+#include <math.h>
+#include <stdio.h>
+
+#include "bme280_compensation.h"
+
+namespace{
+  constexpr int32_t ADC_20_BIT_COUNT {1 << 20};
+  constexpr int32_t ADC_16_BIT_COUNT {1 << 16};
+  // the integer pressure has 1/256 Pa, the reference 1/100 Pa truncated and then a float.
+  constexpr double PRESSURE_TOLERANCE {0.00025}; //[hPa]
+  constexpr double PRESSURE_MIN {300.0};         //[hPa]
+  constexpr double PRESSURE_MAX {1100.0};        //[hPa]
+  // the integer humidity is the bosch 32-bit approximation of the double formula.
+  constexpr double HUMIDITY_TOLERANCE {0.02};    //[%RH]
+  // raw temperatures of about -40, 0, 25, 50 and 85 degree Celsius with the datasheet set
+  constexpr int32_t ADC_T_SAMPLES[] {313000, 440000, 519888, 600000, 710000};
+
+  typedef struct{
+    const char* pname;
+    bme280::calibration_t calibration;
+  }calibration_set_t;
+
+  const calibration_set_t CALIBRATION_SETS[] {
+    // the example of the bmp280 data sheet with typical humidity coefficients
+    {"datasheet", {27504, 26435, -1000, 36477, -10685, 3024, 2855, 140, -7, 15500, -14600, 6000, 75, 362, 0, 313, 50, 30}},
+    // typical coefficients of another part
+    {"smart clock", {28485, 26735, 50, 36738, -10635, 3024, 5270, -5, -7, 9900, -10230, 4285, 75, 359, 0, 339, 0, 30}},
+    // coefficients near the ends of their usual ranges
+    {"extreme", {29000, 26000, -2000, 38000, -11000, 3500, 8000, -150, -7, 16000, -15000, 7000, 100, 400, 10, 280, 100, 40}},
+  };
+
+  bool check_temperature(const calibration_set_t* pset){
+    uint32_t mismatch_count = 0;
+    for(int32_t adc_T = 0; adc_T < ADC_20_BIT_COUNT; adc_T++){
+      int32_t t_fine = 0;
+      int32_t reference_t_fine = 0;
+      const int32_t temperature = bme280::compensate_temperature_fixed(&pset->calibration, adc_T, &t_fine);
+      const float reference = bme280::compensate_temperature_reference(&pset->calibration, adc_T, &reference_t_fine);
+      if((static_cast<float>(temperature) / 100 != reference) || (t_fine != reference_t_fine)){
+        if(mismatch_count == 0){
+          fprintf(stderr, "%s: adc_T %d: %d / 100 != %f\n", pset->pname, adc_T, temperature, reference);
+        }
+        mismatch_count++;
+      }
+    }
+    printf("%s temperature: %d values, mismatches:%u\n", pset->pname, ADC_20_BIT_COUNT, mismatch_count);
+    return mismatch_count == 0;
+  }
+
+  bool check_pressure(const calibration_set_t* pset){
+    uint32_t mismatch_count = 0;
+    uint32_t wrapped_count = 0;
+    double max_error = 0.0;
+    for(int32_t adc_T : ADC_T_SAMPLES){
+      int32_t t_fine = 0;
+      bme280::compensate_temperature_fixed(&pset->calibration, adc_T, &t_fine);
+      for(int32_t adc_P = 0; adc_P < ADC_20_BIT_COUNT; adc_P++){
+        const double pressure = bme280::compensate_pressure_fixed(&pset->calibration, adc_P, t_fine) / 25600.0;
+        const double reference = bme280::compensate_pressure_reference(&pset->calibration, adc_P, t_fine);
+        const double error = fabs(pressure - reference);
+        if((pressure == PRESSURE_MIN) && (reference == PRESSURE_MAX)){
+          wrapped_count++;
+          continue;
+        }
+        if(error > max_error){
+          max_error = error;
+        }
+        if(error > PRESSURE_TOLERANCE){
+          if(mismatch_count == 0){
+            fprintf(stderr, "%s: adc_T %d adc_P %d: %.5f != %.5f hPa\n", pset->pname, adc_T, adc_P, pressure, reference);
+          }
+          mismatch_count++;
+        }
+      }
+    }
+    printf("%s pressure: %d values, max error:%.6f hPa, below 0 Pa:%u, mismatches:%u\n", pset->pname,
+        ADC_20_BIT_COUNT * static_cast<int32_t>(sizeof(ADC_T_SAMPLES) / sizeof(ADC_T_SAMPLES[0])), max_error,
+        wrapped_count, mismatch_count);
+    return mismatch_count == 0;
+  }
+
+  bool check_humidity(const calibration_set_t* pset){
+    uint32_t mismatch_count = 0;
+    double max_error = 0.0;
+    for(int32_t adc_T : ADC_T_SAMPLES){
+      int32_t t_fine = 0;
+      bme280::compensate_temperature_fixed(&pset->calibration, adc_T, &t_fine);
+      for(int32_t adc_H = 0; adc_H < ADC_16_BIT_COUNT; adc_H++){
+        const double humidity = bme280::compensate_humidity_fixed(&pset->calibration, adc_H, t_fine) / 1024.0;
+        const double reference = bme280::compensate_humidity_reference(&pset->calibration, adc_H, t_fine);
+        const double error = fabs(humidity - reference);
+        if(error > max_error){
+          max_error = error;
+        }
+        if(error > HUMIDITY_TOLERANCE){
+          if(mismatch_count == 0){
+            fprintf(stderr, "%s: adc_T %d adc_H %d: %.4f != %.4f %%RH\n", pset->pname, adc_T, adc_H, humidity, reference);
+          }
+          mismatch_count++;
+        }
+      }
+    }
+    printf("%s humidity: %d values, max error:%.4f %%RH, mismatches:%u\n", pset->pname,
+        ADC_16_BIT_COUNT * static_cast<int32_t>(sizeof(ADC_T_SAMPLES) / sizeof(ADC_T_SAMPLES[0])), max_error, mismatch_count);
+    return mismatch_count == 0;
+  }
+
+  // host time only. the esp32-s3 has no double fpu, there CONFIG_BME280_COMPENSATION_BENCHMARK counts the cycles.
+  void print_timing(const calibration_set_t* pset){
+    constexpr int32_t SAMPLE_COUNT {1 << 20};
+    volatile uint32_t fixed_sink = 0;
+    volatile double reference_sink = 0.0;
+    int32_t t_fine = 0;
+
+    const auto fixed_start = std::chrono::steady_clock::now();
+    for(int32_t index = 0; index < SAMPLE_COUNT; index++){
+      fixed_sink = fixed_sink + bme280::compensate_temperature_fixed(&pset->calibration, 519888 + (index & 0xfff), &t_fine);
+      fixed_sink = fixed_sink + bme280::compensate_pressure_fixed(&pset->calibration, 415148 + (index & 0xfff), t_fine);
+      fixed_sink = fixed_sink + bme280::compensate_humidity_fixed(&pset->calibration, 28000 + (index & 0xfff), t_fine);
+    }
+    const auto reference_start = std::chrono::steady_clock::now();
+    for(int32_t index = 0; index < SAMPLE_COUNT; index++){
+      reference_sink = reference_sink + bme280::compensate_temperature_reference(&pset->calibration, 519888 + (index & 0xfff), &t_fine);
+      reference_sink = reference_sink + bme280::compensate_pressure_reference(&pset->calibration, 415148 + (index & 0xfff), t_fine);
+      reference_sink = reference_sink + bme280::compensate_humidity_reference(&pset->calibration, 28000 + (index & 0xfff), t_fine);
+    }
+    const auto end = std::chrono::steady_clock::now();
+    printf("%s host time per sample: integer:%.1fns reference:%.1fns\n", pset->pname,
+        std::chrono::duration<double, std::nano>(reference_start - fixed_start).count() / SAMPLE_COUNT,
+        std::chrono::duration<double, std::nano>(end - reference_start).count() / SAMPLE_COUNT);
+  }
+}
+
+int main(){
+  bool is_passed = true;
+  for(const calibration_set_t& set : CALIBRATION_SETS){
+    is_passed &= check_temperature(&set);
+    is_passed &= check_pressure(&set);
+    is_passed &= check_humidity(&set);
+    print_timing(&set);
+  }
+  printf("%s\n", is_passed ? "PASSED" : "FAILED");
+  return is_passed ? 0 : 1;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+typedef enum{
+  GPIO_NUM_NC = -1,
+  GPIO_NUM_39 = 39,
+  GPIO_NUM_40,
+  GPIO_NUM_41,
+  GPIO_NUM_42,
+}gpio_num_t;
@@ -0,0 +1,16 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+
+typedef struct host_ringbuf* RingbufHandle_t;
+typedef enum{
+  RINGBUF_TYPE_NOSPLIT,
+  RINGBUF_TYPE_ALLOWSPLIT,
+  RINGBUF_TYPE_BYTEBUF
+}RingbufferType_t;
+
+// a first in first out of copied items up to buffer_size bytes. never blocks.
+RingbufHandle_t xRingbufferCreate(size_t buffer_size, RingbufferType_t type);
+BaseType_t xRingbufferSend(RingbufHandle_t ringbuf, const void* pitem, size_t item_size, TickType_t wait_ticks);
+// the item stays valid until vRingbufferReturnItem().
+void* xRingbufferReceive(RingbufHandle_t ringbuf, size_t* pitem_size, TickType_t wait_ticks);
+void vRingbufferReturnItem(RingbufHandle_t ringbuf, void* pitem);
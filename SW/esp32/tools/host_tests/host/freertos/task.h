@@ -0,0 +1,14 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+
+typedef struct host_task* TaskHandle_t;
+typedef void (*TaskFunction_t)(void* arg);
+
+// advances the time instead of sleeping.
+void vTaskDelay(TickType_t ticks);
+// tasks are not supported on the host, the tests call the work directly. always fails.
+BaseType_t xTaskCreate(TaskFunction_t task_function, const char* pname, uint32_t stack_size,
+    void* arg, UBaseType_t priority, TaskHandle_t* ptask_handle);
+void vTaskDelete(TaskHandle_t task_handle);
+BaseType_t xTaskNotifyGive(TaskHandle_t task_handle);
+uint32_t ulTaskNotifyTake(BaseType_t is_clear_on_exit, TickType_t wait_ticks);
@@ -0,0 +1,8 @@
+// the host SD_CARD of sd_card_host.cpp. the card is a directory of the host.
+#pragma once
+
+#include "esp_err.h"
+
+// the directory that stands in for the mount point. set before SD_CARD::init().
+// ESP_ERR_INVALID_SIZE if the path is too long.
+esp_err_t host_sd_card_set_root(const char* proot);
@@ -0,0 +1,132 @@
+// single threaded host implementations of the esp-idf and FreeRTOS functions
+// used by the sensor log.
+#include <deque>
+#include <stdarg.h>
+#include <stdio.h>
+#include <vector>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/ringbuf.h"
+
+struct host_ringbuf{
+  size_t buffer_size;
+  size_t used_size;
+  std::deque<std::vector<uint8_t>> items;
+  // the item handed out by xRingbufferReceive()
+  std::vector<uint8_t> received_item;
+};
+
+namespace{
+  int64_t host_time {0}; //[us]
+  // the logs of the sensor log on errors are part of the test output.
+  esp_log_level_t host_log_level {ESP_LOG_WARN};
+}
+
+const char* esp_err_to_name(esp_err_t code){
+  switch(code){
+    case ESP_OK:                   return "ESP_OK";
+    case ESP_FAIL:                 return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:           return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:      return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:    return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE:     return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND:        return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED:    return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT:          return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_RESPONSE: return "ESP_ERR_INVALID_RESPONSE";
+    case ESP_ERR_INVALID_CRC:      return "ESP_ERR_INVALID_CRC";
+    case ESP_ERR_INVALID_VERSION:  return "ESP_ERR_INVALID_VERSION";
+    case ESP_ERR_NOT_FINISHED:     return "ESP_ERR_NOT_FINISHED";
+    default:                       return "UNKNOWN ERROR";
+  }
+}
+
+void esp_log_level_set(const char* tag, esp_log_level_t level){
+  // the components raise their own level. the tests use one level for all.
+  (void)tag;
+  (void)level;
+}
+
+void host_log_write(esp_log_level_t level, const char* tag, const char* format, ...){
+  constexpr static char LEVEL_LETTERS[] = "NEWIDV";
+  if(level > host_log_level){
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  fprintf(stderr, "%c (%lld) %s: ", LEVEL_LETTERS[level], (long long)(host_time / 1000), tag);
+  vfprintf(stderr, format, args);
+  fprintf(stderr, "\n");
+  va_end(args);
+}
+
+int64_t esp_timer_get_time(){
+  return host_time;
+}
+
+void vTaskDelay(TickType_t ticks){
+  host_time += static_cast<int64_t>(ticks) * portTICK_PERIOD_MS * 1000;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t task_function, const char* pname, uint32_t stack_size,
+    void* arg, UBaseType_t priority, TaskHandle_t* ptask_handle){
+  (void)task_function;
+  (void)pname;
+  (void)stack_size;
+  (void)arg;
+  (void)priority;
+  (void)ptask_handle;
+  return pdFAIL;
+}
+
+void vTaskDelete(TaskHandle_t task_handle){
+  (void)task_handle;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task_handle){
+  (void)task_handle;
+  return pdPASS;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t is_clear_on_exit, TickType_t wait_ticks){
+  (void)is_clear_on_exit;
+  vTaskDelay(wait_ticks);
+  return 0;
+}
+
+RingbufHandle_t xRingbufferCreate(size_t buffer_size, RingbufferType_t type){
+  (void)type;
+  return new host_ringbuf{buffer_size, 0, {}, {}};
+}
+
+BaseType_t xRingbufferSend(RingbufHandle_t ringbuf, const void* pitem, size_t item_size, TickType_t wait_ticks){
+  (void)wait_ticks;
+  if(ringbuf->used_size + item_size > ringbuf->buffer_size){
+    return pdFALSE;
+  }
+  const uint8_t* pdata = static_cast<const uint8_t*>(pitem);
+  ringbuf->items.emplace_back(pdata, pdata + item_size);
+  ringbuf->used_size += item_size;
+  return pdTRUE;
+}
+
+void* xRingbufferReceive(RingbufHandle_t ringbuf, size_t* pitem_size, TickType_t wait_ticks){
+  (void)wait_ticks;
+  if(ringbuf->items.empty()){
+    return NULL;
+  }
+  ringbuf->received_item = ringbuf->items.front();
+  ringbuf->items.pop_front();
+  ringbuf->used_size -= ringbuf->received_item.size();
+  *pitem_size = ringbuf->received_item.size();
+  return ringbuf->received_item.data();
+}
+
+void vRingbufferReturnItem(RingbufHandle_t ringbuf, void* pitem){
+  (void)ringbuf;
+  (void)pitem;
+}
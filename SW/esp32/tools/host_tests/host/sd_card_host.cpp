@@ -0,0 +1,218 @@
+// SD_CARD on a host directory, for the sensor log tests. only the calls of the sensor log.
+// the directory is the mount point, paths below it are the same as on the card.
+#include <dirent.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+
+#include "host_sd_card.h"
+#include "sd_card.h"
+
+namespace{
+  constexpr size_t HOST_ROOT_SIZE {64};
+  char host_root[HOST_ROOT_SIZE] {};
+  sdmmc_card_t host_card {};
+}
+
+esp_err_t host_sd_card_set_root(const char* proot){
+  esp_err_t r = ESP_OK;
+  if(strnlen(proot, sizeof(host_root)) >= sizeof(host_root)){
+    r = ESP_ERR_INVALID_SIZE;
+  }
+  else{
+    strncpy(host_root, proot, sizeof(host_root) - 1);
+  }
+  return r;
+}
+
+SD_CARD::SD_CARD(){
+}
+
+esp_err_t SD_CARD::init(){
+  is_initialized = true;
+  return mount();
+}
+
+esp_err_t SD_CARD::mount(){
+  esp_err_t r = ESP_OK;
+  if(host_root[0] == '\0'){
+    ESP_LOGE(SD_CARD_TAG, "no host directory for the card.");
+    r = ESP_ERR_INVALID_STATE;
+  }
+  if(r == ESP_OK){
+    portENTER_CRITICAL(&mlock);
+    pcard = &host_card;
+    portEXIT_CRITICAL(&mlock);
+  }
+  return r;
+}
+
+// the host runs one thread, so nobody can hold a lock meanwhile.
+esp_err_t SD_CARD::unmount(){
+  esp_err_t r = ESP_OK;
+  portENTER_CRITICAL(&mlock);
+  if(muser_count > 0){
+    r = ESP_ERR_INVALID_STATE;
+  }
+  else{
+    pcard = NULL;
+  }
+  portEXIT_CRITICAL(&mlock);
+  return r;
+}
+
+bool SD_CARD::is_mounted(){
+  return pcard != NULL;
+}
+
+esp_err_t SD_CARD::lock(){
+  esp_err_t r = ESP_OK;
+  if((pcard == NULL) || is_unmount_pending){
+    r = ESP_ERR_INVALID_STATE;
+  }
+  else{
+    muser_count++;
+  }
+  return r;
+}
+
+void SD_CARD::unlock(){
+  if(muser_count > 0){
+    muser_count--;
+  }
+}
+
+esp_err_t SD_CARD::make_full_path(const char* ppath, size_t path_size, char* pfull_path, size_t full_path_size){
+  esp_err_t r = ESP_OK;
+  if(pcard == NULL){
+    r = ESP_ERR_INVALID_STATE;
+  }
+  else if(snprintf(pfull_path, full_path_size, "%s%.*s", host_root, (int)path_size, ppath) >= (int)full_path_size){
+    ESP_LOGW(SD_CARD_TAG, "file path is too large.");
+    r = ESP_FAIL;
+  }
+  return r;
+}
+
+esp_err_t SD_CARD::open_file(const char* pfile_path, size_t file_path_size, char mode, SD_FILE* pfile){
+  esp_err_t r = ESP_OK;
+  char full_path[FULL_PATH_SIZE] = {};
+  const char* pmode = NULL;
+  FILE* pstream = NULL;
+
+  pfile->close();
+  switch(mode){
+    case 'a':
+      pmode = "a";
+      break;
+    case 'w':
+      pmode = "w";
+      break;
+    case 'r':
+      pmode = "r";
+      break;
+    case '+':
+      pmode = "r+";
+      break;
+    default:
+      ESP_LOGW(SD_CARD_TAG, "invalid write mode: %c", mode);
+      r = ESP_FAIL;
+  }
+  if(r == ESP_OK){
+    r = make_full_path(pfile_path, file_path_size, full_path, sizeof(full_path));
+  }
+  if(r == ESP_OK){
+    pstream = fopen(full_path, pmode);
+    if((pstream == NULL) && ((mode == 'r') || (mode == '+')) && (errno == ENOENT)){
+      r = ESP_ERR_NOT_FOUND;
+    }
+    else if(pstream == NULL){
+      ESP_LOGE(SD_CARD_TAG, "fail to open %s. errno=%d: %s", full_path, errno, strerror(errno));
+      r = ESP_FAIL;
+    }
+  }
+  pfile->attach(pstream);
+  return r;
+}
+
+esp_err_t SD_CARD::make_directory(const char* pdirectory_path, size_t directory_path_size){
+  esp_err_t r = ESP_OK;
+  char full_path[FULL_PATH_SIZE] = {};
+  r = make_full_path(pdirectory_path, directory_path_size, full_path, sizeof(full_path));
+  if((r == ESP_OK) && (mkdir(full_path, 0777) != 0) && (errno != EEXIST)){
+    ESP_LOGE(SD_CARD_TAG, "fail to create %s. errno=%d: %s", full_path, errno, strerror(errno));
+    r = ESP_FAIL;
+  }
+  return r;
+}
+
+esp_err_t SD_CARD::list_directory(const char* pdirectory_path, size_t directory_path_size,
+    entry_function_t entry_function, void* arg){
+  esp_err_t r = ESP_OK;
+  char full_path[FULL_PATH_SIZE] = {};
+  DIR* pdirectory = NULL;
+  struct dirent* pentry = NULL;
+
+  r = make_full_path(pdirectory_path, directory_path_size, full_path, sizeof(full_path));
+  if((r == ESP_OK) && ((pdirectory = opendir(full_path)) == NULL)){
+    r = (errno == ENOENT) ? ESP_ERR_NOT_FOUND : ESP_FAIL;
+  }
+  while((r == ESP_OK) && ((pentry = readdir(pdirectory)) != NULL)){
+    if(pentry->d_type == DT_REG){
+      entry_function(arg, pentry->d_name);
+    }
+  }
+  if(pdirectory != NULL){
+    closedir(pdirectory);
+  }
+  return r;
+}
+
+esp_err_t SD_CARD::remove_file(const char* pfile_path, size_t file_path_size){
+  esp_err_t r = ESP_OK;
+  char full_path[FULL_PATH_SIZE] = {};
+  r = make_full_path(pfile_path, file_path_size, full_path, sizeof(full_path));
+  if((r == ESP_OK) && (unlink(full_path) != 0)){
+    r = (errno == ENOENT) ? ESP_ERR_NOT_FOUND : ESP_FAIL;
+  }
+  return r;
+}
+
+// fat does not replace an existing file, unlike rename() of the host.
+esp_err_t SD_CARD::rename_file(const char* pold_path, size_t old_path_size, const char* pnew_path, size_t new_path_size){
+  esp_err_t r = ESP_OK;
+  char old_full_path[FULL_PATH_SIZE] = {};
+  char new_full_path[FULL_PATH_SIZE] = {};
+
+  r = make_full_path(pold_path, old_path_size, old_full_path, sizeof(old_full_path));
+  if(r == ESP_OK){
+    r = make_full_path(pnew_path, new_path_size, new_full_path, sizeof(new_full_path));
+  }
+  if((r == ESP_OK) && (access(new_full_path, F_OK) == 0)){
+    r = ESP_FAIL;
+  }
+  if((r == ESP_OK) && (rename(old_full_path, new_full_path) != 0)){
+    r = (errno == ENOENT) ? ESP_ERR_NOT_FOUND : ESP_FAIL;
+  }
+  return r;
+}
+
+// the content is undefined on the card. the host fills it with 0xa5, so nothing relies on zeros.
+esp_err_t SD_CARD::create_contiguous_file(const char* pfile_path, size_t file_path_size, uint64_t file_size){
+  esp_err_t r = ESP_OK;
+  SD_FILE file;
+  uint8_t fill[512] = {};
+  memset(fill, 0xa5, sizeof(fill));
+  r = open_file(pfile_path, file_path_size, 'w', &file);
+  for(uint64_t written_size = 0; (r == ESP_OK) && (written_size < file_size); written_size += sizeof(fill)){
+    const size_t write_size = (file_size - written_size < sizeof(fill)) ? file_size - written_size : sizeof(fill);
+    r = file.write(fill, write_size);
+  }
+  if(file.is_open() && (file.close() != ESP_OK)){
+    r = ESP_FAIL;
+  }
+  return r;
+}
@@ -0,0 +1,2 @@
+// host replacement of the generated header. no option of the firmware is set.
+#pragma once
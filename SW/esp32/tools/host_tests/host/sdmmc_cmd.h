@@ -0,0 +1,6 @@
+// host replacement of the esp-idf header. SD_CARD only keeps a pointer to the card.
+#pragma once
+
+typedef struct{
+  int host_card;
+}sdmmc_card_t;
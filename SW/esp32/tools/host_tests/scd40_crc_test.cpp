@@ -0,0 +1,58 @@
+// compares the table crc-8 of the scd40 driver with the bitwise calculation it replaced,
+// for every 2 byte word the sensor can send. also prints the host time per word of both.
+#include <chrono>
+#include <stdio.h>
+
+#include "scd40_crc.h"
+
+namespace{
+  constexpr uint32_t WORD_COUNT {1 << 16};
+
+  bool check_all_words(){
+    uint32_t mismatch_count = 0;
+    for(uint32_t value = 0; value < WORD_COUNT; value++){
+      const uint8_t word[] = {static_cast<uint8_t>(value >> 8), static_cast<uint8_t>(value & 0xFF)};
+      const uint8_t crc = scd40::calculate_crc(word, sizeof(word));
+      const uint8_t reference = scd40::calculate_crc_bitwise(word, sizeof(word));
+      if(crc != reference){
+        if(mismatch_count == 0){
+          fprintf(stderr, "word %04x: crc %02x != %02x\n", value, crc, reference);
+        }
+        mismatch_count++;
+      }
+    }
+    printf("crc8: %u words, mismatches:%u\n", WORD_COUNT, mismatch_count);
+    return mismatch_count == 0;
+  }
+
+  void print_timing(){
+    constexpr uint32_t ROUND_COUNT {64};
+    volatile uint8_t table_sink = 0;
+    volatile uint8_t bitwise_sink = 0;
+    uint8_t word[2] {};
+
+    const auto table_start = std::chrono::steady_clock::now();
+    for(uint32_t index = 0; index < ROUND_COUNT * WORD_COUNT; index++){
+      word[0] = static_cast<uint8_t>(index >> 8);
+      word[1] = static_cast<uint8_t>(index);
+      table_sink = table_sink ^ scd40::calculate_crc(word, sizeof(word));
+    }
+    const auto bitwise_start = std::chrono::steady_clock::now();
+    for(uint32_t index = 0; index < ROUND_COUNT * WORD_COUNT; index++){
+      word[0] = static_cast<uint8_t>(index >> 8);
+      word[1] = static_cast<uint8_t>(index);
+      bitwise_sink = bitwise_sink ^ scd40::calculate_crc_bitwise(word, sizeof(word));
+    }
+    const auto end = std::chrono::steady_clock::now();
+    printf("crc8 host time per word: table:%.2fns bitwise:%.2fns\n",
+        std::chrono::duration<double, std::nano>(bitwise_start - table_start).count() / (ROUND_COUNT * WORD_COUNT),
+        std::chrono::duration<double, std::nano>(end - bitwise_start).count() / (ROUND_COUNT * WORD_COUNT));
+  }
+}
+
+int main(){
+  const bool is_passed = check_all_words();
+  print_timing();
+  printf("%s\n", is_passed ? "PASSED" : "FAILED");
+  return is_passed ? 0 : 1;
+}
@@ -0,0 +1,388 @@
+// writes sensor logs to a host directory that stands in for the sd card and reads them back
+// with SENSOR_LOG_READER::read_range():
+// - segments and indexes of the encoder, also with a torn block and a torn index tail.
+//   only the samples of the torn block may be missing.
+// - a day with a packed segment of SENSOR_LOG_RETENTION and a raw segment left by a reset
+//   before the removal, plus newer blocks. every sample must be read once.
+// - blocks only in the journal, which SENSOR_LOGGER::init() copies into their segments.
+// - a preallocated segment whose clusters still hold valid blocks of a removed segment.
+//   only the block after the logical end is zeroed, the reader must stop there.
+#include <filesystem>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "host_sd_card.h"
+#include "sd_card.h"
+#include "sensor_log_format.h"
+#include "log_block_encoder.h"
+#include "log_journal.h"
+#include "sensor_log_reader.h"
+#include "sensor_log_retention.h"
+#include "sensor_logger.h"
+
+namespace{
+  typedef std::vector<sensor_data::sensor_sample_t> samples_t;
+
+  constexpr uint32_t DAY_START {1709251200};   // 2024-03-01 00:00:00 utc
+  constexpr uint32_t SAMPLE_INTERVAL {10};     //[s]
+  constexpr size_t PATH_SIZE {48};
+
+  // the blocks of a segment as the logger writes them
+  typedef struct{
+    std::vector<uint8_t> blocks;
+    std::vector<sensor_log::log_index_entry_t> entries;
+    std::vector<size_t> sample_counts;  // per block
+  }encoded_log_t;
+
+  // a co2 and a bme280 sample in turn, every value unique.
+  samples_t make_samples(uint32_t first_timestamp, size_t sample_count, int32_t first_value){
+    samples_t samples(sample_count);
+    for(size_t sample_index = 0; sample_index < sample_count; sample_index++){
+      sensor_data::sensor_sample_t* psample = &samples[sample_index];
+      const int32_t value = first_value + static_cast<int32_t>(sample_index);
+      psample->timestamp = first_timestamp + static_cast<uint32_t>(sample_index / 2) * SAMPLE_INTERVAL;
+      if((sample_index % 2) == 0){
+        psample->sensor_id = sensor_data::sensor_id_e::SCD40;
+        psample->quality = sensor_data::SAMPLE_PRESSURE_COMPENSATED;
+        psample->value[0] = 400 + value;
+      }
+      else{
+        psample->sensor_id = sensor_data::sensor_id_e::BME280;
+        psample->value[0] = 2000 + value;
+        psample->value[1] = (100000 + value) * 256;
+        psample->value[2] = (40 * 1024) + value;
+      }
+    }
+    return samples;
+  }
+
+  // encodes the samples into blocks from first_sequence on. the index entries point at the
+  // blocks as if they were appended to a segment of first_block_index blocks.
+  encoded_log_t encode_samples(const samples_t& samples, uint32_t first_sequence, uint32_t first_block_index){
+    encoded_log_t log;
+    LOG_BLOCK_ENCODER encoder;
+    uint8_t block[sensor_log::LOG_BLOCK_SIZE] {};
+    size_t sample_count = 0;
+
+    auto finish_block = [&](){
+      encoder.finish();
+      sensor_log::log_index_entry_t entry = encoder.get_index_entry();
+      entry.block_index = first_block_index + static_cast<uint32_t>(log.entries.size());
+      log.blocks.insert(log.blocks.end(), block, block + sizeof(block));
+      log.entries.push_back(entry);
+      log.sample_counts.push_back(sample_count);
+      sample_count = 0;
+    };
+    encoder.begin(block, first_sequence);
+    for(const sensor_data::sensor_sample_t& sample : samples){
+      // like the logger, a block only holds the samples of one utc day.
+      if(!encoder.is_empty() && (sensor_log::get_log_segment_start(sample.timestamp) !=
+          sensor_log::get_log_segment_start(encoder.get_index_entry().first_timestamp))){
+        finish_block();
+        encoder.begin(block, first_sequence + static_cast<uint32_t>(log.entries.size()));
+      }
+      if(encoder.add(&sample) == ESP_ERR_NO_MEM){
+        finish_block();
+        encoder.begin(block, first_sequence + static_cast<uint32_t>(log.entries.size()));
+        encoder.add(&sample);
+      }
+      sample_count++;
+    }
+    if(!encoder.is_empty()){
+      finish_block();
+    }
+    return log;
+  }
+
+  esp_err_t write_file(SD_CARD* psd_card, const char* pdirectory, uint32_t segment_start, const char* pextension,
+      char mode, const void* pdata, size_t data_size){
+    esp_err_t r = ESP_OK;
+    char path[PATH_SIZE] = {};
+    SD_FILE file;
+    if(!sensor_log::make_log_segment_path(path, sizeof(path), pdirectory, segment_start, pextension)){
+      r = ESP_ERR_INVALID_SIZE;
+    }
+    if(r == ESP_OK){
+      r = psd_card->open_file(path, sizeof(path), mode, &file);
+    }
+    if(r == ESP_OK){
+      r = file.write(pdata, data_size);
+    }
+    if(r == ESP_OK){
+      r = file.close();
+    }
+    return r;
+  }
+
+  // appends the blocks to the segment and their entries to its index, like the logger.
+  esp_err_t append_segment(SD_CARD* psd_card, const char* pdirectory, uint32_t segment_start, const encoded_log_t* plog){
+    esp_err_t r = write_file(psd_card, pdirectory, segment_start, sensor_log::LOG_SEGMENT_EXTENSION, 'a',
+        plog->blocks.data(), plog->blocks.size());
+    if(r == ESP_OK){
+      r = write_file(psd_card, pdirectory, segment_start, sensor_log::LOG_INDEX_EXTENSION, 'a',
+          plog->entries.data(), plog->entries.size() * sizeof(sensor_log::log_index_entry_t));
+    }
+    return r;
+  }
+
+  bool is_file_found(SD_CARD* psd_card, const char* pdirectory, uint32_t segment_start, const char* pextension){
+    char path[PATH_SIZE] = {};
+    SD_FILE file;
+    sensor_log::make_log_segment_path(path, sizeof(path), pdirectory, segment_start, pextension);
+    return psd_card->open_file(path, sizeof(path), 'r', &file) == ESP_OK;
+  }
+
+  void add_sample(void* arg, const sensor_data::sensor_sample_t* psample){
+    static_cast<samples_t*>(arg)->push_back(*psample);
+  }
+
+  samples_t select_samples(const samples_t& samples, uint32_t start_time, uint32_t end_time){
+    samples_t selected;
+    for(const sensor_data::sensor_sample_t& sample : samples){
+      if((sample.timestamp >= start_time) && (sample.timestamp <= end_time)){
+        selected.push_back(sample);
+      }
+    }
+    return selected;
+  }
+
+  bool is_same_sample(const sensor_data::sensor_sample_t* psample, const sensor_data::sensor_sample_t* pexpected){
+    return (psample->timestamp == pexpected->timestamp) && (psample->sensor_id == pexpected->sensor_id) &&
+        (psample->quality == pexpected->quality) &&
+        (memcmp(psample->value, pexpected->value, sizeof(psample->value)) == 0);
+  }
+
+  // reads start_time..end_time and compares the samples and their order with expected.
+  bool check_range(SENSOR_LOG_READER* preader, const char* pname, uint32_t start_time, uint32_t end_time,
+      const samples_t& expected){
+    samples_t samples;
+    uint32_t sample_count = 0;
+    uint32_t mismatch_count = 0;
+    const esp_err_t r = preader->read_range(start_time, end_time, add_sample, &samples, &sample_count);
+    for(size_t sample_index = 0; (sample_index < samples.size()) && (sample_index < expected.size()); sample_index++){
+      if(!is_same_sample(&samples[sample_index], &expected[sample_index])){
+        if(mismatch_count == 0){
+          fprintf(stderr, "%s: sample %zu at %u differs from the one at %u\n", pname, sample_index,
+              samples[sample_index].timestamp, expected[sample_index].timestamp);
+        }
+        mismatch_count++;
+      }
+    }
+    printf("%s: %zu samples of %zu, mismatches:%u error:%s\n", pname, samples.size(), expected.size(),
+        mismatch_count, esp_err_to_name(r));
+    return (r == ESP_OK) && (sample_count == samples.size()) && (samples.size() == expected.size()) && (mismatch_count == 0);
+  }
+
+  bool check(const char* pname, bool is_passed){
+    if(!is_passed){
+      printf("%s: failed\n", pname);
+    }
+    return is_passed;
+  }
+
+  // a torn block loses its samples only. a torn index tail loses nothing, the reader
+  // continues after the last complete entry.
+  bool test_torn_segment(SD_CARD* psd_card){
+    constexpr const char* DIRECTORY {"/torn"};
+    constexpr size_t TORN_BLOCK_INDEX {2};
+    constexpr size_t INDEX_ENTRY_COUNT {4};
+    constexpr size_t TORN_ENTRY_SIZE {5};
+    bool is_passed = true;
+    SENSOR_LOG_READER reader;
+
+    const samples_t samples = make_samples(DAY_START + 3600, 400, 0);
+    encoded_log_t log = encode_samples(samples, 0, 0);
+    is_passed &= check("torn: enough blocks", log.entries.size() > INDEX_ENTRY_COUNT + 1);
+    is_passed &= check("torn: write", (psd_card->make_directory(DIRECTORY, strlen(DIRECTORY) + 1) == ESP_OK) &&
+        (append_segment(psd_card, DIRECTORY, DAY_START, &log) == ESP_OK));
+    is_passed &= check("torn: init", reader.init(psd_card, DIRECTORY, strlen(DIRECTORY) + 1) == ESP_OK);
+    is_passed &= check_range(&reader, "complete segment", DAY_START, DAY_START + sensor_log::LOG_SEGMENT_DURATION - 1, samples);
+    const uint32_t middle_time = samples[samples.size() / 2].timestamp;
+    is_passed &= check_range(&reader, "complete segment from the middle", middle_time, UINT32_MAX,
+        select_samples(samples, middle_time, UINT32_MAX));
+
+    // the second half of a block was not written before a reset.
+    memset(log.blocks.data() + TORN_BLOCK_INDEX * sensor_log::LOG_BLOCK_SIZE + sensor_log::LOG_BLOCK_SIZE / 2, 0,
+        sensor_log::LOG_BLOCK_SIZE / 2);
+    // the index ends within an entry.
+    const size_t index_size = INDEX_ENTRY_COUNT * sizeof(sensor_log::log_index_entry_t) + TORN_ENTRY_SIZE;
+    is_passed &= check("torn: write torn", (write_file(psd_card, DIRECTORY, DAY_START, sensor_log::LOG_SEGMENT_EXTENSION, 'w',
+        log.blocks.data(), log.blocks.size()) == ESP_OK) &&
+        (write_file(psd_card, DIRECTORY, DAY_START, sensor_log::LOG_INDEX_EXTENSION, 'w', log.entries.data(), index_size) == ESP_OK));
+
+    samples_t expected;
+    size_t sample_index = 0;
+    for(size_t block_index = 0; block_index < log.sample_counts.size(); block_index++){
+      if(block_index != TORN_BLOCK_INDEX){
+        expected.insert(expected.end(), samples.begin() + sample_index, samples.begin() + sample_index + log.sample_counts[block_index]);
+      }
+      sample_index += log.sample_counts[block_index];
+    }
+    is_passed &= check_range(&reader, "torn block and index", DAY_START, DAY_START + sensor_log::LOG_SEGMENT_DURATION - 1, expected);
+    // starts in a block after the torn index tail
+    const uint32_t tail_time = samples[samples.size() - log.sample_counts.back() / 2].timestamp;
+    is_passed &= check_range(&reader, "torn index, range after its end", tail_time, UINT32_MAX,
+        select_samples(expected, tail_time, UINT32_MAX));
+    return is_passed;
+  }
+
+  // the retention packs the day. a reset before it removed the raw segment leaves both,
+  // and blocks written later to the same day, e.g. after the clock stepped back, are raw only.
+  bool test_packed_and_raw_day(SD_CARD* psd_card){
+    constexpr const char* DIRECTORY {"/packed"};
+    constexpr uint32_t NOW {DAY_START + 3 * sensor_log::LOG_SEGMENT_DURATION};
+    const SENSOR_LOG_RETENTION::retention_config_t retention_config {1, 30, 0, 0, 60000};
+    bool is_passed = true;
+    SENSOR_LOG_RETENTION retention;
+    SENSOR_LOG_READER reader;
+
+    const samples_t packed_samples = make_samples(DAY_START + 3600, 300, 0);
+    const samples_t raw_samples = make_samples(DAY_START + 8 * 3600, 200, 1000);
+    const encoded_log_t packed_log = encode_samples(packed_samples, 0, 0);
+    const encoded_log_t raw_log = encode_samples(raw_samples, static_cast<uint32_t>(packed_log.entries.size()),
+        static_cast<uint32_t>(packed_log.entries.size()));
+    is_passed &= check("packed: write", (psd_card->make_directory(DIRECTORY, strlen(DIRECTORY) + 1) == ESP_OK) &&
+        (append_segment(psd_card, DIRECTORY, DAY_START, &packed_log) == ESP_OK));
+    is_passed &= check("packed: init", (reader.init(psd_card, DIRECTORY, strlen(DIRECTORY) + 1) == ESP_OK) &&
+        (retention.init(psd_card, DIRECTORY, strlen(DIRECTORY) + 1, &retention_config) == ESP_OK));
+    is_passed &= check("packed: apply", retention.apply(NOW) == ESP_OK);
+    is_passed &= check("packed: packed segment only",
+        is_file_found(psd_card, DIRECTORY, DAY_START, sensor_log::LOG_PACKED_EXTENSION) &&
+        !is_file_found(psd_card, DIRECTORY, DAY_START, sensor_log::LOG_SEGMENT_EXTENSION) &&
+        !is_file_found(psd_card, DIRECTORY, DAY_START, sensor_log::LOG_INDEX_EXTENSION));
+    is_passed &= check_range(&reader, "packed day", DAY_START, NOW, packed_samples);
+
+    samples_t expected = packed_samples;
+    expected.insert(expected.end(), raw_samples.begin(), raw_samples.end());
+    is_passed &= check("packed: write raw", (append_segment(psd_card, DIRECTORY, DAY_START, &packed_log) == ESP_OK) &&
+        (append_segment(psd_card, DIRECTORY, DAY_START, &raw_log) == ESP_OK));
+    is_passed &= check_range(&reader, "packed and raw day", DAY_START, NOW, expected);
+    const uint32_t middle_time = packed_samples[packed_samples.size() / 2].timestamp;
+    is_passed &= check_range(&reader, "packed and raw day from the middle", middle_time, NOW,
+        select_samples(expected, middle_time, NOW));
+    return is_passed;
+  }
+
+  // a reset after the journal write lost the segment writes of the last blocks, over midnight.
+  // the logger copies them into their segments once, the blocks already there are not repeated.
+  bool test_journal_replay(SD_CARD* psd_card){
+    constexpr const char* DIRECTORY {"/journal"};
+    constexpr size_t SEGMENT_BLOCK_COUNT {3};
+    const SENSOR_LOGGER::logger_config_t logger_config {
+        4096, 2 * sensor_log::LOG_BLOCK_SIZE, 8 * sensor_log::LOG_BLOCK_SIZE, 16 * sensor_log::LOG_BLOCK_SIZE, 0, 60000, 1000, 5000};
+    bool is_passed = true;
+    char journal_path[PATH_SIZE] = {};
+    uint8_t work_block[sensor_log::LOG_BLOCK_SIZE] {};
+    LOG_JOURNAL journal;
+    SENSOR_LOGGER logger;
+    SENSOR_LOGGER::logger_stats_t stats {};
+    SENSOR_LOG_READER reader;
+
+    // 23:30 until 00:03 of the next day. every block fits the journal.
+    const samples_t samples = make_samples(DAY_START + 23 * 3600 + 1800, 400, 0);
+    const encoded_log_t log = encode_samples(samples, 0, 0);
+    const uint32_t journal_block_count = logger_config.journal_size / sensor_log::LOG_BLOCK_SIZE;
+    encoded_log_t segment_log = log;
+    segment_log.blocks.resize(SEGMENT_BLOCK_COUNT * sensor_log::LOG_BLOCK_SIZE);
+    segment_log.entries.resize(SEGMENT_BLOCK_COUNT);
+    is_passed &= check("journal: blocks fit", log.entries.size() <= journal_block_count);
+    is_passed &= check("journal: over midnight", samples.back().timestamp >= DAY_START + sensor_log::LOG_SEGMENT_DURATION);
+    snprintf(journal_path, sizeof(journal_path), "%s/journal.bin", DIRECTORY);
+    is_passed &= check("journal: write", (psd_card->make_directory(DIRECTORY, strlen(DIRECTORY) + 1) == ESP_OK) &&
+        (append_segment(psd_card, DIRECTORY, DAY_START, &segment_log) == ESP_OK) &&
+        (journal.open(psd_card, journal_path, sizeof(journal_path), journal_block_count, work_block) == ESP_OK) &&
+        (journal.write(log.blocks.data(), log.entries.size()) == ESP_OK));
+    journal.close();
+
+    is_passed &= check("journal: logger init", logger.init(psd_card, DIRECTORY, strlen(DIRECTORY) + 1, &logger_config) == ESP_OK);
+    logger.get_stats(&stats);
+    printf("journal: %zu blocks, %u in the segment, recovered:%lu\n", log.entries.size(), (unsigned)SEGMENT_BLOCK_COUNT,
+        (unsigned long)stats.recovered_block_count);
+    is_passed &= check("journal: recovered blocks", stats.recovered_block_count == log.entries.size() - SEGMENT_BLOCK_COUNT);
+    is_passed &= check("journal: next day", is_file_found(psd_card, DIRECTORY, DAY_START + sensor_log::LOG_SEGMENT_DURATION,
+        sensor_log::LOG_SEGMENT_EXTENSION));
+    is_passed &= check("journal: reader init", reader.init(psd_card, DIRECTORY, strlen(DIRECTORY) + 1) == ESP_OK);
+    is_passed &= check_range(&reader, "journal replay", DAY_START, DAY_START + 2 * sensor_log::LOG_SEGMENT_DURATION - 1, samples);
+    const uint32_t midnight = DAY_START + sensor_log::LOG_SEGMENT_DURATION;
+    is_passed &= check_range(&reader, "journal replay, next day", midnight, UINT32_MAX, select_samples(samples, midnight, UINT32_MAX));
+    return is_passed;
+  }
+
+  // the journal replay writes into a new preallocated segment. the clusters of a removed
+  // segment are reused, so valid old blocks follow the zeroed block after the logical end.
+  bool test_preallocated_segment(SD_CARD* psd_card){
+    constexpr const char* DIRECTORY {"/preallocated"};
+    constexpr size_t PREALLOCATION_BLOCK_COUNT {16};
+    const SENSOR_LOGGER::logger_config_t logger_config {
+        4096, 2 * sensor_log::LOG_BLOCK_SIZE, 8 * sensor_log::LOG_BLOCK_SIZE, 16 * sensor_log::LOG_BLOCK_SIZE,
+        PREALLOCATION_BLOCK_COUNT * sensor_log::LOG_BLOCK_SIZE, 60000, 1000, 5000};
+    bool is_passed = true;
+    char journal_path[PATH_SIZE] = {};
+    char segment_path[PATH_SIZE] = {};
+    uint8_t work_block[sensor_log::LOG_BLOCK_SIZE] {};
+    uint8_t block[sensor_log::LOG_BLOCK_SIZE] {};
+    const uint8_t zero_block[sensor_log::LOG_BLOCK_SIZE] {};
+    LOG_JOURNAL journal;
+    SENSOR_LOGGER logger;
+    SENSOR_LOGGER::logger_stats_t stats {};
+    SENSOR_LOG_READER reader;
+    SD_FILE segment_file;
+    long segment_size = 0;
+    size_t read_size = 0;
+
+    const samples_t samples = make_samples(DAY_START + 3600, 200, 0);
+    const encoded_log_t log = encode_samples(samples, 0, 0);
+    // later samples of the same day, so that the reader would take them.
+    const encoded_log_t old_log = encode_samples(make_samples(DAY_START + 12 * 3600, 800, 10000), 1000, 0);
+    const uint32_t journal_block_count = logger_config.journal_size / sensor_log::LOG_BLOCK_SIZE;
+    const size_t end_block_index = log.entries.size();
+    const size_t old_block_count = PREALLOCATION_BLOCK_COUNT - end_block_index - 1;
+    is_passed &= check("preallocated: blocks fit", (end_block_index < PREALLOCATION_BLOCK_COUNT) &&
+        (end_block_index <= journal_block_count) && (old_log.entries.size() >= PREALLOCATION_BLOCK_COUNT));
+    snprintf(journal_path, sizeof(journal_path), "%s/journal.bin", DIRECTORY);
+    sensor_log::make_log_segment_path(segment_path, sizeof(segment_path), DIRECTORY, DAY_START, sensor_log::LOG_SEGMENT_EXTENSION);
+    is_passed &= check("preallocated: write", (psd_card->make_directory(DIRECTORY, strlen(DIRECTORY) + 1) == ESP_OK) &&
+        (journal.open(psd_card, journal_path, sizeof(journal_path), journal_block_count, work_block) == ESP_OK) &&
+        (journal.write(log.blocks.data(), log.entries.size()) == ESP_OK));
+    journal.close();
+
+    is_passed &= check("preallocated: logger init", logger.init(psd_card, DIRECTORY, strlen(DIRECTORY) + 1, &logger_config) == ESP_OK);
+    logger.get_stats(&stats);
+    is_passed &= check("preallocated: recovered blocks", stats.recovered_block_count == end_block_index);
+    // the segment of today stays at its preallocated size until the day is over.
+    is_passed &= check("preallocated: size", (psd_card->open_file(segment_path, sizeof(segment_path), '+', &segment_file) == ESP_OK) &&
+        (segment_file.get_size(&segment_size) == ESP_OK) &&
+        (segment_size == (long)(PREALLOCATION_BLOCK_COUNT * sensor_log::LOG_BLOCK_SIZE)));
+    is_passed &= check("preallocated: zeroed end", (segment_file.read_at((long)end_block_index * sensor_log::LOG_BLOCK_SIZE,
+        block, sizeof(block), &read_size) == ESP_OK) && (read_size == sizeof(block)) &&
+        (memcmp(block, zero_block, sizeof(block)) == 0));
+    is_passed &= check("preallocated: old blocks", (segment_file.write_at((long)(end_block_index + 1) * sensor_log::LOG_BLOCK_SIZE,
+        old_log.blocks.data(), old_block_count * sensor_log::LOG_BLOCK_SIZE) == ESP_OK) && (segment_file.close() == ESP_OK));
+    printf("preallocated: %zu blocks, %zu old blocks after the end\n", end_block_index, old_block_count);
+
+    is_passed &= check("preallocated: reader init", reader.init(psd_card, DIRECTORY, strlen(DIRECTORY) + 1) == ESP_OK);
+    is_passed &= check_range(&reader, "preallocated segment", DAY_START, DAY_START + sensor_log::LOG_SEGMENT_DURATION - 1, samples);
+    return is_passed;
+  }
+}
+
+int main(){
+  bool is_passed = true;
+  SD_CARD sd_card;
+  std::string root = (std::filesystem::temp_directory_path() / "sensor_log_test.XXXXXX").string();
+
+  if((mkdtemp(root.data()) == NULL) || (host_sd_card_set_root(root.c_str()) != ESP_OK) || (sd_card.init() != ESP_OK)){
+    fprintf(stderr, "no host directory for the card: %s\n", root.c_str());
+    return 1;
+  }
+  is_passed &= test_torn_segment(&sd_card);
+  is_passed &= test_packed_and_raw_day(&sd_card);
+  is_passed &= test_journal_replay(&sd_card);
+  is_passed &= test_preallocated_segment(&sd_card);
+  std::filesystem::remove_all(root);
+  printf("%s\n", is_passed ? "PASSED" : "FAILED");
+  return is_passed ? 0 : 1;
+}
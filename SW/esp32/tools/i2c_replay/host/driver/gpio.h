@@ -0,0 +1,9 @@
+#pragma once
+
+typedef enum{
+  GPIO_NUM_NC = -1,
+  GPIO_NUM_0 = 0,
+  GPIO_NUM_1,
+  GPIO_NUM_2,
+  GPIO_NUM_3,
+}gpio_num_t;
@@ -0,0 +1,5 @@
+// host replacement of the esp-idf header. the time is simulated by the replay.
+#pragma once
+#include <stdint.h>
+
+int64_t esp_timer_get_time();
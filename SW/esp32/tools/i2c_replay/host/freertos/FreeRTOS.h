@@ -0,0 +1,32 @@
+// host replacement of the FreeRTOS header. the replay runs in one thread,
+// so locks and critical sections do nothing.
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE  1
+#define pdFALSE 0
+#define pdPASS  pdTRUE
+#define pdFAIL  pdFALSE
+
+#define configTICK_RATE_HZ 100
+#define portTICK_PERIOD_MS (1000 / configTICK_RATE_HZ)
+#define portMAX_DELAY      (TickType_t)0xffffffffUL
+#define pdMS_TO_TICKS(ms)  ((TickType_t)(((uint64_t)(ms) * configTICK_RATE_HZ) / 1000))
+
+typedef struct{
+  int owner;
+}portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {0}
+#define portENTER_CRITICAL(pmux) (void)(pmux)
+#define portEXIT_CRITICAL(pmux)  (void)(pmux)
+
+#define IRAM_ATTR
+#define DMA_ATTR
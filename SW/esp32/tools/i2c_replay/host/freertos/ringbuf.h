@@ -0,0 +1,16 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+
+typedef struct host_ringbuf* RingbufHandle_t;
+typedef enum{
+  RINGBUF_TYPE_NOSPLIT,
+  RINGBUF_TYPE_ALLOWSPLIT,
+  RINGBUF_TYPE_BYTEBUF
+}RingbufferType_t;
+
+// recording a replay is not supported. xRingbufferCreate() always fails.
+RingbufHandle_t xRingbufferCreate(size_t buffer_size, RingbufferType_t type);
+void* xRingbufferReceive(RingbufHandle_t ringbuf, size_t* pitem_size, TickType_t wait_ticks);
+void vRingbufferReturnItem(RingbufHandle_t ringbuf, void* pitem);
+BaseType_t xRingbufferSendAcquire(RingbufHandle_t ringbuf, void** ppitem, size_t item_size, TickType_t wait_ticks);
+BaseType_t xRingbufferSendComplete(RingbufHandle_t ringbuf, void* pitem);
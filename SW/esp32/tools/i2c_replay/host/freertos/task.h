@@ -0,0 +1,8 @@
+#pragma once
+#include "freertos/FreeRTOS.h"
+
+typedef struct host_task* TaskHandle_t;
+
+// advances the simulated time instead of sleeping.
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount();
@@ -0,0 +1,162 @@
+// single threaded host implementations of the esp-idf and FreeRTOS functions
+// used by the i2c base class and the sensor drivers.
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/ringbuf.h"
+
+#include "host_time.h"
+
+namespace{
+  int64_t host_time {0}; //[us]
+  esp_log_level_t host_log_level {ESP_LOG_WARN};
+  // the bus mutex only has to be a valid handle.
+  int host_mutex {0};
+}
+
+void host_advance_time_to(int64_t time){
+  if(time > host_time){
+    host_time = time;
+  }
+}
+
+void host_set_log_level(esp_log_level_t level){
+  host_log_level = level;
+}
+
+const char* esp_err_to_name(esp_err_t code){
+  switch(code){
+    case ESP_OK:                   return "ESP_OK";
+    case ESP_FAIL:                 return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:           return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:      return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:    return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE:     return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND:        return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED:    return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT:          return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_RESPONSE: return "ESP_ERR_INVALID_RESPONSE";
+    case ESP_ERR_INVALID_CRC:      return "ESP_ERR_INVALID_CRC";
+    case ESP_ERR_INVALID_VERSION:  return "ESP_ERR_INVALID_VERSION";
+    case ESP_ERR_NOT_FINISHED:     return "ESP_ERR_NOT_FINISHED";
+    case ESP_ERR_NVS_NOT_FOUND:    return "ESP_ERR_NVS_NOT_FOUND";
+    default:                       return "UNKNOWN ERROR";
+  }
+}
+
+void esp_log_level_set(const char* tag, esp_log_level_t level){
+  // the drivers lower their own level. the replay uses one level for all.
+  (void)tag;
+  (void)level;
+}
+
+void host_log_write(esp_log_level_t level, const char* tag, const char* format, ...){
+  constexpr static char LEVEL_LETTERS[] = "NEWIDV";
+  if(level > host_log_level){
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  fprintf(stderr, "%c (%lld) %s: ", LEVEL_LETTERS[level], (long long)(host_time / 1000), tag);
+  vfprintf(stderr, format, args);
+  fprintf(stderr, "\n");
+  va_end(args);
+}
+
+int64_t esp_timer_get_time(){
+  return host_time;
+}
+
+esp_err_t nvs_open(const char* pnamespace, nvs_open_mode_t open_mode, nvs_handle_t* phandle){
+  (void)pnamespace;
+  (void)open_mode;
+  *phandle = 1;
+  return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* pvalue, size_t* plength){
+  (void)handle;
+  (void)key;
+  (void)pvalue;
+  (void)plength;
+  return ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* pvalue, size_t length){
+  (void)handle;
+  (void)key;
+  (void)pvalue;
+  (void)length;
+  return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle){
+  (void)handle;
+  return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle){
+  (void)handle;
+}
+
+void vTaskDelay(TickType_t ticks){
+  host_advance_time_to(host_time + static_cast<int64_t>(ticks) * portTICK_PERIOD_MS * 1000);
+}
+
+TickType_t xTaskGetTickCount(){
+  return static_cast<TickType_t>(host_time / (portTICK_PERIOD_MS * 1000));
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(){
+  return reinterpret_cast<SemaphoreHandle_t>(&host_mutex);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t wait_ticks){
+  (void)semaphore;
+  (void)wait_ticks;
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore){
+  (void)semaphore;
+  return pdTRUE;
+}
+
+RingbufHandle_t xRingbufferCreate(size_t buffer_size, RingbufferType_t type){
+  (void)buffer_size;
+  (void)type;
+  return NULL;
+}
+
+void* xRingbufferReceive(RingbufHandle_t ringbuf, size_t* pitem_size, TickType_t wait_ticks){
+  (void)ringbuf;
+  (void)pitem_size;
+  (void)wait_ticks;
+  return NULL;
+}
+
+void vRingbufferReturnItem(RingbufHandle_t ringbuf, void* pitem){
+  (void)ringbuf;
+  (void)pitem;
+}
+
+BaseType_t xRingbufferSendAcquire(RingbufHandle_t ringbuf, void** ppitem, size_t item_size, TickType_t wait_ticks){
+  (void)ringbuf;
+  (void)ppitem;
+  (void)item_size;
+  (void)wait_ticks;
+  return pdFAIL;
+}
+
+BaseType_t xRingbufferSendComplete(RingbufHandle_t ringbuf, void* pitem){
+  (void)ringbuf;
+  (void)pitem;
+  return pdFAIL;
+}
@@ -0,0 +1,10 @@
+// simulated time of the host build. esp_timer_get_time() and vTaskDelay() use it.
+#pragma once
+#include <stdint.h>
+
+#include "esp_log.h"
+
+// moves the time forward. earlier times are ignored, so the time never goes back.
+void host_advance_time_to(int64_t time);
+// only messages at this level or more severe are printed.
+void host_set_log_level(esp_log_level_t level);
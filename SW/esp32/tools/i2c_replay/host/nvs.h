@@ -0,0 +1,18 @@
+// host replacement of the esp-idf header. nothing is stored, so the drivers
+// always read their calibration from the trace.
+#pragma once
+#include "esp_err.h"
+
+typedef uint32_t nvs_handle_t;
+typedef enum{
+  NVS_READONLY,
+  NVS_READWRITE
+}nvs_open_mode_t;
+
+#define NVS_KEY_NAME_MAX_SIZE 16
+
+esp_err_t nvs_open(const char* pnamespace, nvs_open_mode_t open_mode, nvs_handle_t* phandle);
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* pvalue, size_t* plength);
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* pvalue, size_t length);
+esp_err_t nvs_commit(nvs_handle_t handle);
+void nvs_close(nvs_handle_t handle);
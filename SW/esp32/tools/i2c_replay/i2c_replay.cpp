@@ -0,0 +1,208 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "driver/i2c_master.h"
+
+#include "host_time.h"
+#include "i2c_replay.h"
+
+// device handle of the host driver. only the address is needed to find the records.
+struct i2c_master_dev_t{
+  uint16_t device_address;
+};
+
+namespace{
+  constexpr size_t MAX_DEVICES {8};
+  i2c_master_dev_t devices[MAX_DEVICES];
+  size_t device_count {0};
+  int host_bus {0};
+
+  esp_err_t execute_on_active_replay(i2c_master_dev_handle_t dev_handle,
+      const uint8_t* pwrite_buffer, size_t write_size, uint8_t* pread_buffer, size_t read_size){
+    TRACE_REPLAY* preplay = TRACE_REPLAY::get_active_replay();
+    if(preplay == NULL){
+      return ESP_ERR_INVALID_STATE;
+    }
+    return preplay->execute(dev_handle->device_address, pwrite_buffer, write_size, pread_buffer, read_size);
+  }
+}
+
+TRACE_REPLAY* TRACE_REPLAY::pactive_replay {NULL};
+
+esp_err_t TRACE_REPLAY::load(const char* pfile_path){
+  esp_err_t r = ESP_OK;
+  i2c_base::trace_file_header_t file_header {};
+  int64_t time_offset = 0;
+  uint32_t last_start_time = 0;
+
+  FILE* pfile = fopen(pfile_path, "rb");
+  if(pfile == NULL){
+    ESP_LOGE(TRACE_REPLAY_TAG, "fail to open %s.", pfile_path);
+    r = ESP_ERR_NOT_FOUND;
+  }
+  if(r == ESP_OK){
+    if((fread(&file_header, sizeof(file_header), 1, pfile) != 1) ||
+        (file_header.magic != i2c_base::TRACE_MAGIC) ||
+        (file_header.version != i2c_base::TRACE_VERSION) ||
+        (file_header.record_header_size != sizeof(i2c_base::trace_record_header_t))){
+      ESP_LOGE(TRACE_REPLAY_TAG, "%s is not a version %d i2c trace.", pfile_path, i2c_base::TRACE_VERSION);
+      r = ESP_ERR_INVALID_VERSION;
+    }
+  }
+  while(r == ESP_OK){
+    record_t record {};
+    if(fread(&record.header, sizeof(record.header), 1, pfile) != 1){
+      break;
+    }
+    record.write_data.resize(record.header.write_size);
+    if(record.header.result == ESP_OK){
+      record.read_data.resize(record.header.read_size);
+    }
+    if(((record.write_data.size() > 0) && 
+          (fread(record.write_data.data(), record.write_data.size(), 1, pfile) != 1)) ||
+        ((record.read_data.size() > 0) && 
+          (fread(record.read_data.data(), record.read_data.size(), 1, pfile) != 1))){
+      // the firmware was reset while writing. the complete records are still usable.
+      ESP_LOGW(TRACE_REPLAY_TAG, "trace ends with a truncated record.");
+      break;
+    }
+    if(record.header.start_time < last_start_time){
+      time_offset += (int64_t)1 << 32;
+    }
+    last_start_time = record.header.start_time;
+    record.start_time = time_offset + record.header.start_time;
+
+    pending_records[record.header.device_address].push_back(records.size());
+    records.push_back(record);
+  }
+  if(pfile != NULL){
+    fclose(pfile);
+  }
+  if(r == ESP_OK){
+    ESP_LOGI(TRACE_REPLAY_TAG, "loaded %d records of %d devices.", (int)records.size(), (int)pending_records.size());
+  }
+  return r;
+}
+
+void TRACE_REPLAY::activate(){
+  pactive_replay = this;
+}
+
+TRACE_REPLAY* TRACE_REPLAY::get_active_replay(){
+  return pactive_replay;
+}
+
+bool TRACE_REPLAY::has_device(uint16_t device_address){
+  return pending_records.count(device_address) > 0;
+}
+
+esp_err_t TRACE_REPLAY::get_next_device(uint16_t* pdevice_address){
+  esp_err_t r = ESP_ERR_NOT_FOUND;
+  size_t next_index = records.size();
+  for(const auto& [device_address, indices] : pending_records){
+    if((!indices.empty()) && (indices.front() < next_index)){
+      next_index = indices.front();
+      *pdevice_address = device_address;
+      r = ESP_OK;
+    }
+  }
+  return r;
+}
+
+size_t TRACE_REPLAY::get_pending_count(){
+  size_t pending_count = 0;
+  for(const auto& [device_address, indices] : pending_records){
+    pending_count += indices.size();
+  }
+  return pending_count;
+}
+
+void TRACE_REPLAY::skip_next(uint16_t device_address){
+  std::deque<size_t>& indices = pending_records[device_address];
+  if(!indices.empty()){
+    indices.pop_front();
+  }
+}
+
+TRACE_REPLAY::device_stats_t TRACE_REPLAY::get_device_stats(uint16_t device_address){
+  return device_stats[device_address];
+}
+
+esp_err_t TRACE_REPLAY::execute(uint16_t device_address, const uint8_t* pwrite_buffer, size_t write_size,
+    uint8_t* pread_buffer, size_t read_size){
+  esp_err_t r = ESP_OK;
+  device_stats_t* pstats = &device_stats[device_address];
+  std::deque<size_t>& indices = pending_records[device_address];
+  const record_t* precord = NULL;
+
+  if(indices.empty()){
+    pstats->missing_count++;
+    r = ESP_ERR_NOT_FOUND;
+  }
+  if(r == ESP_OK){
+    precord = &records[indices.front()];
+    indices.pop_front();
+    if((write_size != precord->write_data.size()) || (read_size != precord->header.read_size) ||
+        ((write_size > 0) && (memcmp(pwrite_buffer, precord->write_data.data(), write_size) != 0))){
+      ESP_LOGE(TRACE_REPLAY_TAG, "0x%02x: transaction %d differs from the trace. write %d bytes, read %d bytes.",
+          device_address, (int)(precord - records.data()), (int)write_size, (int)read_size);
+      pstats->mismatch_count++;
+      r = ESP_ERR_INVALID_RESPONSE;
+    }
+  }
+  if(r == ESP_OK){
+    // the driver sees the recorded timing.
+    host_advance_time_to(precord->start_time + precord->header.duration);
+    if(precord->header.result == ESP_OK){
+      if(read_size > 0){
+        memcpy(pread_buffer, precord->read_data.data(), read_size);
+      }
+    }
+    r = precord->header.result;
+    pstats->transaction_count++;
+  }
+  return r;
+}
+
+esp_err_t i2c_new_master_bus(const i2c_master_bus_config_t* pbus_config, i2c_master_bus_handle_t* pbus_handle){
+  (void)pbus_config;
+  *pbus_handle = reinterpret_cast<i2c_master_bus_handle_t>(&host_bus);
+  return ESP_OK;
+}
+
+esp_err_t i2c_del_master_bus(i2c_master_bus_handle_t bus_handle){
+  (void)bus_handle;
+  return ESP_OK;
+}
+
+esp_err_t i2c_master_bus_add_device(i2c_master_bus_handle_t bus_handle,
+    const i2c_device_config_t* pdevice_config, i2c_master_dev_handle_t* pdev_handle){
+  (void)bus_handle;
+  if(device_count >= MAX_DEVICES){
+    return ESP_ERR_NO_MEM;
+  }
+  devices[device_count].device_address = pdevice_config->device_address;
+  *pdev_handle = &devices[device_count];
+  device_count++;
+  return ESP_OK;
+}
+
+esp_err_t i2c_master_transmit(i2c_master_dev_handle_t dev_handle,
+    const uint8_t* pwrite_buffer, size_t write_size, int timeout_ms){
+  (void)timeout_ms;
+  return execute_on_active_replay(dev_handle, pwrite_buffer, write_size, NULL, 0);
+}
+
+esp_err_t i2c_master_receive(i2c_master_dev_handle_t dev_handle,
+    uint8_t* pread_buffer, size_t read_size, int timeout_ms){
+  (void)timeout_ms;
+  return execute_on_active_replay(dev_handle, NULL, 0, pread_buffer, read_size);
+}
+
+esp_err_t i2c_master_transmit_receive(i2c_master_dev_handle_t dev_handle,
+    const uint8_t* pwrite_buffer, size_t write_size,
+    uint8_t* pread_buffer, size_t read_size, int timeout_ms){
+  (void)timeout_ms;
+  return execute_on_active_replay(dev_handle, pwrite_buffer, write_size, pread_buffer, read_size);
+}
@@ -0,0 +1,53 @@
+// replays a trace recorded by i2c_base::I2C through the host i2c master driver.
+#pragma once
+#include <deque>
+#include <map>
+#include <vector>
+
+#include "esp_err.h"
+#include "i2c_trace.h"
+
+class TRACE_REPLAY final{
+  public:
+    typedef struct{
+      uint32_t transaction_count;  // transactions served from the trace
+      uint32_t mismatch_count;     // the driver wrote other bytes than recorded
+      uint32_t missing_count;      // the driver asked for more transactions than recorded
+    }device_stats_t;
+
+  private:
+    constexpr static const char* TRACE_REPLAY_TAG = "trace_replay";
+
+    typedef struct{
+      i2c_base::trace_record_header_t header;
+      int64_t start_time;          //[us] unwrapped header.start_time
+      std::vector<uint8_t> write_data;
+      std::vector<uint8_t> read_data;
+    }record_t;
+
+    std::vector<record_t> records;
+    // indices into records, in trace order, per device address
+    std::map<uint16_t, std::deque<size_t>> pending_records;
+    std::map<uint16_t, device_stats_t> device_stats;
+
+    static TRACE_REPLAY* pactive_replay;
+
+  public:
+    // reads a whole trace file. ESP_ERR_INVALID_VERSION for other formats.
+    esp_err_t load(const char* pfile_path);
+    // serves the i2c master driver calls from this trace.
+    void activate();
+    static TRACE_REPLAY* get_active_replay();
+
+    bool has_device(uint16_t device_address);
+    // device of the oldest transaction not replayed yet. ESP_ERR_NOT_FOUND at the end of the trace.
+    esp_err_t get_next_device(uint16_t* pdevice_address);
+    size_t get_pending_count();
+    // drops the next transaction of a device no driver is replayed for.
+    void skip_next(uint16_t device_address);
+    device_stats_t get_device_stats(uint16_t device_address);
+
+    // checks a driver transaction against the trace and returns the recorded response.
+    esp_err_t execute(uint16_t device_address, const uint8_t* pwrite_buffer, size_t write_size,
+        uint8_t* pread_buffer, size_t read_size);
+};
@@ -0,0 +1,164 @@
+// replays an i2c trace recorded by the firmware (CONFIG_I2C_TRACE_RECORDER)
+// through the unmodified BME280 and SCD40 drivers on the host.
+//
+// usage: i2c_replay <i2c_trace.bin> [-v]
+//
+// prints the measured values as csv to stdout and a summary with the
+// replay result and the time spent in the drivers to stderr. exits with 1
+// if the drivers did not issue the recorded transactions.
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_timer.h"
+#include "i2c_base.h"
+#include "bme280.h"
+#include "scd40.h"
+#include "sensor_settings.h"
+
+#include "host_time.h"
+#include "i2c_replay.h"
+
+namespace{
+  constexpr const char* I2C_REPLAY_TAG = "i2c_replay";
+  constexpr uint16_t BME280_ADDRESS {0x76};
+  constexpr uint16_t SCD40_ADDRESS {0x62};
+  // steps in a row without a transaction before the replay gives up
+  constexpr uint32_t MAX_IDLE_STEPS {1000};
+
+  typedef struct{
+    uint32_t step_count;
+    uint32_t sample_count;
+    uint32_t error_count;
+    std::chrono::nanoseconds step_time;
+  }driver_stats_t;
+
+  template<typename STEP_FUNCTION>
+  esp_err_t run_step(driver_stats_t* pstats, STEP_FUNCTION step_function){
+    const auto start = std::chrono::steady_clock::now();
+    esp_err_t r = step_function();
+    pstats->step_time += std::chrono::steady_clock::now() - start;
+    pstats->step_count++;
+    if(r == ESP_OK){
+      pstats->sample_count++;
+    }
+    else if(r != ESP_ERR_NOT_FINISHED){
+      pstats->error_count++;
+    }
+    return r;
+  }
+
+  void print_summary(const char* pname, uint16_t device_address, TRACE_REPLAY* preplay, const driver_stats_t* pstats){
+    const TRACE_REPLAY::device_stats_t device_stats = preplay->get_device_stats(device_address);
+    const double step_time = std::chrono::duration<double, std::micro>(pstats->step_time).count();
+    fprintf(stderr, "%s(0x%02x): transactions:%u mismatches:%u missing:%u samples:%u errors:%u step time:%.2fus\n",
+        pname, device_address, device_stats.transaction_count, device_stats.mismatch_count,
+        device_stats.missing_count, pstats->sample_count, pstats->error_count,
+        (pstats->step_count > 0) ? step_time / pstats->step_count : 0.0);
+  }
+}
+
+int main(int argc, char** argv){
+  esp_err_t r = ESP_OK;
+  TRACE_REPLAY replay;
+  i2c_base::I2C i2c;
+  BME280 bme280;
+  SCD40 scd40;
+  driver_stats_t bme280_stats {};
+  driver_stats_t scd40_stats {};
+  uint32_t idle_step_count = 0;
+
+  if((argc < 2) || (argc > 3) || ((argc == 3) && (strcmp(argv[2], "-v") != 0))){
+    fprintf(stderr, "usage: %s <i2c_trace.bin> [-v]\n", argv[0]);
+    return 2;
+  }
+  if(argc == 3){
+    host_set_log_level(ESP_LOG_INFO);
+  }
+
+  r = replay.load(argv[1]);
+  if(r == ESP_OK){
+    replay.activate();
+    r = i2c.init();
+  }
+  const bool is_bme280_recorded = replay.has_device(BME280_ADDRESS);
+  const bool is_scd40_recorded = replay.has_device(SCD40_ADDRESS);
+  // same order as SMART_CLOCK::init()
+  if((r == ESP_OK) && is_bme280_recorded){
+    r = bme280.init(&i2c);
+    if(r == ESP_OK){
+      r = bme280.start_normal_mode();
+    }
+  }
+  if((r == ESP_OK) && is_scd40_recorded){
+    r = scd40.init(&i2c);
+    if(r == ESP_OK){
+      r = scd40.configure_temperature_offset(sensor_settings::SCD40_TEMPERATURE_OFFSET);
+    }
+    scd40.set_measurement_mode(sensor_settings::SCD40_MEASUREMENT_MODE);
+  }
+  if(r != ESP_OK){
+    ESP_LOGE(I2C_REPLAY_TAG, "fail to initialize the drivers from the trace. error:%s", esp_err_to_name(r));
+  }
+
+  // run the driver that owns the oldest transaction left, like the sensor scheduler did.
+  if(r == ESP_OK){
+    printf("time[s],sensor,temperature[degree Celsius],pressure[hPa],humidity[%%],co2[ppm]\n");
+  }
+  uint16_t device_address = 0;
+  while((r == ESP_OK) && (replay.get_next_device(&device_address) == ESP_OK)){
+    const size_t pending_count = replay.get_pending_count();
+    esp_err_t step_result = ESP_OK;
+    uint32_t wait_ms = 0;
+
+    if((device_address == BME280_ADDRESS) && is_bme280_recorded){
+      BME280::compensated_data_t bme280_data {};
+      step_result = run_step(&bme280_stats, [&](){ return bme280.measure_step(&bme280_data, &wait_ms); });
+      if(step_result == ESP_OK){
+        printf("%.3f,bme280,%.2f,%.2f,%.2f,\n", esp_timer_get_time() / 1e6, bme280_data.temperature / 100.0,
+            bme280_data.pressure / 25600.0, bme280_data.humidity / 1024.0);
+        if(is_scd40_recorded){
+          // SMART_CLOCK::sensor_sample_subscriber()
+          scd40.set_ambient_pressure(bme280_data.pressure / 25600.0f);
+        }
+      }
+    }
+    else if((device_address == SCD40_ADDRESS) && is_scd40_recorded){
+      uint16_t co2 = 0;
+      step_result = run_step(&scd40_stats, [&](){ return scd40.measure_step(&co2, &wait_ms); });
+      if(step_result == ESP_OK){
+        printf("%.3f,scd40,,,,%u\n", esp_timer_get_time() / 1e6, co2);
+      }
+    }
+    else{
+      // no driver on the host, e.g. the display.
+      replay.skip_next(device_address);
+    }
+
+    if((replay.get_device_stats(BME280_ADDRESS).mismatch_count > 0) ||
+        (replay.get_device_stats(SCD40_ADDRESS).mismatch_count > 0)){
+      r = ESP_ERR_INVALID_RESPONSE;
+    }
+    if(replay.get_pending_count() != pending_count){
+      idle_step_count = 0;
+    }
+    else{
+      // the driver is waiting. let the time pass like the scheduler would.
+      host_advance_time_to(esp_timer_get_time() + ((wait_ms > 0) ? wait_ms : 1) * 1000);
+      idle_step_count++;
+      if(idle_step_count >= MAX_IDLE_STEPS){
+        ESP_LOGE(I2C_REPLAY_TAG, "0x%02x does not issue the recorded transactions.", device_address);
+        r = ESP_ERR_TIMEOUT;
+      }
+    }
+    (void)step_result;
+  }
+
+  if(is_bme280_recorded){
+    print_summary("bme280", BME280_ADDRESS, &replay, &bme280_stats);
+  }
+  if(is_scd40_recorded){
+    print_summary("scd40", SCD40_ADDRESS, &replay, &scd40_stats);
+  }
+  return (r == ESP_OK) ? 0 : 1;
+}
@@ -0,0 +1,14 @@
+# replays TRACE with REPLAY and compares the csv output with EXPECTED.
+#   cmake -DREPLAY=<i2c_replay> -DTRACE=<trace.bin> -DEXPECTED=<expected.csv> -P check_replay.cmake
+execute_process(COMMAND ${REPLAY} ${TRACE}
+  RESULT_VARIABLE replay_result
+  OUTPUT_VARIABLE replay_output
+  ERROR_VARIABLE replay_summary)
+message(STATUS "${replay_summary}")
+if(NOT replay_result EQUAL 0)
+  message(FATAL_ERROR "the drivers do not replay ${TRACE}. exit code:${replay_result}")
+endif()
+file(READ ${EXPECTED} expected_output)
+if(NOT replay_output STREQUAL expected_output)
+  message(FATAL_ERROR "decoded values differ from ${EXPECTED}:\n${replay_output}")
+endif()
@@ -0,0 +1,305 @@
+// writes the trace the replay test runs (bme280_scd40_trace.bin).
+//
+// usage: make_test_trace <i2c_trace.bin>
+//
+// the unmodified drivers run against a BME280 and an SCD40 model, and every
+// transaction is written in the format of the firmware recorder. the BME280
+// answers with the calibration and adc values of the datasheet example
+// (25.08 degree Celsius, 1006.53 hPa), the SCD40 with known raw words.
+// only needed again when the drivers change the transactions on purpose.
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "esp_timer.h"
+#include "driver/i2c_master.h"
+#include "i2c_base.h"
+#include "i2c_trace.h"
+#include "bme280.h"
+#include "scd40.h"
+#include "scd40_crc.h"
+#include "sensor_settings.h"
+
+#include "host_time.h"
+
+struct i2c_master_dev_t{
+  uint16_t device_address;
+};
+
+namespace{
+  constexpr uint16_t BME280_ADDRESS {0x76};
+  constexpr uint16_t SCD40_ADDRESS {0x62};
+  constexpr uint32_t BME280_SAMPLE_PERIOD {10 * 1000}; //[ms] same as SMART_CLOCK
+  // a little shorter than the measurement interval, so the trace also has data ready polls without data.
+  constexpr uint32_t SCD40_SAMPLE_PERIOD {4500}; //[ms]
+  constexpr int64_t TRACE_LENGTH {20 * 1000 * 1000}; //[us]
+  constexpr int64_t BYTE_TIME {90}; //[us] one byte and its ack at 100kHz
+
+  constexpr size_t MAX_DEVICES {8};
+  i2c_master_dev_t devices[MAX_DEVICES];
+  size_t device_count {0};
+  int host_bus {0};
+  std::vector<uint8_t> trace;
+
+  // datasheet chapter 8.2 example and typical humidity calibration
+  constexpr uint8_t BME280_CALIB_00[26] {
+    0x70, 0x6b, 0x43, 0x67, 0x18, 0xfc,             // dig_T1 27504, dig_T2 26435, dig_T3 -1000
+    0x7d, 0x8e, 0x43, 0xd6, 0xd0, 0x0b, 0x27, 0x0b, // dig_P1 36477, dig_P2 -10685, dig_P3 3024, dig_P4 2855
+    0x8c, 0x00, 0xf9, 0xff, 0x8c, 0x3c, 0xf8, 0xc6, // dig_P5 140, dig_P6 -7, dig_P7 15500, dig_P8 -14600
+    0x70, 0x17, 0x00, 0x4b};                        // dig_P9 6000, dig_H1 75
+  constexpr uint8_t BME280_CALIB_26[7] {
+    0x6a, 0x01, 0x00, 0x13, 0x29, 0x03, 0x1e};      // dig_H2 362, dig_H3 0, dig_H4 313, dig_H5 50, dig_H6 30
+  // adc_P 415148, adc_T 519888, adc_H 27000
+  constexpr uint8_t BME280_RAW_DATA[8] {0x65, 0x5a, 0xc0, 0x7e, 0xed, 0x00, 0x69, 0x78};
+  constexpr uint8_t BME280_CHIP_ID {0x60};
+
+  // scd40 words: co2 500 ppm + 10 ppm per sample, 25.0 degree Celsius, 37.0 %
+  constexpr uint16_t SCD40_CO2 {500};
+  constexpr uint16_t SCD40_CO2_STEP {10};
+  constexpr uint16_t SCD40_TEMPERATURE {0x6667};
+  constexpr uint16_t SCD40_HUMIDITY {0x5eb9};
+  constexpr uint16_t SCD40_SERIAL_NUMBER[3] {0x1234, 0x5678, 0x9abc};
+  constexpr uint16_t SCD40_DATA_READY {0x8006};
+  constexpr int64_t SCD40_MEASUREMENT_INTERVAL {5 * 1000 * 1000}; //[us]
+
+  uint8_t bme280_registers[256] {};
+  int64_t scd40_start_time {-1};
+  uint16_t scd40_sample_count {0};
+
+  void init_bme280_registers(){
+    memcpy(&bme280_registers[0x88], BME280_CALIB_00, sizeof(BME280_CALIB_00));
+    memcpy(&bme280_registers[0xe1], BME280_CALIB_26, sizeof(BME280_CALIB_26));
+    memcpy(&bme280_registers[0xf7], BME280_RAW_DATA, sizeof(BME280_RAW_DATA));
+    bme280_registers[0xd0] = BME280_CHIP_ID;
+  }
+
+  // register address, then register and value pairs to write or the bytes to read.
+  esp_err_t execute_bme280(const uint8_t* pwrite_buffer, size_t write_size, uint8_t* pread_buffer, size_t read_size){
+    if(write_size == 0){
+      return ESP_FAIL;
+    }
+    for(size_t write_index = 0; write_index + 1 < write_size; write_index += 2){
+      bme280_registers[pwrite_buffer[write_index]] = pwrite_buffer[write_index + 1];
+    }
+    for(size_t read_index = 0; read_index < read_size; read_index++){
+      pread_buffer[read_index] = bme280_registers[(pwrite_buffer[0] + read_index) & 0xff];
+    }
+    return ESP_OK;
+  }
+
+  void put_scd40_words(const uint16_t* pwords, size_t word_count, uint8_t* pread_buffer, size_t read_size){
+    for(size_t word_index = 0; (word_index < word_count) && ((word_index + 1) * 3 <= read_size); word_index++){
+      uint8_t* pword = &pread_buffer[word_index * 3];
+      pword[0] = pwords[word_index] >> 8;
+      pword[1] = pwords[word_index] & 0xff;
+      pword[2] = scd40::calculate_crc(pword, 2);
+    }
+  }
+
+  esp_err_t execute_scd40(const uint8_t* pwrite_buffer, size_t write_size, uint8_t* pread_buffer, size_t read_size){
+    if(write_size < 2){
+      return ESP_FAIL;
+    }
+    const uint16_t command = (pwrite_buffer[0] << 8) | pwrite_buffer[1];
+    const int64_t time = esp_timer_get_time();
+    switch(command){
+      case 0x3682: // get_serial_number
+        put_scd40_words(SCD40_SERIAL_NUMBER, 3, pread_buffer, read_size);
+        break;
+      case 0x2318:{ // get_temperature_offset, already stored
+        const uint16_t offset = (sensor_settings::SCD40_TEMPERATURE_OFFSET * 65536.0) / 175.0;
+        put_scd40_words(&offset, 1, pread_buffer, read_size);
+        break;
+      }
+      case 0x21b1: // start_periodic_measurement
+        scd40_start_time = time;
+        break;
+      case 0xe4b8:{ // get_data_ready_status
+        const bool is_data_ready = (scd40_start_time >= 0) &&
+          (time - scd40_start_time >= (scd40_sample_count + 1) * SCD40_MEASUREMENT_INTERVAL);
+        const uint16_t status = is_data_ready ? SCD40_DATA_READY : 0;
+        put_scd40_words(&status, 1, pread_buffer, read_size);
+        break;
+      }
+      case 0xec05:{ // read_measurement
+        const uint16_t words[3] {static_cast<uint16_t>(SCD40_CO2 + scd40_sample_count * SCD40_CO2_STEP),
+          SCD40_TEMPERATURE, SCD40_HUMIDITY};
+        put_scd40_words(words, 3, pread_buffer, read_size);
+        scd40_sample_count++;
+        break;
+      }
+      case 0xe000: // set_ambient_pressure
+        break;
+      default:
+        fprintf(stderr, "the scd40 model does not know the command 0x%04x.\n", command);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+  }
+
+  void append(const void* pdata, size_t size){
+    const uint8_t* pbytes = static_cast<const uint8_t*>(pdata);
+    trace.insert(trace.end(), pbytes, pbytes + size);
+  }
+
+  esp_err_t execute(i2c_master_dev_handle_t dev_handle,
+      const uint8_t* pwrite_buffer, size_t write_size, uint8_t* pread_buffer, size_t read_size){
+    esp_err_t r = ESP_OK;
+    const int64_t start_time = esp_timer_get_time();
+    if(dev_handle->device_address == BME280_ADDRESS){
+      r = execute_bme280(pwrite_buffer, write_size, pread_buffer, read_size);
+    }
+    else if(dev_handle->device_address == SCD40_ADDRESS){
+      r = execute_scd40(pwrite_buffer, write_size, pread_buffer, read_size);
+    }
+    else{
+      r = ESP_ERR_NOT_FOUND;
+    }
+    const int64_t duration = (1 + write_size + read_size) * BYTE_TIME;
+    host_advance_time_to(start_time + duration);
+
+    const i2c_base::trace_record_header_t header {
+      .start_time = static_cast<uint32_t>(start_time),
+      .duration = static_cast<uint32_t>(duration),
+      .result = r,
+      .device_address = dev_handle->device_address,
+      .write_size = static_cast<uint8_t>(write_size),
+      .read_size = static_cast<uint8_t>(read_size),
+    };
+    append(&header, sizeof(header));
+    append(pwrite_buffer, write_size);
+    if(r == ESP_OK){
+      append(pread_buffer, read_size);
+    }
+    return r;
+  }
+}
+
+esp_err_t i2c_new_master_bus(const i2c_master_bus_config_t* pbus_config, i2c_master_bus_handle_t* pbus_handle){
+  (void)pbus_config;
+  *pbus_handle = reinterpret_cast<i2c_master_bus_handle_t>(&host_bus);
+  return ESP_OK;
+}
+
+esp_err_t i2c_del_master_bus(i2c_master_bus_handle_t bus_handle){
+  (void)bus_handle;
+  return ESP_OK;
+}
+
+esp_err_t i2c_master_bus_add_device(i2c_master_bus_handle_t bus_handle,
+    const i2c_device_config_t* pdevice_config, i2c_master_dev_handle_t* pdev_handle){
+  (void)bus_handle;
+  if(device_count >= MAX_DEVICES){
+    return ESP_ERR_NO_MEM;
+  }
+  devices[device_count].device_address = pdevice_config->device_address;
+  *pdev_handle = &devices[device_count];
+  device_count++;
+  return ESP_OK;
+}
+
+esp_err_t i2c_master_transmit(i2c_master_dev_handle_t dev_handle,
+    const uint8_t* pwrite_buffer, size_t write_size, int timeout_ms){
+  (void)timeout_ms;
+  return execute(dev_handle, pwrite_buffer, write_size, NULL, 0);
+}
+
+esp_err_t i2c_master_receive(i2c_master_dev_handle_t dev_handle,
+    uint8_t* pread_buffer, size_t read_size, int timeout_ms){
+  (void)timeout_ms;
+  return execute(dev_handle, NULL, 0, pread_buffer, read_size);
+}
+
+esp_err_t i2c_master_transmit_receive(i2c_master_dev_handle_t dev_handle,
+    const uint8_t* pwrite_buffer, size_t write_size,
+    uint8_t* pread_buffer, size_t read_size, int timeout_ms){
+  (void)timeout_ms;
+  return execute(dev_handle, pwrite_buffer, write_size, pread_buffer, read_size);
+}
+
+int main(int argc, char** argv){
+  esp_err_t r = ESP_OK;
+  i2c_base::I2C i2c;
+  BME280 bme280;
+  SCD40 scd40;
+
+  if(argc != 2){
+    fprintf(stderr, "usage: %s <i2c_trace.bin>\n", argv[0]);
+    return 2;
+  }
+  init_bme280_registers();
+  const i2c_base::trace_file_header_t file_header {
+    .magic = i2c_base::TRACE_MAGIC,
+    .version = i2c_base::TRACE_VERSION,
+    .record_header_size = sizeof(i2c_base::trace_record_header_t),
+  };
+  append(&file_header, sizeof(file_header));
+
+  // same order as i2c_replay and SMART_CLOCK::init()
+  r = i2c.init();
+  if(r == ESP_OK){
+    r = bme280.init(&i2c);
+  }
+  if(r == ESP_OK){
+    r = bme280.start_normal_mode();
+  }
+  if(r == ESP_OK){
+    r = scd40.init(&i2c);
+  }
+  if(r == ESP_OK){
+    r = scd40.configure_temperature_offset(sensor_settings::SCD40_TEMPERATURE_OFFSET);
+  }
+  scd40.set_measurement_mode(sensor_settings::SCD40_MEASUREMENT_MODE);
+
+  // the sensor scheduler runs the driver that is due first.
+  int64_t bme280_due_time = esp_timer_get_time();
+  int64_t scd40_due_time = esp_timer_get_time();
+  while((r == ESP_OK) && (esp_timer_get_time() < TRACE_LENGTH)){
+    esp_err_t step_result = ESP_OK;
+    uint32_t wait_ms = 0;
+    if(bme280_due_time <= scd40_due_time){
+      BME280::compensated_data_t bme280_data {};
+      host_advance_time_to(bme280_due_time);
+      step_result = bme280.measure_step(&bme280_data, &wait_ms);
+      if(step_result == ESP_OK){
+        scd40.set_ambient_pressure(bme280_data.pressure / 25600.0f);
+        wait_ms = BME280_SAMPLE_PERIOD;
+      }
+      bme280_due_time = esp_timer_get_time() + wait_ms * 1000;
+    }
+    else{
+      uint16_t co2 = 0;
+      host_advance_time_to(scd40_due_time);
+      step_result = scd40.measure_step(&co2, &wait_ms);
+      if(step_result == ESP_OK){
+        wait_ms = SCD40_SAMPLE_PERIOD;
+      }
+      scd40_due_time = esp_timer_get_time() + wait_ms * 1000;
+    }
+    if((step_result != ESP_OK) && (step_result != ESP_ERR_NOT_FINISHED)){
+      r = step_result;
+    }
+  }
+  if(r != ESP_OK){
+    fprintf(stderr, "the drivers fail on the sensor models. error:%s\n", esp_err_to_name(r));
+  }
+
+  FILE* pfile = NULL;
+  if(r == ESP_OK){
+    pfile = fopen(argv[1], "wb");
+    if(pfile == NULL){
+      fprintf(stderr, "fail to open %s.\n", argv[1]);
+      r = ESP_ERR_NOT_FOUND;
+    }
+  }
+  if(r == ESP_OK){
+    if(fwrite(trace.data(), trace.size(), 1, pfile) != 1){
+      fprintf(stderr, "fail to write %s.\n", argv[1]);
+      r = ESP_FAIL;
+    }
+  }
+  if(pfile != NULL){
+    fclose(pfile);
+  }
+  return (r == ESP_OK) ? 0 : 1;
+}
@@ -0,0 +1,224 @@
+// converts binary sensor log segments written by SENSOR_LOGGER (sensor_log_format.h) to csv.
+//
+// usage: log2csv <YYYYMMDD.bin|YYYYMMDD.pak>...
+//        log2csv -a <YYYYMMDD.1m|YYYYMMDD.1h>...
+//
+// prints one line per sample to stdout in the order of the files. blocks that
+// fail the checks, e.g. a torn write at power loss, are skipped and counted
+// on stderr. exits with 1 if a block was skipped.
+// raw and packed segments are decoded alike. a raw segment left next to the
+// packed segment of its day repeats the samples that were packed.
+// with -a the aggregates of SENSOR_LOG_RETENTION are printed instead, one line
+// each for min, mean and max of a record.
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "sensor_sample.h"
+#include "sensor_log_format.h"
+#include "log_block_decoder.h"
+
+namespace{
+  typedef struct{
+    uint32_t block_count;
+    uint32_t sample_count;
+    uint32_t empty_count;
+    uint32_t bad_count;
+  }convert_stats_t;
+
+  const char* get_state_name(LOG_BLOCK_DECODER::block_state_e state){
+    switch(state){
+      case LOG_BLOCK_DECODER::block_state_e::VALID:
+        return "valid";
+      case LOG_BLOCK_DECODER::block_state_e::EMPTY:
+        return "empty";
+      case LOG_BLOCK_DECODER::block_state_e::BAD_MAGIC:
+        return "bad magic";
+      case LOG_BLOCK_DECODER::block_state_e::BAD_VERSION:
+        return "unsupported version";
+      case LOG_BLOCK_DECODER::block_state_e::BAD_CRC:
+        return "bad crc";
+      case LOG_BLOCK_DECODER::block_state_e::BAD_PAYLOAD:
+        return "bad payload";
+    }
+    return "unknown";
+  }
+
+  void format_datetime(uint32_t timestamp, uint8_t quality, char* pdatetime, size_t datetime_size){
+    pdatetime[0] = '\0';
+    if((quality & sensor_data::SAMPLE_TIME_NOT_SYNCED) == 0){
+      const time_t time = timestamp;
+      struct tm utc {};
+      gmtime_r(&time, &utc);
+      strftime(pdatetime, datetime_size, "%Y-%m-%dT%H:%M:%SZ", &utc);
+    }
+  }
+
+  void print_sensor(sensor_data::sensor_id_e sensor_id){
+    switch(sensor_id){
+      case sensor_data::sensor_id_e::SCD40:
+        printf("scd40,");
+        break;
+      case sensor_data::sensor_id_e::BME280:
+        printf("bme280,");
+        break;
+      default:
+        printf("%u,", static_cast<unsigned>(sensor_id));
+        break;
+    }
+  }
+
+  // same fixed-point scaling as SMART_CLOCK::read_sensor_samples()
+  void print_values(sensor_data::sensor_id_e sensor_id, const int32_t* pvalue){
+    switch(sensor_id){
+      case sensor_data::sensor_id_e::SCD40:
+        printf(",,,%d\n", pvalue[0]);
+        break;
+      case sensor_data::sensor_id_e::BME280:
+        printf("%.2f,%.2f,%.2f,\n", pvalue[0] / 100.0, pvalue[1] / 25600.0, pvalue[2] / 1024.0);
+        break;
+      default:
+        printf(",,,\n");
+        break;
+    }
+  }
+
+  void print_sample(const sensor_data::sensor_sample_t* psample){
+    char datetime[32];
+    format_datetime(psample->timestamp, psample->quality, datetime, sizeof(datetime));
+    printf("%u,%s,", psample->timestamp, datetime);
+    print_sensor(psample->sensor_id);
+    printf("%u,", psample->quality);
+    print_values(psample->sensor_id, psample->value);
+  }
+
+  void print_aggregate(const sensor_log::log_aggregate_record_t* precord){
+    char datetime[32];
+    const char* STATISTIC_NAMES[] = {"min", "mean", "max"};
+    int32_t values[3][sensor_data::SAMPLE_VALUE_SIZE];
+    // the record is packed, copy the values before taking their address.
+    memcpy(values[0], precord->min, sizeof(values[0]));
+    memcpy(values[1], precord->mean, sizeof(values[1]));
+    memcpy(values[2], precord->max, sizeof(values[2]));
+    format_datetime(precord->start_timestamp, precord->quality, datetime, sizeof(datetime));
+    for(size_t statistic_index = 0; statistic_index < 3; statistic_index++){
+      printf("%u,%s,%u,", precord->start_timestamp, datetime, precord->interval);
+      print_sensor(precord->sensor_id);
+      printf("%u,%u,%s,", precord->quality, precord->sample_count, STATISTIC_NAMES[statistic_index]);
+      print_values(precord->sensor_id, values[statistic_index]);
+    }
+  }
+
+  // returns the number of skipped records.
+  uint32_t convert_aggregate_file(const char* pfile_path, convert_stats_t* pstats){
+    sensor_log::log_aggregate_record_t record {};
+    uint32_t record_count = 0;
+    uint32_t bad_count = 0;
+
+    FILE* pfile = fopen(pfile_path, "rb");
+    if(pfile == NULL){
+      fprintf(stderr, "fail to open %s.\n", pfile_path);
+      pstats->bad_count++;
+      return 1;
+    }
+    size_t read_size = 0;
+    while((read_size = fread(&record, 1, sizeof(record), pfile)) == sizeof(record)){
+      if(sensor_log::is_valid_aggregate(&record)){
+        print_aggregate(&record);
+        pstats->sample_count++;
+      }
+      else{
+        fprintf(stderr, "%s: skip record %u at offset %u: bad record\n", pfile_path, record_count,
+            static_cast<unsigned>(record_count * sizeof(record)));
+        bad_count++;
+      }
+      record_count++;
+    }
+    if(read_size > 0){
+      fprintf(stderr, "%s: skip %u bytes of a partial record at the end.\n", pfile_path, static_cast<unsigned>(read_size));
+      bad_count++;
+    }
+    fclose(pfile);
+    pstats->block_count += record_count;
+    pstats->bad_count += bad_count;
+    return bad_count;
+  }
+
+  // returns the number of skipped blocks.
+  uint32_t convert_file(const char* pfile_path, convert_stats_t* pstats){
+    LOG_BLOCK_DECODER decoder;
+    sensor_data::sensor_sample_t sample {};
+    uint8_t block[sensor_log::LOG_BLOCK_SIZE];
+    uint32_t block_count = 0;
+    uint32_t bad_count = 0;
+
+    FILE* pfile = fopen(pfile_path, "rb");
+    if(pfile == NULL){
+      fprintf(stderr, "fail to open %s.\n", pfile_path);
+      pstats->bad_count++;
+      return 1;
+    }
+    size_t read_size = 0;
+    while((read_size = fread(block, 1, sizeof(block), pfile)) == sizeof(block)){
+      const LOG_BLOCK_DECODER::block_state_e state = decoder.open(block);
+      if(state == LOG_BLOCK_DECODER::block_state_e::EMPTY){
+        pstats->empty_count++;
+      }
+      else if(state != LOG_BLOCK_DECODER::block_state_e::VALID){
+        fprintf(stderr, "%s: skip block %u at offset %u: %s\n", pfile_path, block_count,
+            static_cast<unsigned>(block_count * sizeof(block)), get_state_name(state));
+        bad_count++;
+      }
+      while(decoder.next(&sample)){
+        print_sample(&sample);
+        pstats->sample_count++;
+      }
+      block_count++;
+    }
+    if(read_size > 0){
+      fprintf(stderr, "%s: skip %u bytes of a partial block at the end.\n", pfile_path, static_cast<unsigned>(read_size));
+      bad_count++;
+    }
+    fclose(pfile);
+    pstats->block_count += block_count;
+    pstats->bad_count += bad_count;
+    return bad_count;
+  }
+}
+
+int main(int argc, char** argv){
+  convert_stats_t stats {};
+  uint32_t bad_count = 0;
+  const bool is_aggregate = (argc >= 2) && (strcmp(argv[1], "-a") == 0);
+  const int first_file_index = is_aggregate ? 2 : 1;
+
+  if(argc <= first_file_index){
+    fprintf(stderr, "usage: %s <YYYYMMDD.bin|YYYYMMDD.pak>...\n", argv[0]);
+    fprintf(stderr, "       %s -a <YYYYMMDD.1m|YYYYMMDD.1h>...\n", argv[0]);
+    return 2;
+  }
+
+  if(is_aggregate){
+    printf("start_timestamp,datetime(UTC),interval[s],sensor,quality,sample_count,statistic,temperature[degree Celsius],pressure[hPa],humidity[%%],co2[ppm]\n");
+  }
+  else{
+    printf("timestamp,datetime(UTC),sensor,quality,temperature[degree Celsius],pressure[hPa],humidity[%%],co2[ppm]\n");
+  }
+  for(int arg_index = first_file_index; arg_index < argc; arg_index++){
+    if(is_aggregate){
+      bad_count += convert_aggregate_file(argv[arg_index], &stats);
+    }
+    else{
+      bad_count += convert_file(argv[arg_index], &stats);
+    }
+  }
+
+  if(is_aggregate){
+    fprintf(stderr, "records:%u valid:%u skipped:%u\n", stats.block_count, stats.sample_count, stats.bad_count);
+  }
+  else{
+    fprintf(stderr, "blocks:%u samples:%u empty:%u skipped:%u\n",
+        stats.block_count, stats.sample_count, stats.empty_count, stats.bad_count);
+  }
+  return (bad_count == 0) ? 0 : 1;
+}